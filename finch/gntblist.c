@@ -990,11 +990,8 @@ chat_components_edit_ok(PurpleChat *chat, PurpleRequestFields *allfields)
 			else
 				val = g_strdup(purple_request_field_string_get_value(field));
 
-			if (!val) {
-				g_hash_table_remove(purple_chat_get_components(chat), id);
-			} else {
-				g_hash_table_replace(purple_chat_get_components(chat), g_strdup(id), val);  /* val should not be free'd */
-			}
+			purple_chat_set_component(chat, id, val);
+			g_free(val);
 		}
 	}
 }
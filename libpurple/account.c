@@ -1034,7 +1034,7 @@ purple_account_new(const gchar *username, const gchar *protocol_id) {
 	manager = purple_account_manager_get_default();
 	account = purple_account_manager_find(manager, username, protocol_id);
 	if(account != NULL) {
-		return account;
+		return g_object_ref(account);
 	}
 
 	account = g_object_new(
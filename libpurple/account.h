@@ -110,9 +110,10 @@ G_DECLARE_FINAL_TYPE(PurpleAccount, purple_account, PURPLE, ACCOUNT, GObject)
  * @username:    The username.
  * @protocol_id: The protocol ID.
  *
- * Creates a new account.
+ * Creates a new account, or returns the account in the default
+ * #PurpleAccountManager that has the same @username and @protocol_id.
  *
- * Returns: The new account.
+ * Returns: (transfer full): The account.
  */
 PurpleAccount *purple_account_new(const char *username, const char *protocol_id);
 
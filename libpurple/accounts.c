@@ -33,7 +33,6 @@
 
 static PurpleAccountUiOps *account_ui_ops = NULL;
 
-static guint    save_timer = 0;
 static gboolean accounts_loaded = FALSE;
 
 static void
@@ -70,39 +69,23 @@ accounts_to_xmlnode(void)
 	return node;
 }
 
-static void
+static PurpleXmlNode *
 sync_accounts(void)
 {
-	PurpleXmlNode *node;
-	char *data;
-
 	if (!accounts_loaded)
 	{
 		purple_debug_error("accounts", "Attempted to save accounts before "
 						 "they were read!\n");
-		return;
+		return NULL;
 	}
 
-	node = accounts_to_xmlnode();
-	data = purple_xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_config_file("accounts.xml", data, -1);
-	g_free(data);
-	purple_xmlnode_free(node);
-}
-
-static gboolean
-save_cb(gpointer data)
-{
-	sync_accounts();
-	save_timer = 0;
-	return FALSE;
+	return accounts_to_xmlnode();
 }
 
 void
 purple_accounts_schedule_save(void)
 {
-	if (save_timer == 0)
-		save_timer = g_timeout_add_seconds(5, save_cb, NULL);
+	purple_persistence_schedule_save("accounts.xml", sync_accounts);
 }
 
 static void
@@ -431,7 +414,7 @@ load_accounts(void) {
 
 	accounts_loaded = TRUE;
 
-	node = purple_util_read_xml_from_config_file("accounts.xml", _("accounts"));
+	node = purple_persistence_read("accounts.xml", _("accounts"));
 
 	if(node == NULL) {
 		return;
@@ -742,12 +725,8 @@ void
 purple_accounts_uninit(void)
 {
 	gpointer handle = purple_accounts_get_handle();
-	if (save_timer != 0)
-	{
-		g_source_remove(save_timer);
-		save_timer = 0;
-		sync_accounts();
-	}
+
+	purple_persistence_flush("accounts.xml");
 
 	purple_signals_disconnect_by_handle(handle);
 	purple_signals_unregister_by_instance(handle);
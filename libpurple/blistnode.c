@@ -21,14 +21,38 @@
  *
  */
 
+#include <string.h>
+
 #include "blistnode.h"
 #include "buddy.h"
+#include "purpleprivate.h"
 
 typedef struct _PurpleBlistNodePrivate  PurpleBlistNodePrivate;
 
+typedef enum {
+	PURPLE_BLIST_NODE_SETTING_BOOLEAN,
+	PURPLE_BLIST_NODE_SETTING_INT,
+	PURPLE_BLIST_NODE_SETTING_STRING,
+} PurpleBlistNodeSettingType;
+
+/* A single node setting.  Nodes only ever have a handful of settings, so they
+ * are kept in an array sorted by key rather than a hash table, which would
+ * cost far more memory than the settings themselves.
+ */
+typedef struct {
+	GQuark key;
+	PurpleBlistNodeSettingType type;
+	union {
+		gboolean boolean;
+		gint integer;
+		gchar *string;
+	} value;
+} PurpleBlistNodeSetting;
+
 /* Private data of a buddy list node */
 struct _PurpleBlistNodePrivate {
-	GHashTable *settings;  /* per-node settings                            */
+	PurpleBlistNodeSetting *settings; /* per-node settings, sorted by key  */
+	guint n_settings;                 /* the number of settings            */
 	gboolean transient;    /* node should not be saved with the buddy list */
 };
 
@@ -45,6 +69,148 @@ static GParamSpec *bn_properties[BLNODE_PROP_LAST];
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE(PurpleBlistNode, purple_blist_node,
 		G_TYPE_OBJECT);
 
+/**************************************************************************/
+/* Settings helpers                                                       */
+/**************************************************************************/
+
+static void
+purple_blist_node_setting_clear(PurpleBlistNodeSetting *setting)
+{
+	if(setting->type == PURPLE_BLIST_NODE_SETTING_STRING) {
+		g_clear_pointer(&setting->value.string, g_free);
+	}
+}
+
+/* Finds the index of the setting for key, or where it would be inserted, and
+ * returns whether it exists.
+ */
+static gboolean
+purple_blist_node_find_setting_index(PurpleBlistNodePrivate *priv, GQuark key,
+                                     guint *index)
+{
+	guint low = 0, high = priv->n_settings;
+
+	while(low < high) {
+		guint mid = low + (high - low) / 2;
+		GQuark current = priv->settings[mid].key;
+
+		if(current == key) {
+			*index = mid;
+
+			return TRUE;
+		}
+
+		if(current < key) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	*index = low;
+
+	return FALSE;
+}
+
+static PurpleBlistNodeSetting *
+purple_blist_node_lookup_setting(PurpleBlistNode *node, const char *key)
+{
+	PurpleBlistNodePrivate *priv = purple_blist_node_get_instance_private(node);
+	GQuark quark = 0;
+	guint index = 0;
+
+	/* A key that was never interned can't have been set on any node. */
+	quark = g_quark_try_string(key);
+	if(quark == 0) {
+		return NULL;
+	}
+
+	if(!purple_blist_node_find_setting_index(priv, quark, &index)) {
+		return NULL;
+	}
+
+	return &priv->settings[index];
+}
+
+/* Returns the setting for key, cleared and ready for a new value, adding it if
+ * it didn't exist.
+ */
+static PurpleBlistNodeSetting *
+purple_blist_node_replace_setting(PurpleBlistNode *node, const char *key)
+{
+	PurpleBlistNodePrivate *priv = purple_blist_node_get_instance_private(node);
+	PurpleBlistNodeSetting *setting = NULL;
+	GQuark quark = g_quark_from_string(key);
+	guint index = 0;
+
+	if(purple_blist_node_find_setting_index(priv, quark, &index)) {
+		setting = &priv->settings[index];
+		purple_blist_node_setting_clear(setting);
+
+		return setting;
+	}
+
+	/* Settings are rarely added, so grow the array to exactly fit rather than
+	 * keeping spare capacity around on every node.
+	 */
+	priv->settings = g_renew(PurpleBlistNodeSetting, priv->settings,
+	                         priv->n_settings + 1);
+	memmove(&priv->settings[index + 1], &priv->settings[index],
+	        (priv->n_settings - index) * sizeof(PurpleBlistNodeSetting));
+	priv->n_settings++;
+
+	setting = &priv->settings[index];
+	setting->key = quark;
+	setting->type = PURPLE_BLIST_NODE_SETTING_BOOLEAN;
+	setting->value.string = NULL;
+
+	return setting;
+}
+
+/* Initializes value to hold the value of setting. */
+static void
+purple_blist_node_setting_get_value(PurpleBlistNodeSetting *setting,
+                                    GValue *value)
+{
+	switch(setting->type) {
+		case PURPLE_BLIST_NODE_SETTING_BOOLEAN:
+			g_value_init(value, G_TYPE_BOOLEAN);
+			g_value_set_boolean(value, setting->value.boolean);
+			break;
+		case PURPLE_BLIST_NODE_SETTING_INT:
+			g_value_init(value, G_TYPE_INT);
+			g_value_set_int(value, setting->value.integer);
+			break;
+		case PURPLE_BLIST_NODE_SETTING_STRING:
+			g_value_init(value, G_TYPE_STRING);
+			g_value_set_static_string(value, setting->value.string);
+			break;
+	}
+}
+
+/* Saves the current value of the setting for key after it was changed. */
+static void
+purple_blist_node_save_setting(PurpleBlistNode *node, const char *key)
+{
+	PurpleBlistNodeSetting *setting = NULL;
+	GValue value = G_VALUE_INIT;
+
+	setting = purple_blist_node_lookup_setting(node, key);
+
+	/* A string setting without a value isn't kept when the list is saved. */
+	if(setting == NULL || (setting->type == PURPLE_BLIST_NODE_SETTING_STRING &&
+	                       setting->value.string == NULL))
+	{
+		_purple_blist_save_node_setting(node, key, NULL);
+
+		return;
+	}
+
+	purple_blist_node_setting_get_value(setting, &value);
+	_purple_blist_save_node_setting(node, key, &value);
+	g_value_unset(&value);
+}
+
 /**************************************************************************/
 /* Buddy list node API                                                    */
 /**************************************************************************/
@@ -101,16 +267,31 @@ PurpleBlistNode *purple_blist_node_get_sibling_prev(PurpleBlistNode *node)
 void purple_blist_node_remove_setting(PurpleBlistNode *node, const char *key)
 {
 	PurpleBlistNodePrivate *priv = NULL;
+	GQuark quark = 0;
+	guint index = 0;
 
 	g_return_if_fail(PURPLE_IS_BLIST_NODE(node));
 	g_return_if_fail(key != NULL);
 
 	priv = purple_blist_node_get_instance_private(node);
-	g_return_if_fail(priv->settings != NULL);
 
-	g_hash_table_remove(priv->settings, key);
+	quark = g_quark_try_string(key);
+	if(quark != 0 && purple_blist_node_find_setting_index(priv, quark, &index)) {
+		purple_blist_node_setting_clear(&priv->settings[index]);
+
+		priv->n_settings--;
+		memmove(&priv->settings[index], &priv->settings[index + 1],
+		        (priv->n_settings - index) * sizeof(PurpleBlistNodeSetting));
 
-	purple_blist_save_node(purple_blist_get_default(), node);
+		if(priv->n_settings == 0) {
+			g_clear_pointer(&priv->settings, g_free);
+		} else {
+			priv->settings = g_renew(PurpleBlistNodeSetting, priv->settings,
+			                         priv->n_settings);
+		}
+	}
+
+	purple_blist_node_save_setting(node, key);
 }
 
 void
@@ -138,156 +319,176 @@ purple_blist_node_is_transient(PurpleBlistNode *node)
 	return priv->transient;
 }
 
-GHashTable *
-purple_blist_node_get_settings(PurpleBlistNode *node)
+void
+purple_blist_node_foreach_setting(PurpleBlistNode *node,
+                                  PurpleBlistNodeSettingFunc func,
+                                  gpointer data)
 {
 	PurpleBlistNodePrivate *priv = NULL;
 
-	g_return_val_if_fail(PURPLE_IS_BLIST_NODE(node), NULL);
+	g_return_if_fail(PURPLE_IS_BLIST_NODE(node));
+	g_return_if_fail(func != NULL);
 
 	priv = purple_blist_node_get_instance_private(node);
-	return priv->settings;
+
+	for(guint i = 0; i < priv->n_settings; i++) {
+		PurpleBlistNodeSetting *setting = &priv->settings[i];
+		GValue value = G_VALUE_INIT;
+
+		purple_blist_node_setting_get_value(setting, &value);
+
+		func(g_quark_to_string(setting->key), &value, data);
+
+		g_value_unset(&value);
+	}
 }
 
-gboolean
-purple_blist_node_has_setting(PurpleBlistNode* node, const char *key)
+gsize
+purple_blist_node_get_settings_size(PurpleBlistNode *node, guint *allocations)
 {
 	PurpleBlistNodePrivate *priv = NULL;
+	gsize size = 0;
+	guint count = 0;
 
-	g_return_val_if_fail(PURPLE_IS_BLIST_NODE(node), FALSE);
-	g_return_val_if_fail(key != NULL, FALSE);
+	g_return_val_if_fail(PURPLE_IS_BLIST_NODE(node), 0);
 
 	priv = purple_blist_node_get_instance_private(node);
-	g_return_val_if_fail(priv->settings != NULL, FALSE);
 
-	/* Boxed type, so it won't ever be NULL, so no need for _extended */
-	return (g_hash_table_lookup(priv->settings, key) != NULL);
+	if(priv->settings != NULL) {
+		size += priv->n_settings * sizeof(PurpleBlistNodeSetting);
+		count++;
+	}
+
+	for(guint i = 0; i < priv->n_settings; i++) {
+		PurpleBlistNodeSetting *setting = &priv->settings[i];
+
+		if(setting->type == PURPLE_BLIST_NODE_SETTING_STRING &&
+		   setting->value.string != NULL)
+		{
+			size += strlen(setting->value.string) + 1;
+			count++;
+		}
+	}
+
+	if(allocations != NULL) {
+		*allocations = count;
+	}
+
+	return size;
+}
+
+gboolean
+purple_blist_node_has_setting(PurpleBlistNode* node, const char *key)
+{
+	g_return_val_if_fail(PURPLE_IS_BLIST_NODE(node), FALSE);
+	g_return_val_if_fail(key != NULL, FALSE);
+
+	return (purple_blist_node_lookup_setting(node, key) != NULL);
 }
 
 void
 purple_blist_node_set_bool(PurpleBlistNode* node, const char *key, gboolean data)
 {
-	PurpleBlistNodePrivate *priv = NULL;
-	GValue *value;
+	PurpleBlistNodeSetting *setting = NULL;
 
 	g_return_if_fail(PURPLE_IS_BLIST_NODE(node));
 	g_return_if_fail(key != NULL);
 
-	priv = purple_blist_node_get_instance_private(node);
-	g_return_if_fail(priv->settings != NULL);
-
-	value = purple_value_new(G_TYPE_BOOLEAN);
-	g_value_set_boolean(value, data);
+	setting = purple_blist_node_replace_setting(node, key);
+	setting->type = PURPLE_BLIST_NODE_SETTING_BOOLEAN;
+	setting->value.boolean = data;
 
-	g_hash_table_replace(priv->settings, g_strdup(key), value);
-
-	purple_blist_save_node(purple_blist_get_default(), node);
+	purple_blist_node_save_setting(node, key);
 }
 
 gboolean
 purple_blist_node_get_bool(PurpleBlistNode* node, const char *key)
 {
-	PurpleBlistNodePrivate *priv = NULL;
-	GValue *value;
+	PurpleBlistNodeSetting *setting = NULL;
 
 	g_return_val_if_fail(PURPLE_IS_BLIST_NODE(node), FALSE);
 	g_return_val_if_fail(key != NULL, FALSE);
 
-	priv = purple_blist_node_get_instance_private(node);
-	g_return_val_if_fail(priv->settings != NULL, FALSE);
-
-	value = g_hash_table_lookup(priv->settings, key);
+	setting = purple_blist_node_lookup_setting(node, key);
 
-	if (value == NULL)
+	if (setting == NULL)
 		return FALSE;
 
-	g_return_val_if_fail(G_VALUE_HOLDS_BOOLEAN(value), FALSE);
+	g_return_val_if_fail(setting->type == PURPLE_BLIST_NODE_SETTING_BOOLEAN,
+	                     FALSE);
 
-	return g_value_get_boolean(value);
+	return setting->value.boolean;
 }
 
 void
 purple_blist_node_set_int(PurpleBlistNode* node, const char *key, int data)
 {
-	PurpleBlistNodePrivate *priv = NULL;
-	GValue *value;
+	PurpleBlistNodeSetting *setting = NULL;
 
 	g_return_if_fail(PURPLE_IS_BLIST_NODE(node));
 	g_return_if_fail(key != NULL);
 
-	priv = purple_blist_node_get_instance_private(node);
-	g_return_if_fail(priv->settings != NULL);
-
-	value = purple_value_new(G_TYPE_INT);
-	g_value_set_int(value, data);
+	setting = purple_blist_node_replace_setting(node, key);
+	setting->type = PURPLE_BLIST_NODE_SETTING_INT;
+	setting->value.integer = data;
 
-	g_hash_table_replace(priv->settings, g_strdup(key), value);
-
-	purple_blist_save_node(purple_blist_get_default(), node);
+	purple_blist_node_save_setting(node, key);
 }
 
 int
 purple_blist_node_get_int(PurpleBlistNode* node, const char *key)
 {
-	PurpleBlistNodePrivate *priv = NULL;
-	GValue *value;
+	PurpleBlistNodeSetting *setting = NULL;
 
 	g_return_val_if_fail(PURPLE_IS_BLIST_NODE(node), 0);
 	g_return_val_if_fail(key != NULL, 0);
 
-	priv = purple_blist_node_get_instance_private(node);
-	g_return_val_if_fail(priv->settings != NULL, 0);
-
-	value = g_hash_table_lookup(priv->settings, key);
+	setting = purple_blist_node_lookup_setting(node, key);
 
-	if (value == NULL)
+	if (setting == NULL)
 		return 0;
 
-	g_return_val_if_fail(G_VALUE_HOLDS_INT(value), 0);
+	g_return_val_if_fail(setting->type == PURPLE_BLIST_NODE_SETTING_INT, 0);
 
-	return g_value_get_int(value);
+	return setting->value.integer;
 }
 
 void
 purple_blist_node_set_string(PurpleBlistNode* node, const char *key, const char *data)
 {
-	PurpleBlistNodePrivate *priv = NULL;
-	GValue *value;
+	PurpleBlistNodeSetting *setting = NULL;
+	gchar *copy = NULL;
 
 	g_return_if_fail(PURPLE_IS_BLIST_NODE(node));
 	g_return_if_fail(key != NULL);
 
-	priv = purple_blist_node_get_instance_private(node);
-	g_return_if_fail(priv->settings != NULL);
-
-	value = purple_value_new(G_TYPE_STRING);
-	g_value_set_string(value, data);
+	/* Copy first, data may be the value that is about to be replaced. */
+	copy = g_strdup(data);
 
-	g_hash_table_replace(priv->settings, g_strdup(key), value);
+	setting = purple_blist_node_replace_setting(node, key);
+	setting->type = PURPLE_BLIST_NODE_SETTING_STRING;
+	setting->value.string = copy;
 
-	purple_blist_save_node(purple_blist_get_default(), node);
+	purple_blist_node_save_setting(node, key);
 }
 
 const char *
 purple_blist_node_get_string(PurpleBlistNode* node, const char *key)
 {
-	PurpleBlistNodePrivate *priv = NULL;
-	GValue *value;
+	PurpleBlistNodeSetting *setting = NULL;
 
 	g_return_val_if_fail(PURPLE_IS_BLIST_NODE(node), NULL);
 	g_return_val_if_fail(key != NULL, NULL);
 
-	priv = purple_blist_node_get_instance_private(node);
-	g_return_val_if_fail(priv->settings != NULL, NULL);
+	setting = purple_blist_node_lookup_setting(node, key);
 
-	value = g_hash_table_lookup(priv->settings, key);
-
-	if (value == NULL)
+	if (setting == NULL)
 		return NULL;
 
-	g_return_val_if_fail(G_VALUE_HOLDS_STRING(value), NULL);
+	g_return_val_if_fail(setting->type == PURPLE_BLIST_NODE_SETTING_STRING,
+	                     NULL);
 
-	return g_value_get_string(value);
+	return setting->value.string;
 }
 
 GList *
@@ -344,11 +545,6 @@ purple_blist_node_get_property(GObject *obj, guint param_id, GValue *value,
 static void
 purple_blist_node_init(PurpleBlistNode *node)
 {
-	PurpleBlistNodePrivate *priv =
-			purple_blist_node_get_instance_private(node);
-
-	priv->settings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-			(GDestroyNotify)purple_value_free);
 }
 
 /* GObject finalize function */
@@ -358,7 +554,10 @@ purple_blist_node_finalize(GObject *object)
 	PurpleBlistNodePrivate *priv = purple_blist_node_get_instance_private(
 			PURPLE_BLIST_NODE(object));
 
-	g_hash_table_destroy(priv->settings);
+	for(guint i = 0; i < priv->n_settings; i++) {
+		purple_blist_node_setting_clear(&priv->settings[i]);
+	}
+	g_clear_pointer(&priv->settings, g_free);
 
 	G_OBJECT_CLASS(purple_blist_node_parent_class)->finalize(object);
 }
@@ -60,6 +60,21 @@ struct _PurpleBlistNode {
 	PurpleBlistNode *child;
 };
 
+/**
+ * PurpleBlistNodeSettingFunc:
+ * @key: The name of the setting.
+ * @value: The value of the setting, which holds a boolean, an integer or a
+ *         string.
+ * @data: User data passed to purple_blist_node_foreach_setting().
+ *
+ * A function called for each setting of a #PurpleBlistNode.
+ *
+ * Since: 3.0.0
+ */
+typedef void (*PurpleBlistNodeSettingFunc)(const gchar *key,
+                                           const GValue *value,
+                                           gpointer data);
+
 struct _PurpleBlistNodeClass {
 	GObjectClass gparent_class;
 
@@ -147,14 +162,17 @@ PurpleBlistNode *purple_blist_node_get_sibling_next(PurpleBlistNode *node);
 PurpleBlistNode *purple_blist_node_get_sibling_prev(PurpleBlistNode *node);
 
 /**
- * purple_blist_node_get_settings:
- * @node:  The node to from which to get settings
+ * purple_blist_node_foreach_setting:
+ * @node: The node whose settings to iterate.
+ * @func: (scope call): The function to call for each setting.
+ * @data: User data to pass to @func.
  *
- * Returns a node's settings
+ * Calls @func for each setting of @node.  @func must not add or remove
+ * settings of @node.
  *
- * Returns: (transfer none): The hash table with the node's settings.
+ * Since: 3.0.0
  */
-GHashTable *purple_blist_node_get_settings(PurpleBlistNode *node);
+void purple_blist_node_foreach_setting(PurpleBlistNode *node, PurpleBlistNodeSettingFunc func, gpointer data);
 
 /**
  * purple_blist_node_has_setting:
@@ -26,14 +26,15 @@
 #include "purplebuddypresence.h"
 #include "purplecontactmanager.h"
 #include "purpleconversationmanager.h"
+#include "purpleprivate.h"
 #include "purpleprotocolclient.h"
 #include "util.h"
 
 typedef struct {
 	gchar *id;
-	gchar *name;
-	gchar *local_alias;
-	gchar *server_alias;
+	GRefString *name;
+	GRefString *local_alias;
+	GRefString *server_alias;
 
 	gpointer proto_data;
 
@@ -224,9 +225,9 @@ purple_buddy_finalize(GObject *object) {
 	}
 
 	g_free(priv->id);
-	g_free(priv->name);
-	g_free(priv->local_alias);
-	g_free(priv->server_alias);
+	g_clear_pointer(&priv->name, g_ref_string_release);
+	g_clear_pointer(&priv->local_alias, g_ref_string_release);
+	g_clear_pointer(&priv->server_alias, g_ref_string_release);
 
 	G_OBJECT_CLASS(purple_buddy_parent_class)->finalize(object);
 }
@@ -388,6 +389,7 @@ void
 purple_buddy_set_name(PurpleBuddy *buddy, const gchar *name) {
 	PurpleBuddyList *blist = NULL;
 	PurpleBuddyPrivate *priv = NULL;
+	gchar *stripped = NULL;
 
 	g_return_if_fail(PURPLE_IS_BUDDY(buddy));
 
@@ -397,8 +399,9 @@ purple_buddy_set_name(PurpleBuddy *buddy, const gchar *name) {
 		purple_blist_update_buddies_cache(buddy, name);
 	}
 
-	g_free(priv->name);
-	priv->name = purple_utf8_strip_unprintables(name);
+	stripped = purple_utf8_strip_unprintables(name);
+	purple_str_intern_set(&priv->name, stripped);
+	g_free(stripped);
 
 	g_object_notify_by_pspec(G_OBJECT(buddy), properties[PROP_NAME]);
 
@@ -516,7 +519,9 @@ purple_buddy_set_local_alias(PurpleBuddy *buddy, const gchar *alias) {
 	PurpleBuddyPrivate *priv = NULL;
 	PurpleConversation *im = NULL;
 	PurpleConversationManager *manager = NULL;
-	gchar *old_alias = NULL, *new_alias = NULL;
+	GRefString *old_alias = NULL;
+	gchar *new_alias = NULL;
+	gboolean changed = FALSE;
 
 	g_return_if_fail(PURPLE_IS_BUDDY(buddy));
 
@@ -525,25 +530,31 @@ purple_buddy_set_local_alias(PurpleBuddy *buddy, const gchar *alias) {
 	if((alias != NULL) && (*alias != '\0')) {
 		new_alias = purple_utf8_strip_unprintables(alias);
 	}
+	if((new_alias != NULL) && (*new_alias == '\0')) {
+		g_clear_pointer(&new_alias, g_free);
+	}
 
-	if(purple_strequal(priv->local_alias, new_alias)) {
-		g_free(new_alias);
-		return;
+	/* Keep the old alias alive for the blist-node-aliased signal. */
+	if(priv->local_alias != NULL) {
+		old_alias = g_ref_string_acquire(priv->local_alias);
 	}
 
-	old_alias = priv->local_alias;
+	/* The aliases are interned, so this only has to compare pointers to tell
+	 * whether anything changed.
+	 */
+	changed = purple_str_intern_set(&priv->local_alias, new_alias);
+	g_free(new_alias);
+
+	if(!changed) {
+		g_clear_pointer(&old_alias, g_ref_string_release);
 
-	if((new_alias != NULL) && (*new_alias != '\0')) {
-		priv->local_alias = new_alias;
-	} else {
-		priv->local_alias = NULL;
-		g_free(new_alias);
+		return;
 	}
 
 	g_object_notify_by_pspec(G_OBJECT(buddy), properties[PROP_LOCAL_ALIAS]);
 
 	blist = purple_blist_get_default();
-	purple_blist_save_node(blist, PURPLE_BLIST_NODE(buddy));
+	_purple_blist_save_buddy_alias(buddy);
 	purple_blist_update_node(blist, PURPLE_BLIST_NODE(buddy));
 
 	manager = purple_conversation_manager_get_default();
@@ -555,7 +566,7 @@ purple_buddy_set_local_alias(PurpleBuddy *buddy, const gchar *alias) {
 
 	purple_signal_emit(purple_blist_get_handle(), "blist-node-aliased", buddy,
 	                   old_alias);
-	g_free(old_alias);
+	g_clear_pointer(&old_alias, g_ref_string_release);
 }
 
 const gchar *
@@ -575,7 +586,9 @@ purple_buddy_set_server_alias(PurpleBuddy *buddy, const gchar *alias) {
 	PurpleBuddyPrivate *priv = NULL;
 	PurpleConversation *im = NULL;
 	PurpleConversationManager *manager = NULL;
-	gchar *old_alias = NULL, *new_alias = NULL;
+	GRefString *old_alias = NULL;
+	gchar *new_alias = NULL;
+	gboolean changed = FALSE;
 
 	g_return_if_fail(PURPLE_IS_BUDDY(buddy));
 
@@ -585,20 +598,25 @@ purple_buddy_set_server_alias(PurpleBuddy *buddy, const gchar *alias) {
 	{
 		new_alias = purple_utf8_strip_unprintables(alias);
 	}
+	if((new_alias != NULL) && (*new_alias == '\0')) {
+		g_clear_pointer(&new_alias, g_free);
+	}
 
-	if(purple_strequal(priv->server_alias, new_alias)) {
-		g_free(new_alias);
-
-		return;
+	/* Keep the old alias alive for the blist-node-aliased signal. */
+	if(priv->server_alias != NULL) {
+		old_alias = g_ref_string_acquire(priv->server_alias);
 	}
 
-	old_alias = priv->server_alias;
+	/* The aliases are interned, so this only has to compare pointers to tell
+	 * whether anything changed.
+	 */
+	changed = purple_str_intern_set(&priv->server_alias, new_alias);
+	g_free(new_alias);
 
-	if((new_alias != NULL) && (*new_alias != '\0')) {
-		priv->server_alias = new_alias;
-	} else {
-		priv->server_alias = NULL;
-		g_free(new_alias);
+	if(!changed) {
+		g_clear_pointer(&old_alias, g_ref_string_release);
+
+		return;
 	}
 
 	g_object_notify_by_pspec(G_OBJECT(buddy), properties[PROP_SERVER_ALIAS]);
@@ -616,7 +634,7 @@ purple_buddy_set_server_alias(PurpleBuddy *buddy, const gchar *alias) {
 
 	purple_signal_emit(purple_blist_get_handle(), "blist-node-aliased", buddy,
 	                   old_alias);
-	g_free(old_alias);
+	g_clear_pointer(&old_alias, g_ref_string_release);
 }
 
 const gchar *
@@ -29,6 +29,7 @@
 #include "notify.h"
 #include "prefs.h"
 #include "purpleaccountmanager.h"
+#include "purplepath.h"
 #include "purpleprivate.h"
 #include "purpleprotocol.h"
 #include "purpleprotocolchat.h"
@@ -50,6 +51,14 @@ static PurpleBuddyList *purplebuddylist = NULL;
 
 G_DEFINE_TYPE_WITH_PRIVATE(PurpleBuddyList, purple_buddy_list, G_TYPE_OBJECT);
 
+/* Changes to single nodes are appended to this file, which is replayed on top
+ * of blist.xml when the list is loaded.
+ */
+#define PURPLE_BLIST_JOURNAL "blist.journal"
+
+/* The number of journal entries after which blist.xml is rewritten. */
+#define PURPLE_BLIST_JOURNAL_MAX (500)
+
 /*
  * A hash table used for efficient lookups of buddies by name.
  * PurpleAccount* => GHashTable*, with the inner hash table being
@@ -63,8 +72,15 @@ static GHashTable *buddies_cache = NULL;
  */
 static GHashTable *groups_cache = NULL;
 
-static guint          save_timer = 0;
+/*
+ * A hash table used for efficient lookups of chats by name.
+ * PurpleAccount* => PurpleBlistChatIndex*, see purple_blist_find_chat().
+ */
+static GHashTable *chats_cache = NULL;
+
 static gboolean       blist_loaded = FALSE;
+static gboolean       blist_loading = FALSE;
+static guint          journal_entries = 0;
 static gchar *localized_default_group_name = NULL;
 
 /*********************************************************************
@@ -149,20 +165,258 @@ purple_blist_buddies_cache_remove_account(const PurpleAccount *account)
 	g_hash_table_remove(buddies_cache, account);
 }
 
+/* The chats of an account indexed by the normalized name that
+ * purple_blist_find_chat() matches them by.  The names can only be worked out
+ * while the account is connected, so the index is built on demand and thrown
+ * away whenever the chats change in a way that can't be applied to it
+ * directly.
+ */
+typedef struct {
+	GHashTable *names;  /* normalized name => the first PurpleChat with it */
+	GHashTable *chats;  /* PurpleChat* => normalized name, for the above   */
+	gboolean valid;
+} PurpleBlistChatIndex;
+
+static void
+purple_blist_chat_index_free(PurpleBlistChatIndex *index)
+{
+	g_hash_table_destroy(index->names);
+	g_hash_table_destroy(index->chats);
+	g_free(index);
+}
+
+/* Returns the name of the chat component that identifies a chat on the
+ * account's protocol.
+ */
+static gchar *
+purple_blist_chat_get_identifier(PurpleAccount *account)
+{
+	PurpleProtocol *protocol = purple_account_get_protocol(account);
+	PurpleProtocolChatEntry *pce = NULL;
+	GList *parts = NULL;
+	gchar *identifier = NULL;
+
+	if(!PURPLE_IS_PROTOCOL_CHAT(protocol)) {
+		return NULL;
+	}
+
+	parts = purple_protocol_chat_info(PURPLE_PROTOCOL_CHAT(protocol),
+	                                  purple_account_get_connection(account));
+	if(parts == NULL) {
+		return NULL;
+	}
+
+	pce = parts->data;
+	identifier = g_strdup(pce->identifier);
+	g_list_free_full(parts, g_free);
+
+	return identifier;
+}
+
+static GRefString *
+purple_blist_chat_get_index_name(PurpleChat *chat, const gchar *identifier)
+{
+	const gchar *name = NULL;
+
+	name = g_hash_table_lookup(purple_chat_get_components(chat), identifier);
+	if(name == NULL) {
+		return NULL;
+	}
+
+	return purple_normalize_ref(purple_chat_get_account(chat), name);
+}
+
+static void
+purple_blist_chats_cache_remove_account(const PurpleAccount *account)
+{
+	g_hash_table_remove(chats_cache, account);
+}
+
+/* Marks the index of account, or of every account if it's NULL, as needing to
+ * be rebuilt.
+ */
+static void
+purple_blist_chats_cache_invalidate(PurpleAccount *account)
+{
+	PurpleBlistChatIndex *index = NULL;
+
+	if(chats_cache == NULL) {
+		return;
+	}
+
+	if(account == NULL) {
+		GHashTableIter iter;
+
+		g_hash_table_iter_init(&iter, chats_cache);
+		while(g_hash_table_iter_next(&iter, NULL, (gpointer *)&index)) {
+			index->valid = FALSE;
+		}
+
+		return;
+	}
+
+	index = g_hash_table_lookup(chats_cache, account);
+	if(index != NULL) {
+		index->valid = FALSE;
+	}
+}
+
+/* Returns the up to date index for the connected account. */
+static PurpleBlistChatIndex *
+purple_blist_chats_cache_get(PurpleAccount *account)
+{
+	PurpleBlistChatIndex *index = NULL;
+	gchar *identifier = NULL;
+
+	index = g_hash_table_lookup(chats_cache, account);
+	if(index == NULL) {
+		index = g_new0(PurpleBlistChatIndex, 1);
+		index->names = g_hash_table_new_full(g_str_hash, g_str_equal,
+		                                     (GDestroyNotify)g_ref_string_release,
+		                                     NULL);
+		index->chats = g_hash_table_new(g_direct_hash, g_direct_equal);
+		g_hash_table_insert(chats_cache, account, index);
+	}
+
+	if(index->valid) {
+		return index;
+	}
+
+	g_hash_table_remove_all(index->chats);
+	g_hash_table_remove_all(index->names);
+
+	identifier = purple_blist_chat_get_identifier(account);
+	if(identifier != NULL) {
+		PurpleBlistNode *group = NULL, *node = NULL;
+
+		for(group = purple_blist_get_default_root(); group != NULL;
+		    group = group->next)
+		{
+			for(node = group->child; node != NULL; node = node->next) {
+				PurpleChat *chat = NULL;
+				GRefString *name = NULL;
+
+				if(!PURPLE_IS_CHAT(node)) {
+					continue;
+				}
+
+				chat = PURPLE_CHAT(node);
+				if(purple_chat_get_account(chat) != account) {
+					continue;
+				}
+
+				name = purple_blist_chat_get_index_name(chat, identifier);
+				if(name == NULL) {
+					continue;
+				}
+
+				/* The first chat in the list wins, like the walk that this
+				 * replaces.
+				 */
+				if(g_hash_table_contains(index->names, name)) {
+					g_ref_string_release(name);
+					continue;
+				}
+
+				g_hash_table_insert(index->names, name, chat);
+				g_hash_table_insert(index->chats, chat, name);
+			}
+		}
+
+		g_free(identifier);
+	}
+
+	index->valid = TRUE;
+
+	return index;
+}
+
+/* Called after chat has been put into the list. */
+static void
+purple_blist_chats_cache_add_chat(PurpleChat *chat)
+{
+	PurpleAccount *account = purple_chat_get_account(chat);
+	PurpleBlistChatIndex *index = NULL;
+	GRefString *name = NULL;
+	gchar *identifier = NULL;
+
+	index = g_hash_table_lookup(chats_cache, account);
+	if(index == NULL || !index->valid) {
+		return;
+	}
+
+	if(!purple_account_is_connected(account)) {
+		index->valid = FALSE;
+
+		return;
+	}
+
+	identifier = purple_blist_chat_get_identifier(account);
+	if(identifier != NULL) {
+		name = purple_blist_chat_get_index_name(chat, identifier);
+		g_free(identifier);
+	}
+
+	if(name == NULL) {
+		return;
+	}
+
+	/* If the name is taken we don't know which chat comes first anymore. This
+	 * includes chats being moved, which are already in the index.
+	 */
+	if(g_hash_table_contains(index->names, name)) {
+		g_ref_string_release(name);
+		index->valid = FALSE;
+
+		return;
+	}
+
+	g_hash_table_insert(index->names, name, chat);
+	g_hash_table_insert(index->chats, chat, name);
+}
+
+void
+_purple_blist_chat_components_changed(PurpleChat *chat)
+{
+	/* Chats that aren't in the list can't be found, so their names don't
+	 * matter until they are added.
+	 */
+	if(PURPLE_BLIST_NODE(chat)->parent == NULL) {
+		return;
+	}
+
+	purple_blist_chats_cache_invalidate(purple_chat_get_account(chat));
+}
+
+/* Called when chat is being removed from the list. */
+static void
+purple_blist_chats_cache_remove_chat(PurpleChat *chat)
+{
+	PurpleBlistChatIndex *index = NULL;
+
+	index = g_hash_table_lookup(chats_cache, purple_chat_get_account(chat));
+	if(index == NULL || !index->valid) {
+		return;
+	}
+
+	/* Another chat with the same name may be further down the list, so the
+	 * index has to be rebuilt to find it.
+	 */
+	if(g_hash_table_contains(index->chats, chat)) {
+		index->valid = FALSE;
+	}
+}
+
 /*********************************************************************
  * Writing to disk                                                   *
  *********************************************************************/
 
 static void
-value_to_xmlnode(gpointer key, gpointer hvalue, gpointer user_data)
+value_to_xmlnode(const gchar *name, const GValue *value, gpointer user_data)
 {
-	const char *name;
-	GValue *value;
 	PurpleXmlNode *node, *child;
 	char buf[21];
 
-	name    = (const char *)key;
-	value   = (GValue *)hvalue;
 	node    = (PurpleXmlNode *)user_data;
 
 	g_return_if_fail(value != NULL);
@@ -225,7 +479,7 @@ buddy_to_xmlnode(PurpleBuddy *buddy)
 	}
 
 	/* Write buddy settings */
-	g_hash_table_foreach(purple_blist_node_get_settings(PURPLE_BLIST_NODE(buddy)),
+	purple_blist_node_foreach_setting(PURPLE_BLIST_NODE(buddy),
 			value_to_xmlnode, node);
 
 	return node;
@@ -259,7 +513,7 @@ contact_to_xmlnode(PurpleMetaContact *contact)
 	}
 
 	/* Write contact settings */
-	g_hash_table_foreach(purple_blist_node_get_settings(PURPLE_BLIST_NODE(contact)),
+	purple_blist_node_foreach_setting(PURPLE_BLIST_NODE(contact),
 			value_to_xmlnode, node);
 
 	g_free(alias);
@@ -290,7 +544,7 @@ chat_to_xmlnode(PurpleChat *chat)
 			chat_component_to_xmlnode, node);
 
 	/* Write chat settings */
-	g_hash_table_foreach(purple_blist_node_get_settings(PURPLE_BLIST_NODE(chat)),
+	purple_blist_node_foreach_setting(PURPLE_BLIST_NODE(chat),
 			value_to_xmlnode, node);
 
 	g_free(alias);
@@ -308,7 +562,7 @@ group_to_xmlnode(PurpleGroup *group)
 		purple_xmlnode_set_attrib(node, "name", purple_group_get_name(group));
 
 	/* Write settings */
-	g_hash_table_foreach(purple_blist_node_get_settings(PURPLE_BLIST_NODE(group)),
+	purple_blist_node_foreach_setting(PURPLE_BLIST_NODE(group),
 			value_to_xmlnode, node);
 
 	/* Write contacts and chats */
@@ -406,39 +660,33 @@ blist_to_xmlnode(void) {
 	return node;
 }
 
-static void
+static PurpleXmlNode *
 purple_blist_sync(void)
 {
-	PurpleXmlNode *node;
-	char *data;
-
 	if (!blist_loaded)
 	{
 		purple_debug_error("buddylist", "Attempted to save buddy list before it "
 						 "was read!\n");
-		return;
+		return NULL;
 	}
 
-	node = blist_to_xmlnode();
-	data = purple_xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_config_file("blist.xml", data, -1);
-	g_free(data);
-	purple_xmlnode_free(node);
-}
+	/* The snapshot has every change up to now, the journal is removed once
+	 * it has been written.
+	 */
+	journal_entries = 0;
 
-static gboolean
-save_cb(gpointer data)
-{
-	purple_blist_sync();
-	save_timer = 0;
-	return FALSE;
+	return blist_to_xmlnode();
 }
 
 static void
 purple_blist_real_schedule_save(void)
 {
-	if (save_timer == 0)
-		save_timer = g_timeout_add_seconds(5, save_cb, NULL);
+	/* Loading the list from disk doesn't change anything. */
+	if(blist_loading) {
+		return;
+	}
+
+	purple_persistence_schedule_save("blist.xml", purple_blist_sync);
 }
 
 static void
@@ -461,6 +709,167 @@ purple_blist_real_save_node(PurpleBuddyList *list, PurpleBlistNode *node)
 	purple_blist_real_schedule_save();
 }
 
+/*********************************************************************
+ * Journal                                                           *
+ *********************************************************************/
+
+/* Creates the journal entry that identifies node, or returns NULL if it can't
+ * be found again from its name alone.
+ */
+static PurpleXmlNode *
+purple_blist_journal_entry_new(PurpleBlistNode *node)
+{
+	PurpleXmlNode *entry = NULL;
+	PurpleBlistNode *bnode = NULL;
+	PurpleAccount *account = NULL;
+
+	if(PURPLE_IS_GROUP(node)) {
+		entry = purple_xmlnode_new("group");
+		purple_xmlnode_set_attrib(entry, "name",
+		                          purple_group_get_name(PURPLE_GROUP(node)));
+
+		return entry;
+	}
+
+	/* Contacts don't have a name, so they are found through their first
+	 * buddy.
+	 */
+	if(PURPLE_IS_BUDDY(node)) {
+		bnode = node;
+		entry = purple_xmlnode_new("buddy");
+	} else if(PURPLE_IS_META_CONTACT(node) && PURPLE_IS_BUDDY(node->child)) {
+		bnode = node->child;
+		entry = purple_xmlnode_new("contact");
+	} else {
+		return NULL;
+	}
+
+	if(bnode->parent == NULL || !PURPLE_IS_GROUP(bnode->parent->parent)) {
+		purple_xmlnode_free(entry);
+
+		return NULL;
+	}
+
+	account = purple_buddy_get_account(PURPLE_BUDDY(bnode));
+
+	purple_xmlnode_set_attrib(entry, "group",
+	                          purple_group_get_name(PURPLE_GROUP(bnode->parent->parent)));
+	purple_xmlnode_set_attrib(entry, "account",
+	                          purple_account_get_username(account));
+	purple_xmlnode_set_attrib(entry, "proto",
+	                          purple_account_get_protocol_id(account));
+	purple_xmlnode_set_attrib(entry, "buddy",
+	                          purple_buddy_get_name(PURPLE_BUDDY(bnode)));
+
+	return entry;
+}
+
+static void
+purple_blist_journal_append(PurpleXmlNode *entry)
+{
+	gchar *data = NULL, *escaped = NULL, *line = NULL;
+
+	/* Every entry is on its own line, so a partially written entry at the end
+	 * can't take the ones before it with it.
+	 */
+	data = purple_xmlnode_to_str(entry, NULL);
+	escaped = purple_strreplace(data, "\n", "&#10;");
+	g_free(data);
+	data = purple_strreplace(escaped, "\r", "&#13;");
+	g_free(escaped);
+
+	line = g_strconcat(data, "\n", NULL);
+	g_free(data);
+
+	purple_persistence_append(PURPLE_BLIST_JOURNAL, line);
+	g_free(line);
+
+	journal_entries++;
+	if(journal_entries >= PURPLE_BLIST_JOURNAL_MAX) {
+		purple_blist_real_schedule_save();
+	}
+}
+
+/* Returns the entry for node if the change should go into the journal, or
+ * NULL if it has been saved some other way.
+ */
+static PurpleXmlNode *
+purple_blist_journal_begin(PurpleBlistNode *node)
+{
+	PurpleBuddyListClass *klass = NULL;
+	PurpleXmlNode *entry = NULL;
+
+	/* A UI that saves the list itself needs to know about every change. */
+	if(PURPLE_IS_BUDDY_LIST(purplebuddylist)) {
+		klass = PURPLE_BUDDY_LIST_GET_CLASS(purplebuddylist);
+	}
+	if(klass == NULL || klass->save_node != purple_blist_real_save_node) {
+		purple_blist_save_node(purple_blist_get_default(), node);
+
+		return NULL;
+	}
+
+	/* Loading only replays what is already saved. Changes made while a
+	 * rewrite is pending are still journaled, because that rewrite can fail
+	 * and the journal is only removed once it has been written.
+	 */
+	if(blist_loading) {
+		return NULL;
+	}
+
+	entry = purple_blist_journal_entry_new(node);
+	if(entry == NULL) {
+		purple_blist_real_schedule_save();
+	}
+
+	return entry;
+}
+
+void
+_purple_blist_save_node_setting(PurpleBlistNode *node, const gchar *key,
+                                const GValue *value)
+{
+	PurpleXmlNode *entry = NULL;
+
+	entry = purple_blist_journal_begin(node);
+	if(entry == NULL) {
+		return;
+	}
+
+	if(value != NULL) {
+		value_to_xmlnode(key, value, entry);
+	} else {
+		PurpleXmlNode *child = purple_xmlnode_new_child(entry, "unset");
+
+		purple_xmlnode_set_attrib(child, "name", key);
+	}
+
+	purple_blist_journal_append(entry);
+	purple_xmlnode_free(entry);
+}
+
+void
+_purple_blist_save_buddy_alias(PurpleBuddy *buddy)
+{
+	PurpleXmlNode *entry = NULL, *child = NULL;
+	const gchar *alias = NULL;
+
+	entry = purple_blist_journal_begin(PURPLE_BLIST_NODE(buddy));
+	if(entry == NULL) {
+		return;
+	}
+
+	/* An empty alias element removes the alias. */
+	child = purple_xmlnode_new_child(entry, "alias");
+	alias = purple_buddy_get_local_alias(buddy);
+	if(alias != NULL) {
+		purple_xmlnode_insert_data(child, alias, -1);
+	}
+
+	purple_blist_journal_append(entry);
+	purple_xmlnode_free(entry);
+}
+
 void
 purple_blist_schedule_save(void)
 {
@@ -648,20 +1057,159 @@ parse_group(PurpleXmlNode *groupnode)
 	}
 }
 
+static PurpleBlistNode *
+parse_journal_target(PurpleXmlNode *entry)
+{
+	PurpleAccount *account = NULL;
+	PurpleAccountManager *manager = purple_account_manager_get_default();
+	PurpleBuddy *buddy = NULL;
+	PurpleGroup *group = NULL;
+	const char *group_name, *acct_name, *proto, *name;
+
+	if(purple_strequal(entry->name, "group")) {
+		name = purple_xmlnode_get_attrib(entry, "name");
+		if(name == NULL) {
+			return NULL;
+		}
+
+		return PURPLE_BLIST_NODE(purple_blist_find_group(name));
+	}
+
+	group_name = purple_xmlnode_get_attrib(entry, "group");
+	acct_name = purple_xmlnode_get_attrib(entry, "account");
+	proto = purple_xmlnode_get_attrib(entry, "proto");
+	name = purple_xmlnode_get_attrib(entry, "buddy");
+
+	if(!group_name || !acct_name || !proto || !name) {
+		return NULL;
+	}
+
+	group = purple_blist_find_group(group_name);
+	account = purple_account_manager_find(manager, acct_name, proto);
+	if(!group || !account) {
+		return NULL;
+	}
+
+	buddy = purple_blist_find_buddy_in_group(account, name, group);
+	if(!buddy) {
+		return NULL;
+	}
+
+	if(purple_strequal(entry->name, "buddy")) {
+		return PURPLE_BLIST_NODE(buddy);
+	} else if(purple_strequal(entry->name, "contact")) {
+		return PURPLE_BLIST_NODE(buddy)->parent;
+	}
+
+	return NULL;
+}
+
+static void
+parse_journal_entry(PurpleXmlNode *entry)
+{
+	PurpleBlistNode *node = parse_journal_target(entry);
+	PurpleXmlNode *x;
+
+	if(node == NULL) {
+		return;
+	}
+
+	for(x = entry->child; x; x = x->next) {
+		if(x->type != PURPLE_XMLNODE_TYPE_TAG) {
+			continue;
+		}
+
+		if(purple_strequal(x->name, "setting")) {
+			parse_setting(node, x);
+		} else if(purple_strequal(x->name, "unset")) {
+			const char *name = purple_xmlnode_get_attrib(x, "name");
+
+			if(name != NULL) {
+				purple_blist_node_remove_setting(node, name);
+			}
+		} else if(purple_strequal(x->name, "alias") && PURPLE_IS_BUDDY(node)) {
+			char *alias = purple_xmlnode_get_data(x);
+
+			purple_buddy_set_local_alias(PURPLE_BUDDY(node), alias);
+			g_free(alias);
+		}
+	}
+}
+
+/* Replays the changes made since blist.xml was last written, and returns
+ * whether there were any.
+ */
+static gboolean
+load_blist_journal(void)
+{
+	GError *error = NULL;
+	gchar *path, *contents = NULL;
+	gchar **lines;
+	guint replayed = 0;
+
+	path = g_build_filename(purple_config_dir(), PURPLE_BLIST_JOURNAL, NULL);
+
+	if(!g_file_get_contents(path, &contents, NULL, &error)) {
+		if(!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			purple_debug_warning("buddylist", "Failed to read %s: %s",
+			                     path, error->message);
+		}
+
+		g_clear_error(&error);
+		g_free(path);
+
+		return FALSE;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	for(guint i = 0; lines[i] != NULL; i++) {
+		PurpleXmlNode *entry;
+
+		if(lines[i][0] == '\0') {
+			continue;
+		}
+
+		/* The last entry is cut short if we didn't get to finish writing
+		 * it.
+		 */
+		entry = purple_xmlnode_from_str(lines[i], -1);
+		if(entry == NULL) {
+			continue;
+		}
+
+		parse_journal_entry(entry);
+		purple_xmlnode_free(entry);
+
+		replayed++;
+	}
+
+	purple_debug_info("buddylist", "Replayed %u changes from %s", replayed,
+	                  path);
+
+	g_strfreev(lines);
+	g_free(contents);
+	g_free(path);
+
+	return TRUE;
+}
+
 static void
 load_blist(void)
 {
 	PurpleAccountManager *manager = NULL;
 	PurpleXmlNode *purple, *blist, *privacy;
+	gboolean replayed = FALSE;
 
 	blist_loaded = TRUE;
 
-	purple = purple_util_read_xml_from_config_file("blist.xml", _("buddy list"));
+	purple = purple_persistence_read("blist.xml", _("buddy list"));
 
 	if(purple == NULL) {
 		return;
 	}
 
+	blist_loading = TRUE;
+
 	manager = purple_account_manager_get_default();
 
 	blist = purple_xmlnode_get_child(purple, "blist");
@@ -728,6 +1276,15 @@ load_blist(void)
 
 	purple_xmlnode_free(purple);
 
+	replayed = load_blist_journal();
+
+	blist_loading = FALSE;
+
+	/* Fold the journal back into blist.xml. */
+	if(replayed) {
+		purple_blist_real_schedule_save();
+	}
+
 	/* This tells the buddy icon code to do its thing. */
 	_purple_buddy_icons_blist_loaded_cb();
 }
@@ -756,6 +1313,9 @@ purple_blist_boot(void)
 
 	groups_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
+	chats_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+	                                    (GDestroyNotify)purple_blist_chat_index_free);
+
 	manager_model = purple_account_manager_get_default_as_model();
 	n_items = g_list_model_get_n_items(manager_model);
 	for(guint index = 0; index < n_items; index++) {
@@ -766,6 +1326,8 @@ purple_blist_boot(void)
 
 	purplebuddylist = gbl;
 
+	purple_persistence_set_journal("blist.xml", PURPLE_BLIST_JOURNAL);
+
 	load_blist();
 }
 
@@ -983,6 +1545,8 @@ void purple_blist_add_chat(PurpleChat *chat, PurpleGroup *group, PurpleBlistNode
 		}
 	}
 
+	purple_blist_chats_cache_add_chat(chat);
+
 	purple_signal_emit(purple_blist_get_handle(), "blist-node-added",
 			cnode);
 }
@@ -1338,6 +1902,9 @@ void purple_blist_add_group(PurpleGroup *group, PurpleBlistNode *node)
 	if (purple_blist_find_group(purple_group_get_name(group))) {
 		/* This is just being moved */
 
+		/* This changes which chat comes first for a name. */
+		purple_blist_chats_cache_invalidate(NULL);
+
 		if (klass && klass->remove) {
 			klass->remove(purplebuddylist,
 			              (PurpleBlistNode *)group);
@@ -1547,6 +2114,8 @@ void purple_blist_remove_chat(PurpleChat *chat)
 	gnode = node->parent;
 	group = (PurpleGroup *)gnode;
 
+	purple_blist_chats_cache_remove_chat(chat);
+
 	if (gnode != NULL)
 	{
 		/* Remove the node from its parent */
@@ -1771,13 +2340,10 @@ purple_blist_get_default_group(void)
 PurpleChat *
 purple_blist_find_chat(PurpleAccount *account, const char *name)
 {
-	char *chat_name;
 	PurpleChat *chat;
 	PurpleProtocol *protocol = NULL;
-	PurpleProtocolChatEntry *pce;
-	PurpleBlistNode *node, *group;
-	GList *parts;
-	char *normname;
+	PurpleBlistChatIndex *index = NULL;
+	GRefString *normname;
 
 	g_return_val_if_fail(PURPLE_IS_BUDDY_LIST(purplebuddylist), NULL);
 	g_return_val_if_fail((name != NULL) && (*name != '\0'), NULL);
@@ -1796,36 +2362,35 @@ purple_blist_find_chat(PurpleAccount *account, const char *name)
 		}
 	}
 
-	normname = g_strdup(purple_normalize(account, name));
-	for (group = purple_blist_get_default_root(); group != NULL;
-	     group = group->next) {
-		for (node = group->child; node != NULL; node = node->next) {
-			if (PURPLE_IS_CHAT(node)) {
+	normname = purple_normalize_ref(account, name);
 
-				chat = (PurpleChat*)node;
+	index = purple_blist_chats_cache_get(account);
+	chat = g_hash_table_lookup(index->names, normname);
 
-				if (account != purple_chat_get_account(chat))
-					continue;
-
-				parts = purple_protocol_chat_info(PURPLE_PROTOCOL_CHAT(protocol),
-					purple_account_get_connection(purple_chat_get_account(chat)));
+	/* Chat components can be changed in place without the buddy list knowing,
+	 * so make sure the chat still has this name before returning it.
+	 */
+	if(chat != NULL) {
+		gchar *identifier = purple_blist_chat_get_identifier(account);
+		GRefString *current = NULL;
 
-				pce = parts->data;
-				chat_name = g_hash_table_lookup(purple_chat_get_components(chat),
-												pce->identifier);
-				g_list_free_full(parts, g_free);
+		if(identifier != NULL) {
+			current = purple_blist_chat_get_index_name(chat, identifier);
+			g_free(identifier);
+		}
 
-				if (purple_chat_get_account(chat) == account && chat_name != NULL &&
-					purple_strequal(purple_normalize(account, chat_name), normname)) {
-					g_free(normname);
-					return chat;
-				}
-			}
+		if(!purple_strequal(current, normname)) {
+			index->valid = FALSE;
+			index = purple_blist_chats_cache_get(account);
+			chat = g_hash_table_lookup(index->names, normname);
 		}
+
+		g_clear_pointer(&current, g_ref_string_release);
 	}
 
-	g_free(normname);
-	return NULL;
+	g_ref_string_release(normname);
+
+	return chat;
 }
 
 void purple_blist_add_account(PurpleAccount *account)
@@ -2212,6 +2777,11 @@ purple_blist_init(void)
 			handle,
 			G_CALLBACK(purple_blist_buddies_cache_remove_account),
 			NULL);
+
+	purple_signal_connect(purple_accounts_get_handle(), "account-destroying",
+			handle,
+			G_CALLBACK(purple_blist_chats_cache_remove_account),
+			NULL);
 }
 
 static void
@@ -2246,19 +2816,17 @@ purple_blist_uninit(void)
 	if (purplebuddylist == NULL)
 		return;
 
-	if (save_timer != 0) {
-		g_source_remove(save_timer);
-		save_timer = 0;
-		purple_blist_sync();
-	}
+	purple_persistence_flush("blist.xml");
 
 	purple_debug_info("buddylist", "Destroying");
 
 	g_hash_table_destroy(buddies_cache);
 	g_hash_table_destroy(groups_cache);
+	g_hash_table_destroy(chats_cache);
 
 	buddies_cache = NULL;
 	groups_cache = NULL;
+	chats_cache = NULL;
 
 	g_clear_object(&purplebuddylist);
 
@@ -21,6 +21,7 @@
  *
  */
 #include "chat.h"
+#include "purpleprivate.h"
 #include "purpleprotocolchat.h"
 #include "util.h"
 
@@ -166,6 +167,31 @@ purple_chat_get_components(PurpleChat *chat)
 	return priv->components;
 }
 
+void
+purple_chat_set_component(PurpleChat *chat, const gchar *key,
+                          const gchar *value)
+{
+	PurpleChatPrivate *priv = NULL;
+
+	g_return_if_fail(PURPLE_IS_CHAT(chat));
+	g_return_if_fail(key != NULL);
+
+	priv = purple_chat_get_instance_private(chat);
+
+	if(value != NULL) {
+		g_hash_table_replace(priv->components, g_strdup(key), g_strdup(value));
+	} else {
+		g_hash_table_remove(priv->components, key);
+	}
+
+	_purple_blist_chat_components_changed(chat);
+
+	g_object_notify_by_pspec(G_OBJECT(chat), properties[PROP_COMPONENTS]);
+
+	purple_blist_save_node(purple_blist_get_default(),
+	                       PURPLE_BLIST_NODE(chat));
+}
+
 /******************************************************************************
  * GObject Stuff
  *****************************************************************************/
@@ -137,10 +137,25 @@ PurpleAccount *purple_chat_get_account(PurpleChat *chat);
  *
  * Get a hashtable containing information about a chat.
  *
+ * Use purple_chat_set_component() to change the components, so that the buddy
+ * list knows about the change.
+ *
  * Returns: (transfer none):  The hashtable.
  */
 GHashTable *purple_chat_get_components(PurpleChat *chat);
 
+/**
+ * purple_chat_set_component:
+ * @chat: The chat.
+ * @key: The identifier of the component.
+ * @value: (nullable): The new value of the component, or %NULL to remove it.
+ *
+ * Sets a single component of @chat and saves the chat.
+ *
+ * Since: 3.0.0
+ */
+void purple_chat_set_component(PurpleChat *chat, const gchar *key, const gchar *value);
+
 G_END_DECLS
 
 #endif /* PURPLE_CHAT_H */
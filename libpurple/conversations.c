@@ -58,6 +58,7 @@ purple_conversations_init(void)
 
 	/* Conversations */
 	purple_prefs_add_none("/purple/conversations");
+	purple_prefs_add_int("/purple/conversations/message_history_size", 500);
 
 	/* Conversations -> Chat */
 	purple_prefs_add_none("/purple/conversations/chat");
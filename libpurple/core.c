@@ -126,6 +126,9 @@ purple_core_init(PurpleUiInfo *ui_info) {
 
 	purple_util_init();
 
+	/* Before anything that saves files. */
+	purple_persistence_startup();
+
 	purple_signal_register(core, "uri-handler",
 		purple_marshal_BOOLEAN__POINTER_POINTER_POINTER,
 		G_TYPE_BOOLEAN, 3,
@@ -268,6 +271,9 @@ purple_core_quit(void)
 	purple_notification_manager_shutdown();
 	purple_history_manager_shutdown();
 
+	/* Wait for the last files to be written. */
+	purple_persistence_shutdown();
+
 	/* Everything after util_uninit cannot try to write things to the
 	 * confdir.
 	 */
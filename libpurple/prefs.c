@@ -35,6 +35,7 @@
 #include "prefs.h"
 #include "debug.h"
 #include "purplepath.h"
+#include "purpleprivate.h"
 #include "util.h"
 
 struct _PurplePrefCallbackData {
@@ -89,7 +90,6 @@ static struct purple_pref prefs = {
 };
 
 static GHashTable *prefs_hash = NULL;
-static guint       save_timer = 0;
 static gboolean    prefs_loaded = FALSE;
 
 /*********************************************************************
@@ -202,12 +202,9 @@ prefs_to_xmlnode(void)
 	return node;
 }
 
-static void
+static PurpleXmlNode *
 sync_prefs(void)
 {
-	PurpleXmlNode *node;
-	char *data;
-
 	if (!prefs_loaded)
 	{
 		/*
@@ -216,29 +213,16 @@ sync_prefs(void)
 		 */
 		purple_debug_error("prefs", "Attempted to save prefs before "
 						 "they were read!\n");
-		return;
+		return NULL;
 	}
 
-	node = prefs_to_xmlnode();
-	data = purple_xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_config_file("prefs.xml", data, -1);
-	g_free(data);
-	purple_xmlnode_free(node);
-}
-
-static gboolean
-save_cb(gpointer data)
-{
-	sync_prefs();
-	save_timer = 0;
-	return FALSE;
+	return prefs_to_xmlnode();
 }
 
 static void
 schedule_prefs_save(void)
 {
-	if (save_timer == 0)
-		save_timer = g_timeout_add_seconds(5, save_cb, NULL);
+	purple_persistence_schedule_save("prefs.xml", sync_prefs);
 }
 
 
@@ -1471,11 +1455,7 @@ purple_prefs_init(void)
 void
 purple_prefs_uninit(void)
 {
-	if (save_timer != 0)
-	{
-		g_source_remove(save_timer);
-		save_cb(NULL);
-	}
+	purple_persistence_flush("prefs.xml");
 
 	purple_prefs_disconnect_by_handle(purple_prefs_get_handle());
 
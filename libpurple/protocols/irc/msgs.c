@@ -737,8 +737,11 @@ void irc_msg_names(struct irc_conn *irc, const char *name, const char *from, cha
 					cur++;
 			}
 
+			/* This is the roster of a channel we just joined, which can
+			 * be thousands of users, so add them all at once.
+			 */
 			if (users != NULL) {
-				purple_chat_conversation_add_users(PURPLE_CHAT_CONVERSATION(convo), users, NULL, flags, FALSE);
+				purple_chat_conversation_add_users_bulk(PURPLE_CHAT_CONVERSATION(convo), users, flags);
 
 				g_list_free_full(users, g_free);
 				g_list_free(flags);
@@ -113,15 +113,11 @@ static void jabber_caps_store_client(gpointer key, gpointer value, gpointer user
 static gboolean
 do_jabber_caps_store(gpointer data)
 {
-	char *str;
-	int length = 0;
 	PurpleXmlNode *root = purple_xmlnode_new("capabilities");
 
 	g_hash_table_foreach(capstable, jabber_caps_store_client, root);
-	str = purple_xmlnode_to_formatted_str(root, &length);
+	purple_util_write_xml_to_cache_file(JABBER_CAPS_FILENAME, root);
 	purple_xmlnode_free(root);
-	purple_util_write_data_to_cache_file(JABBER_CAPS_FILENAME, str, length);
-	g_free(str);
 
 	save_timer = 0;
 	return FALSE;
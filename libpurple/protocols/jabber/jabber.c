@@ -67,6 +67,8 @@
  * anything in the last 120 seconds
  */
 #define DEFAULT_INACTIVITY_TIME 120
+/* The largest send buffer that is kept around for the next stanza. */
+#define JABBER_SEND_BUFFER_MAX (64 * 1024)
 
 GList *jabber_features = NULL;
 GList *jabber_identities = NULL;
@@ -534,8 +536,7 @@ jabber_send_signal_cb(PurpleConnection *pc, PurpleXmlNode **packet,
                       G_GNUC_UNUSED gpointer unused)
 {
 	JabberStream *js;
-	char *txt;
-	int len;
+	GString *buffer;
 
 	if (NULL == packet)
 		return;
@@ -552,9 +553,26 @@ jabber_send_signal_cb(PurpleConnection *pc, PurpleXmlNode **packet,
 				purple_strequal((*packet)->name, "iq") ||
 				purple_strequal((*packet)->name, "presence"))
 			purple_xmlnode_set_namespace(*packet, NS_XMPP_CLIENT);
-	txt = purple_xmlnode_to_str(*packet, &len);
-	jabber_send_raw(NULL, js, txt, len);
-	g_free(txt);
+
+	/* Take the buffer while we use it, in case sending ends up sending
+	 * another packet on this stream.
+	 */
+	buffer = js->send_buffer;
+	js->send_buffer = NULL;
+	if (buffer == NULL)
+		buffer = g_string_sized_new(1024);
+
+	purple_xmlnode_append_to_str(*packet, buffer);
+	jabber_send_raw(NULL, js, buffer->str, buffer->len);
+
+	/* Don't hold on to the memory from the odd huge stanza. */
+	if (js->send_buffer == NULL &&
+			buffer->allocated_len <= JABBER_SEND_BUFFER_MAX) {
+		g_string_truncate(buffer, 0);
+		js->send_buffer = buffer;
+	} else {
+		g_string_free(buffer, TRUE);
+	}
 }
 
 void jabber_send(JabberStream *js, PurpleXmlNode *packet)
@@ -1621,6 +1639,9 @@ jabber_close(G_GNUC_UNUSED PurpleProtocol *protocol, PurpleConnection *gc) {
 
 	g_free(js->stun_ip);
 
+	if (js->send_buffer != NULL)
+		g_string_free(js->send_buffer, TRUE);
+
 	g_free(js);
 
 	purple_connection_set_protocol_data(gc, NULL);
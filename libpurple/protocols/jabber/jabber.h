@@ -178,6 +178,8 @@ struct _JabberStream
 	GIOStream *stream;
 	GInputStream *input;
 	PurpleQueuedOutputStream *output;
+	/* Reused to serialize outgoing stanzas. */
+	GString *send_buffer;
 
 	gboolean registration;
 
@@ -319,7 +319,7 @@ purple_account_manager_find(PurpleAccountManager *manager,
 
 	for(guint index = 0; index < manager->accounts->len; index++) {
 		PurpleAccount *account = g_ptr_array_index(manager->accounts, index);
-		gchar *normalized = NULL;
+		GRefString *normalized = NULL;
 		const gchar *existing_protocol_id = NULL;
 		const gchar *existing_username = NULL;
 		const gchar *existing_normalized = NULL;
@@ -332,15 +332,15 @@ purple_account_manager_find(PurpleAccountManager *manager,
 
 		/* Finally verify the username. */
 		existing_username = purple_account_get_username(account);
-		normalized = g_strdup(purple_normalize(account, username));
+		normalized = purple_normalize_ref(account, username);
 		existing_normalized = purple_normalize(account, existing_username);
 
 		if(purple_strequal(existing_normalized, normalized)) {
-			g_free(normalized);
+			g_ref_string_release(normalized);
 
 			return account;
 		}
-		g_free(normalized);
+		g_ref_string_release(normalized);
 	}
 
 	return NULL;
@@ -32,12 +32,14 @@
 
 typedef struct {
 	GList *ignored;     /* Ignored users.                            */
+	GHashTable *ignored_keys; /* Case folded names that are ignored,
+	                             mapped to their entry in ignored.    */
 	char  *who;         /* The person who set the topic.             */
 	char  *topic;       /* The topic.                                */
 	int    id;          /* The chat ID.                              */
 	char *nick;         /* Your nick in this chat.                   */
 	gboolean left;      /* We left the chat and kept the window open */
-	GHashTable *users;  /* Hash table of the users in the room.      */
+	GHashTable *users;  /* The users in the room by their folded name. */
 } PurpleChatConversationPrivate;
 
 enum {
@@ -53,6 +55,7 @@ static GParamSpec *properties[N_PROPERTIES] = { NULL, };
 
 enum {
 	SIG_USER_JOINED,
+	SIG_USERS_JOINED,
 	SIG_USER_LEFT,
 	N_SIGNALS
 };
@@ -64,21 +67,190 @@ G_DEFINE_TYPE_WITH_PRIVATE(PurpleChatConversation, purple_chat_conversation,
 /**************************************************************************
  * Helpers
  **************************************************************************/
-static guint
-purple_conversation_user_hash(gconstpointer data) {
-	gchar *collated;
-	guint hash;
+/* The users table is keyed by the folded names of the users, see
+ * purple_chat_user_get_key(). Most names don't need folding, so this doesn't
+ * allocate in the common case.
+ */
+static PurpleChatUser *
+purple_chat_conversation_lookup_user(PurpleChatConversationPrivate *priv,
+                                     const gchar *name)
+{
+	PurpleChatUser *chat_user = NULL;
+	gchar *folded = NULL;
+
+	folded = purple_chat_user_fold_name(name);
+	chat_user = g_hash_table_lookup(priv->users,
+	                                (folded != NULL) ? folded : name);
+	g_free(folded);
+
+	return chat_user;
+}
+
+/* An entry can carry a status prefix like "@", "%", "+", or "@+", in which
+ * case it also matches the name without the prefix. This returns that name, or
+ * entry itself if there is no prefix.
+ */
+static const gchar *
+purple_chat_conversation_strip_ignored_prefix(const gchar *entry) {
+	const gchar *name = entry;
+
+	if(*name == '@') {
+		name++;
+	}
+
+	if(*name == '+' || (*name == '%' && name == entry)) {
+		name++;
+	}
+
+	return name;
+}
+
+/* Maps the case folded name to entry. If replace is FALSE an existing mapping
+ * is kept, as the first entry in the list wins like it did when the list was
+ * searched. If only is not NULL, the name is only added when it folds to only.
+ */
+static void
+purple_chat_conversation_add_ignored_key(PurpleChatConversationPrivate *priv,
+                                         const gchar *name,
+                                         const gchar *entry,
+                                         gboolean replace,
+                                         const gchar *only)
+{
+	gchar *key = purple_chat_user_casefold_name(name);
+
+	if((only != NULL && !purple_strequal(key, only)) ||
+	   (!replace && g_hash_table_contains(priv->ignored_keys, key)))
+	{
+		g_free(key);
+
+		return;
+	}
+
+	g_hash_table_replace(priv->ignored_keys, key, (gpointer)entry);
+}
+
+static void
+purple_chat_conversation_add_ignored_entry(PurpleChatConversationPrivate *priv,
+                                           const gchar *entry,
+                                           gboolean replace,
+                                           const gchar *only)
+{
+	const gchar *name = NULL;
+
+	if(entry == NULL) {
+		return;
+	}
+
+	purple_chat_conversation_add_ignored_key(priv, entry, entry, replace,
+	                                         only);
+
+	name = purple_chat_conversation_strip_ignored_prefix(entry);
+	if(name != entry) {
+		purple_chat_conversation_add_ignored_key(priv, name, entry, replace,
+		                                         only);
+	}
+}
+
+/* Removes the names of entry, which must no longer be in the list, and hands
+ * them to the next entries in the list that match them.
+ */
+static void
+purple_chat_conversation_remove_ignored_entry(PurpleChatConversationPrivate *priv,
+                                              const gchar *entry)
+{
+	const gchar *names[2] = {
+		entry,
+		purple_chat_conversation_strip_ignored_prefix(entry),
+	};
+
+	for(guint i = 0; i < G_N_ELEMENTS(names); i++) {
+		gchar *key = NULL;
+
+		if(i > 0 && names[i] == entry) {
+			break;
+		}
+
+		key = purple_chat_user_casefold_name(names[i]);
+
+		if(g_hash_table_lookup(priv->ignored_keys, key) == entry) {
+			g_hash_table_remove(priv->ignored_keys, key);
+
+			for(GList *l = priv->ignored; l != NULL; l = l->next) {
+				purple_chat_conversation_add_ignored_entry(priv, l->data,
+				                                           FALSE, key);
+
+				if(g_hash_table_contains(priv->ignored_keys, key)) {
+					break;
+				}
+			}
+		}
+
+		g_free(key);
+	}
+}
 
-	collated = g_utf8_collate_key((const gchar *)data, -1);
-	hash = g_str_hash(collated);
-	g_free(collated);
+/* Rebuilds the set of ignored names from the list. */
+static void
+purple_chat_conversation_update_ignored_keys(PurpleChatConversationPrivate *priv)
+{
+	g_hash_table_remove_all(priv->ignored_keys);
 
-	return hash;
+	for(GList *l = priv->ignored; l != NULL; l = l->next) {
+		purple_chat_conversation_add_ignored_entry(priv, l->data, FALSE,
+		                                           NULL);
+	}
 }
 
-static gboolean
-purple_conversation_user_equal(gconstpointer a, gconstpointer b) {
-	return !g_utf8_collate(a, b);
+/* Creates the PurpleChatUser for user, working out its alias, and puts it in
+ * the users table replacing any existing user with the same name.
+ */
+static PurpleChatUser *
+purple_chat_conversation_create_user(PurpleChatConversation *chat,
+                                     PurpleConnection *gc,
+                                     gboolean unique_chatname,
+                                     const gchar *user,
+                                     PurpleChatUserFlags flags,
+                                     const gchar **alias_out)
+{
+	PurpleChatConversationPrivate *priv = NULL;
+	PurpleAccount *account = NULL;
+	PurpleChatUser *chat_user = NULL;
+	const gchar *alias = user;
+
+	priv = purple_chat_conversation_get_instance_private(chat);
+	account = purple_connection_get_account(gc);
+
+	if(!unique_chatname) {
+		if(purple_strequal(priv->nick, purple_normalize(account, user))) {
+			const gchar *alias2 = purple_account_get_private_alias(account);
+			if(alias2 != NULL) {
+				alias = alias2;
+			} else {
+				const gchar *display_name = purple_connection_get_display_name(gc);
+				if(display_name != NULL) {
+					alias = display_name;
+				}
+			}
+		} else {
+			PurpleBuddy *buddy;
+			if((buddy = purple_blist_find_buddy(account, user)) != NULL) {
+				alias = purple_buddy_get_contact_alias(buddy);
+			}
+		}
+	}
+
+	chat_user = purple_chat_user_new(chat, user, alias, flags);
+
+	/* The key is interned, so the table shares it with the user. */
+	g_hash_table_replace(priv->users,
+	                     g_ref_string_acquire(purple_chat_user_get_key(chat_user)),
+	                     chat_user);
+
+	if(alias_out != NULL) {
+		*alias_out = alias;
+	}
+
+	return chat_user;
 }
 
 static void
@@ -184,9 +356,11 @@ purple_chat_conversation_init(PurpleChatConversation *chat) {
 
 	priv = purple_chat_conversation_get_instance_private(chat);
 
-	priv->users = g_hash_table_new_full(purple_conversation_user_hash,
-	                                    purple_conversation_user_equal,
-	                                    g_free, g_object_unref);
+	priv->users = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                    (GDestroyNotify)g_ref_string_release,
+	                                    g_object_unref);
+	priv->ignored_keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                           NULL);
 }
 
 static void
@@ -258,6 +432,7 @@ purple_chat_conversation_finalize(GObject *obj) {
 
 	g_clear_pointer(&priv->users, g_hash_table_destroy);
 
+	g_clear_pointer(&priv->ignored_keys, g_hash_table_destroy);
 	g_list_free_full(priv->ignored, g_free);
 	priv->ignored = NULL;
 
@@ -365,6 +540,35 @@ purple_chat_conversation_class_init(PurpleChatConversationClass *klass) {
 		PURPLE_TYPE_CHAT_USER_FLAGS,
 		G_TYPE_BOOLEAN);
 
+	/**
+	 * PurpleChatConversation::users-joined:
+	 * @chat: The chat instance.
+	 * @users: (type GList(PurpleChatUser)) (transfer none): The users that
+	 *         joined, sorted with purple_chat_user_compare().
+	 *
+	 * Emitted once after purple_chat_conversation_add_users_bulk() has added
+	 * all of its users. PurpleChatConversation::user-joined is not emitted
+	 * for them.
+	 *
+	 * @users is a #GList of #PurpleChatUser, which is passed as a pointer.
+	 * Both the list and the users are owned by @chat and are only valid
+	 * during the emission, so handlers that want to keep a user need to take
+	 * a reference to it.
+	 *
+	 * Since: 3.0.0
+	 */
+	signals[SIG_USERS_JOINED] = g_signal_new_class_handler(
+		"users-joined",
+		G_OBJECT_CLASS_TYPE(klass),
+		G_SIGNAL_RUN_LAST,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		G_TYPE_NONE,
+		1,
+		G_TYPE_POINTER);
+
 	/**
 	 * PurpleChatConversation::user-left:
 	 * @chat: The chat instance.
@@ -467,6 +671,12 @@ purple_chat_conversation_ignore(PurpleChatConversation *chat,
 	}
 
 	priv->ignored = g_list_prepend(priv->ignored, g_strdup(name));
+
+	/* The new entry is first in the list, so it takes over any names that
+	 * other entries also match.
+	 */
+	purple_chat_conversation_add_ignored_entry(priv, priv->ignored->data,
+	                                           TRUE, NULL);
 }
 
 void
@@ -488,9 +698,15 @@ purple_chat_conversation_unignore(PurpleChatConversation *chat,
 
 	item = g_list_find(priv->ignored,
 					   purple_chat_conversation_get_ignored_user(chat, name));
-	g_free(item->data);
+	if(item == NULL) {
+		return;
+	}
+
+	priv->ignored = g_list_remove_link(priv->ignored, item);
+	purple_chat_conversation_remove_ignored_entry(priv, item->data);
 
-	priv->ignored = g_list_delete_link(priv->ignored, item);
+	g_free(item->data);
+	g_list_free_1(item);
 }
 
 GList *
@@ -504,6 +720,7 @@ purple_chat_conversation_set_ignored(PurpleChatConversation *chat,
 	priv = purple_chat_conversation_get_instance_private(chat);
 
 	priv->ignored = ignored;
+	purple_chat_conversation_update_ignored_keys(priv);
 
 	return ignored;
 }
@@ -522,34 +739,36 @@ const gchar *
 purple_chat_conversation_get_ignored_user(PurpleChatConversation *chat,
                                           const gchar *user)
 {
-	GList *ignored;
+	PurpleChatConversationPrivate *priv = NULL;
+	PurpleChatUser *chat_user = NULL;
+	const gchar *entry = NULL;
 
 	g_return_val_if_fail(PURPLE_IS_CHAT_CONVERSATION(chat), NULL);
 	g_return_val_if_fail(user != NULL, NULL);
 
-	ignored = purple_chat_conversation_get_ignored(chat);
-	for(; ignored != NULL; ignored = ignored->next) {
-		const gchar *ign = (const gchar *)ignored->data;
+	priv = purple_chat_conversation_get_instance_private(chat);
 
-		if(!purple_utf8_strcasecmp(user, ign) ||
-			((*ign == '+' || *ign == '%') &&
-			  !purple_utf8_strcasecmp(user, ign + 1)))
-		{
-			return ign;
-		}
+	if(g_hash_table_size(priv->ignored_keys) == 0) {
+		return NULL;
+	}
 
-		if(*ign == '@') {
-			ign++;
+	/* Users in the room cache their case folded name, so only nicks we
+	 * don't know about need to be folded here.
+	 */
+	chat_user = purple_chat_conversation_lookup_user(priv, user);
+	if(chat_user != NULL &&
+	   purple_strequal(purple_chat_user_get_name(chat_user), user))
+	{
+		entry = g_hash_table_lookup(priv->ignored_keys,
+		                            purple_chat_user_get_casefolded_name(chat_user));
+	} else {
+		gchar *key = purple_chat_user_casefold_name(user);
 
-			if((*ign == '+' && !purple_utf8_strcasecmp(user, ign + 1)) ||
-			   (*ign != '+' && !purple_utf8_strcasecmp(user, ign)))
-			{
-				return ign;
-			}
-		}
+		entry = g_hash_table_lookup(priv->ignored_keys, key);
+		g_free(key);
 	}
 
-	return NULL;
+	return entry;
 }
 
 gboolean
@@ -663,21 +882,18 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users,
 	PurpleConversation *conv;
 	PurpleConversationUiOps *ops;
 	PurpleChatUser *chatuser;
-	PurpleChatConversationPrivate *priv;
-	PurpleAccount *account;
 	PurpleConnection *gc;
 	PurpleProtocol *protocol;
 	GList *cbuddies = NULL;
 	gpointer handle;
+	gboolean unique_chatname = FALSE;
 
 	g_return_if_fail(PURPLE_IS_CHAT_CONVERSATION(chat));
 	g_return_if_fail(users != NULL);
 
-	priv = purple_chat_conversation_get_instance_private(chat);
 	conv = PURPLE_CONVERSATION(chat);
 	ops = purple_conversation_get_ui_ops(conv);
 
-	account = purple_conversation_get_account(conv);
 	gc = purple_conversation_get_connection(conv);
 	g_return_if_fail(PURPLE_IS_CONNECTION(gc));
 
@@ -685,6 +901,8 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users,
 	g_return_if_fail(PURPLE_IS_PROTOCOL(protocol));
 
 	handle = purple_conversations_get_handle();
+	unique_chatname = (purple_protocol_get_options(protocol) &
+	                   OPT_PROTO_UNIQUE_CHATNAME);
 
 	while(users != NULL && flags != NULL) {
 		const gchar *user = (const gchar *)users->data;
@@ -693,36 +911,18 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users,
 		PurpleChatUserFlags flag = GPOINTER_TO_INT(flags->data);
 		const gchar *extra_msg = (extra_msgs ? extra_msgs->data : NULL);
 
-		if(!(purple_protocol_get_options(protocol) & OPT_PROTO_UNIQUE_CHATNAME)) {
-			if(purple_strequal(priv->nick, purple_normalize(account, user))) {
-				const gchar *alias2 = purple_account_get_private_alias(account);
-				if(alias2 != NULL) {
-					alias = alias2;
-				} else {
-					const gchar *display_name = purple_connection_get_display_name(gc);
-					if(display_name != NULL) {
-						alias = display_name;
-					}
-				}
-			} else {
-				PurpleBuddy *buddy;
-				if((buddy = purple_blist_find_buddy(purple_connection_get_account(gc), user)) != NULL) {
-					alias = purple_buddy_get_contact_alias(buddy);
-				}
-			}
-		}
-
 		quiet = GPOINTER_TO_INT(purple_signal_emit_return_1(handle,
 		                        "chat-user-joining", chat, user, flag)) ||
 				purple_chat_conversation_is_ignored_user(chat, user);
 
-		chatuser = purple_chat_user_new(chat, user, alias, flag);
-
-		g_hash_table_replace(priv->users,
-			g_strdup(purple_chat_user_get_name(chatuser)),
-			chatuser);
+		chatuser = purple_chat_conversation_create_user(chat, gc,
+		                                                unique_chatname, user,
+		                                                flag, &alias);
 
-		cbuddies = g_list_prepend(cbuddies, chatuser);
+		/* Hold a reference as a later user in the same batch with the same
+		 * name replaces this one in the users table.
+		 */
+		cbuddies = g_list_prepend(cbuddies, g_object_ref(chatuser));
 
 		if(!quiet && new_arrivals) {
 			gchar *alias_esc = g_markup_escape_text(alias, -1);
@@ -762,7 +962,92 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users,
 		ops->chat_add_users(chat, cbuddies, new_arrivals);
 	}
 
-	g_list_free(cbuddies);
+	g_list_free_full(cbuddies, g_object_unref);
+}
+
+void
+purple_chat_conversation_add_users_bulk(PurpleChatConversation *chat,
+                                        GList *users, GList *flags)
+{
+	PurpleChatConversationPrivate *priv = NULL;
+	PurpleConversation *conv = NULL;
+	PurpleConversationUiOps *ops = NULL;
+	PurpleConnection *gc = NULL;
+	PurpleProtocol *protocol = NULL;
+	GList *cbuddies = NULL;
+	gpointer handle = NULL;
+	gboolean unique_chatname = FALSE;
+
+	g_return_if_fail(PURPLE_IS_CHAT_CONVERSATION(chat));
+
+	priv = purple_chat_conversation_get_instance_private(chat);
+	conv = PURPLE_CONVERSATION(chat);
+	ops = purple_conversation_get_ui_ops(conv);
+
+	gc = purple_conversation_get_connection(conv);
+	g_return_if_fail(PURPLE_IS_CONNECTION(gc));
+
+	protocol = purple_connection_get_protocol(gc);
+	g_return_if_fail(PURPLE_IS_PROTOCOL(protocol));
+
+	handle = purple_conversations_get_handle();
+	unique_chatname = (purple_protocol_get_options(protocol) &
+	                   OPT_PROTO_UNIQUE_CHATNAME);
+
+	while(users != NULL && flags != NULL) {
+		PurpleChatUser *chatuser = NULL;
+		const gchar *user = users->data;
+		PurpleChatUserFlags flag = GPOINTER_TO_INT(flags->data);
+
+		/* Plugins still hear about every user, it is only the user interface
+		 * that is updated once for the whole batch. Whatever
+		 * chat-user-joining returns only silences the join message, which
+		 * isn't written for a roster anyway.
+		 */
+		purple_signal_emit(handle, "chat-user-joining", chat, user, flag);
+
+		chatuser = purple_chat_conversation_create_user(chat, gc,
+		                                                unique_chatname, user,
+		                                                flag, NULL);
+		cbuddies = g_list_prepend(cbuddies, g_object_ref(chatuser));
+
+		purple_signal_emit(handle, "chat-user-joined", chat, user, flag,
+		                   FALSE);
+
+		users = users->next;
+		flags = flags->next;
+	}
+
+	/* A name that is in the batch more than once replaced its earlier
+	 * entries in the users table, so only the last one is passed on.
+	 */
+	for(GList *l = cbuddies; l != NULL;) {
+		GList *next = l->next;
+		PurpleChatUser *chatuser = l->data;
+		const gchar *key = purple_chat_user_get_key(chatuser);
+
+		if(g_hash_table_lookup(priv->users, key) != chatuser) {
+			g_object_unref(chatuser);
+			cbuddies = g_list_delete_link(cbuddies, l);
+		}
+
+		l = next;
+	}
+
+	if(cbuddies == NULL) {
+		return;
+	}
+
+	/* The users are sorted once here rather than by every listener. */
+	cbuddies = g_list_sort(cbuddies, (GCompareFunc)purple_chat_user_compare);
+
+	g_signal_emit(chat, signals[SIG_USERS_JOINED], 0, cbuddies);
+
+	if(ops != NULL && ops->chat_add_users != NULL) {
+		ops->chat_add_users(chat, cbuddies, FALSE);
+	}
+
+	g_list_free_full(cbuddies, g_object_unref);
 }
 
 void
@@ -778,6 +1063,7 @@ purple_chat_conversation_rename_user(PurpleChatConversation *chat,
 	PurpleChatUser *cb;
 	PurpleChatUserFlags flags;
 	PurpleChatConversationPrivate *priv;
+	GRefString *old_key = NULL;
 	const gchar *new_alias = new_user;
 	gchar tmp[BUF_LONG];
 	gboolean is_me = FALSE;
@@ -820,19 +1106,31 @@ purple_chat_conversation_rename_user(PurpleChatConversation *chat,
 		}
 	}
 
-	flags = purple_chat_user_get_flags(purple_chat_conversation_find_user(chat, old_user));
+	cb = purple_chat_conversation_find_user(chat, old_user);
+	flags = purple_chat_user_get_flags(cb);
+	if(cb != NULL) {
+		old_key = g_ref_string_acquire(purple_chat_user_get_key(cb));
+	}
+
 	cb = purple_chat_user_new(chat, new_user, new_alias, flags);
 
 	g_hash_table_replace(priv->users,
-		g_strdup(purple_chat_user_get_name(cb)), cb);
+	                     g_ref_string_acquire(purple_chat_user_get_key(cb)),
+	                     cb);
 
 	if(ops != NULL && ops->chat_rename_user != NULL) {
 		ops->chat_rename_user(chat, old_user, new_user, new_alias);
 	}
 
-	cb = purple_chat_conversation_find_user(chat, old_user);
-	if(cb) {
-		g_hash_table_remove(priv->users, purple_chat_user_get_name(cb));
+	/* Keys are interned, so the same pointer means the new name folds to the
+	 * old key and the replace above already took the old user's place.
+	 */
+	if(old_key != NULL) {
+		if(old_key != purple_chat_user_get_key(cb)) {
+			g_hash_table_remove(priv->users, old_key);
+		}
+
+		g_ref_string_release(old_key);
 	}
 
 	if(purple_chat_conversation_is_ignored_user(chat, old_user)) {
@@ -934,7 +1232,7 @@ purple_chat_conversation_remove_users(PurpleChatConversation *chat,
 		cb = purple_chat_conversation_find_user(chat, user);
 
 		if(cb) {
-			g_hash_table_remove(priv->users, purple_chat_user_get_name(cb));
+			g_hash_table_remove(priv->users, purple_chat_user_get_key(cb));
 		}
 
 		/* NOTE: Don't remove them from ignored in case they re-enter. */
@@ -982,13 +1280,23 @@ void
 purple_chat_conversation_clear_users(PurpleChatConversation *chat) {
 	PurpleChatConversationPrivate *priv = NULL;
 	PurpleConversationUiOps *ops = NULL;
+	GHashTableIter iter;
+	gpointer value;
 	GList *names = NULL;
 
 	g_return_if_fail(PURPLE_IS_CHAT_CONVERSATION(chat));
 
 	priv = purple_chat_conversation_get_instance_private(chat);
 	ops = purple_conversation_get_ui_ops(PURPLE_CONVERSATION(chat));
-	names = g_hash_table_get_keys(priv->users);
+
+	/* The table is keyed by folded names, so get the real ones from the
+	 * users.
+	 */
+	g_hash_table_iter_init(&iter, priv->users);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		names = g_list_prepend(names,
+		                       (gpointer)purple_chat_user_get_name(value));
+	}
 
 	if(ops != NULL && ops->chat_remove_users != NULL) {
 		ops->chat_remove_users(chat, names);
@@ -1145,5 +1453,5 @@ purple_chat_conversation_find_user(PurpleChatConversation *chat,
 
 	priv = purple_chat_conversation_get_instance_private(chat);
 
-	return g_hash_table_lookup(priv->users, name);
+	return purple_chat_conversation_lookup_user(priv, name);
 }
@@ -256,6 +256,29 @@ void purple_chat_conversation_add_user(PurpleChatConversation *chat, const gchar
  */
 void purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, GList *extra_msgs, GList *flags, gboolean new_arrivals);
 
+/**
+ * purple_chat_conversation_add_users_bulk:
+ * @chat: The chat.
+ * @users: (element-type utf8): The list of users to add.
+ * @flags: (element-type PurpleChatUserFlags): The list of flags for each user.
+ *         This list data should be an int converted to pointer using
+ *         GINT_TO_POINTER(flag)
+ *
+ * Adds a large list of users to a chat at once, like the initial roster of a
+ * channel that was just joined.
+ *
+ * Unlike purple_chat_conversation_add_users(), the users are not treated as
+ * new arrivals, so no join messages are written. The chat-user-joining and
+ * chat-user-joined signals of the conversations subsystem are still emitted
+ * for every user, but #PurpleChatConversation::user-joined is not. Instead
+ * #PurpleChatConversation::users-joined is emitted once with all of the new
+ * users, and the user interface is told about all of them in a single call.
+ * If a name is in @users more than once, only the last entry is added.
+ *
+ * Since: 3.0.0
+ */
+void purple_chat_conversation_add_users_bulk(PurpleChatConversation *chat, GList *users, GList *flags);
+
 /**
  * purple_chat_conversation_rename_user:
  * @chat: The chat.
@@ -24,14 +24,15 @@
 
 #include "conversations.h"
 #include "purpleenums.h"
+#include "purpleprivate.h"
 
 struct _PurpleChatUser {
 	GObject parent;
 
 	PurpleChatConversation *chat;  /* The chat                              */
-	gchar *name;                   /* The chat participant's name in the
+	GRefString *name;              /* The chat participant's name in the
 	                                  chat.                                 */
-	gchar *alias;                  /* The chat participant's alias, if known;
+	GRefString *alias;             /* The chat participant's alias, if known;
 	                                  NULL otherwise.                       */
 	gboolean buddy;                /* TRUE if this chat participant is on
 	                                  the buddy list; FALSE otherwise.      */
@@ -39,6 +40,15 @@ struct _PurpleChatUser {
 	                                  participant, such as whether they
 	                                  are a channel operator.               */
 
+	GRefString *key;               /* The folded name that the chat uses to
+	                                  look up this participant.  For ASCII
+	                                  names this is the same string as
+	                                  name.                                 */
+	gchar *sort_key;               /* The collation key of the case folded
+	                                  alias or name, created on demand.     */
+	gchar *casefolded_name;        /* The case folded name, used to check
+	                                  the ignore list, created on demand.   */
+
 	gboolean constructed;
 };
 
@@ -59,8 +69,22 @@ static void
 purple_chat_user_set_name(PurpleChatUser *chat_user, const gchar *name) {
 	g_return_if_fail(PURPLE_IS_CHAT_USER(chat_user));
 
-	g_free(chat_user->name);
-	chat_user->name = g_strdup(name);
+	purple_str_intern_set(&chat_user->name, name);
+
+	g_clear_pointer(&chat_user->key, g_ref_string_release);
+	if(name != NULL) {
+		gchar *folded = purple_chat_user_fold_name(name);
+
+		if(folded != NULL) {
+			purple_str_intern_set(&chat_user->key, folded);
+			g_free(folded);
+		} else {
+			chat_user->key = g_ref_string_acquire(chat_user->name);
+		}
+	}
+
+	g_clear_pointer(&chat_user->sort_key, g_free);
+	g_clear_pointer(&chat_user->casefolded_name, g_free);
 
 	g_object_notify_by_pspec(G_OBJECT(chat_user), properties[PROP_NAME]);
 }
@@ -69,12 +93,49 @@ static void
 purple_chat_user_set_alias(PurpleChatUser *chat_user, const gchar *alias) {
 	g_return_if_fail(PURPLE_IS_CHAT_USER(chat_user));
 
-	g_free(chat_user->alias);
-	chat_user->alias = g_strdup(alias);
+	purple_str_intern_set(&chat_user->alias, alias);
+
+	g_clear_pointer(&chat_user->sort_key, g_free);
 
 	g_object_notify_by_pspec(G_OBJECT(chat_user), properties[PROP_ALIAS]);
 }
 
+/**************************************************************************
+ * Helpers
+ **************************************************************************/
+
+/* Returns the key that purple_chat_user_compare() sorts by. This is the same
+ * ordering that purple_utf8_strcasecmp() gives, but computed only once for
+ * each user rather than on every comparison.
+ */
+static const gchar *
+purple_chat_user_get_sort_key(PurpleChatUser *chat_user) {
+	if(chat_user->sort_key == NULL) {
+		const gchar *name = chat_user->alias;
+		gchar *folded = NULL;
+
+		if(name == NULL) {
+			name = chat_user->name;
+		}
+
+		if(name == NULL) {
+			return NULL;
+		}
+
+		if(!g_utf8_validate(name, -1, NULL)) {
+			chat_user->sort_key = g_strdup(name);
+
+			return chat_user->sort_key;
+		}
+
+		folded = g_utf8_casefold(name, -1);
+		chat_user->sort_key = g_utf8_collate_key(folded, -1);
+		g_free(folded);
+	}
+
+	return chat_user->sort_key;
+}
+
 /**************************************************************************
  * GObject Implementation
  **************************************************************************/
@@ -156,8 +217,11 @@ static void
 purple_chat_user_finalize(GObject *object) {
 	PurpleChatUser *chat_user = PURPLE_CHAT_USER(object);
 
-	g_free(chat_user->alias);
-	g_free(chat_user->name);
+	g_clear_pointer(&chat_user->alias, g_ref_string_release);
+	g_clear_pointer(&chat_user->name, g_ref_string_release);
+	g_clear_pointer(&chat_user->key, g_ref_string_release);
+	g_free(chat_user->sort_key);
+	g_free(chat_user->casefolded_name);
 
 	G_OBJECT_CLASS(purple_chat_user_parent_class)->finalize(object);
 }
@@ -303,7 +367,7 @@ purple_chat_user_is_buddy(PurpleChatUser *chat_user) {
 
 gint
 purple_chat_user_compare(PurpleChatUser *a, PurpleChatUser *b) {
-	gchar *namea = NULL, *nameb = NULL;
+	const gchar *keya = NULL, *keyb = NULL;
 
 	/* NULL is equal to NULL */
 	if(a == NULL && b == NULL) {
@@ -329,20 +393,77 @@ purple_chat_user_compare(PurpleChatUser *a, PurpleChatUser *b) {
 		return a->buddy ? -1 : 1;
 	}
 
-	/* figure out what name we need to check for user a */
-	if(a->alias) {
-		namea = a->alias;
-	} else if (a->name) {
-		namea = a->name;
+	/* Names and aliases are interned, so the same string means the same
+	 * sort key.
+	 */
+	if((a->alias != NULL ? a->alias : a->name) ==
+	   (b->alias != NULL ? b->alias : b->name))
+	{
+		return 0;
 	}
 
-	/* figure out what name we need to check for user b */
-	if(b->alias) {
-		nameb = b->alias;
-	} else if(b->name) {
-		nameb = b->name;
+	/* finally we're just sorting names */
+	keya = purple_chat_user_get_sort_key(a);
+	keyb = purple_chat_user_get_sort_key(b);
+
+	return g_strcmp0(keya, keyb);
+}
+
+/******************************************************************************
+ * Private API
+ *****************************************************************************/
+GRefString *
+purple_chat_user_get_key(PurpleChatUser *chat_user) {
+	g_return_val_if_fail(PURPLE_IS_CHAT_USER(chat_user), NULL);
+
+	return chat_user->key;
+}
+
+gchar *
+purple_chat_user_fold_name(const gchar *name) {
+	g_return_val_if_fail(name != NULL, NULL);
+
+	/* ASCII is unchanged by normalization, which covers most names. */
+	if(g_str_is_ascii(name)) {
+		return NULL;
 	}
 
-	/* finally we're just sorting names */
-	return purple_utf8_strcasecmp(namea, nameb);
+	/* This is the normalization that g_utf8_collate() applies, so names that
+	 * collated equal before still end up with the same key.
+	 */
+	return g_utf8_normalize(name, -1, G_NORMALIZE_ALL_COMPOSE);
+}
+
+const gchar *
+purple_chat_user_get_casefolded_name(PurpleChatUser *chat_user) {
+	g_return_val_if_fail(PURPLE_IS_CHAT_USER(chat_user), NULL);
+
+	if(chat_user->casefolded_name == NULL && chat_user->name != NULL) {
+		chat_user->casefolded_name = purple_chat_user_casefold_name(chat_user->name);
+	}
+
+	return chat_user->casefolded_name;
+}
+
+gchar *
+purple_chat_user_casefold_name(const gchar *name) {
+	gchar *folded = NULL;
+	gchar *normalized = NULL;
+
+	g_return_val_if_fail(name != NULL, NULL);
+
+	if(g_str_is_ascii(name)) {
+		return g_ascii_strdown(name, -1);
+	}
+
+	if(!g_utf8_validate(name, -1, NULL)) {
+		return g_strdup(name);
+	}
+
+	/* Names that purple_utf8_strcasecmp() considers equal end up the same. */
+	folded = g_utf8_casefold(name, -1);
+	normalized = g_utf8_normalize(folded, -1, G_NORMALIZE_ALL_COMPOSE);
+	g_free(folded);
+
+	return normalized;
 }
@@ -18,15 +18,17 @@
 
 #include "purplecontact.h"
 
+#include "purpleprivate.h"
+
 struct _PurpleContact {
 	GObject parent;
 
 	gchar *id;
 	PurpleAccount *account;
 
-	gchar *username;
-	gchar *display_name;
-	gchar *alias;
+	GRefString *username;
+	GRefString *display_name;
+	GRefString *alias;
 
 	GdkPixbuf *avatar;
 
@@ -177,9 +179,9 @@ purple_contact_finalize(GObject *obj) {
 	PurpleContact *contact = PURPLE_CONTACT(obj);
 
 	g_clear_pointer(&contact->id, g_free);
-	g_clear_pointer(&contact->username, g_free);
-	g_clear_pointer(&contact->display_name, g_free);
-	g_clear_pointer(&contact->alias, g_free);
+	g_clear_pointer(&contact->username, g_ref_string_release);
+	g_clear_pointer(&contact->display_name, g_ref_string_release);
+	g_clear_pointer(&contact->alias, g_ref_string_release);
 
 	G_OBJECT_CLASS(purple_contact_parent_class)->finalize(obj);
 }
@@ -376,8 +378,7 @@ purple_contact_set_username(PurpleContact *contact, const gchar *username) {
 	g_return_if_fail(PURPLE_IS_CONTACT(contact));
 	g_return_if_fail(username != NULL);
 
-	g_free(contact->username);
-	contact->username = g_strdup(username);
+	purple_str_intern_set(&contact->username, username);
 
 	g_object_notify_by_pspec(G_OBJECT(contact), properties[PROP_USERNAME]);
 }
@@ -395,8 +396,7 @@ purple_contact_set_display_name(PurpleContact *contact,
 {
 	g_return_if_fail(PURPLE_IS_CONTACT(contact));
 
-	g_free(contact->display_name);
-	contact->display_name = g_strdup(display_name);
+	purple_str_intern_set(&contact->display_name, display_name);
 
 	g_object_notify_by_pspec(G_OBJECT(contact), properties[PROP_DISPLAY_NAME]);
 }
@@ -412,8 +412,7 @@ void
 purple_contact_set_alias(PurpleContact *contact, const gchar *alias) {
 	g_return_if_fail(PURPLE_IS_CONTACT(contact));
 
-	g_free(contact->alias);
-	contact->alias = g_strdup(alias);
+	purple_str_intern_set(&contact->alias, alias);
 
 	g_object_notify_by_pspec(G_OBJECT(contact), properties[PROP_ALIAS]);
 }
@@ -37,37 +37,162 @@ struct _PurpleContactManager {
 	GHashTable *accounts;
 };
 
+/* The contacts of a single account. The list store owns the contacts and
+ * keeps them in the order they were added, the hash tables index them so
+ * that lookups don't have to walk the list.
+ *
+ * ids maps the id of each contact, which is owned by the contact, to the
+ * contact. members maps each contact to its interned normalized username,
+ * which is owned by members and may be NULL, and usernames maps those
+ * normalized usernames back to the contacts. If multiple contacts share an id
+ * or a username, the indexes point at the one that was added first.
+ */
+typedef struct {
+	PurpleContactManager *manager;
+
+	GListStore *contacts;
+
+	GHashTable *ids;
+	GHashTable *members;
+	GHashTable *usernames;
+} PurpleContactManagerAccount;
+
 static PurpleContactManager *default_manager = NULL;
 
+static void purple_contact_manager_username_changed_cb(GObject *obj, GParamSpec *pspec, gpointer data);
+
 /******************************************************************************
  * Helpers
  *****************************************************************************/
-static gboolean
-purple_contact_manager_find_with_username_helper(gconstpointer a,
-                                                 gconstpointer b)
+static void
+purple_contact_manager_release_key(gpointer key) {
+	if(key != NULL) {
+		g_ref_string_release(key);
+	}
+}
+
+static PurpleContactManagerAccount *
+purple_contact_manager_account_new(PurpleContactManager *manager) {
+	PurpleContactManagerAccount *data = NULL;
+
+	data = g_new0(PurpleContactManagerAccount, 1);
+	data->manager = manager;
+	data->contacts = g_list_store_new(PURPLE_TYPE_CONTACT);
+	data->ids = g_hash_table_new(g_str_hash, g_str_equal);
+	data->members = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+	                                      purple_contact_manager_release_key);
+	data->usernames = g_hash_table_new(g_str_hash, g_str_equal);
+
+	return data;
+}
+
+static void
+purple_contact_manager_account_free(PurpleContactManagerAccount *data) {
+	guint n_items = g_list_model_get_n_items(G_LIST_MODEL(data->contacts));
+
+	for(guint i = 0; i < n_items; i++) {
+		PurpleContact *contact = NULL;
+
+		contact = g_list_model_get_item(G_LIST_MODEL(data->contacts), i);
+		g_signal_handlers_disconnect_by_func(contact,
+		                                     purple_contact_manager_username_changed_cb,
+		                                     data->manager);
+		g_object_unref(contact);
+	}
+
+	/* The indexes borrow their keys from members and the contacts, so they
+	 * have to go first.
+	 */
+	g_clear_pointer(&data->usernames, g_hash_table_destroy);
+	g_clear_pointer(&data->ids, g_hash_table_destroy);
+	g_clear_pointer(&data->members, g_hash_table_destroy);
+	g_clear_object(&data->contacts);
+
+	g_free(data);
+}
+
+static void
+purple_contact_manager_account_index_username(PurpleContactManagerAccount *data,
+                                              PurpleContact *contact)
 {
-	PurpleContact *contact_a = (gpointer)a;
-	PurpleContact *contact_b = (gpointer)b;
-	const gchar *username_a = NULL;
-	const gchar *username_b = NULL;
+	PurpleAccount *account = NULL;
+	const gchar *username = NULL;
+	GRefString *key = NULL;
 
-	username_a = purple_contact_get_username(contact_a);
-	username_b = purple_contact_get_username(contact_b);
+	username = purple_contact_get_username(contact);
+	if(username != NULL) {
+		account = purple_contact_get_account(contact);
+		key = g_ref_string_new_intern(purple_normalize(account, username));
+	}
 
-	return purple_strequal(username_a, username_b);
+	g_hash_table_insert(data->members, contact, key);
+	if(key != NULL && !g_hash_table_contains(data->usernames, key)) {
+		g_hash_table_insert(data->usernames, key, contact);
+	}
 }
 
-static gboolean
-purple_contact_manager_find_with_id_helper(gconstpointer a, gconstpointer b) {
-	PurpleContact *contact_a = (gpointer)a;
-	PurpleContact *contact_b = (gpointer)b;
-	const gchar *id_a = NULL;
-	const gchar *id_b = NULL;
+static void
+purple_contact_manager_account_unindex_username(PurpleContactManagerAccount *data,
+                                                PurpleContact *contact)
+{
+	const gchar *key = NULL;
 
-	id_a = purple_contact_get_id(contact_a);
-	id_b = purple_contact_get_id(contact_b);
+	key = g_hash_table_lookup(data->members, contact);
+	if(key == NULL) {
+		return;
+	}
 
-	return purple_strequal(id_a, id_b);
+	/* If this contact was the one in the index, hand its entry over to the
+	 * next contact with the same username, if there is one.
+	 */
+	if(g_hash_table_lookup(data->usernames, key) == contact) {
+		GListModel *model = G_LIST_MODEL(data->contacts);
+		guint n_items = g_list_model_get_n_items(model);
+
+		g_hash_table_remove(data->usernames, key);
+
+		for(guint i = 0; i < n_items; i++) {
+			PurpleContact *other = g_list_model_get_item(model, i);
+			const gchar *other_key = g_hash_table_lookup(data->members, other);
+
+			g_object_unref(other);
+
+			/* The keys are interned, so equal keys are the same pointer. */
+			if(other != contact && key == other_key) {
+				g_hash_table_insert(data->usernames, (gpointer)other_key,
+				                    other);
+				break;
+			}
+		}
+	}
+}
+
+static void
+purple_contact_manager_account_unindex_id(PurpleContactManagerAccount *data,
+                                          PurpleContact *contact)
+{
+	GListModel *model = G_LIST_MODEL(data->contacts);
+	const gchar *id = purple_contact_get_id(contact);
+	guint n_items = 0;
+
+	if(g_hash_table_lookup(data->ids, id) != contact) {
+		return;
+	}
+
+	g_hash_table_remove(data->ids, id);
+
+	n_items = g_list_model_get_n_items(model);
+	for(guint i = 0; i < n_items; i++) {
+		PurpleContact *other = g_list_model_get_item(model, i);
+		const gchar *other_id = purple_contact_get_id(other);
+
+		g_object_unref(other);
+
+		if(other != contact && purple_strequal(id, other_id)) {
+			g_hash_table_insert(data->ids, (gpointer)other_id, other);
+			break;
+		}
+	}
 }
 
 static gboolean
@@ -126,6 +251,30 @@ purple_contact_manager_convert_avatar_to_icon(GBinding *binding,
 	return TRUE;
 }
 
+/******************************************************************************
+ * Callbacks
+ *****************************************************************************/
+static void
+purple_contact_manager_username_changed_cb(GObject *obj,
+                                           G_GNUC_UNUSED GParamSpec *pspec,
+                                           gpointer data)
+{
+	PurpleContactManager *manager = data;
+	PurpleContactManagerAccount *account_data = NULL;
+	PurpleContact *contact = PURPLE_CONTACT(obj);
+
+	account_data = g_hash_table_lookup(manager->accounts,
+	                                   purple_contact_get_account(contact));
+	if(account_data == NULL ||
+	   !g_hash_table_contains(account_data->members, contact))
+	{
+		return;
+	}
+
+	purple_contact_manager_account_unindex_username(account_data, contact);
+	purple_contact_manager_account_index_username(account_data, contact);
+}
+
 /******************************************************************************
  * GObject Implementation
  *****************************************************************************/
@@ -156,7 +305,8 @@ purple_contact_manager_finalize(GObject *obj) {
 static void
 purple_contact_manager_init(PurpleContactManager *manager) {
 	manager->accounts = g_hash_table_new_full(g_direct_hash, g_direct_equal,
-	                                          g_object_unref, g_object_unref);
+	                                          g_object_unref,
+	                                          (GDestroyNotify)purple_contact_manager_account_free);
 }
 
 static void
@@ -243,38 +393,39 @@ purple_contact_manager_add(PurpleContactManager *manager,
                            PurpleContact *contact)
 {
 	PurpleAccount *account = NULL;
-	GListStore *contacts = NULL;
-	gboolean added = FALSE;
+	PurpleContactManagerAccount *data = NULL;
+	const gchar *id = NULL;
 
 	g_return_if_fail(PURPLE_IS_CONTACT_MANAGER(manager));
 	g_return_if_fail(PURPLE_IS_CONTACT(contact));
 
 	account = purple_contact_get_account(contact);
-	contacts = g_hash_table_lookup(manager->accounts, account);
-	if(!G_IS_LIST_STORE(contacts)) {
-		contacts = g_list_store_new(PURPLE_TYPE_CONTACT);
-		g_hash_table_insert(manager->accounts, g_object_ref(account), contacts);
-
-		g_list_store_append(contacts, contact);
+	id = purple_contact_get_id(contact);
 
-		added = TRUE;
-	} else {
-		if(g_list_store_find(contacts, contact, NULL)) {
-			const gchar *username = purple_contact_get_username(contact);
-			const gchar *id = purple_contact_get_id(contact);
+	data = g_hash_table_lookup(manager->accounts, account);
+	if(data == NULL) {
+		data = purple_contact_manager_account_new(manager);
+		g_hash_table_insert(manager->accounts, g_object_ref(account), data);
+	} else if(g_hash_table_contains(data->members, contact)) {
+		const gchar *username = purple_contact_get_username(contact);
 
-			g_warning("double add detected for contact %s:%s", id, username);
+		g_warning("double add detected for contact %s:%s", id, username);
 
-			return;
-		}
-
-		g_list_store_append(contacts, contact);
-		added = TRUE;
+		return;
 	}
 
-	if(added) {
-		g_signal_emit(manager, signals[SIG_ADDED], 0, contact);
+	if(!g_hash_table_contains(data->ids, id)) {
+		g_hash_table_insert(data->ids, (gpointer)id, contact);
 	}
+	purple_contact_manager_account_index_username(data, contact);
+
+	g_list_store_append(data->contacts, contact);
+
+	g_signal_connect_object(contact, "notify::username",
+	                        G_CALLBACK(purple_contact_manager_username_changed_cb),
+	                        manager, 0);
+
+	g_signal_emit(manager, signals[SIG_ADDED], 0, contact);
 }
 
 gboolean
@@ -282,6 +433,7 @@ purple_contact_manager_remove(PurpleContactManager *manager,
                               PurpleContact *contact)
 {
 	PurpleAccount *account = NULL;
+	PurpleContactManagerAccount *data = NULL;
 	GListStore *contacts = NULL;
 	guint position = 0;
 
@@ -289,11 +441,12 @@ purple_contact_manager_remove(PurpleContactManager *manager,
 	g_return_val_if_fail(PURPLE_IS_CONTACT(contact), FALSE);
 
 	account = purple_contact_get_account(contact);
-	contacts = g_hash_table_lookup(manager->accounts, account);
-	if(!G_IS_LIST_STORE(contacts)) {
+	data = g_hash_table_lookup(manager->accounts, account);
+	if(data == NULL || !g_hash_table_contains(data->members, contact)) {
 		return FALSE;
 	}
 
+	contacts = data->contacts;
 	if(g_list_store_find(contacts, contact, &position)) {
 		gboolean removed = FALSE;
 		guint len = 0;
@@ -303,6 +456,17 @@ purple_contact_manager_remove(PurpleContactManager *manager,
 		 */
 		g_object_ref(contact);
 
+		g_signal_handlers_disconnect_by_func(contact,
+		                                     purple_contact_manager_username_changed_cb,
+		                                     manager);
+
+		/* Update the indexes first so that anyone listening to the list
+		 * store doesn't find the contact after it has been removed.
+		 */
+		purple_contact_manager_account_unindex_id(data, contact);
+		purple_contact_manager_account_unindex_username(data, contact);
+		g_hash_table_remove(data->members, contact);
+
 		len = g_list_model_get_n_items(G_LIST_MODEL(contacts));
 		g_list_store_remove(contacts, position);
 		if(g_list_model_get_n_items(G_LIST_MODEL(contacts)) < len) {
@@ -325,7 +489,7 @@ gboolean
 purple_contact_manager_remove_all(PurpleContactManager *manager,
                                   PurpleAccount *account)
 {
-	GListStore *contacts = NULL;
+	PurpleContactManagerAccount *data = NULL;
 
 	g_return_val_if_fail(PURPLE_IS_CONTACT_MANAGER(manager), FALSE);
 	g_return_val_if_fail(PURPLE_IS_ACCOUNT(account), FALSE);
@@ -335,13 +499,14 @@ purple_contact_manager_remove_all(PurpleContactManager *manager,
 	 * each one individually as that would require updating the backing
 	 * GListStore for each individual removal.
 	 */
-	contacts = g_hash_table_lookup(manager->accounts, account);
-	if(G_IS_LIST_STORE(contacts)) {
-		guint n_items = g_list_model_get_n_items(G_LIST_MODEL(contacts));
+	data = g_hash_table_lookup(manager->accounts, account);
+	if(data != NULL) {
+		GListModel *contacts = G_LIST_MODEL(data->contacts);
+		guint n_items = g_list_model_get_n_items(contacts);
 		for(guint i = 0; i < n_items; i++) {
 			PurpleContact *contact = NULL;
 
-			contact = g_list_model_get_item(G_LIST_MODEL(contacts), i);
+			contact = g_list_model_get_item(contacts, i);
 
 			g_signal_emit(manager, signals[SIG_REMOVED], 0, contact);
 
@@ -356,10 +521,17 @@ GListModel *
 purple_contact_manager_get_all(PurpleContactManager *manager,
                                PurpleAccount *account)
 {
+	PurpleContactManagerAccount *data = NULL;
+
 	g_return_val_if_fail(PURPLE_IS_CONTACT_MANAGER(manager), FALSE);
 	g_return_val_if_fail(PURPLE_IS_ACCOUNT(account), FALSE);
 
-	return g_hash_table_lookup(manager->accounts, account);
+	data = g_hash_table_lookup(manager->accounts, account);
+	if(data == NULL) {
+		return NULL;
+	}
+
+	return G_LIST_MODEL(data->contacts);
 }
 
 PurpleContact *
@@ -367,29 +539,22 @@ purple_contact_manager_find_with_username(PurpleContactManager *manager,
                                           PurpleAccount *account,
                                           const gchar *username)
 {
-	PurpleContact *needle = NULL;
-	GListStore *contacts = NULL;
-	guint position = 0;
-	gboolean found = FALSE;
+	PurpleContactManagerAccount *data = NULL;
+	PurpleContact *contact = NULL;
 
 	g_return_val_if_fail(PURPLE_IS_CONTACT_MANAGER(manager), FALSE);
 	g_return_val_if_fail(PURPLE_IS_ACCOUNT(account), FALSE);
 	g_return_val_if_fail(username != NULL, FALSE);
 
-	contacts = g_hash_table_lookup(manager->accounts, account);
-	if(!G_IS_LIST_STORE(contacts)) {
+	data = g_hash_table_lookup(manager->accounts, account);
+	if(data == NULL) {
 		return NULL;
 	}
 
-	needle = purple_contact_new(account, NULL);
-	purple_contact_set_username(needle, username);
-	found = g_list_store_find_with_equal_func(contacts, needle,
-	                                          purple_contact_manager_find_with_username_helper,
-	                                          &position);
-	g_clear_object(&needle);
-
-	if(found) {
-		return g_list_model_get_item(G_LIST_MODEL(contacts), position);
+	contact = g_hash_table_lookup(data->usernames,
+	                              purple_normalize(account, username));
+	if(contact != NULL) {
+		return g_object_ref(contact);
 	}
 
 	return NULL;
@@ -399,28 +564,21 @@ PurpleContact *
 purple_contact_manager_find_with_id(PurpleContactManager *manager,
                                     PurpleAccount *account, const gchar *id)
 {
-	PurpleContact *needle = NULL;
-	GListStore *contacts = NULL;
-	guint position = 0;
-	gboolean found = FALSE;
+	PurpleContactManagerAccount *data = NULL;
+	PurpleContact *contact = NULL;
 
 	g_return_val_if_fail(PURPLE_IS_CONTACT_MANAGER(manager), FALSE);
 	g_return_val_if_fail(PURPLE_IS_ACCOUNT(account), FALSE);
 	g_return_val_if_fail(id != NULL, FALSE);
 
-	contacts = g_hash_table_lookup(manager->accounts, account);
-	if(!G_IS_LIST_STORE(contacts)) {
+	data = g_hash_table_lookup(manager->accounts, account);
+	if(data == NULL) {
 		return NULL;
 	}
 
-	needle = purple_contact_new(account, id);
-	found = g_list_store_find_with_equal_func(contacts, needle,
-	                                          purple_contact_manager_find_with_id_helper,
-	                                          &position);
-	g_clear_object(&needle);
-
-	if(found) {
-		return g_list_model_get_item(G_LIST_MODEL(contacts), position);
+	contact = g_hash_table_lookup(data->ids, id);
+	if(contact != NULL) {
+		return g_object_ref(contact);
 	}
 
 	return NULL;
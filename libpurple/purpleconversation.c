@@ -48,7 +48,12 @@ typedef struct {
 	PurpleConversationUiOps *ui_ops;  /* UI-specific operations.           */
 
 	PurpleConnectionFlags features;   /* The supported features            */
-	GList *message_history; /* Message history, as a GList of PurpleMessages */
+	/* The most recent PurpleMessages with the newest at the head. It is
+	 * bounded by the message_history_size pref, older messages can be loaded
+	 * from the history manager with
+	 * purple_conversation_load_older_messages_async().
+	 */
+	GQueue message_history;
 } PurpleConversationPrivate;
 
 enum {
@@ -68,6 +73,26 @@ G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE(PurpleConversation, purple_conversation,
 /**************************************************************************
  * Helpers
  **************************************************************************/
+static void
+purple_conversation_trim_message_history(PurpleConversation *conv) {
+	PurpleConversationPrivate *priv = NULL;
+	gint size = 0;
+
+	priv = purple_conversation_get_instance_private(conv);
+
+	/* Anything that is evicted is still available from the history manager
+	 * unless it was written with PURPLE_MESSAGE_NO_LOG.
+	 */
+	size = purple_prefs_get_int("/purple/conversations/message_history_size");
+	if(size <= 0) {
+		return;
+	}
+
+	while(priv->message_history.length > (guint)size) {
+		g_object_unref(g_queue_pop_tail(&priv->message_history));
+	}
+}
+
 static void
 common_send(PurpleConversation *conv, const gchar *message,
             PurpleMessageFlags msgflags)
@@ -219,7 +244,7 @@ purple_conversation_set_property(GObject *obj, guint param_id,
 
 	switch (param_id) {
 		case PROP_ACCOUNT:
-			priv->account = g_value_get_object(value);
+			g_set_object(&priv->account, g_value_get_object(value));
 			break;
 		case PROP_NAME:
 			g_free(priv->name);
@@ -339,6 +364,7 @@ purple_conversation_finalize(GObject *object) {
 		ops->destroy_conversation(conv);
 	}
 
+	g_clear_object(&priv->account);
 	g_clear_pointer(&priv->name, g_free);
 	g_clear_pointer(&priv->title, g_free);
 
@@ -680,6 +706,12 @@ _purple_conversation_write_common(PurpleConversation *conv,
 		GError *error = NULL;
 		PurpleHistoryManager *manager = NULL;
 
+		/* The history and the message history of the conversation have to
+		 * agree on the id for purple_conversation_load_older_messages_async()
+		 * to continue where the latter ends.
+		 */
+		purple_message_ensure_id(pmsg);
+
 		manager = purple_history_manager_get_default();
 		/* We should probably handle this error somehow, but I don't think that
 		 * spamming purple_debug_warning is necessarily the right call.
@@ -701,8 +733,8 @@ _purple_conversation_write_common(PurpleConversation *conv,
 		}
 	}
 
-	g_object_ref(pmsg);
-	priv->message_history = g_list_prepend(priv->message_history, pmsg);
+	g_queue_push_head(&priv->message_history, g_object_ref(pmsg));
+	purple_conversation_trim_message_history(conv);
 
 	purple_signal_emit(purple_conversations_get_handle(),
 		(PURPLE_IS_IM_CONVERSATION(conv) ? "wrote-im-msg" : "wrote-chat-msg"),
@@ -853,9 +885,9 @@ purple_conversation_clear_message_history(PurpleConversation *conv) {
 	g_return_if_fail(PURPLE_IS_CONVERSATION(conv));
 
 	priv = purple_conversation_get_instance_private(conv);
-	list = priv->message_history;
+	list = priv->message_history.head;
+	g_queue_init(&priv->message_history);
 	g_list_free_full(list, g_object_unref);
-	priv->message_history = NULL;
 
 	purple_signal_emit(purple_conversations_get_handle(),
 	                   "cleared-message-history", conv);
@@ -869,7 +901,125 @@ purple_conversation_get_message_history(PurpleConversation *conv) {
 
 	priv = purple_conversation_get_instance_private(conv);
 
-	return priv->message_history;
+	return priv->message_history.head;
+}
+
+/* Appends a term to a history query with its value quoted, so that names
+ * with spaces, colons or quotes in them are matched exactly.
+ */
+static void
+purple_conversation_append_query_term(GString *query, const gchar *prefix,
+                                      const gchar *value)
+{
+	if(query->len > 0) {
+		g_string_append_c(query, ' ');
+	}
+
+	g_string_append_printf(query, "%s:\"", prefix);
+	for(const gchar *p = value; *p != '\0'; p++) {
+		if(*p == '"' || *p == '\\') {
+			g_string_append_c(query, '\\');
+		}
+		g_string_append_c(query, *p);
+	}
+	g_string_append_c(query, '"');
+}
+
+static void
+purple_conversation_free_messages(GList *messages) {
+	g_list_free_full(messages, g_object_unref);
+}
+
+static void
+purple_conversation_load_older_messages_cb(GObject *obj, GAsyncResult *result,
+                                           gpointer data)
+{
+	GTask *task = data;
+	GError *error = NULL;
+	GList *messages = NULL;
+
+	messages = purple_history_manager_query_finish(PURPLE_HISTORY_MANAGER(obj),
+	                                               result, &error);
+	if(error != NULL) {
+		g_task_return_error(task, error);
+	} else {
+		g_task_return_pointer(task, messages,
+		                      (GDestroyNotify)purple_conversation_free_messages);
+	}
+
+	g_object_unref(task);
+}
+
+void
+purple_conversation_load_older_messages_async(PurpleConversation *conv,
+                                              PurpleMessage *before,
+                                              guint count,
+                                              GCancellable *cancellable,
+                                              GAsyncReadyCallback callback,
+                                              gpointer data)
+{
+	PurpleConversationPrivate *priv = NULL;
+	PurpleHistoryManager *manager = NULL;
+	GTask *task = NULL;
+	GString *query = NULL;
+
+	g_return_if_fail(PURPLE_IS_CONVERSATION(conv));
+	g_return_if_fail(before == NULL || PURPLE_IS_MESSAGE(before));
+	g_return_if_fail(count > 0);
+
+	priv = purple_conversation_get_instance_private(conv);
+
+	task = g_task_new(conv, cancellable, callback, data);
+	g_task_set_source_tag(task, purple_conversation_load_older_messages_async);
+
+	if(before == NULL) {
+		before = g_queue_peek_tail(&priv->message_history);
+	}
+
+	query = g_string_new(NULL);
+	if(priv->account != NULL) {
+		purple_conversation_append_query_term(query, "account",
+		                                      purple_account_get_username(priv->account));
+	}
+	purple_conversation_append_query_term(query, "in", priv->name);
+
+	/* The query only wants messages that are older than everything we
+	 * already have, when we have nothing at all it wants the newest ones.
+	 * Messages that were written at the same time as @before are ordered by
+	 * when they were stored, which its id lets the history find.
+	 */
+	if(before != NULL) {
+		GDateTime *timestamp = purple_message_get_timestamp(before);
+		const gchar *id = purple_message_get_id(before);
+		gchar *iso8601 = g_date_time_format_iso8601(timestamp);
+
+		purple_conversation_append_query_term(query, "before", iso8601);
+		if(id != NULL) {
+			purple_conversation_append_query_term(query, "before-id", id);
+		}
+
+		g_free(iso8601);
+	}
+
+	g_string_append_printf(query, " last:%u", count);
+
+	manager = purple_history_manager_get_default();
+	purple_history_manager_query_async(manager, query->str, cancellable,
+	                                   purple_conversation_load_older_messages_cb,
+	                                   task);
+
+	g_string_free(query, TRUE);
+}
+
+GList *
+purple_conversation_load_older_messages_finish(PurpleConversation *conv,
+                                               GAsyncResult *result,
+                                               GError **error)
+{
+	g_return_val_if_fail(PURPLE_IS_CONVERSATION(conv), NULL);
+	g_return_val_if_fail(g_task_is_valid(result, conv), NULL);
+
+	return g_task_propagate_pointer(G_TASK(result), error);
 }
 
 gboolean
@@ -28,6 +28,7 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 
 #include <purplemessage.h>
 
@@ -323,6 +324,10 @@ void purple_conversation_update(PurpleConversation *conv, PurpleConversationUpda
  *          A GList of PurpleMessage's. You must not modify the
  *          list or the data within. The list contains the newest message at
  *          the beginning, and the oldest message at the end.
+ *
+ * Only the most recent messages are kept, up to the value of the
+ * `/purple/conversations/message_history_size` preference. Use
+ * purple_conversation_load_older_messages_async() to get the ones before them.
  */
 GList *purple_conversation_get_message_history(PurpleConversation *conv);
 
@@ -334,6 +339,42 @@ GList *purple_conversation_get_message_history(PurpleConversation *conv);
  */
 void purple_conversation_clear_message_history(PurpleConversation *conv);
 
+/**
+ * purple_conversation_load_older_messages_async:
+ * @conv: The conversation.
+ * @before: (nullable): The message to load the messages before, or %NULL for
+ *          the oldest message in the message history of @conv.
+ * @count: The maximum number of messages to load.
+ * @cancellable: (nullable): A #GCancellable.
+ * @callback: (scope async): The callback to call when the messages are loaded.
+ * @data: User data to pass to @callback.
+ *
+ * Loads up to @count messages of @conv that were written before @before from
+ * the active #PurpleHistoryAdapter. This is meant for user interfaces that
+ * display more than the message history of @conv, for example when the user
+ * scrolls up. Call purple_conversation_load_older_messages_finish() from
+ * @callback to get the messages.
+ *
+ * Since: 3.0.0
+ */
+void purple_conversation_load_older_messages_async(PurpleConversation *conv, PurpleMessage *before, guint count, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer data);
+
+/**
+ * purple_conversation_load_older_messages_finish:
+ * @conv: The conversation.
+ * @result: The #GAsyncResult passed to the callback.
+ * @error: A return address for a #GError.
+ *
+ * Finishes loading messages that was started with
+ * purple_conversation_load_older_messages_async().
+ *
+ * Returns: (element-type PurpleMessage) (transfer full): The messages in
+ *          chronological order, that is with the oldest message first.
+ *
+ * Since: 3.0.0
+ */
+GList *purple_conversation_load_older_messages_finish(PurpleConversation *conv, GAsyncResult *result, GError **error);
+
 /**
  * purple_conversation_send_confirm:
  * @conv:    The conversation.
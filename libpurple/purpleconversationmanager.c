@@ -22,6 +22,8 @@
 #include <purpleimconversation.h>
 #include <purpleprivate.h>
 
+#include "util.h"
+
 enum {
 	SIG_REGISTERED,
 	SIG_UNREGISTERED,
@@ -29,10 +31,46 @@ enum {
 };
 static guint signals[N_SIGNALS] = {0, };
 
+/* The kinds of conversations that the name index tells apart. */
+enum {
+	PURPLE_CONVERSATION_MANAGER_KIND_IM,
+	PURPLE_CONVERSATION_MANAGER_KIND_CHAT,
+	PURPLE_CONVERSATION_MANAGER_KIND_OTHER,
+	PURPLE_CONVERSATION_MANAGER_N_KINDS,
+};
+
+/* A key into one of the indexes. For the name index, name is the normalized
+ * name of the conversation and value is its kind. For the chat id index, name
+ * is NULL and value is the chat id. The account is only ever compared, never
+ * dereferenced.
+ */
+typedef struct {
+	PurpleAccount *account;
+	gchar *name;
+	gint value;
+} PurpleConversationManagerKey;
+
+/* What the manager remembers about each registered conversation, so that it
+ * can be found in the indexes again after its name, account, or chat id has
+ * changed.
+ */
+typedef struct {
+	PurpleConversationManagerKey name_key;
+	PurpleConversationManagerKey id_key;
+	gboolean has_id;
+} PurpleConversationManagerEntry;
+
 struct _PurpleConversationManager {
 	GObject parent;
 
+	/* Maps each conversation to its PurpleConversationManagerEntry. */
 	GHashTable *conversations;
+
+	/* Map PurpleConversationManagerKeys to GQueues of conversations, in the
+	 * order they were registered.
+	 */
+	GHashTable *names;
+	GHashTable *chat_ids;
 };
 
 static PurpleConversationManager *default_manager = NULL;
@@ -40,78 +78,196 @@ static PurpleConversationManager *default_manager = NULL;
 G_DEFINE_TYPE(PurpleConversationManager, purple_conversation_manager,
               G_TYPE_OBJECT)
 
-typedef gboolean (*PurpleConversationManagerCompareFunc)(PurpleConversation *conversation, gpointer userdata);
+static void purple_conversation_manager_changed_cb(GObject *obj, GParamSpec *pspec, gpointer data);
 
 /******************************************************************************
  * Helpers
  *****************************************************************************/
+static guint
+purple_conversation_manager_key_hash(gconstpointer data) {
+	const PurpleConversationManagerKey *key = data;
+	guint hash = g_direct_hash(key->account);
+
+	if(key->name != NULL) {
+		hash = (hash * 31) + g_str_hash(key->name);
+	}
+
+	return (hash * 31) + (guint)key->value;
+}
+
 static gboolean
-purple_conversation_is_im(PurpleConversation *conversation,
-                          G_GNUC_UNUSED gpointer userdata)
+purple_conversation_manager_key_equal(gconstpointer a, gconstpointer b) {
+	const PurpleConversationManagerKey *key_a = a;
+	const PurpleConversationManagerKey *key_b = b;
+
+	return key_a->account == key_b->account &&
+	       key_a->value == key_b->value &&
+	       purple_strequal(key_a->name, key_b->name);
+}
+
+static void
+purple_conversation_manager_key_free(gpointer data) {
+	PurpleConversationManagerKey *key = data;
+
+	g_free(key->name);
+	g_free(key);
+}
+
+static void
+purple_conversation_manager_entry_free(gpointer data) {
+	PurpleConversationManagerEntry *entry = data;
+
+	g_free(entry->name_key.name);
+	g_free(entry);
+}
+
+static void
+purple_conversation_manager_index_add(GHashTable *index,
+                                      const PurpleConversationManagerKey *key,
+                                      PurpleConversation *conversation)
 {
-	return PURPLE_IS_IM_CONVERSATION(conversation);
+	GQueue *queue = g_hash_table_lookup(index, key);
+
+	if(queue == NULL) {
+		PurpleConversationManagerKey *copy = NULL;
+
+		copy = g_new(PurpleConversationManagerKey, 1);
+		copy->account = key->account;
+		copy->name = g_strdup(key->name);
+		copy->value = key->value;
+
+		queue = g_queue_new();
+		g_hash_table_insert(index, copy, queue);
+	}
+
+	g_queue_push_tail(queue, conversation);
 }
 
-static gboolean
-purple_conversation_is_chat(PurpleConversation *conversation,
-                            G_GNUC_UNUSED gpointer userdata)
+static void
+purple_conversation_manager_index_remove(GHashTable *index,
+                                         const PurpleConversationManagerKey *key,
+                                         PurpleConversation *conversation)
+{
+	GQueue *queue = g_hash_table_lookup(index, key);
+
+	if(queue == NULL) {
+		return;
+	}
+
+	g_queue_remove(queue, conversation);
+	if(g_queue_is_empty(queue)) {
+		g_hash_table_remove(index, key);
+	}
+}
+
+static PurpleConversation *
+purple_conversation_manager_index_lookup(GHashTable *index,
+                                         const PurpleConversationManagerKey *key)
 {
-	return PURPLE_IS_CHAT_CONVERSATION(conversation);
+	GQueue *queue = g_hash_table_lookup(index, key);
+
+	if(queue == NULL) {
+		return NULL;
+	}
+
+	return g_queue_peek_head(queue);
 }
 
-static gboolean
-purple_conversation_chat_has_id(PurpleConversation *conversation,
-                                gpointer userdata)
+/* Fills in entry from the current state of conversation and adds it to the
+ * indexes.
+ */
+static void
+purple_conversation_manager_add_to_indexes(PurpleConversationManager *manager,
+                                           PurpleConversation *conversation,
+                                           PurpleConversationManagerEntry *entry)
 {
-	PurpleChatConversation *chat = NULL;
-	gint id = GPOINTER_TO_INT(userdata);
+	PurpleAccount *account = purple_conversation_get_account(conversation);
+	const gchar *name = purple_conversation_get_name(conversation);
 
+	entry->name_key.account = account;
+	entry->id_key.account = account;
 
-	if(!PURPLE_IS_CHAT_CONVERSATION(conversation)) {
-		return FALSE;
+	if(PURPLE_IS_IM_CONVERSATION(conversation)) {
+		entry->name_key.value = PURPLE_CONVERSATION_MANAGER_KIND_IM;
+	} else if(PURPLE_IS_CHAT_CONVERSATION(conversation)) {
+		PurpleChatConversation *chat = PURPLE_CHAT_CONVERSATION(conversation);
+
+		entry->name_key.value = PURPLE_CONVERSATION_MANAGER_KIND_CHAT;
+		entry->id_key.value = purple_chat_conversation_get_id(chat);
+		entry->has_id = TRUE;
+	} else {
+		entry->name_key.value = PURPLE_CONVERSATION_MANAGER_KIND_OTHER;
+	}
+
+	if(name != NULL) {
+		entry->name_key.name = g_strdup(purple_normalize(account, name));
+		purple_conversation_manager_index_add(manager->names, &entry->name_key,
+		                                      conversation);
 	}
 
-	chat = PURPLE_CHAT_CONVERSATION(conversation);
+	if(entry->has_id) {
+		purple_conversation_manager_index_add(manager->chat_ids,
+		                                      &entry->id_key, conversation);
+	}
+}
+
+static void
+purple_conversation_manager_remove_from_indexes(PurpleConversationManager *manager,
+                                                PurpleConversation *conversation,
+                                                PurpleConversationManagerEntry *entry)
+{
+	if(entry->name_key.name != NULL) {
+		purple_conversation_manager_index_remove(manager->names,
+		                                         &entry->name_key,
+		                                         conversation);
+		g_clear_pointer(&entry->name_key.name, g_free);
+	}
 
-	return (purple_chat_conversation_get_id(chat) == id);
+	if(entry->has_id) {
+		purple_conversation_manager_index_remove(manager->chat_ids,
+		                                         &entry->id_key, conversation);
+		entry->has_id = FALSE;
+	}
 }
 
 static PurpleConversation *
 purple_conversation_manager_find_internal(PurpleConversationManager *manager,
                                           PurpleAccount *account,
-                                          const gchar *name,
-                                          PurpleConversationManagerCompareFunc func,
-                                          gpointer userdata)
+                                          const gchar *name, gint kind)
 {
-	GHashTableIter iter;
-	gpointer key;
+	PurpleConversationManagerKey key = {
+		.account = account,
+		.value = kind,
+	};
 
-	g_return_val_if_fail(PURPLE_IS_ACCOUNT(account), NULL);
-
-	g_hash_table_iter_init(&iter, manager->conversations);
-	while(g_hash_table_iter_next(&iter, &key, NULL)) {
-		PurpleConversation *conversation = PURPLE_CONVERSATION(key);
-
-		if(name != NULL) {
-			const gchar *conv_name = purple_conversation_get_name(conversation);
-
-			if(!purple_strequal(conv_name, name)) {
-				continue;
-			}
-		}
+	/* The result of purple_normalize stays valid for the next few calls in
+	 * this thread, and we're done with it before we return.
+	 */
+	key.name = (gchar *)purple_normalize(account, name);
 
-		if(purple_conversation_get_account(conversation) != account) {
-			continue;
-		}
+	return purple_conversation_manager_index_lookup(manager->names, &key);
+}
 
-		if(func != NULL && !func(conversation, userdata)) {
-			continue;
-		}
+/******************************************************************************
+ * Callbacks
+ *****************************************************************************/
+static void
+purple_conversation_manager_changed_cb(GObject *obj,
+                                       G_GNUC_UNUSED GParamSpec *pspec,
+                                       gpointer data)
+{
+	PurpleConversationManager *manager = data;
+	PurpleConversation *conversation = PURPLE_CONVERSATION(obj);
+	PurpleConversationManagerEntry *entry = NULL;
 
-		return conversation;
+	entry = g_hash_table_lookup(manager->conversations, conversation);
+	if(entry == NULL) {
+		return;
 	}
 
-	return NULL;
+	purple_conversation_manager_remove_from_indexes(manager, conversation,
+	                                                entry);
+	purple_conversation_manager_add_to_indexes(manager, conversation, entry);
 }
 
 /******************************************************************************
@@ -121,13 +277,33 @@ static void
 purple_conversation_manager_init(PurpleConversationManager *manager) {
 	manager->conversations = g_hash_table_new_full(g_direct_hash,
 	                                               g_direct_equal,
-	                                               g_object_unref, NULL);
+	                                               g_object_unref,
+	                                               purple_conversation_manager_entry_free);
+	manager->names = g_hash_table_new_full(purple_conversation_manager_key_hash,
+	                                       purple_conversation_manager_key_equal,
+	                                       purple_conversation_manager_key_free,
+	                                       (GDestroyNotify)g_queue_free);
+	manager->chat_ids = g_hash_table_new_full(purple_conversation_manager_key_hash,
+	                                          purple_conversation_manager_key_equal,
+	                                          purple_conversation_manager_key_free,
+	                                          (GDestroyNotify)g_queue_free);
 }
 
 static void
 purple_conversation_manager_finalize(GObject *obj) {
 	PurpleConversationManager *manager = PURPLE_CONVERSATION_MANAGER(obj);
+	GHashTableIter iter;
+	gpointer key;
 
+	g_hash_table_iter_init(&iter, manager->conversations);
+	while(g_hash_table_iter_next(&iter, &key, NULL)) {
+		g_signal_handlers_disconnect_by_func(key,
+		                                     purple_conversation_manager_changed_cb,
+		                                     manager);
+	}
+
+	g_hash_table_destroy(manager->names);
+	g_hash_table_destroy(manager->chat_ids);
 	g_hash_table_destroy(manager->conversations);
 
 	G_OBJECT_CLASS(purple_conversation_manager_parent_class)->finalize(obj);
@@ -209,35 +385,57 @@ gboolean
 purple_conversation_manager_register(PurpleConversationManager *manager,
                                      PurpleConversation *conversation)
 {
-	gboolean registered = FALSE;
+	PurpleConversationManagerEntry *entry = NULL;
 
 	g_return_val_if_fail(PURPLE_IS_CONVERSATION_MANAGER(manager), FALSE);
 	g_return_val_if_fail(PURPLE_IS_CONVERSATION(conversation), FALSE);
 
-	registered = g_hash_table_insert(manager->conversations,
-	                                 g_object_ref(conversation), NULL);
-	if(registered) {
-		g_signal_emit(manager, signals[SIG_REGISTERED], 0, conversation);
-	} else {
-		/* We need to clean up the ref we created above if the insert failed as
-		 * the key destroy function won't be called until the manager is
-		 * destroyed which will leave the conversation floating around.
-		 */
-		g_object_unref(conversation);
+	if(g_hash_table_contains(manager->conversations, conversation)) {
+		return FALSE;
 	}
 
-	return registered;
+	entry = g_new0(PurpleConversationManagerEntry, 1);
+	g_hash_table_insert(manager->conversations, g_object_ref(conversation),
+	                    entry);
+	purple_conversation_manager_add_to_indexes(manager, conversation, entry);
+
+	/* Keep the indexes up to date when anything they're keyed on changes. */
+	g_signal_connect_object(conversation, "notify::name",
+	                        G_CALLBACK(purple_conversation_manager_changed_cb),
+	                        manager, 0);
+	g_signal_connect_object(conversation, "notify::account",
+	                        G_CALLBACK(purple_conversation_manager_changed_cb),
+	                        manager, 0);
+	if(PURPLE_IS_CHAT_CONVERSATION(conversation)) {
+		g_signal_connect_object(conversation, "notify::chat-id",
+		                        G_CALLBACK(purple_conversation_manager_changed_cb),
+		                        manager, 0);
+	}
+
+	g_signal_emit(manager, signals[SIG_REGISTERED], 0, conversation);
+
+	return TRUE;
 }
 
 gboolean
 purple_conversation_manager_unregister(PurpleConversationManager *manager,
                                        PurpleConversation *conversation)
 {
+	PurpleConversationManagerEntry *entry = NULL;
 	gboolean unregistered = FALSE;
 
 	g_return_val_if_fail(PURPLE_IS_CONVERSATION_MANAGER(manager), FALSE);
 	g_return_val_if_fail(PURPLE_IS_CONVERSATION(conversation), FALSE);
 
+	entry = g_hash_table_lookup(manager->conversations, conversation);
+	if(entry != NULL) {
+		g_signal_handlers_disconnect_by_func(conversation,
+		                                     purple_conversation_manager_changed_cb,
+		                                     manager);
+		purple_conversation_manager_remove_from_indexes(manager, conversation,
+		                                                entry);
+	}
+
 	unregistered = g_hash_table_remove(manager->conversations, conversation);
 	if(unregistered) {
 		g_signal_emit(manager, signals[SIG_UNREGISTERED], 0, conversation);
@@ -290,8 +488,18 @@ purple_conversation_manager_find(PurpleConversationManager *manager,
 	g_return_val_if_fail(PURPLE_IS_ACCOUNT(account), NULL);
 	g_return_val_if_fail(name != NULL, NULL);
 
-	return purple_conversation_manager_find_internal(manager, account, name,
-	                                                 NULL, NULL);
+	for(gint kind = 0; kind < PURPLE_CONVERSATION_MANAGER_N_KINDS; kind++) {
+		PurpleConversation *conversation = NULL;
+
+		conversation = purple_conversation_manager_find_internal(manager,
+		                                                         account, name,
+		                                                         kind);
+		if(conversation != NULL) {
+			return conversation;
+		}
+	}
+
+	return NULL;
 }
 
 PurpleConversation *
@@ -303,8 +511,7 @@ purple_conversation_manager_find_im(PurpleConversationManager *manager,
 	g_return_val_if_fail(name != NULL, NULL);
 
 	return purple_conversation_manager_find_internal(manager, account, name,
-	                                                 purple_conversation_is_im,
-	                                                 NULL);
+	                                                 PURPLE_CONVERSATION_MANAGER_KIND_IM);
 }
 
 PurpleConversation *
@@ -317,18 +524,21 @@ purple_conversation_manager_find_chat(PurpleConversationManager *manager,
 	g_return_val_if_fail(name != NULL, NULL);
 
 	return purple_conversation_manager_find_internal(manager, account, name,
-	                                                 purple_conversation_is_chat,
-	                                                 NULL);
+	                                                 PURPLE_CONVERSATION_MANAGER_KIND_CHAT);
 }
 
 PurpleConversation *
 purple_conversation_manager_find_chat_by_id(PurpleConversationManager *manager,
                                             PurpleAccount *account, gint id)
 {
+	PurpleConversationManagerKey key = {
+		.account = account,
+		.name = NULL,
+		.value = id,
+	};
+
 	g_return_val_if_fail(PURPLE_IS_CONVERSATION_MANAGER(manager), NULL);
 	g_return_val_if_fail(PURPLE_IS_ACCOUNT(account), NULL);
 
-	return purple_conversation_manager_find_internal(manager, account, NULL,
-	                                                 purple_conversation_chat_has_id,
-	                                                 GINT_TO_POINTER(id));
+	return purple_conversation_manager_index_lookup(manager->chat_ids, &key);
 }
@@ -255,6 +255,89 @@ purple_history_adapter_query(PurpleHistoryAdapter *adapter,
 	return NULL;
 }
 
+GList *
+purple_history_adapter_query_page(PurpleHistoryAdapter *adapter,
+                                  const gchar *query,
+                                  const gchar *cursor,
+                                  guint page_size,
+                                  gchar **next_cursor,
+                                  GError **error)
+{
+	PurpleHistoryAdapterClass *klass = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_HISTORY_ADAPTER(adapter), NULL);
+	g_return_val_if_fail(query != NULL, NULL);
+	g_return_val_if_fail(page_size > 0, NULL);
+
+	if(next_cursor != NULL) {
+		*next_cursor = NULL;
+	}
+
+	klass = PURPLE_HISTORY_ADAPTER_GET_CLASS(adapter);
+	if(klass != NULL && klass->query_page != NULL) {
+		return klass->query_page(adapter, query, cursor, page_size,
+		                         next_cursor, error);
+	}
+
+	g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+	            "%s does not implement the query_page function.",
+	            G_OBJECT_TYPE_NAME(G_OBJECT(adapter)));
+
+	return NULL;
+}
+
+void
+purple_history_adapter_query_async(PurpleHistoryAdapter *adapter,
+                                   const gchar *query,
+                                   GCancellable *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   gpointer data)
+{
+	PurpleHistoryAdapterClass *klass = NULL;
+
+	g_return_if_fail(PURPLE_IS_HISTORY_ADAPTER(adapter));
+	g_return_if_fail(query != NULL);
+
+	klass = PURPLE_HISTORY_ADAPTER_GET_CLASS(adapter);
+	if(klass != NULL && klass->query_async != NULL) {
+		klass->query_async(adapter, query, cancellable, callback, data);
+
+		return;
+	}
+
+	g_task_report_new_error(adapter, callback, data,
+	                        purple_history_adapter_query_async,
+	                        PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+	                        "%s does not implement the query_async function.",
+	                        G_OBJECT_TYPE_NAME(G_OBJECT(adapter)));
+}
+
+GList *
+purple_history_adapter_query_finish(PurpleHistoryAdapter *adapter,
+                                    GAsyncResult *result,
+                                    GError **error)
+{
+	PurpleHistoryAdapterClass *klass = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_HISTORY_ADAPTER(adapter), NULL);
+	g_return_val_if_fail(G_IS_ASYNC_RESULT(result), NULL);
+
+	if(g_async_result_is_tagged(result, purple_history_adapter_query_async)) {
+		return g_task_propagate_pointer(G_TASK(result), error);
+	}
+
+	klass = PURPLE_HISTORY_ADAPTER_GET_CLASS(adapter);
+	if(klass != NULL && klass->query_finish != NULL) {
+		return klass->query_finish(adapter, result, error);
+	}
+
+	g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+	            "%s does not implement the query_finish function.",
+	            G_OBJECT_TYPE_NAME(G_OBJECT(adapter)));
+
+	return NULL;
+}
+
 gboolean
 purple_history_adapter_remove(PurpleHistoryAdapter *adapter,
                               const gchar *query,
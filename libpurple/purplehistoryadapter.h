@@ -25,6 +25,7 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 
 #include <purplemessage.h>
 #include <purpleconversation.h>
@@ -70,6 +71,9 @@ struct _PurpleHistoryAdapterClass {
 	gboolean (*activate)(PurpleHistoryAdapter *adapter, GError **error);
 	gboolean (*deactivate)(PurpleHistoryAdapter *adapter, GError **error);
 	GList* (*query)(PurpleHistoryAdapter *adapter, const gchar *query, GError **error);
+	GList* (*query_page)(PurpleHistoryAdapter *adapter, const gchar *query, const gchar *cursor, guint page_size, gchar **next_cursor, GError **error);
+	void (*query_async)(PurpleHistoryAdapter *adapter, const gchar *query, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer data);
+	GList* (*query_finish)(PurpleHistoryAdapter *adapter, GAsyncResult *result, GError **error);
 	gboolean (*remove)(PurpleHistoryAdapter *adapter, const gchar *query, GError **error);
 	gboolean (*write)(PurpleHistoryAdapter *adapter, PurpleConversation *conversation, PurpleMessage *message, GError **error);
 
@@ -137,6 +141,75 @@ GList *purple_history_adapter_query(PurpleHistoryAdapter *adapter,
                                     const gchar *query,
                                     GError **error);
 
+/**
+ * purple_history_adapter_query_page:
+ * @adapter: The #PurpleHistoryAdapter instance.
+ * @query: The query to send to the @adapter.
+ * @cursor: (nullable): The cursor returned with the previous page, or %NULL
+ *          to get the first page.
+ * @page_size: The maximum number of messages to return.
+ * @next_cursor: (out) (optional) (nullable) (transfer full): A return address
+ *               for the cursor of the next page. This will be set to %NULL
+ *               when there are no more pages.
+ * @error: A return address for a #GError.
+ *
+ * Runs @query against @adapter but only returns up to @page_size messages
+ * that come after @cursor. This allows callers to walk through a large number
+ * of results without having all of them in memory at once.
+ *
+ * Cursors are opaque and only valid for the @adapter and @query that they
+ * were returned for.
+ *
+ * Returns: (element-type PurpleMessage) (transfer full): A list of messages
+ *          that match @query.
+ *
+ * Since: 3.0.0
+ */
+GList *purple_history_adapter_query_page(PurpleHistoryAdapter *adapter,
+                                         const gchar *query,
+                                         const gchar *cursor,
+                                         guint page_size,
+                                         gchar **next_cursor,
+                                         GError **error);
+
+/**
+ * purple_history_adapter_query_async:
+ * @adapter: The #PurpleHistoryAdapter instance.
+ * @query: The query to send to the @adapter.
+ * @cancellable: (nullable): A #GCancellable.
+ * @callback: (scope async): The callback to call when the query is done.
+ * @data: User data to pass to @callback.
+ *
+ * Runs @query against @adapter without blocking the main loop. Call
+ * purple_history_adapter_query_finish() from @callback to get the results.
+ *
+ * Since: 3.0.0
+ */
+void purple_history_adapter_query_async(PurpleHistoryAdapter *adapter,
+                                        const gchar *query,
+                                        GCancellable *cancellable,
+                                        GAsyncReadyCallback callback,
+                                        gpointer data);
+
+/**
+ * purple_history_adapter_query_finish:
+ * @adapter: The #PurpleHistoryAdapter instance.
+ * @result: The #GAsyncResult passed to the callback.
+ * @error: A return address for a #GError.
+ *
+ * Finishes a query that was started with purple_history_adapter_query_async().
+ * If the query was cancelled, %NULL is returned and @error is set to
+ * %G_IO_ERROR_CANCELLED.
+ *
+ * Returns: (element-type PurpleMessage) (transfer full): A list of messages
+ *          that match the query.
+ *
+ * Since: 3.0.0
+ */
+GList *purple_history_adapter_query_finish(PurpleHistoryAdapter *adapter,
+                                           GAsyncResult *result,
+                                           GError **error);
+
 /**
  * purple_history_adapter_remove:
  * @adapter: The #PurpleHistoryAdapter instance.
@@ -344,6 +344,117 @@ purple_history_manager_query(PurpleHistoryManager *manager,
 	return purple_history_adapter_query(manager->active_adapter, query, error);
 }
 
+static void
+purple_history_manager_free_results(GList *results) {
+	g_list_free_full(results, g_object_unref);
+}
+
+static void
+purple_history_manager_query_cb(GObject *obj, GAsyncResult *result,
+                                gpointer data)
+{
+	GTask *task = data;
+	GError *error = NULL;
+	GList *results = NULL;
+
+	results = purple_history_adapter_query_finish(PURPLE_HISTORY_ADAPTER(obj),
+	                                              result, &error);
+
+	if(error != NULL) {
+		g_task_return_error(task, error);
+	} else {
+		g_task_return_pointer(task, results,
+		                      (GDestroyNotify)purple_history_manager_free_results);
+	}
+
+	g_object_unref(task);
+}
+
+void
+purple_history_manager_query_async(PurpleHistoryManager *manager,
+                                   const gchar *query,
+                                   GCancellable *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   gpointer data)
+{
+	GTask *task = NULL;
+
+	g_return_if_fail(PURPLE_IS_HISTORY_MANAGER(manager));
+	g_return_if_fail(query != NULL);
+
+	task = g_task_new(manager, cancellable, callback, data);
+	g_task_set_source_tag(task, purple_history_manager_query_async);
+
+	if(manager->active_adapter == NULL) {
+		g_task_return_new_error(task, PURPLE_HISTORY_MANAGER_DOMAIN, 0,
+		                        _("no active history adapter"));
+		g_object_unref(task);
+
+		return;
+	}
+
+	purple_history_adapter_query_async(manager->active_adapter, query,
+	                                   cancellable,
+	                                   purple_history_manager_query_cb, task);
+}
+
+GList *
+purple_history_manager_query_finish(PurpleHistoryManager *manager,
+                                    GAsyncResult *result,
+                                    GError **error)
+{
+	g_return_val_if_fail(PURPLE_IS_HISTORY_MANAGER(manager), NULL);
+	g_return_val_if_fail(g_task_is_valid(result, manager), NULL);
+
+	return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+GList *
+purple_history_manager_query_page(PurpleHistoryManager *manager,
+                                  const gchar *query,
+                                  const gchar *cursor,
+                                  guint page_size,
+                                  gchar **next_cursor,
+                                  GError **error)
+{
+	g_return_val_if_fail(PURPLE_IS_HISTORY_MANAGER(manager), NULL);
+
+	if(manager->active_adapter == NULL) {
+		g_set_error_literal(error, PURPLE_HISTORY_MANAGER_DOMAIN, 0,
+		                    _("no active history adapter"));
+		return NULL;
+	}
+
+	return purple_history_adapter_query_page(manager->active_adapter, query,
+	                                         cursor, page_size, next_cursor,
+	                                         error);
+}
+
+PurpleHistoryQuery *
+purple_history_manager_query_model(PurpleHistoryManager *manager,
+                                   const gchar *query,
+                                   guint page_size,
+                                   GError **error)
+{
+	PurpleHistoryQuery *model = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_HISTORY_MANAGER(manager), NULL);
+
+	if(manager->active_adapter == NULL) {
+		g_set_error_literal(error, PURPLE_HISTORY_MANAGER_DOMAIN, 0,
+		                    _("no active history adapter"));
+		return NULL;
+	}
+
+	model = purple_history_query_new(manager->active_adapter, query,
+	                                 page_size);
+	if(!purple_history_query_load_more(model, error)) {
+		g_clear_object(&model);
+	}
+
+	return model;
+}
+
 gboolean
 purple_history_manager_remove(PurpleHistoryManager *manager,
                               const gchar *query,
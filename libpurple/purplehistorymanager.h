@@ -27,6 +27,7 @@
 #include <glib-object.h>
 
 #include "purplehistoryadapter.h"
+#include "purplehistoryquery.h"
 
 G_BEGIN_DECLS
 
@@ -175,6 +176,75 @@ GList *purple_history_manager_get_all(PurpleHistoryManager *manager);
  */
 GList *purple_history_manager_query(PurpleHistoryManager *manager, const gchar *query, GError **error);
 
+/**
+ * purple_history_manager_query_async:
+ * @manager: The #PurpleHistoryManager instance.
+ * @query: A query to send to the @manager instance.
+ * @cancellable: (nullable): A #GCancellable.
+ * @callback: (scope async): The callback to call when the query is done.
+ * @data: User data to pass to @callback.
+ *
+ * Runs @query against the active #PurpleHistoryAdapter of @manager without
+ * blocking the main loop. Call purple_history_manager_query_finish() from
+ * @callback to get the results.
+ *
+ * Since: 3.0.0
+ */
+void purple_history_manager_query_async(PurpleHistoryManager *manager, const gchar *query, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer data);
+
+/**
+ * purple_history_manager_query_finish:
+ * @manager: The #PurpleHistoryManager instance.
+ * @result: The #GAsyncResult passed to the callback.
+ * @error: A return address for a #GError.
+ *
+ * Finishes a query that was started with purple_history_manager_query_async().
+ *
+ * Returns: (transfer full) (element-type PurpleMessage): The messages that
+ *          matched the query.
+ *
+ * Since: 3.0.0
+ */
+GList *purple_history_manager_query_finish(PurpleHistoryManager *manager, GAsyncResult *result, GError **error);
+
+/**
+ * purple_history_manager_query_page:
+ * @manager: The #PurpleHistoryManager instance.
+ * @query: A query to send to the @manager instance.
+ * @cursor: (nullable): The cursor returned with the previous page, or %NULL
+ *          to get the first page.
+ * @page_size: The maximum number of messages to return.
+ * @next_cursor: (out) (optional) (nullable) (transfer full): A return address
+ *               for the cursor of the next page.
+ * @error: A return address for a #GError.
+ *
+ * Runs @query against the active #PurpleHistoryAdapter of @manager, returning
+ * at most @page_size messages. See purple_history_adapter_query_page() for
+ * details.
+ *
+ * Returns: (transfer full) (element-type PurpleMessage): The messages of the
+ *          page.
+ *
+ * Since: 3.0.0
+ */
+GList *purple_history_manager_query_page(PurpleHistoryManager *manager, const gchar *query, const gchar *cursor, guint page_size, gchar **next_cursor, GError **error);
+
+/**
+ * purple_history_manager_query_model:
+ * @manager: The #PurpleHistoryManager instance.
+ * @query: A query to send to the @manager instance.
+ * @page_size: The number of messages to load at a time.
+ * @error: A return address for a #GError.
+ *
+ * Creates a #PurpleHistoryQuery for @query against the active
+ * #PurpleHistoryAdapter of @manager and loads its first page.
+ *
+ * Returns: (transfer full): The new #PurpleHistoryQuery or %NULL on error.
+ *
+ * Since: 3.0.0
+ */
+PurpleHistoryQuery *purple_history_manager_query_model(PurpleHistoryManager *manager, const gchar *query, guint page_size, GError **error);
+
 /**
  * purple_history_manager_remove:
  * @manager: The #PurpleHistoryManager instance.
@@ -0,0 +1,310 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <gio/gio.h>
+
+#include "purplehistoryquery.h"
+
+#include "purplemessage.h"
+
+struct _PurpleHistoryQuery {
+	GObject parent;
+
+	PurpleHistoryAdapter *adapter;
+	gchar *query;
+	guint page_size;
+
+	GPtrArray *messages;
+	gchar *cursor;
+	gboolean has_more;
+};
+
+enum {
+	PROP_0,
+	PROP_ADAPTER,
+	PROP_QUERY,
+	PROP_PAGE_SIZE,
+	PROP_HAS_MORE,
+	N_PROPERTIES,
+};
+static GParamSpec *properties[N_PROPERTIES] = {NULL, };
+
+/******************************************************************************
+ * GListModel Implementation
+ *****************************************************************************/
+static GType
+purple_history_query_get_item_type(GListModel *list) {
+	return PURPLE_TYPE_MESSAGE;
+}
+
+static guint
+purple_history_query_get_n_items(GListModel *list) {
+	PurpleHistoryQuery *query = PURPLE_HISTORY_QUERY(list);
+
+	return query->messages->len;
+}
+
+static gpointer
+purple_history_query_get_item(GListModel *list, guint position) {
+	PurpleHistoryQuery *query = PURPLE_HISTORY_QUERY(list);
+	PurpleMessage *message = NULL;
+
+	if(position < query->messages->len) {
+		message = g_object_ref(g_ptr_array_index(query->messages, position));
+	}
+
+	return message;
+}
+
+static void
+purple_history_query_list_model_iface_init(GListModelInterface *iface) {
+	iface->get_item_type = purple_history_query_get_item_type;
+	iface->get_n_items = purple_history_query_get_n_items;
+	iface->get_item = purple_history_query_get_item;
+}
+
+/******************************************************************************
+ * GObject Implementation
+ *****************************************************************************/
+G_DEFINE_TYPE_WITH_CODE(PurpleHistoryQuery, purple_history_query,
+                        G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(G_TYPE_LIST_MODEL,
+                                              purple_history_query_list_model_iface_init));
+
+static void
+purple_history_query_get_property(GObject *obj, guint param_id, GValue *value,
+                                  GParamSpec *pspec)
+{
+	PurpleHistoryQuery *query = PURPLE_HISTORY_QUERY(obj);
+
+	switch(param_id) {
+		case PROP_ADAPTER:
+			g_value_set_object(value,
+			                   purple_history_query_get_adapter(query));
+			break;
+		case PROP_QUERY:
+			g_value_set_string(value, purple_history_query_get_query(query));
+			break;
+		case PROP_PAGE_SIZE:
+			g_value_set_uint(value,
+			                 purple_history_query_get_page_size(query));
+			break;
+		case PROP_HAS_MORE:
+			g_value_set_boolean(value,
+			                    purple_history_query_get_has_more(query));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
+			break;
+	}
+}
+
+static void
+purple_history_query_set_property(GObject *obj, guint param_id,
+                                  const GValue *value, GParamSpec *pspec)
+{
+	PurpleHistoryQuery *query = PURPLE_HISTORY_QUERY(obj);
+
+	switch(param_id) {
+		case PROP_ADAPTER:
+			query->adapter = g_value_dup_object(value);
+			break;
+		case PROP_QUERY:
+			query->query = g_value_dup_string(value);
+			break;
+		case PROP_PAGE_SIZE:
+			query->page_size = g_value_get_uint(value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
+			break;
+	}
+}
+
+static void
+purple_history_query_finalize(GObject *obj) {
+	PurpleHistoryQuery *query = PURPLE_HISTORY_QUERY(obj);
+
+	g_clear_object(&query->adapter);
+	g_clear_pointer(&query->query, g_free);
+	g_clear_pointer(&query->messages, g_ptr_array_unref);
+	g_clear_pointer(&query->cursor, g_free);
+
+	G_OBJECT_CLASS(purple_history_query_parent_class)->finalize(obj);
+}
+
+static void
+purple_history_query_init(PurpleHistoryQuery *query) {
+	query->messages = g_ptr_array_new_with_free_func(g_object_unref);
+	query->has_more = TRUE;
+}
+
+static void
+purple_history_query_class_init(PurpleHistoryQueryClass *klass) {
+	GObjectClass *obj_class = G_OBJECT_CLASS(klass);
+
+	obj_class->get_property = purple_history_query_get_property;
+	obj_class->set_property = purple_history_query_set_property;
+	obj_class->finalize = purple_history_query_finalize;
+
+	/**
+	 * PurpleHistoryQuery:adapter:
+	 *
+	 * The #PurpleHistoryAdapter that the query is run against.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_ADAPTER] = g_param_spec_object(
+		"adapter", "adapter",
+		"The history adapter to query",
+		PURPLE_TYPE_HISTORY_ADAPTER,
+		G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * PurpleHistoryQuery:query:
+	 *
+	 * The query string.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_QUERY] = g_param_spec_string(
+		"query", "query",
+		"The query string",
+		"",
+		G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * PurpleHistoryQuery:page-size:
+	 *
+	 * The number of messages to load at a time.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_PAGE_SIZE] = g_param_spec_uint(
+		"page-size", "page-size",
+		"The number of messages to load at a time",
+		1, G_MAXUINT, 100,
+		G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * PurpleHistoryQuery:has-more:
+	 *
+	 * Whether or not there may be more messages to load.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_HAS_MORE] = g_param_spec_boolean(
+		"has-more", "has-more",
+		"Whether or not there are more messages to load",
+		TRUE,
+		G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+	g_object_class_install_properties(obj_class, N_PROPERTIES, properties);
+}
+
+/******************************************************************************
+ * Public API
+ *****************************************************************************/
+PurpleHistoryQuery *
+purple_history_query_new(PurpleHistoryAdapter *adapter, const gchar *query,
+                         guint page_size)
+{
+	g_return_val_if_fail(PURPLE_IS_HISTORY_ADAPTER(adapter), NULL);
+	g_return_val_if_fail(query != NULL, NULL);
+	g_return_val_if_fail(page_size > 0, NULL);
+
+	return g_object_new(
+		PURPLE_TYPE_HISTORY_QUERY,
+		"adapter", adapter,
+		"query", query,
+		"page-size", page_size,
+		NULL);
+}
+
+PurpleHistoryAdapter *
+purple_history_query_get_adapter(PurpleHistoryQuery *query) {
+	g_return_val_if_fail(PURPLE_IS_HISTORY_QUERY(query), NULL);
+
+	return query->adapter;
+}
+
+const gchar *
+purple_history_query_get_query(PurpleHistoryQuery *query) {
+	g_return_val_if_fail(PURPLE_IS_HISTORY_QUERY(query), NULL);
+
+	return query->query;
+}
+
+guint
+purple_history_query_get_page_size(PurpleHistoryQuery *query) {
+	g_return_val_if_fail(PURPLE_IS_HISTORY_QUERY(query), 0);
+
+	return query->page_size;
+}
+
+gboolean
+purple_history_query_get_has_more(PurpleHistoryQuery *query) {
+	g_return_val_if_fail(PURPLE_IS_HISTORY_QUERY(query), FALSE);
+
+	return query->has_more;
+}
+
+gboolean
+purple_history_query_load_more(PurpleHistoryQuery *query, GError **error) {
+	GError *local_error = NULL;
+	GList *page = NULL;
+	gchar *next_cursor = NULL;
+	guint position = 0;
+
+	g_return_val_if_fail(PURPLE_IS_HISTORY_QUERY(query), FALSE);
+
+	if(!query->has_more) {
+		return TRUE;
+	}
+
+	page = purple_history_adapter_query_page(query->adapter, query->query,
+	                                         query->cursor, query->page_size,
+	                                         &next_cursor, &local_error);
+	if(local_error != NULL) {
+		g_propagate_error(error, local_error);
+		g_list_free_full(page, g_object_unref);
+
+		return FALSE;
+	}
+
+	g_free(query->cursor);
+	query->cursor = next_cursor;
+
+	position = query->messages->len;
+	while(page != NULL) {
+		g_ptr_array_add(query->messages, page->data);
+		page = g_list_delete_link(page, page);
+	}
+
+	if(query->messages->len > position) {
+		g_list_model_items_changed(G_LIST_MODEL(query), position, 0,
+		                           query->messages->len - position);
+	}
+
+	if(query->cursor == NULL) {
+		query->has_more = FALSE;
+		g_object_notify_by_pspec(G_OBJECT(query), properties[PROP_HAS_MORE]);
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,129 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#if !defined(PURPLE_GLOBAL_HEADER_INSIDE) && !defined(PURPLE_COMPILATION)
+# error "only <purple.h> may be included directly"
+#endif
+
+#ifndef PURPLE_HISTORY_QUERY_H
+#define PURPLE_HISTORY_QUERY_H
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include <purplehistoryadapter.h>
+
+G_BEGIN_DECLS
+
+#define PURPLE_TYPE_HISTORY_QUERY (purple_history_query_get_type())
+G_DECLARE_FINAL_TYPE(PurpleHistoryQuery, purple_history_query, PURPLE,
+                     HISTORY_QUERY, GObject)
+
+/**
+ * PurpleHistoryQuery:
+ *
+ * #PurpleHistoryQuery is a #GListModel of the #PurpleMessage's that match a
+ * query against a #PurpleHistoryAdapter.
+ *
+ * The model starts out empty and is filled one page at a time by
+ * purple_history_query_load_more(), which makes it suitable for views that
+ * load more history as the user scrolls.
+ *
+ * Since: 3.0.0
+ */
+
+/**
+ * purple_history_query_new:
+ * @adapter: The #PurpleHistoryAdapter to query.
+ * @query: The query to run.
+ * @page_size: The number of messages to load at a time.
+ *
+ * Creates a new #PurpleHistoryQuery for @query against @adapter. No messages
+ * are loaded until purple_history_query_load_more() is called.
+ *
+ * Returns: (transfer full): The new instance.
+ *
+ * Since: 3.0.0
+ */
+PurpleHistoryQuery *purple_history_query_new(PurpleHistoryAdapter *adapter, const gchar *query, guint page_size);
+
+/**
+ * purple_history_query_get_adapter:
+ * @query: The instance.
+ *
+ * Gets the #PurpleHistoryAdapter that @query runs against.
+ *
+ * Returns: (transfer none): The adapter.
+ *
+ * Since: 3.0.0
+ */
+PurpleHistoryAdapter *purple_history_query_get_adapter(PurpleHistoryQuery *query);
+
+/**
+ * purple_history_query_get_query:
+ * @query: The instance.
+ *
+ * Gets the query string of @query.
+ *
+ * Returns: The query string.
+ *
+ * Since: 3.0.0
+ */
+const gchar *purple_history_query_get_query(PurpleHistoryQuery *query);
+
+/**
+ * purple_history_query_get_page_size:
+ * @query: The instance.
+ *
+ * Gets the number of messages that @query loads at a time.
+ *
+ * Returns: The page size.
+ *
+ * Since: 3.0.0
+ */
+guint purple_history_query_get_page_size(PurpleHistoryQuery *query);
+
+/**
+ * purple_history_query_get_has_more:
+ * @query: The instance.
+ *
+ * Gets whether or not there may be more messages to load.
+ *
+ * Returns: %TRUE if purple_history_query_load_more() may add more messages,
+ *          otherwise %FALSE.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_history_query_get_has_more(PurpleHistoryQuery *query);
+
+/**
+ * purple_history_query_load_more:
+ * @query: The instance.
+ * @error: (nullable): A return address for a #GError.
+ *
+ * Loads the next page of messages and appends them to @query.
+ *
+ * Returns: %TRUE on success, otherwise %FALSE with @error set.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_history_query_load_more(PurpleHistoryQuery *query, GError **error);
+
+G_END_DECLS
+
+#endif /* PURPLE_HISTORY_QUERY_H */
@@ -31,17 +31,23 @@ struct _PurpleMessage {
 	GObject parent;
 
 	gchar *id;
-	gchar *author;
+	GRefString *author;
 	gchar *author_name_color;
-	gchar *author_alias;
-	gchar *recipient;
+	GRefString *author_alias;
+	GRefString *recipient;
 
 	gchar *contents;
 	PurpleMessageContentType content_type;
 
-	GDateTime *timestamp;
+	/* The timestamp is kept as microseconds since the epoch and the
+	 * GDateTime is only created when someone asks for it.
+	 */
+	gint64 timestamp;
+	GDateTime *timestamp_dt;
+	gboolean has_timestamp;
 	PurpleMessageFlags flags;
 
+	/* Created when the first attachment is added. */
 	GHashTable *attachments;
 };
 
@@ -65,6 +71,26 @@ G_DEFINE_TYPE(PurpleMessage, purple_message, G_TYPE_OBJECT)
 /******************************************************************************
  * Helpers
  *****************************************************************************/
+static GHashTable *
+purple_message_ensure_attachments(PurpleMessage *message) {
+	if(message->attachments == NULL) {
+		message->attachments = g_hash_table_new_full(g_int64_hash,
+		                                             g_int64_equal, NULL,
+		                                             g_object_unref);
+	}
+
+	return message->attachments;
+}
+
+static void
+purple_message_set_timestamp_usec_internal(PurpleMessage *message,
+                                           gint64 timestamp)
+{
+	g_clear_pointer(&message->timestamp_dt, g_date_time_unref);
+	message->timestamp = timestamp;
+	message->has_timestamp = TRUE;
+}
+
 static void
 purple_message_set_id(PurpleMessage *message, const gchar *id) {
 	g_free(message->id);
@@ -75,8 +101,7 @@ purple_message_set_id(PurpleMessage *message, const gchar *id) {
 
 static void
 purple_message_set_author(PurpleMessage *message, const gchar *author) {
-	g_free(message->author);
-	message->author = g_strdup(author);
+	purple_str_intern_set(&message->author, author);
 
 	g_object_notify_by_pspec(G_OBJECT(message), properties[PROP_AUTHOR]);
 }
@@ -171,24 +196,20 @@ purple_message_finalize(GObject *obj) {
 	PurpleMessage *message = PURPLE_MESSAGE(obj);
 
 	g_free(message->id);
-	g_free(message->author);
-	g_free(message->author_alias);
-	g_free(message->recipient);
+	g_clear_pointer(&message->author, g_ref_string_release);
+	g_free(message->author_name_color);
+	g_clear_pointer(&message->author_alias, g_ref_string_release);
+	g_clear_pointer(&message->recipient, g_ref_string_release);
 	g_free(message->contents);
 
-	if(message->timestamp != NULL) {
-		g_date_time_unref(message->timestamp);
-	}
-
-	g_hash_table_destroy(message->attachments);
+	g_clear_pointer(&message->timestamp_dt, g_date_time_unref);
+	g_clear_pointer(&message->attachments, g_hash_table_destroy);
 
 	G_OBJECT_CLASS(purple_message_parent_class)->finalize(obj);
 }
 
 static void
 purple_message_init(PurpleMessage *message) {
-	message->attachments = g_hash_table_new_full(g_int64_hash, g_int64_equal,
-	                                             NULL, g_object_unref);
 }
 
 static void
@@ -323,83 +344,74 @@ purple_message_class_init(PurpleMessageClass *klass) {
  * Public API
  *****************************************************************************/
 PurpleMessage *
-purple_message_new_outgoing(const gchar *author, const gchar *recipient,
-                            const gchar *contents, PurpleMessageFlags flags)
+purple_message_new_full(const gchar *id, const gchar *author,
+                        const gchar *author_alias, const gchar *recipient,
+                        const gchar *contents,
+                        PurpleMessageContentType content_type,
+                        gint64 timestamp, PurpleMessageFlags flags)
 {
 	PurpleMessage *message = NULL;
-	GDateTime *dt = NULL;
 
+	message = g_object_new(PURPLE_TYPE_MESSAGE, NULL);
+
+	/* Nothing can be listening yet, so set the fields directly rather than
+	 * going through the properties and their notifications.
+	 */
+	message->id = g_strdup(id);
+	purple_str_intern_set(&message->author, author);
+	purple_str_intern_set(&message->author_alias, author_alias);
+	purple_str_intern_set(&message->recipient, recipient);
+	message->contents = g_strdup(contents);
+	message->content_type = content_type;
+	message->flags = flags;
+
+	if(timestamp == 0) {
+		timestamp = g_get_real_time();
+	}
+	purple_message_set_timestamp_usec_internal(message, timestamp);
+
+	return message;
+}
+
+PurpleMessage *
+purple_message_new_outgoing(const gchar *author, const gchar *recipient,
+                            const gchar *contents, PurpleMessageFlags flags)
+{
 	g_warn_if_fail(!(flags & PURPLE_MESSAGE_RECV));
 	g_warn_if_fail(!(flags & PURPLE_MESSAGE_SYSTEM));
 
 	flags |= PURPLE_MESSAGE_SEND;
-	dt = g_date_time_new_now_local();
 
 	/* who may be NULL for outgoing MUC messages */
-	message = PURPLE_MESSAGE(g_object_new(PURPLE_TYPE_MESSAGE,
-		"author", author,
-		"recipient", recipient,
-		"contents", contents,
-		"timestamp", dt,
-		"flags", flags,
-		NULL));
-
-	g_date_time_unref(dt);
-
-	return message;
+	return purple_message_new_full(NULL, author, NULL, recipient, contents,
+	                               PURPLE_MESSAGE_CONTENT_TYPE_PLAIN, 0,
+	                               flags);
 }
 
 PurpleMessage *
 purple_message_new_incoming(const gchar *who, const gchar *contents,
                             PurpleMessageFlags flags, guint64 timestamp)
 {
-	PurpleMessage *message = NULL;
-	GDateTime *dt = NULL;
-
 	g_warn_if_fail(!(flags & PURPLE_MESSAGE_SEND));
 	g_warn_if_fail(!(flags & PURPLE_MESSAGE_SYSTEM));
 
 	flags |= PURPLE_MESSAGE_RECV;
 
-	if(timestamp == 0) {
-		dt = g_date_time_new_now_local();
-	} else {
-		dt = g_date_time_new_from_unix_local((gint64)timestamp);
-	}
-
-	message = PURPLE_MESSAGE(g_object_new(PURPLE_TYPE_MESSAGE,
-		"author", who,
-		"author-alias", who,
-		"contents", contents,
-		"timestamp", dt,
-		"flags", flags,
-		NULL));
-
-	g_date_time_unref(dt);
-
-	return message;
+	return purple_message_new_full(NULL, who, who, NULL, contents,
+	                               PURPLE_MESSAGE_CONTENT_TYPE_PLAIN,
+	                               (gint64)timestamp * G_USEC_PER_SEC, flags);
 }
 
 PurpleMessage *
 purple_message_new_system(const gchar *contents, PurpleMessageFlags flags) {
-	PurpleMessage *message = NULL;
-	GDateTime *dt = NULL;
-
 	g_warn_if_fail(!(flags & PURPLE_MESSAGE_SEND));
 	g_warn_if_fail(!(flags & PURPLE_MESSAGE_RECV));
 
 	flags |= PURPLE_MESSAGE_SYSTEM;
-	dt = g_date_time_new_now_local();
-
-	message = PURPLE_MESSAGE(g_object_new(PURPLE_TYPE_MESSAGE,
-		"contents", contents,
-		"timestamp", dt,
-		"flags", flags,
-		NULL));
 
-	g_date_time_unref(dt);
-
-	return message;
+	return purple_message_new_full(NULL, NULL, NULL, NULL, contents,
+	                               PURPLE_MESSAGE_CONTENT_TYPE_PLAIN, 0,
+	                               flags);
 }
 
 const gchar *
@@ -409,6 +421,18 @@ purple_message_get_id(PurpleMessage *message) {
 	return message->id;
 }
 
+void
+purple_message_ensure_id(PurpleMessage *message) {
+	g_return_if_fail(PURPLE_IS_MESSAGE(message));
+
+	if(message->id == NULL) {
+		gchar *id = g_uuid_string_random();
+
+		purple_message_set_id(message, id);
+		g_free(id);
+	}
+}
+
 const gchar *
 purple_message_get_author(PurpleMessage *message) {
 	g_return_val_if_fail(PURPLE_IS_MESSAGE(message), NULL);
@@ -440,8 +464,7 @@ void
 purple_message_set_recipient(PurpleMessage *message, const gchar *recipient) {
 	g_return_if_fail(PURPLE_IS_MESSAGE(message));
 
-	g_free(message->recipient);
-	message->recipient = g_strdup(recipient);
+	purple_str_intern_set(&message->recipient, recipient);
 
 	g_object_notify_by_pspec(G_OBJECT(message), properties[PROP_RECIPIENT]);
 }
@@ -459,8 +482,7 @@ purple_message_set_author_alias(PurpleMessage *message,
 {
 	g_return_if_fail(PURPLE_IS_MESSAGE(message));
 
-	g_free(message->author_alias);
-	message->author_alias = g_strdup(author_alias);
+	purple_str_intern_set(&message->author_alias, author_alias);
 
 	g_object_notify_by_pspec(G_OBJECT(message), properties[PROP_AUTHOR_ALIAS]);
 }
@@ -520,9 +542,17 @@ void
 purple_message_set_timestamp(PurpleMessage *message, GDateTime *timestamp) {
 	g_return_if_fail(PURPLE_IS_MESSAGE(message));
 
-	g_clear_pointer(&message->timestamp, g_date_time_unref);
+	g_clear_pointer(&message->timestamp_dt, g_date_time_unref);
+	message->has_timestamp = FALSE;
+
 	if(timestamp != NULL) {
-		message->timestamp = g_date_time_ref(timestamp);
+		gint64 usec = g_date_time_to_unix(timestamp) * G_USEC_PER_SEC;
+
+		usec += g_date_time_get_microsecond(timestamp);
+		purple_message_set_timestamp_usec_internal(message, usec);
+
+		/* We already have the GDateTime, so keep it around. */
+		message->timestamp_dt = g_date_time_ref(timestamp);
 	}
 
 	g_object_notify_by_pspec(G_OBJECT(message), properties[PROP_TIMESTAMP]);
@@ -532,10 +562,47 @@ GDateTime *
 purple_message_get_timestamp(PurpleMessage *message) {
 	g_return_val_if_fail(PURPLE_IS_MESSAGE(message), 0);
 
-	if(message->timestamp == NULL) {
-		GDateTime *dt = g_date_time_new_now_local();
-		purple_message_set_timestamp(message, dt);
-		g_date_time_unref(dt);
+	if(message->timestamp_dt == NULL) {
+		gint64 usec = purple_message_get_timestamp_usec(message);
+		gint64 seconds = usec / G_USEC_PER_SEC;
+		gint64 remainder = usec % G_USEC_PER_SEC;
+		GDateTime *dt = NULL;
+
+		/* Round towards negative infinity for times before the epoch. */
+		if(remainder < 0) {
+			seconds--;
+			remainder += G_USEC_PER_SEC;
+		}
+
+		dt = g_date_time_new_from_unix_local(seconds);
+		if(remainder != 0) {
+			GDateTime *tmp = dt;
+
+			dt = g_date_time_add(tmp, remainder);
+			g_date_time_unref(tmp);
+		}
+
+		message->timestamp_dt = dt;
+	}
+
+	return message->timestamp_dt;
+}
+
+void
+purple_message_set_timestamp_usec(PurpleMessage *message, gint64 timestamp) {
+	g_return_if_fail(PURPLE_IS_MESSAGE(message));
+
+	purple_message_set_timestamp_usec_internal(message, timestamp);
+
+	g_object_notify_by_pspec(G_OBJECT(message), properties[PROP_TIMESTAMP]);
+}
+
+gint64
+purple_message_get_timestamp_usec(PurpleMessage *message) {
+	g_return_val_if_fail(PURPLE_IS_MESSAGE(message), 0);
+
+	if(!message->has_timestamp) {
+		purple_message_set_timestamp_usec(message, g_get_real_time());
 	}
 
 	return message->timestamp;
@@ -576,7 +643,7 @@ purple_message_add_attachment(PurpleMessage *message,
 	g_return_val_if_fail(PURPLE_IS_MESSAGE(message), FALSE);
 	g_return_val_if_fail(PURPLE_IS_ATTACHMENT(attachment), FALSE);
 
-	return g_hash_table_insert(message->attachments,
+	return g_hash_table_insert(purple_message_ensure_attachments(message),
 	                           purple_attachment_get_hash_key(attachment),
 	                           g_object_ref(G_OBJECT(attachment)));
 }
@@ -585,6 +652,10 @@ gboolean
 purple_message_remove_attachment(PurpleMessage *message, guint64 id) {
 	g_return_val_if_fail(PURPLE_IS_MESSAGE(message), FALSE);
 
+	if(message->attachments == NULL) {
+		return FALSE;
+	}
+
 	return g_hash_table_remove(message->attachments, &id);
 }
 
@@ -594,6 +665,10 @@ purple_message_get_attachment(PurpleMessage *message, guint64 id) {
 
 	g_return_val_if_fail(PURPLE_IS_MESSAGE(message), NULL);
 
+	if(message->attachments == NULL) {
+		return NULL;
+	}
+
 	attachment = g_hash_table_lookup(message->attachments, &id);
 	if(PURPLE_IS_ATTACHMENT(attachment)) {
 		return PURPLE_ATTACHMENT(g_object_ref(G_OBJECT(attachment)));
@@ -613,6 +688,10 @@ purple_message_foreach_attachment(PurpleMessage *message,
 	g_return_if_fail(PURPLE_IS_MESSAGE(message));
 	g_return_if_fail(func != NULL);
 
+	if(message->attachments == NULL) {
+		return;
+	}
+
 	g_hash_table_iter_init(&iter, message->attachments);
 	while(g_hash_table_iter_next(&iter, NULL, &value)) {
 		func(PURPLE_ATTACHMENT(value), data);
@@ -623,5 +702,7 @@ void
 purple_message_clear_attachments(PurpleMessage *message) {
 	g_return_if_fail(PURPLE_IS_MESSAGE(message));
 
-	g_hash_table_remove_all(message->attachments);
+	if(message->attachments != NULL) {
+		g_hash_table_remove_all(message->attachments);
+	}
 }
@@ -108,6 +108,30 @@ typedef enum /*< prefix=PURPLE_MESSAGE_CONTENT_TYPE,underscore_name=PURPLE_MESSA
 
 G_DECLARE_FINAL_TYPE(PurpleMessage, purple_message, PURPLE, MESSAGE, GObject)
 
+/**
+ * purple_message_new_full:
+ * @id: (nullable): The account specific identifier of the message.
+ * @author: (nullable): The author.
+ * @author_alias: (nullable): The alias of the author.
+ * @recipient: (nullable): The recipient.
+ * @contents: (nullable): The contents.
+ * @content_type: The #PurpleMessageContentType of @contents.
+ * @timestamp: The time of the message in microseconds since the Unix epoch,
+ *             or 0 for the current time.
+ * @flags: The #PurpleMessageFlags.
+ *
+ * Creates a new message with all of its fields set at once.  This is meant for
+ * code that creates a lot of messages, like history adapters, as it avoids
+ * setting each property and emitting its notification separately.
+ *
+ * Unlike the other constructors, no flags are added to @flags.
+ *
+ * Returns: (transfer full): The new #PurpleMessage instance.
+ *
+ * Since: 3.0.0
+ */
+PurpleMessage *purple_message_new_full(const gchar *id, const gchar *author, const gchar *author_alias, const gchar *recipient, const gchar *contents, PurpleMessageContentType content_type, gint64 timestamp, PurpleMessageFlags flags);
+
 /**
  * purple_message_new_outgoing:
  * @author: The author.
@@ -331,12 +355,41 @@ void purple_message_set_timestamp(PurpleMessage *message, GDateTime *timestamp);
  * Returns a @message's timestamp.  If @message does not currently have a
  * timestamp, the current time will be set as the time stamp and returned.
  *
+ * The #GDateTime is created the first time this is called, in the local
+ * timezone unless it was set with purple_message_set_timestamp().
+ *
  * Returns: (transfer none): The #GDateTime timestamp from @message.
  *
  * Since: 3.0.0
  */
 GDateTime *purple_message_get_timestamp(PurpleMessage *message);
 
+/**
+ * purple_message_set_timestamp_usec:
+ * @message: The message.
+ * @timestamp: The time in microseconds since the Unix epoch.
+ *
+ * Sets the timestamp of @message without creating a #GDateTime.
+ *
+ * Since: 3.0.0
+ */
+void purple_message_set_timestamp_usec(PurpleMessage *message, gint64 timestamp);
+
+/**
+ * purple_message_get_timestamp_usec:
+ * @message: The message.
+ *
+ * Gets the timestamp of @message in microseconds since the Unix epoch.  This
+ * is cheaper than purple_message_get_timestamp() as it does not need to
+ * create a #GDateTime.  If @message does not currently have a timestamp, the
+ * current time will be set as the time stamp and returned.
+ *
+ * Returns: The timestamp of @message.
+ *
+ * Since: 3.0.0
+ */
+gint64 purple_message_get_timestamp_usec(PurpleMessage *message);
+
 /**
  * purple_message_format_timestamp:
  * @message: The #PurpleMessage instance.
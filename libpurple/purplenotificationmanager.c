@@ -41,11 +41,27 @@ static guint signals[N_SIGNALS] = { 0, };
 struct _PurpleNotificationManager {
 	GObject parent;
 
+	/* The notifications sorted by their created timestamp. GListStore is
+	 * backed by a balanced tree so inserting into it and getting an item at a
+	 * position are both logarithmic.
+	 */
 	GListStore *notifications;
 
+	/* The set of notifications in the store, so that membership checks don't
+	 * have to walk it.
+	 */
+	GHashTable *members;
+
 	guint unread_count;
 };
 
+typedef gboolean (*PurpleNotificationManagerMatchFunc)(PurpleNotification *notification, gpointer data);
+
+typedef struct {
+	PurpleAccount *account;
+	gboolean all;
+} PurpleNotificationManagerAccountMatch;
+
 G_DEFINE_TYPE(PurpleNotificationManager, purple_notification_manager,
               G_TYPE_OBJECT);
 
@@ -84,6 +100,251 @@ purple_notification_manager_decrement_unread_count(PurpleNotificationManager *ma
 	}
 }
 
+static void purple_notification_manager_notify_cb(GObject *obj, GParamSpec *pspec, gpointer data);
+
+/* Finds the position of notification in the store. Since the store is sorted
+ * this is a binary search followed by a walk over the notifications that were
+ * created at the same time.
+ */
+static gboolean
+purple_notification_manager_find_position(PurpleNotificationManager *manager,
+                                          PurpleNotification *notification,
+                                          guint *position)
+{
+	GListModel *model = G_LIST_MODEL(manager->notifications);
+	guint n_items = g_list_model_get_n_items(model);
+	guint low = 0, high = n_items;
+
+	while(low < high) {
+		PurpleNotification *item = NULL;
+		guint middle = low + (high - low) / 2;
+		gint cmp = 0;
+
+		item = g_list_model_get_item(model, middle);
+		cmp = purple_notification_compare(item, notification);
+		g_object_unref(item);
+
+		if(cmp < 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	for(guint i = low; i < n_items; i++) {
+		PurpleNotification *item = NULL;
+		gint cmp = 0;
+
+		item = g_list_model_get_item(model, i);
+		cmp = purple_notification_compare(item, notification);
+		g_object_unref(item);
+
+		if(item == notification) {
+			if(position != NULL) {
+				*position = i;
+			}
+
+			return TRUE;
+		}
+
+		if(cmp != 0) {
+			break;
+		}
+	}
+
+	/* The created timestamp of a notification can be changed after it was
+	 * added, in which case it won't be where we expect it.
+	 */
+	return g_list_store_find(manager->notifications, notification, position);
+}
+
+/* g_ptr_array_sort passes pointers to the elements rather than the elements
+ * themselves.
+ */
+static gint
+purple_notification_manager_compare_indirect(gconstpointer a, gconstpointer b) {
+	return purple_notification_compare(*(PurpleNotification **)a,
+	                                   *(PurpleNotification **)b);
+}
+
+/* Tracks notification as a member of manager, the caller is responsible for
+ * putting it in the store and for the unread count.
+ */
+static void
+purple_notification_manager_track(PurpleNotificationManager *manager,
+                                  PurpleNotification *notification)
+{
+	g_hash_table_add(manager->members, g_object_ref(notification));
+
+	/* Connect to the notify signal for the read property only so we can
+	 * propagate out changes for any notification.
+	 */
+	g_signal_connect_object(notification, "notify::read",
+	                        G_CALLBACK(purple_notification_manager_notify_cb),
+	                        manager, 0);
+}
+
+static void
+purple_notification_manager_untrack(PurpleNotificationManager *manager,
+                                    PurpleNotification *notification)
+{
+	/* Remove the notify signal handler for the read state incase someone
+	 * else added a reference to the notification which would then mess
+	 * with our unread count accounting.
+	 */
+	g_signal_handlers_disconnect_by_func(notification,
+	                                     G_CALLBACK(purple_notification_manager_notify_cb),
+	                                     manager);
+
+	g_hash_table_remove(manager->members, notification);
+}
+
+/* Returns the position where notification would be inserted into the store,
+ * which is after any notifications that compare equal to it.
+ */
+static guint
+purple_notification_manager_find_insert_position(PurpleNotificationManager *manager,
+                                                 PurpleNotification *notification)
+{
+	GListModel *model = G_LIST_MODEL(manager->notifications);
+	guint low = 0, high = g_list_model_get_n_items(model);
+
+	while(low < high) {
+		PurpleNotification *item = NULL;
+		guint middle = low + (high - low) / 2;
+		gint cmp = 0;
+
+		item = g_list_model_get_item(model, middle);
+		cmp = purple_notification_compare(item, notification);
+		g_object_unref(item);
+
+		if(cmp <= 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+static gint
+purple_notification_manager_compare_positions(gconstpointer a, gconstpointer b)
+{
+	guint position_a = *(const guint *)a;
+	guint position_b = *(const guint *)b;
+
+	return (position_a > position_b) - (position_a < position_b);
+}
+
+/* Removes the notifications at positions from the store. Every run of
+ * adjacent positions is removed with a single splice, starting from the end
+ * so that the positions of the remaining runs stay valid.
+ */
+static void
+purple_notification_manager_remove_positions(PurpleNotificationManager *manager,
+                                             GArray *positions)
+{
+	GListModel *model = G_LIST_MODEL(manager->notifications);
+	GPtrArray *removed = NULL;
+	guint unread_count = manager->unread_count;
+	guint end = 0;
+
+	if(positions->len == 0) {
+		return;
+	}
+
+	g_array_sort(positions, purple_notification_manager_compare_positions);
+
+	removed = g_ptr_array_new_full(positions->len, g_object_unref);
+	for(guint i = 0; i < positions->len; i++) {
+		PurpleNotification *notification = NULL;
+
+		notification = g_list_model_get_item(model,
+		                                     g_array_index(positions, guint, i));
+		purple_notification_manager_untrack(manager, notification);
+
+		if(!purple_notification_get_read(notification) && unread_count > 0) {
+			unread_count--;
+		}
+
+		g_ptr_array_add(removed, notification);
+	}
+
+	end = positions->len;
+	while(end > 0) {
+		guint start = end - 1;
+		guint first = g_array_index(positions, guint, start);
+
+		while(start > 0 &&
+		      g_array_index(positions, guint, start - 1) == first - 1)
+		{
+			start--;
+			first--;
+		}
+
+		g_list_store_splice(manager->notifications, first, end - start, NULL,
+		                    0);
+
+		end = start;
+	}
+
+	purple_notification_manager_set_unread_count(manager, unread_count);
+
+	for(guint i = 0; i < removed->len; i++) {
+		g_signal_emit(G_OBJECT(manager), signals[SIG_REMOVED], 0,
+		              g_ptr_array_index(removed, i));
+	}
+
+	g_ptr_array_free(removed, TRUE);
+}
+
+/* Removes every notification that func returns TRUE for. */
+static void
+purple_notification_manager_remove_matching(PurpleNotificationManager *manager,
+                                            PurpleNotificationManagerMatchFunc func,
+                                            gpointer data)
+{
+	GListModel *model = G_LIST_MODEL(manager->notifications);
+	GArray *positions = NULL;
+	guint n_items = 0;
+
+	n_items = g_list_model_get_n_items(model);
+	positions = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	for(guint i = 0; i < n_items; i++) {
+		PurpleNotification *notification = g_list_model_get_item(model, i);
+
+		if(func(notification, data)) {
+			g_array_append_val(positions, i);
+		}
+
+		g_object_unref(notification);
+	}
+
+	purple_notification_manager_remove_positions(manager, positions);
+
+	g_array_free(positions, TRUE);
+}
+
+static gboolean
+purple_notification_manager_match_account(PurpleNotification *notification,
+                                          gpointer data)
+{
+	PurpleNotificationManagerAccountMatch *match = data;
+	PurpleNotificationType type;
+
+	/* If the notification's type is connection error, only remove it when
+	 * all was set.
+	 */
+	type = purple_notification_get_notification_type(notification);
+	if(type == PURPLE_NOTIFICATION_TYPE_CONNECTION_ERROR && !match->all) {
+		return FALSE;
+	}
+
+	return purple_notification_get_account(notification) == match->account;
+}
+
 /******************************************************************************
  * Callbacks
  *****************************************************************************/
@@ -140,6 +401,7 @@ purple_notification_manager_finalize(GObject *obj) {
 	manager = PURPLE_NOTIFICATION_MANAGER(obj);
 
 	g_clear_object(&manager->notifications);
+	g_clear_pointer(&manager->members, g_hash_table_destroy);
 
 	G_OBJECT_CLASS(purple_notification_manager_parent_class)->finalize(obj);
 }
@@ -147,6 +409,8 @@ purple_notification_manager_finalize(GObject *obj) {
 static void
 purple_notification_manager_init(PurpleNotificationManager *manager) {
 	manager->notifications = g_list_store_new(PURPLE_TYPE_NOTIFICATION);
+	manager->members = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	                                         g_object_unref, NULL);
 }
 
 static void
@@ -290,7 +554,7 @@ purple_notification_manager_add(PurpleNotificationManager *manager,
 	g_return_if_fail(PURPLE_IS_NOTIFICATION_MANAGER(manager));
 	g_return_if_fail(PURPLE_IS_NOTIFICATION(notification));
 
-	if(g_list_store_find(manager->notifications, notification, NULL)) {
+	if(g_hash_table_contains(manager->members, notification)) {
 		const gchar *id = purple_notification_get_id(notification);
 
 		g_warning("double add detected for notification %s", id);
@@ -298,17 +562,12 @@ purple_notification_manager_add(PurpleNotificationManager *manager,
 		return;
 	}
 
+	purple_notification_manager_track(manager, notification);
+
 	g_list_store_insert_sorted(manager->notifications, notification,
 	                           (GCompareDataFunc)purple_notification_compare,
 	                           NULL);
 
-	/* Connect to the notify signal for the read property only so we can
-	 * propagate out changes for any notification.
-	 */
-	g_signal_connect_object(notification, "notify::read",
-	                        G_CALLBACK(purple_notification_manager_notify_cb),
-	                        manager, 0);
-
 	/* If the notification is not read, we need to increment the unread count.
 	 */
 	if(!purple_notification_get_read(notification)) {
@@ -327,19 +586,19 @@ purple_notification_manager_remove(PurpleNotificationManager *manager,
 	g_return_if_fail(PURPLE_IS_NOTIFICATION_MANAGER(manager));
 	g_return_if_fail(PURPLE_IS_NOTIFICATION(notification));
 
-	if(g_list_store_find(manager->notifications, notification, &position)) {
+	if(!g_hash_table_contains(manager->members, notification)) {
+		return;
+	}
+
+	if(purple_notification_manager_find_position(manager, notification,
+	                                             &position))
+	{
 		/* Reference the notification so we can emit the signal after it's been
 		 * removed from the hash table.
 		 */
 		g_object_ref(notification);
 
-		/* Remove the notify signal handler for the read state incase someone
-		 * else added a reference to the notification which would then mess
-		 * with our unread count accounting.
-		 */
-		g_signal_handlers_disconnect_by_func(notification,
-		                                     G_CALLBACK(purple_notification_manager_notify_cb),
-		                                     manager);
+		purple_notification_manager_untrack(manager, notification);
 
 		/* If the notification is not read, we need to decrement the unread
 		 * count.
@@ -357,105 +616,146 @@ purple_notification_manager_remove(PurpleNotificationManager *manager,
 	}
 }
 
-/*
-This function uses the following algorithm to optimally remove items from the
-GListStore. See the psuedo code below for an easier to follow version.
-
-A
-A B C
-B C
-A A B C
-B A C
-B A A C
-B C A
-B C A A
-
-set len = number_of_items
-set pos = 0
-set have_same = false
-while pos < len
-  check item at pos
-    if same
-      if not have_same
-        reset count = 0
-        set start = pos
-        set have_same = TRUE
-
-      set count = count + 1
-    else
-      if have_same
-        remove count items from start
-        set pos = pos - count
-        set len = len - count
-        set have_same = FALSE
-  set pos = pos + 1
-if have_same
-  remove count items from start
-*/
 void
-purple_notification_manager_remove_with_account(PurpleNotificationManager *manager,
-                                                PurpleAccount *account,
-                                                gboolean all)
+purple_notification_manager_add_many(PurpleNotificationManager *manager,
+                                     GList *notifications)
 {
-	guint pos = 0, len = 0;
-	guint start = 0, count = 0;
-	gboolean have_same = FALSE;
+	GPtrArray *added = NULL;
+	GArray *positions = NULL;
+	guint unread_count = 0;
+	guint end = 0;
 
 	g_return_if_fail(PURPLE_IS_NOTIFICATION_MANAGER(manager));
-	g_return_if_fail(PURPLE_IS_ACCOUNT(account));
 
-	len = g_list_model_get_n_items(G_LIST_MODEL(manager->notifications));
-	for(pos = 0; pos < len; pos++) {
-		PurpleAccount *account2 = NULL;
-		PurpleNotification *notification = NULL;
-		PurpleNotificationType type;
-		gboolean can_remove = TRUE;
+	added = g_ptr_array_new();
+	for(GList *l = notifications; l != NULL; l = l->next) {
+		PurpleNotification *notification = l->data;
 
-		notification = g_list_model_get_item(G_LIST_MODEL(manager->notifications),
-		                                     pos);
+		if(!PURPLE_IS_NOTIFICATION(notification)) {
+			continue;
+		}
 
-		/* If the notification's type is connection error, set can_remove to
-		 * the value of the all parameter.
-		 */
-		type = purple_notification_get_notification_type(notification);
-		if(type == PURPLE_NOTIFICATION_TYPE_CONNECTION_ERROR) {
-			can_remove = all;
+		if(g_hash_table_contains(manager->members, notification)) {
+			const gchar *id = purple_notification_get_id(notification);
+
+			g_warning("double add detected for notification %s", id);
+
+			continue;
 		}
 
-		account2 = purple_notification_get_account(notification);
-		if(account == account2 && can_remove) {
-			/* If this is the first item with the right account store its
-			 * position.
-			 */
-			if(!have_same) {
-				count = 0;
-				start = pos;
-				have_same = TRUE;
-			}
+		purple_notification_manager_track(manager, notification);
+		g_ptr_array_add(added, notification);
+	}
 
-			/* Increment the count of items starting at the start position. */
-			count++;
-		} else {
-			if(have_same) {
-				/* Remove the run of items from the list. */
-				g_list_store_splice(manager->notifications, start, count, NULL,
-				                    0);
+	if(added->len == 0) {
+		g_ptr_array_free(added, TRUE);
 
-				/* Adjust pos and len for the items that we removed. */
-				pos = pos - count;
-				len = len - count;
+		return;
+	}
 
-				have_same = FALSE;
-			}
+	g_ptr_array_sort(added, purple_notification_manager_compare_indirect);
+
+	/* Find where each of the new notifications goes in the store as it is
+	 * now. Since they are sorted, the ones that go into the same place are
+	 * next to each other and can be inserted with a single splice. Starting
+	 * from the end keeps the positions of the earlier ones valid.
+	 */
+	positions = g_array_sized_new(FALSE, FALSE, sizeof(guint), added->len);
+	for(guint i = 0; i < added->len; i++) {
+		guint position = 0;
+
+		position = purple_notification_manager_find_insert_position(manager,
+		                                                            added->pdata[i]);
+		g_array_append_val(positions, position);
+	}
+
+	end = added->len;
+	while(end > 0) {
+		guint start = end - 1;
+		guint position = g_array_index(positions, guint, start);
+
+		while(start > 0 &&
+		      g_array_index(positions, guint, start - 1) == position)
+		{
+			start--;
 		}
 
-		g_clear_object(&notification);
+		g_list_store_splice(manager->notifications, position, 0,
+		                    added->pdata + start, end - start);
+
+		end = start;
+	}
+
+	g_array_free(positions, TRUE);
+
+	unread_count = manager->unread_count;
+	for(guint i = 0; i < added->len; i++) {
+		if(!purple_notification_get_read(added->pdata[i]) &&
+		   unread_count < G_MAXUINT)
+		{
+			unread_count++;
+		}
 	}
+	purple_notification_manager_set_unread_count(manager, unread_count);
 
-	/* Clean up the last bit if the last item needs to be removed. */
-	if(have_same) {
-		g_list_store_splice(manager->notifications, start, count, NULL, 0);
+	for(guint i = 0; i < added->len; i++) {
+		g_signal_emit(G_OBJECT(manager), signals[SIG_ADDED], 0,
+		              added->pdata[i]);
 	}
+
+	g_ptr_array_free(added, TRUE);
+}
+
+void
+purple_notification_manager_remove_many(PurpleNotificationManager *manager,
+                                        GList *notifications)
+{
+	GHashTable *seen = NULL;
+	GArray *positions = NULL;
+
+	g_return_if_fail(PURPLE_IS_NOTIFICATION_MANAGER(manager));
+
+	/* Look up each notification instead of walking the whole store. */
+	seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+	positions = g_array_new(FALSE, FALSE, sizeof(guint));
+	for(GList *l = notifications; l != NULL; l = l->next) {
+		guint position = 0;
+
+		if(!g_hash_table_contains(manager->members, l->data) ||
+		   !g_hash_table_add(seen, l->data))
+		{
+			continue;
+		}
+
+		if(purple_notification_manager_find_position(manager, l->data,
+		                                             &position))
+		{
+			g_array_append_val(positions, position);
+		}
+	}
+
+	purple_notification_manager_remove_positions(manager, positions);
+
+	g_array_free(positions, TRUE);
+	g_hash_table_destroy(seen);
+}
+
+void
+purple_notification_manager_remove_with_account(PurpleNotificationManager *manager,
+                                                PurpleAccount *account,
+                                                gboolean all)
+{
+	PurpleNotificationManagerAccountMatch match = {
+		.account = account,
+		.all = all,
+	};
+
+	g_return_if_fail(PURPLE_IS_NOTIFICATION_MANAGER(manager));
+	g_return_if_fail(PURPLE_IS_ACCOUNT(account));
+
+	purple_notification_manager_remove_matching(manager,
+	                                            purple_notification_manager_match_account,
+	                                            &match);
 }
 
 guint
@@ -77,6 +77,37 @@ void purple_notification_manager_add(PurpleNotificationManager *manager, PurpleN
  */
 void purple_notification_manager_remove(PurpleNotificationManager *manager, PurpleNotification *notification);
 
+/**
+ * purple_notification_manager_add_many:
+ * @manager: The instance.
+ * @notifications: (element-type PurpleNotification) (transfer none): The
+ *                 notifications to add.
+ *
+ * Adds all of @notifications to @manager. This is the same as calling
+ * [method@NotificationManager.add] for each of them, except that the model
+ * from [method@NotificationManager.get_model] only emits a single
+ * [signal@Gio.ListModel::items-changed] signal for each place where
+ * notifications are inserted.
+ *
+ * Since: 3.0.0
+ */
+void purple_notification_manager_add_many(PurpleNotificationManager *manager, GList *notifications);
+
+/**
+ * purple_notification_manager_remove_many:
+ * @manager: The instance.
+ * @notifications: (element-type PurpleNotification) (transfer none): The
+ *                 notifications to remove.
+ *
+ * Removes all of @notifications from @manager. Like
+ * [method@NotificationManager.add_many], the model only emits a single
+ * [signal@Gio.ListModel::items-changed] signal for each run of adjacent
+ * notifications that are removed.
+ *
+ * Since: 3.0.0
+ */
+void purple_notification_manager_remove_many(PurpleNotificationManager *manager, GList *notifications);
+
 /**
  * purple_notification_manager_remove_with_account:
  * @manager: The instance.
@@ -90,6 +121,9 @@ void purple_notification_manager_remove(PurpleNotificationManager *manager, Purp
  * treated differently from other notifications tied to accounts, as those are
  * transient and depend on the account being connected to be valid.
  *
+ * Each run of adjacent notifications is removed with a single change to the
+ * model.
+ *
  * Since: 3.0.0
  */
 void purple_notification_manager_remove_with_account(PurpleNotificationManager *manager, PurpleAccount *account, gboolean all);
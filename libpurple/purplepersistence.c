@@ -0,0 +1,960 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include "purpleprivate.h"
+
+#include "debug.h"
+#include "purplepath.h"
+#include "util.h"
+
+/* How long to wait for more changes before saving, in seconds. */
+#define PURPLE_PERSISTENCE_DELAY (5)
+
+#define PURPLE_PERSISTENCE_CACHE_MAGIC "PURPLEXC"
+#define PURPLE_PERSISTENCE_CACHE_VERSION (3)
+
+/* The attribute of the root node that holds the generation of a file that
+ * has a cache, and how much of the start of the file is searched for it.
+ */
+#define PURPLE_PERSISTENCE_GENERATION "cache-generation"
+#define PURPLE_PERSISTENCE_GENERATION_HEAD (1024)
+
+/* The length that marks a NULL string in the cache. */
+#define PURPLE_PERSISTENCE_CACHE_NULL (G_MAXUINT32)
+
+/* A job is either a snapshot to write out, or data to append to the end of a
+ * journal when node is NULL.  When cache_only is set, the file was just read
+ * and only payload, the cache that was encoded from it, is written.
+ */
+typedef struct {
+	gchar *filename;
+	PurpleXmlNode *node;
+	GByteArray *payload;
+	gchar *data;
+	gchar *journal;
+	gboolean cache;
+	gboolean cache_only;
+	guint64 generation;
+	gint64 snapshot_time;
+} PurplePersistenceJob;
+
+/* The cache of a file is its tree in a binary form that is read without
+ * having to parse any XML.  It starts with this header, where every integer
+ * is little endian, followed by the records for the root node.
+ *
+ * A tag record is 'T' followed by its name, namespace and prefix, then the
+ * records of its children and finally 'E'.  An attribute record is 'A'
+ * followed by its name, namespace, prefix and value, and a data record is 'D'
+ * followed by the data.  Strings are a 32 bit length followed by that many
+ * bytes and a nul, so they are passed straight out of the mapped file to the
+ * xmlnode functions, which make the only copy of them.
+ *
+ * Every time a file with a cache is saved, the writer stores a new generation
+ * on its root node and in the header of the cache.  The modification time
+ * alone isn't precise enough to tell apart saves made in the same second, and
+ * the generation is found at the start of the file without reading all of
+ * it.  The size and modification time are kept as well, to catch the file
+ * being edited by hand.
+ */
+typedef struct {
+	gchar magic[8];
+	guint32 version;
+	guint32 reserved;
+	guint64 generation;
+	gint64 xml_mtime;
+	guint64 xml_size;
+	guint64 payload_size;
+	guint8 checksum[16];
+} PurplePersistenceCacheHeader;
+
+G_STATIC_ASSERT(sizeof(PurplePersistenceCacheHeader) == 64);
+
+typedef enum {
+	PURPLE_PERSISTENCE_CACHE_TAG = 'T',
+	PURPLE_PERSISTENCE_CACHE_ATTRIB = 'A',
+	PURPLE_PERSISTENCE_CACHE_DATA = 'D',
+	PURPLE_PERSISTENCE_CACHE_END = 'E',
+} PurplePersistenceCacheRecord;
+
+typedef struct {
+	const guint8 *data;
+	gsize length;
+	gsize offset;
+} PurplePersistenceCacheReader;
+
+/* filename => PurplePersistenceSnapshotFunc for every file with unsaved
+ * changes.
+ */
+static GHashTable *dirty = NULL;
+static guint save_timer = 0;
+
+/* filename => the name of the journal that a snapshot of it replaces. */
+static GHashTable *journals = NULL;
+
+/* The filenames that were read through purple_persistence_read() and get a
+ * cache when they are saved.
+ */
+static GHashTable *cached = NULL;
+
+/* A single thread does the writing so that writes of the same file happen in
+ * the order that they were snapshotted.
+ */
+static GThreadPool *pool = NULL;
+
+static GMutex pending_lock;
+static GCond pending_cond;
+static guint pending = 0;
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static void
+purple_persistence_job_free(PurplePersistenceJob *job) {
+	g_free(job->filename);
+	g_clear_pointer(&job->node, purple_xmlnode_free);
+	if(job->payload != NULL) {
+		g_byte_array_free(job->payload, TRUE);
+	}
+	g_free(job->data);
+	g_free(job->journal);
+	g_free(job);
+}
+
+/* Runs on the worker thread. */
+static void
+purple_persistence_append_data(PurplePersistenceJob *job) {
+	FILE *fp = NULL;
+	gchar *path = NULL;
+	gboolean written = FALSE;
+
+	path = g_build_filename(purple_config_dir(), job->filename, NULL);
+
+	fp = g_fopen(path, "ab");
+	if(fp != NULL) {
+		gsize length = strlen(job->data);
+
+		written = (fwrite(job->data, 1, length, fp) == length);
+		written = (fclose(fp) == 0) && written;
+	}
+
+	if(!written) {
+		purple_debug_warning("persistence", "failed to append to %s: %s",
+		                     path, g_strerror(errno));
+	}
+
+	g_free(path);
+}
+
+static gchar *
+purple_persistence_cache_filename(const gchar *filename) {
+	return g_strdup_printf("%s.cache", filename);
+}
+
+static void
+purple_persistence_cache_checksum(const guint8 *data, gsize length,
+                                  guint8 digest[16])
+{
+	GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
+	gsize digest_len = 16;
+
+	g_checksum_update(checksum, data, length);
+	g_checksum_get_digest(checksum, digest, &digest_len);
+	g_checksum_free(checksum);
+}
+
+/* Returns a generation that is newer than any other one this process
+ * created.  Only called by the writer, one job at a time.
+ */
+static guint64
+purple_persistence_next_generation(void) {
+	static guint64 last = 0;
+
+	last = MAX((guint64)g_get_real_time(), last + 1);
+
+	return last;
+}
+
+static guint64
+purple_persistence_parse_generation(const gchar *value) {
+	if(value == NULL || !g_ascii_isdigit(*value)) {
+		return 0;
+	}
+
+	return g_ascii_strtoull(value, NULL, 10);
+}
+
+/* Finds the generation on the root node of the file at path by only reading
+ * its start.  Returns 0 if it has none.
+ */
+static guint64
+purple_persistence_read_generation(const gchar *path) {
+	gchar head[PURPLE_PERSISTENCE_GENERATION_HEAD + 1];
+	const gchar *tag = NULL, *end = NULL, *value = NULL;
+	FILE *fp = NULL;
+	gsize length = 0;
+
+	fp = g_fopen(path, "rb");
+	if(fp == NULL) {
+		return 0;
+	}
+
+	length = fread(head, 1, PURPLE_PERSISTENCE_GENERATION_HEAD, fp);
+	fclose(fp);
+	head[length] = '\0';
+
+	/* Skip the XML declaration to get to the start tag of the root. */
+	tag = head;
+	while((tag = strchr(tag, '<')) != NULL &&
+	      (tag[1] == '?' || tag[1] == '!'))
+	{
+		tag++;
+	}
+
+	if(tag == NULL || (end = strchr(tag, '>')) == NULL) {
+		return 0;
+	}
+
+	value = g_strstr_len(tag, end - tag, " " PURPLE_PERSISTENCE_GENERATION "='");
+	if(value == NULL) {
+		return 0;
+	}
+
+	return purple_persistence_parse_generation(value +
+	                                           strlen(" " PURPLE_PERSISTENCE_GENERATION "='"));
+}
+
+static void
+purple_persistence_cache_append_string(GByteArray *buffer, const gchar *str,
+                                       gsize length)
+{
+	guint32 le = GUINT32_TO_LE(PURPLE_PERSISTENCE_CACHE_NULL);
+
+	if(str == NULL) {
+		g_byte_array_append(buffer, (const guint8 *)&le, sizeof(le));
+
+		return;
+	}
+
+	le = GUINT32_TO_LE((guint32)length);
+	g_byte_array_append(buffer, (const guint8 *)&le, sizeof(le));
+	g_byte_array_append(buffer, (const guint8 *)str, length);
+	g_byte_array_append(buffer, (const guint8 *)"", 1);
+}
+
+static void
+purple_persistence_cache_append_record(GByteArray *buffer,
+                                       PurplePersistenceCacheRecord record)
+{
+	guint8 byte = record;
+
+	g_byte_array_append(buffer, &byte, 1);
+}
+
+#define purple_persistence_cache_append_cstring(buffer, str) \
+	purple_persistence_cache_append_string((buffer), (str), \
+	                                       (str) != NULL ? strlen(str) : 0)
+
+static void
+purple_persistence_cache_encode(GByteArray *buffer, PurpleXmlNode *node) {
+	purple_persistence_cache_append_record(buffer,
+	                                       PURPLE_PERSISTENCE_CACHE_TAG);
+	purple_persistence_cache_append_cstring(buffer, node->name);
+	purple_persistence_cache_append_cstring(buffer, node->xmlns);
+	purple_persistence_cache_append_cstring(buffer, node->prefix);
+
+	for(PurpleXmlNode *child = node->child; child != NULL;
+	    child = child->next)
+	{
+		switch(child->type) {
+			case PURPLE_XMLNODE_TYPE_TAG:
+				purple_persistence_cache_encode(buffer, child);
+				break;
+			case PURPLE_XMLNODE_TYPE_ATTRIB:
+				purple_persistence_cache_append_record(buffer,
+				                                       PURPLE_PERSISTENCE_CACHE_ATTRIB);
+				purple_persistence_cache_append_cstring(buffer, child->name);
+				purple_persistence_cache_append_cstring(buffer, child->xmlns);
+				purple_persistence_cache_append_cstring(buffer, child->prefix);
+				purple_persistence_cache_append_cstring(buffer, child->data);
+				break;
+			case PURPLE_XMLNODE_TYPE_DATA:
+				purple_persistence_cache_append_record(buffer,
+				                                       PURPLE_PERSISTENCE_CACHE_DATA);
+				purple_persistence_cache_append_string(buffer, child->data,
+				                                       child->data_sz);
+				break;
+		}
+	}
+
+	purple_persistence_cache_append_record(buffer,
+	                                       PURPLE_PERSISTENCE_CACHE_END);
+}
+
+/* Encodes node after the space for the header, which is filled in when the
+ * cache is written.
+ */
+static GByteArray *
+purple_persistence_cache_new_payload(PurpleXmlNode *node) {
+	PurplePersistenceCacheHeader header;
+	GByteArray *buffer = g_byte_array_new();
+
+	memset(&header, 0, sizeof(header));
+	g_byte_array_append(buffer, (const guint8 *)&header, sizeof(header));
+	purple_persistence_cache_encode(buffer, node);
+
+	return buffer;
+}
+
+static gboolean
+purple_persistence_cache_read_record(PurplePersistenceCacheReader *reader,
+                                     guint8 *record)
+{
+	if(reader->offset >= reader->length) {
+		return FALSE;
+	}
+
+	*record = reader->data[reader->offset++];
+
+	return TRUE;
+}
+
+/* Points str at the next string in the cache, without copying it. */
+static gboolean
+purple_persistence_cache_read_string(PurplePersistenceCacheReader *reader,
+                                     const gchar **str, gsize *length)
+{
+	guint32 le = 0;
+	gsize len = 0;
+
+	if(reader->length - reader->offset < sizeof(le)) {
+		return FALSE;
+	}
+
+	memcpy(&le, reader->data + reader->offset, sizeof(le));
+	reader->offset += sizeof(le);
+
+	len = GUINT32_FROM_LE(le);
+	if(len == PURPLE_PERSISTENCE_CACHE_NULL) {
+		*str = NULL;
+		if(length != NULL) {
+			*length = 0;
+		}
+
+		return TRUE;
+	}
+
+	if(reader->length - reader->offset <= len ||
+	   reader->data[reader->offset + len] != '\0')
+	{
+		return FALSE;
+	}
+
+	*str = (const gchar *)reader->data + reader->offset;
+	if(length != NULL) {
+		*length = len;
+	}
+	reader->offset += len + 1;
+
+	return TRUE;
+}
+
+/* Reads a tag, after its record type, and its children into a new child of
+ * parent, or a new root node when parent is NULL.
+ */
+static PurpleXmlNode *
+purple_persistence_cache_decode(PurplePersistenceCacheReader *reader,
+                                PurpleXmlNode *parent)
+{
+	PurpleXmlNode *node = NULL;
+	const gchar *name = NULL, *xmlns = NULL, *prefix = NULL;
+	guint8 record = 0;
+
+	if(!purple_persistence_cache_read_string(reader, &name, NULL) ||
+	   !purple_persistence_cache_read_string(reader, &xmlns, NULL) ||
+	   !purple_persistence_cache_read_string(reader, &prefix, NULL) ||
+	   name == NULL || *name == '\0')
+	{
+		return NULL;
+	}
+
+	if(parent == NULL) {
+		node = purple_xmlnode_new(name);
+	} else {
+		node = purple_xmlnode_new_child(parent, name);
+	}
+
+	if(xmlns != NULL) {
+		purple_xmlnode_set_namespace(node, xmlns);
+	}
+	if(prefix != NULL) {
+		purple_xmlnode_set_prefix(node, prefix);
+	}
+
+	while(purple_persistence_cache_read_record(reader, &record)) {
+		const gchar *value = NULL;
+		gsize length = 0;
+
+		switch(record) {
+			case PURPLE_PERSISTENCE_CACHE_END:
+				return node;
+
+			case PURPLE_PERSISTENCE_CACHE_TAG:
+				if(purple_persistence_cache_decode(reader, node) == NULL) {
+					goto failed;
+				}
+				break;
+
+			case PURPLE_PERSISTENCE_CACHE_ATTRIB:
+				if(!purple_persistence_cache_read_string(reader, &name, NULL) ||
+				   !purple_persistence_cache_read_string(reader, &xmlns, NULL) ||
+				   !purple_persistence_cache_read_string(reader, &prefix, NULL) ||
+				   !purple_persistence_cache_read_string(reader, &value, NULL) ||
+				   name == NULL || value == NULL)
+				{
+					goto failed;
+				}
+
+				purple_xmlnode_set_attrib_full(node, name, xmlns, prefix,
+				                               value);
+				break;
+
+			case PURPLE_PERSISTENCE_CACHE_DATA:
+				if(!purple_persistence_cache_read_string(reader, &value,
+				                                         &length))
+				{
+					goto failed;
+				}
+
+				if(value != NULL && length > 0) {
+					purple_xmlnode_insert_data(node, value, length);
+				}
+				break;
+
+			default:
+				goto failed;
+		}
+	}
+
+failed:
+	/* Children are freed along with the root. */
+	if(parent == NULL) {
+		purple_xmlnode_free(node);
+	}
+
+	return NULL;
+}
+
+/* Runs on the worker thread. */
+static void
+purple_persistence_write_cache(PurplePersistenceJob *job) {
+	PurplePersistenceCacheHeader header;
+	GByteArray *buffer = NULL;
+	GStatBuf st;
+	gchar *path = NULL, *cache = NULL;
+	gint64 start = 0;
+
+	start = g_get_monotonic_time();
+
+	/* The cache is only good for the file exactly as it is now, which still
+	 * has to be the generation that was encoded.
+	 */
+	path = g_build_filename(purple_config_dir(), job->filename, NULL);
+	if(job->generation == 0 || g_stat(path, &st) != 0 ||
+	   purple_persistence_read_generation(path) != job->generation)
+	{
+		g_free(path);
+
+		return;
+	}
+	g_free(path);
+
+	memset(&header, 0, sizeof(header));
+
+	if(job->payload != NULL) {
+		buffer = g_steal_pointer(&job->payload);
+	} else {
+		buffer = purple_persistence_cache_new_payload(job->node);
+	}
+
+	memcpy(header.magic, PURPLE_PERSISTENCE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = GUINT32_TO_LE(PURPLE_PERSISTENCE_CACHE_VERSION);
+	header.generation = GUINT64_TO_LE(job->generation);
+	header.xml_mtime = GINT64_TO_LE((gint64)st.st_mtime);
+	header.xml_size = GUINT64_TO_LE((guint64)st.st_size);
+	header.payload_size = GUINT64_TO_LE(buffer->len - sizeof(header));
+	purple_persistence_cache_checksum(buffer->data + sizeof(header),
+	                                  buffer->len - sizeof(header),
+	                                  header.checksum);
+	memcpy(buffer->data, &header, sizeof(header));
+
+	cache = purple_persistence_cache_filename(job->filename);
+	if(purple_util_write_data_to_cache_file(cache, (const gchar *)buffer->data,
+	                                        buffer->len))
+	{
+		purple_debug_info("persistence",
+		                  "saved %s (%u bytes) in %.2f ms", cache,
+		                  buffer->len,
+		                  (g_get_monotonic_time() - start) / 1000.0);
+	} else {
+		purple_debug_warning("persistence", "failed to save %s", cache);
+	}
+
+	g_free(cache);
+	g_byte_array_free(buffer, TRUE);
+}
+
+/* Reads the cache of filename if it is still good, returns NULL if it has to
+ * be read from the XML instead.
+ */
+static PurpleXmlNode *
+purple_persistence_read_cache(const gchar *filename) {
+	PurplePersistenceCacheHeader header;
+	PurplePersistenceCacheReader reader;
+	PurpleXmlNode *node = NULL;
+	GMappedFile *file = NULL;
+	GError *error = NULL;
+	GStatBuf st;
+	gchar *path = NULL, *xml_path = NULL, *cache = NULL;
+	const guint8 *contents = NULL;
+	guint8 checksum[16];
+	gsize length = 0;
+	gint64 start = 0;
+	guint8 record = 0;
+
+	start = g_get_monotonic_time();
+
+	xml_path = g_build_filename(purple_config_dir(), filename, NULL);
+	if(g_stat(xml_path, &st) != 0) {
+		g_free(xml_path);
+
+		return NULL;
+	}
+
+	cache = purple_persistence_cache_filename(filename);
+	path = g_build_filename(purple_cache_dir(), cache, NULL);
+	g_free(cache);
+
+	file = g_mapped_file_new(path, FALSE, &error);
+	if(file == NULL) {
+		if(!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+			purple_debug_warning("persistence", "failed to open %s: %s",
+			                     path, error->message);
+		}
+		g_clear_error(&error);
+		g_free(path);
+		g_free(xml_path);
+
+		return NULL;
+	}
+
+	contents = (const guint8 *)g_mapped_file_get_contents(file);
+	length = g_mapped_file_get_length(file);
+
+	if(contents == NULL || length < sizeof(header)) {
+		purple_debug_info("persistence", "ignoring truncated %s", path);
+		g_mapped_file_unref(file);
+		g_free(path);
+		g_free(xml_path);
+
+		return NULL;
+	}
+
+	memcpy(&header, contents, sizeof(header));
+
+	if(memcmp(header.magic, PURPLE_PERSISTENCE_CACHE_MAGIC,
+	          sizeof(header.magic)) != 0 ||
+	   GUINT32_FROM_LE(header.version) != PURPLE_PERSISTENCE_CACHE_VERSION ||
+	   GUINT64_FROM_LE(header.payload_size) != length - sizeof(header))
+	{
+		purple_debug_info("persistence", "ignoring invalid %s", path);
+		g_mapped_file_unref(file);
+		g_free(path);
+		g_free(xml_path);
+
+		return NULL;
+	}
+
+	/* The XML is the source of truth, so the cache is ignored if the file was
+	 * saved or edited after the cache was written.
+	 */
+	if(header.generation == 0 ||
+	   GUINT64_FROM_LE(header.xml_size) != (guint64)st.st_size ||
+	   GINT64_FROM_LE(header.xml_mtime) != (gint64)st.st_mtime ||
+	   GUINT64_FROM_LE(header.generation) !=
+	   purple_persistence_read_generation(xml_path))
+	{
+		purple_debug_info("persistence", "ignoring stale %s", path);
+		g_mapped_file_unref(file);
+		g_free(path);
+		g_free(xml_path);
+
+		return NULL;
+	}
+
+	purple_persistence_cache_checksum(contents + sizeof(header),
+	                                  length - sizeof(header), checksum);
+	if(memcmp(checksum, header.checksum, sizeof(checksum)) != 0) {
+		purple_debug_warning("persistence", "ignoring corrupt %s", path);
+		g_mapped_file_unref(file);
+		g_free(path);
+		g_free(xml_path);
+
+		return NULL;
+	}
+
+	reader.data = contents;
+	reader.length = length;
+	reader.offset = sizeof(header);
+
+	if(purple_persistence_cache_read_record(&reader, &record) &&
+	   record == PURPLE_PERSISTENCE_CACHE_TAG)
+	{
+		node = purple_persistence_cache_decode(&reader, NULL);
+	}
+
+	if(node != NULL && reader.offset != reader.length) {
+		g_clear_pointer(&node, purple_xmlnode_free);
+	}
+
+	if(node != NULL) {
+		purple_debug_info("persistence", "loaded %s in %.2f ms", path,
+		                  (g_get_monotonic_time() - start) / 1000.0);
+	} else {
+		purple_debug_warning("persistence", "ignoring corrupt %s", path);
+	}
+
+	g_mapped_file_unref(file);
+	g_free(path);
+	g_free(xml_path);
+
+	return node;
+}
+
+/* Runs on the worker thread. */
+static void
+purple_persistence_write_snapshot(PurplePersistenceJob *job) {
+	gint64 start = 0;
+
+	start = g_get_monotonic_time();
+
+	if(job->cache) {
+		gchar *generation = NULL;
+
+		job->generation = purple_persistence_next_generation();
+		generation = g_strdup_printf("%" G_GUINT64_FORMAT, job->generation);
+		purple_xmlnode_set_attrib(job->node, PURPLE_PERSISTENCE_GENERATION,
+		                          generation);
+		g_free(generation);
+	}
+
+	if(!purple_util_write_xml_to_config_file(job->filename, job->node)) {
+		purple_debug_warning("persistence", "failed to save %s",
+		                     job->filename);
+
+		/* Keep the journal, it still has the changes. */
+		return;
+	}
+
+	purple_debug_info("persistence",
+	                  "saved %s: snapshot %.2f ms, write %.2f ms",
+	                  job->filename, job->snapshot_time / 1000.0,
+	                  (g_get_monotonic_time() - start) / 1000.0);
+
+	/* Everything that was appended to the journal before the snapshot was
+	 * taken is in the file now, and anything appended after it is queued
+	 * behind this job.
+	 */
+	if(job->journal != NULL) {
+		gchar *path = g_build_filename(purple_config_dir(), job->journal,
+		                               NULL);
+
+		if(g_unlink(path) != 0 && errno != ENOENT) {
+			purple_debug_warning("persistence", "failed to remove %s: %s",
+			                     path, g_strerror(errno));
+		}
+
+		g_free(path);
+	}
+
+	if(job->cache) {
+		purple_persistence_write_cache(job);
+	}
+}
+
+/* Runs on the worker thread. */
+static void
+purple_persistence_write(gpointer data, G_GNUC_UNUSED gpointer user_data) {
+	PurplePersistenceJob *job = data;
+
+	if(job->cache_only) {
+		purple_persistence_write_cache(job);
+	} else if(job->node == NULL) {
+		purple_persistence_append_data(job);
+	} else {
+		purple_persistence_write_snapshot(job);
+	}
+
+	purple_persistence_job_free(job);
+
+	g_mutex_lock(&pending_lock);
+	pending--;
+	if(pending == 0) {
+		g_cond_broadcast(&pending_cond);
+	}
+	g_mutex_unlock(&pending_lock);
+}
+
+static void
+purple_persistence_push(PurplePersistenceJob *job) {
+	g_mutex_lock(&pending_lock);
+	pending++;
+	g_mutex_unlock(&pending_lock);
+
+	if(pool == NULL) {
+		purple_persistence_write(job, NULL);
+	} else {
+		g_thread_pool_push(pool, job, NULL);
+	}
+}
+
+/* Takes the snapshot of filename on the main thread and hands it off to be
+ * written.
+ */
+static void
+purple_persistence_snapshot(const gchar *filename,
+                            PurplePersistenceSnapshotFunc snapshot)
+{
+	PurplePersistenceJob *job = NULL;
+	PurpleXmlNode *node = NULL;
+	gint64 start = 0;
+
+	start = g_get_monotonic_time();
+	node = snapshot();
+	if(node == NULL) {
+		return;
+	}
+
+	job = g_new0(PurplePersistenceJob, 1);
+	job->filename = g_strdup(filename);
+	job->node = node;
+	job->journal = g_strdup(g_hash_table_lookup(journals, filename));
+	job->cache = g_hash_table_contains(cached, filename);
+	job->snapshot_time = g_get_monotonic_time() - start;
+
+	purple_persistence_push(job);
+}
+
+static void
+purple_persistence_snapshot_all(void) {
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init(&iter, dirty);
+	while(g_hash_table_iter_next(&iter, &key, &value)) {
+		g_hash_table_iter_steal(&iter);
+
+		purple_persistence_snapshot(key, value);
+
+		g_free(key);
+	}
+}
+
+static gboolean
+purple_persistence_save_cb(G_GNUC_UNUSED gpointer data) {
+	save_timer = 0;
+
+	purple_persistence_snapshot_all();
+
+	return G_SOURCE_REMOVE;
+}
+
+/******************************************************************************
+ * Private API
+ *****************************************************************************/
+void
+purple_persistence_startup(void) {
+	GError *error = NULL;
+
+	dirty = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	journals = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	cached = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	pool = g_thread_pool_new(purple_persistence_write, NULL, 1, FALSE,
+	                         &error);
+	if(error != NULL) {
+		purple_debug_warning("persistence",
+		                     "failed to start the writer thread, files will "
+		                     "be saved on the main thread: %s",
+		                     error->message);
+		g_clear_error(&error);
+	}
+}
+
+void
+purple_persistence_shutdown(void) {
+	if(dirty == NULL) {
+		return;
+	}
+
+	g_clear_handle_id(&save_timer, g_source_remove);
+
+	/* Everything that saves through here flushes its own file when it shuts
+	 * down, so anything left over has been changed after that and its state
+	 * is already gone.
+	 */
+	if(g_hash_table_size(dirty) > 0) {
+		purple_debug_warning("persistence",
+		                     "discarding %u unsaved files at shutdown",
+		                     g_hash_table_size(dirty));
+	}
+	g_clear_pointer(&dirty, g_hash_table_destroy);
+	g_clear_pointer(&journals, g_hash_table_destroy);
+	g_clear_pointer(&cached, g_hash_table_destroy);
+
+	/* Waits for the writes that are still queued. */
+	if(pool != NULL) {
+		g_thread_pool_free(pool, FALSE, TRUE);
+		pool = NULL;
+	}
+}
+
+void
+purple_persistence_schedule_save(const gchar *filename,
+                                 PurplePersistenceSnapshotFunc snapshot)
+{
+	g_return_if_fail(filename != NULL);
+	g_return_if_fail(snapshot != NULL);
+	g_return_if_fail(dirty != NULL);
+
+	g_hash_table_replace(dirty, g_strdup(filename), snapshot);
+
+	/* One timer for every file so that changes to several of them are saved
+	 * together.
+	 */
+	if(save_timer == 0) {
+		save_timer = g_timeout_add_seconds(PURPLE_PERSISTENCE_DELAY,
+		                                   purple_persistence_save_cb, NULL);
+	}
+}
+
+void
+purple_persistence_set_journal(const gchar *filename, const gchar *journal) {
+	g_return_if_fail(filename != NULL);
+	g_return_if_fail(journals != NULL);
+
+	if(journal == NULL) {
+		g_hash_table_remove(journals, filename);
+	} else {
+		g_hash_table_replace(journals, g_strdup(filename), g_strdup(journal));
+	}
+}
+
+void
+purple_persistence_append(const gchar *journal, const gchar *data) {
+	PurplePersistenceJob *job = NULL;
+
+	g_return_if_fail(journal != NULL);
+	g_return_if_fail(data != NULL);
+
+	job = g_new0(PurplePersistenceJob, 1);
+	job->filename = g_strdup(journal);
+	job->data = g_strdup(data);
+
+	purple_persistence_push(job);
+}
+
+PurpleXmlNode *
+purple_persistence_read(const gchar *filename, const gchar *description) {
+	PurpleXmlNode *node = NULL;
+	PurplePersistenceJob *job = NULL;
+	guint64 generation = 0;
+
+	g_return_val_if_fail(filename != NULL, NULL);
+	g_return_val_if_fail(cached != NULL, NULL);
+
+	g_hash_table_add(cached, g_strdup(filename));
+
+	node = purple_persistence_read_cache(filename);
+	if(node != NULL) {
+		return node;
+	}
+
+	node = purple_util_read_xml_from_config_file(filename, description);
+	if(node == NULL) {
+		return NULL;
+	}
+
+	/* A file that was never saved with a cache doesn't have a generation to
+	 * check the cache against, so it gets one the next time it is saved.
+	 */
+	generation = purple_persistence_parse_generation(purple_xmlnode_get_attrib(node,
+	                                                                           PURPLE_PERSISTENCE_GENERATION));
+	if(generation == 0) {
+		return node;
+	}
+
+	/* Otherwise the cache was lost or is stale, so it is written again now
+	 * rather than waiting for the file to be changed.  The caller owns the
+	 * tree, so it is encoded here, which is a lot cheaper than copying it for
+	 * the worker thread.
+	 */
+	job = g_new0(PurplePersistenceJob, 1);
+	job->filename = g_strdup(filename);
+	job->generation = generation;
+	job->payload = purple_persistence_cache_new_payload(node);
+	job->cache = TRUE;
+	job->cache_only = TRUE;
+
+	purple_persistence_push(job);
+
+	return node;
+}
+
+void
+purple_persistence_flush(const gchar *filename) {
+	if(dirty == NULL) {
+		return;
+	}
+
+	if(filename == NULL) {
+		purple_persistence_snapshot_all();
+	} else {
+		gpointer key = NULL, value = NULL;
+
+		if(g_hash_table_steal_extended(dirty, filename, &key, &value)) {
+			purple_persistence_snapshot(key, value);
+			g_free(key);
+		}
+	}
+
+	if(g_hash_table_size(dirty) == 0) {
+		g_clear_handle_id(&save_timer, g_source_remove);
+	}
+
+	g_mutex_lock(&pending_lock);
+	while(pending > 0) {
+		g_cond_wait(&pending_cond, &pending_lock);
+	}
+	g_mutex_unlock(&pending_lock);
+}
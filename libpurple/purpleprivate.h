@@ -31,8 +31,11 @@
 
 #include "accounts.h"
 #include "connection.h"
+#include "purplechatuser.h"
 #include "purplecredentialprovider.h"
 #include "purplehistoryadapter.h"
+#include "purplesqlitehistoryadapter.h"
+#include "xmlnode.h"
 
 #define PURPLE_STATIC_ASSERT(condition, message) \
 	{ typedef char static_assertion_failed_ ## message \
@@ -72,6 +75,52 @@ PurpleXmlNode *_purple_account_to_xmlnode(PurpleAccount *account);
  */
 PurpleBlistNode *_purple_blist_get_last_child(PurpleBlistNode *node);
 
+/**
+ * _purple_blist_save_node_setting:
+ * @node: The node whose setting changed.
+ * @key: The name of the setting.
+ * @value: (nullable): The new value of the setting, or %NULL if it was
+ *         removed.
+ *
+ * Saves a change to a single setting of @node.  When the default buddy list
+ * storage is used, the change is appended to the buddy list journal instead of
+ * rewriting the whole buddy list.
+ */
+void _purple_blist_save_node_setting(PurpleBlistNode *node, const gchar *key, const GValue *value);
+
+/**
+ * _purple_blist_save_buddy_alias:
+ * @buddy: The buddy whose local alias changed.
+ *
+ * Saves a change to the local alias of @buddy, like
+ * _purple_blist_save_node_setting().
+ */
+void _purple_blist_save_buddy_alias(PurpleBuddy *buddy);
+
+/**
+ * _purple_blist_chat_components_changed:
+ * @chat: The chat whose components changed.
+ *
+ * Tells the buddy list that a component of @chat changed, which may change the
+ * name that purple_blist_find_chat() finds it by.
+ */
+void _purple_blist_chat_components_changed(PurpleChat *chat);
+
+/**
+ * purple_blist_node_get_settings_size:
+ * @node: The instance.
+ * @allocations: (out) (optional): Return address for the number of heap
+ *               allocations that hold the settings.
+ *
+ * Adds up the heap memory that the settings of @node use. The keys are
+ * #GQuark's that are shared by all nodes, so they are not counted.
+ *
+ * Returns: The size of the settings in bytes.
+ *
+ * Since: 3.0.0
+ */
+gsize purple_blist_node_get_settings_size(PurpleBlistNode *node, guint *allocations);
+
 /* This is for the accounts code to notify the buddy icon code that
  * it's done loading.  We may want to replace this with a signal. */
 void
@@ -181,6 +230,17 @@ int *_purple_statuses_get_primitive_scores(void);
 void
 _purple_conversation_write_common(PurpleConversation *conv, PurpleMessage *msg);
 
+/**
+ * purple_message_ensure_id:
+ * @message: The instance.
+ *
+ * Gives @message a random id if it does not have one yet, so that it can be
+ * found again in the history after it was written.
+ *
+ * Since: 3.0.0
+ */
+void purple_message_ensure_id(PurpleMessage *message);
+
 /**
  * purple_account_manager_startup:
  *
@@ -320,6 +380,21 @@ gboolean purple_history_adapter_activate(PurpleHistoryAdapter *adapter, GError *
  */
 gboolean purple_history_adapter_deactivate(PurpleHistoryAdapter *adapter, GError **error);
 
+/**
+ * purple_sqlite_history_adapter_explain_page:
+ * @adapter: The instance.
+ * @query: The query.
+ * @error: A return address for a #GError.
+ *
+ * Gets the query plan that SQLite picks for the pages after the first one of
+ * @query, one step per line. This is only meant for the unit tests.
+ *
+ * Returns: (transfer full): The query plan, or %NULL with @error set.
+ *
+ * Since: 3.0.0
+ */
+gchar *purple_sqlite_history_adapter_explain_page(PurpleSqliteHistoryAdapter *adapter, const gchar *query, GError **error);
+
 /**
  * purple_history_manager_startup:
  *
@@ -374,6 +449,181 @@ void purple_whiteboard_manager_startup(void);
  */
 void purple_whiteboard_manager_shutdown(void);
 
+/**
+ * purple_chat_user_get_key:
+ * @chat_user: The instance.
+ *
+ * Gets the folded name that chat conversations use to look up @chat_user.
+ * This is computed once when the name is set.
+ *
+ * The key is interned, so users whose names fold to the same key share the
+ * same string and keys can be compared by pointer.
+ *
+ * Returns: (transfer none): The key.
+ *
+ * Since: 3.0.0
+ */
+GRefString *purple_chat_user_get_key(PurpleChatUser *chat_user);
+
+/**
+ * purple_chat_user_fold_name:
+ * @name: The name to fold.
+ *
+ * Folds @name the same way as purple_chat_user_get_key(). Most names are
+ * already folded, in which case %NULL is returned and @name can be used as
+ * is, which keeps lookups from allocating.
+ *
+ * Returns: (transfer full) (nullable): The folded name, or %NULL if @name is
+ *          already folded.
+ *
+ * Since: 3.0.0
+ */
+gchar *purple_chat_user_fold_name(const gchar *name);
+
+/**
+ * purple_chat_user_get_casefolded_name:
+ * @chat_user: The instance.
+ *
+ * Gets the name of @chat_user folded with purple_chat_user_casefold_name().
+ * This is computed the first time it is needed and then cached.
+ *
+ * Returns: The case folded name.
+ *
+ * Since: 3.0.0
+ */
+const gchar *purple_chat_user_get_casefolded_name(PurpleChatUser *chat_user);
+
+/**
+ * purple_chat_user_casefold_name:
+ * @name: The name to fold.
+ *
+ * Folds @name so that names which purple_utf8_strcasecmp() considers equal
+ * compare equal with strcmp().
+ *
+ * Returns: (transfer full): The case folded name.
+ *
+ * Since: 3.0.0
+ */
+gchar *purple_chat_user_casefold_name(const gchar *name);
+
+/**
+ * purple_str_intern_set:
+ * @dest: (inout): The interned string to replace.
+ * @str: (nullable): The new value.
+ *
+ * Replaces the #GRefString at @dest with the interned copy of @str, releasing
+ * the old value.  Every object that stores the same string this way shares a
+ * single allocation, and two such strings are equal exactly when they are the
+ * same pointer.
+ *
+ * Returns: %TRUE if the value at @dest changed.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_str_intern_set(GRefString **dest, const gchar *str);
+
+/**
+ * PurplePersistenceSnapshotFunc:
+ *
+ * Creates the document to save for a file.  This is called on the main thread
+ * and the returned node must not share anything with the live state, as it is
+ * serialized and written on another thread.
+ *
+ * Returns: (transfer full) (nullable): The document to save, or %NULL to not
+ *          save anything.
+ *
+ * Since: 3.0.0
+ */
+typedef PurpleXmlNode *(*PurplePersistenceSnapshotFunc)(void);
+
+/**
+ * purple_persistence_startup:
+ *
+ * Starts the service that saves configuration files.
+ *
+ * Since: 3.0.0
+ */
+void purple_persistence_startup(void);
+
+/**
+ * purple_persistence_shutdown:
+ *
+ * Stops the service that saves configuration files after waiting for any
+ * writes that are in progress.
+ *
+ * Since: 3.0.0
+ */
+void purple_persistence_shutdown(void);
+
+/**
+ * purple_persistence_schedule_save:
+ * @filename: The name of the file in the config directory.
+ * @snapshot: (scope forever): The function that creates the document to save.
+ *
+ * Marks @filename as having unsaved changes.  After a short delay, which is
+ * shared by all files so that changes to several of them are saved together,
+ * @snapshot is called and the result is written out on a worker thread.
+ *
+ * Since: 3.0.0
+ */
+void purple_persistence_schedule_save(const gchar *filename, PurplePersistenceSnapshotFunc snapshot);
+
+/**
+ * purple_persistence_set_journal:
+ * @filename: The name of the file in the config directory.
+ * @journal: (nullable): The name of the journal for @filename.
+ *
+ * Sets the journal that holds the changes made since @filename was last
+ * saved.  The journal is removed once a new snapshot of @filename has been
+ * written successfully.
+ *
+ * Since: 3.0.0
+ */
+void purple_persistence_set_journal(const gchar *filename, const gchar *journal);
+
+/**
+ * purple_persistence_append:
+ * @journal: The name of the journal in the config directory.
+ * @data: The data to append.
+ *
+ * Appends @data to the end of @journal on the worker thread.  Appends and
+ * snapshots are written in the order that they were made.
+ *
+ * Since: 3.0.0
+ */
+void purple_persistence_append(const gchar *journal, const gchar *data);
+
+/**
+ * purple_persistence_read:
+ * @filename: The name of the file in the config directory.
+ * @description: A description of the file for error messages.
+ *
+ * Reads @filename like purple_util_read_xml_from_config_file(), but from its
+ * binary cache when that was written for the current contents of the file.
+ * The XML is always the source of truth: the cache is only used when the
+ * generation that was stored on the root node of @filename when it was last
+ * saved, and its size and modification time, match the ones the cache was
+ * written for.  From now on, a new cache is written whenever @filename is
+ * saved.
+ *
+ * Returns: (transfer full) (nullable): The root node of the file.
+ *
+ * Since: 3.0.0
+ */
+PurpleXmlNode *purple_persistence_read(const gchar *filename, const gchar *description);
+
+/**
+ * purple_persistence_flush:
+ * @filename: (nullable): The file to save, or %NULL for all of them.
+ *
+ * Saves @filename right away if it has unsaved changes and then waits until
+ * every write that has been started is finished.  Subsystems call this when
+ * they shut down.
+ *
+ * Since: 3.0.0
+ */
+void purple_persistence_flush(const gchar *filename);
+
 /**
  * purple_account_set_enabled_plain:
  * @account: The instance.
@@ -19,30 +19,308 @@
 #include <glib/gi18n-lib.h>
 
 #include <sqlite3.h>
+#include <zlib.h>
 
 #include "purplesqlitehistoryadapter.h"
 
 #include "account.h"
+#include "purpleenums.h"
 #include "purpleprivate.h"
 #include "purplesqlite3.h"
 
+/* The maximum number of messages that can be waiting for the writer thread.
+ * Once this is reached, purple_history_adapter_write() blocks until the
+ * writer thread has caught up.
+ */
+#define PURPLE_SQLITE_HISTORY_ADAPTER_MAX_PENDING (4096)
+
+#define PURPLE_SQLITE_HISTORY_ADAPTER_DEFAULT_COMMIT_INTERVAL (5)
+
+/* The number of prepared query statements to keep around. There is one for
+ * each combination of query terms, so this covers the handful of different
+ * searches a user typically runs.
+ */
+#define PURPLE_SQLITE_HISTORY_ADAPTER_STATEMENT_CACHE_SIZE (16)
+
+/* Compaction deletes this many messages or frees this many pages at a time
+ * and gives up the database between each step so that the writer thread is
+ * never blocked for long.
+ */
+#define PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BATCH (256)
+
+/* How long each run of the compaction timer may take. */
+#define PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BUDGET (20 * G_TIME_SPAN_MILLISECOND)
+
+/* How soon to continue when a compaction run ran out of time, in
+ * milliseconds.
+ */
+#define PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_RETRY (250)
+
+#define PURPLE_SQLITE_HISTORY_ADAPTER_DEFAULT_COMPACTION_INTERVAL (300)
+
+/* Shorter content rarely gets any smaller, so it is always stored as text. */
+#define PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_THRESHOLD (64)
+
+/* How much of the most recent history goes into the dictionary that short
+ * messages are compressed against, and how much there has to be before it is
+ * worth having one. zlib only looks at the last 32KiB of a dictionary.
+ */
+#define PURPLE_SQLITE_HISTORY_ADAPTER_DICTIONARY_SIZE (16 * 1024)
+#define PURPLE_SQLITE_HISTORY_ADAPTER_DICTIONARY_MINIMUM (1024)
+
+/* Compresses and decompresses the content of messages for one connection and
+ * is only used while the lock of that connection is held. Compressed content
+ * is a blob that starts with the id of the dictionary it was compressed
+ * against, or 0 for none, followed by a raw deflate stream.
+ */
+typedef struct {
+	z_stream deflater;
+	z_stream inflater;
+
+	/* Maps dictionary ids to their contents, which are loaded as needed. */
+	GHashTable *dictionaries;
+	/* The dictionary that new content is compressed against, or 0. */
+	guint8 dictionary_id;
+} PurpleSqliteHistoryAdapterCodec;
+
+typedef struct {
+	gchar *key;
+	sqlite3_stmt *statement;
+} PurpleSqliteHistoryAdapterCachedStatement;
+
+typedef struct {
+	/* Maps keys to their link in lru. */
+	GHashTable *statements;
+	/* The most recently used statement is at the head. */
+	GQueue lru;
+
+	guint64 hits;
+	guint64 misses;
+} PurpleSqliteHistoryAdapterStatementCache;
+
 struct _PurpleSqliteHistoryAdapter {
 	PurpleHistoryAdapter parent;
 
 	gchar *filename;
 	sqlite3 *db;
+	PurpleSqliteHistoryAdapterStatementCache *statements;
+
+	/* The codec of db and whether the search index reads the content through
+	 * purple_history_content(), both are protected by db_lock.
+	 */
+	PurpleSqliteHistoryAdapterCodec *codec;
+	gboolean compressed_index;
+
+	PurpleSqliteHistoryAdapterSynchronous synchronous;
+	guint commit_interval;
+
+	/* The retention policy, these are only used on the main thread. */
+	guint max_age;
+	guint max_messages;
+	guint64 max_size;
+	guint compaction_interval;
+	guint compaction_source;
+	gboolean compacting;
+
+	/* compaction_lock serializes compaction runs, which happen on the writer
+	 * thread for the timer and on the calling thread for
+	 * purple_sqlite_history_adapter_compact(). It also protects the
+	 * conversation that the next run of compact_by_count continues after.
+	 */
+	GMutex compaction_lock;
+	gchar *count_cursor_conversation;
+	gchar *count_cursor_account;
+
+	/* db_lock is held by whichever thread is currently using db so that a
+	 * batch transaction is never interleaved with a query or a removal. It
+	 * also protects write_mode and compression which the writer thread
+	 * checks for every batch.
+	 */
+	GMutex db_lock;
+	PurpleSqliteHistoryAdapterWriteMode write_mode;
+	PurpleSqliteHistoryAdapterCompression compression;
+
+	/* A read only connection that queries use so that they are not blocked
+	 * by the writer thread. read_lock serializes the queries and is held
+	 * while the connections are opened and closed.
+	 */
+	sqlite3 *read_db;
+	PurpleSqliteHistoryAdapterStatementCache *read_statements;
+	GMutex read_lock;
+
+	/* Everything below is protected by lock. */
+	GMutex lock;
+	GCond cond;
+	GThread *writer;
+	sqlite3_stmt *insert_statement;
+	sqlite3_stmt *upsert_statement;
+	GQueue *pending;
+	GQueue *jobs;
+	guint64 queued;
+	guint64 committed;
+	guint64 failed;
+	GError *write_error;
+	guint flush_waiters;
+	gboolean converting;
+	gboolean stopping;
 };
 
+/* A snapshot of everything that we need to write a message to the database.
+ * It is created on the main thread so that the writer thread never touches
+ * any GObjects.
+ */
+typedef struct {
+	gchar *protocol;
+	gchar *account;
+	gchar *conversation_id;
+	gchar *message_id;
+	gchar *author;
+	gchar *author_name_color;
+	gchar *author_alias;
+	gchar *recipient;
+	const gchar *content_type;
+	gchar *content;
+	gchar *timestamp;
+	gint64 timestamp_us;
+} PurpleSqliteHistoryAdapterRow;
+
+/* Maintenance that runs on the writer thread whenever no messages are waiting
+ * to be written. func is called like a GTaskThreadFunc and has to return a
+ * result on task.
+ */
+typedef struct {
+	GTask *task;
+	GTaskThreadFunc func;
+} PurpleSqliteHistoryAdapterJob;
+
+/* The position of a message in the order of paged queries, which is the order
+ * of the indexes on client_timestamp_us with the rowid breaking ties. Rows
+ * without a timestamp come first.
+ */
+typedef struct {
+	gboolean has_timestamp;
+	gint64 timestamp_us;
+	gint64 rowid;
+} PurpleSqliteHistoryAdapterCursor;
+
 enum {
 	PROP_0,
 	PROP_FILENAME,
+	PROP_SYNCHRONOUS,
+	PROP_COMMIT_INTERVAL,
+	PROP_WRITE_MODE,
+	PROP_MAX_AGE,
+	PROP_MAX_MESSAGES,
+	PROP_MAX_SIZE,
+	PROP_COMPACTION_INTERVAL,
+	PROP_COMPRESSION,
 	N_PROPERTIES,
 };
 static GParamSpec *properties[N_PROPERTIES] = {NULL, };
 
+enum {
+	SIG_COMPACTED,
+	N_SIGNALS,
+};
+static guint signals[N_SIGNALS] = {0, };
+
 G_DEFINE_TYPE(PurpleSqliteHistoryAdapter, purple_sqlite_history_adapter,
               PURPLE_TYPE_HISTORY_ADAPTER)
 
+/******************************************************************************
+ * Statement Cache
+ *****************************************************************************/
+static PurpleSqliteHistoryAdapterStatementCache *
+purple_sqlite_history_adapter_statement_cache_new(void) {
+	PurpleSqliteHistoryAdapterStatementCache *cache = NULL;
+
+	cache = g_new0(PurpleSqliteHistoryAdapterStatementCache, 1);
+	cache->statements = g_hash_table_new(g_str_hash, g_str_equal);
+	g_queue_init(&cache->lru);
+
+	return cache;
+}
+
+static void
+purple_sqlite_history_adapter_cached_statement_free(PurpleSqliteHistoryAdapterCachedStatement *cached)
+{
+	g_free(cached->key);
+	sqlite3_finalize(cached->statement);
+
+	g_free(cached);
+}
+
+static void
+purple_sqlite_history_adapter_statement_cache_free(PurpleSqliteHistoryAdapterStatementCache *cache)
+{
+	g_hash_table_destroy(cache->statements);
+	g_queue_clear_full(&cache->lru,
+	                   (GDestroyNotify)purple_sqlite_history_adapter_cached_statement_free);
+
+	g_free(cache);
+}
+
+/* Returns the cached statement for key, marking it as the most recently used
+ * one, or NULL if there isn't one.
+ */
+static sqlite3_stmt *
+purple_sqlite_history_adapter_statement_cache_lookup(PurpleSqliteHistoryAdapterStatementCache *cache,
+                                                     const gchar *key)
+{
+	PurpleSqliteHistoryAdapterCachedStatement *cached = NULL;
+	GList *link = NULL;
+
+	link = g_hash_table_lookup(cache->statements, key);
+	if(link == NULL) {
+		cache->misses++;
+
+		return NULL;
+	}
+
+	cache->hits++;
+
+	g_queue_unlink(&cache->lru, link);
+	g_queue_push_head_link(&cache->lru, link);
+
+	cached = link->data;
+
+	return cached->statement;
+}
+
+/* Takes ownership of key and statement, evicting the least recently used
+ * statement if the cache is full.
+ */
+static void
+purple_sqlite_history_adapter_statement_cache_insert(PurpleSqliteHistoryAdapterStatementCache *cache,
+                                                     gchar *key,
+                                                     sqlite3_stmt *statement)
+{
+	PurpleSqliteHistoryAdapterCachedStatement *cached = NULL;
+
+	cached = g_new0(PurpleSqliteHistoryAdapterCachedStatement, 1);
+	cached->key = key;
+	cached->statement = statement;
+
+	g_queue_push_head(&cache->lru, cached);
+	g_hash_table_insert(cache->statements, cached->key, cache->lru.head);
+
+	if(cache->lru.length > PURPLE_SQLITE_HISTORY_ADAPTER_STATEMENT_CACHE_SIZE) {
+		cached = g_queue_pop_tail(&cache->lru);
+		g_hash_table_remove(cache->statements, cached->key);
+
+		purple_sqlite_history_adapter_cached_statement_free(cached);
+	}
+}
+
+/* Cached statements are owned by the cache, so instead of finalizing them,
+ * callers reset them so they can be reused.
+ */
+static void
+purple_sqlite_history_adapter_release_statement(sqlite3_stmt *statement) {
+	sqlite3_reset(statement);
+	sqlite3_clear_bindings(statement);
+}
+
 /******************************************************************************
  * Helpers
  *****************************************************************************/
@@ -56,576 +334,4024 @@ purple_sqlite_history_adapter_set_filename(PurpleSqliteHistoryAdapter *adapter,
 	g_object_notify_by_pspec(G_OBJECT(adapter), properties[PROP_FILENAME]);
 }
 
-static gboolean
-purple_sqlite_history_adapter_run_migrations(PurpleSqliteHistoryAdapter *adapter,
-                                             GError **error)
-{
-	const char *path = "/im/pidgin/libpurple/sqlitehistoryadapter";
-	const char *migrations[] = {
-		"01-schema.sql",
-		NULL
-	};
+static PurpleSqliteHistoryAdapterCodec *
+purple_sqlite_history_adapter_codec_new(void) {
+	PurpleSqliteHistoryAdapterCodec *codec = NULL;
 
-	return purple_sqlite3_run_migrations_from_resources(adapter->db, path,
-	                                                    migrations, error);
-}
+	codec = g_new0(PurpleSqliteHistoryAdapterCodec, 1);
 
-static gchar *
-purple_sqlite_history_adapter_get_content_type(PurpleMessageContentType content_type) {
-	switch(content_type) {
-		case PURPLE_MESSAGE_CONTENT_TYPE_PLAIN:
-			return "plain";
-			break;
-		case PURPLE_MESSAGE_CONTENT_TYPE_HTML:
-			return "html";
-			break;
-		case PURPLE_MESSAGE_CONTENT_TYPE_XHTML:
-			return "xhtml";
-			break;
-		case PURPLE_MESSAGE_CONTENT_TYPE_MARKDOWN:
-			return "markdown";
-			break;
-		default:
-			return "";
-			break;
+	if(deflateInit2(&codec->deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+	                -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		g_free(codec);
+
+		return NULL;
+	}
+
+	if(inflateInit2(&codec->inflater, -MAX_WBITS) != Z_OK) {
+		deflateEnd(&codec->deflater);
+		g_free(codec);
+
+		return NULL;
 	}
+
+	codec->dictionaries = g_hash_table_new_full(NULL, NULL, NULL,
+	                                            (GDestroyNotify)g_bytes_unref);
+
+	return codec;
 }
 
-static PurpleMessageContentType
-purple_sqlite_history_adapter_get_content_type_enum(const gchar *content_type)
+static void
+purple_sqlite_history_adapter_codec_free(PurpleSqliteHistoryAdapterCodec *codec)
 {
-	if(purple_strequal(content_type, "plain")) {
-		return PURPLE_MESSAGE_CONTENT_TYPE_PLAIN;
-	}
-	if(purple_strequal(content_type, "html")) {
-		return PURPLE_MESSAGE_CONTENT_TYPE_HTML;
+	deflateEnd(&codec->deflater);
+	inflateEnd(&codec->inflater);
+	g_hash_table_destroy(codec->dictionaries);
+
+	g_free(codec);
+}
+
+/* Returns the dictionary with the given id, loading it from db the first time
+ * it is needed, or NULL if there is no such dictionary.
+ */
+static GBytes *
+purple_sqlite_history_adapter_codec_get_dictionary(PurpleSqliteHistoryAdapterCodec *codec,
+                                                   sqlite3 *db, guint8 id)
+{
+	sqlite3_stmt *statement = NULL;
+	GBytes *dictionary = NULL;
+
+	dictionary = g_hash_table_lookup(codec->dictionaries, GUINT_TO_POINTER(id));
+	if(dictionary != NULL) {
+		return dictionary;
 	}
-	if(purple_strequal(content_type, "xhtml")) {
-		return PURPLE_MESSAGE_CONTENT_TYPE_XHTML;
+
+	sqlite3_prepare_v2(db,
+	                   "SELECT dictionary FROM message_log_dictionary "
+	                   "WHERE id = ?1;",
+	                   -1, &statement, NULL);
+	if(statement == NULL) {
+		return NULL;
 	}
-	if(purple_strequal(content_type, "markdown")) {
-		return PURPLE_MESSAGE_CONTENT_TYPE_MARKDOWN;
+
+	sqlite3_bind_int(statement, 1, id);
+	if(sqlite3_step(statement) == SQLITE_ROW) {
+		dictionary = g_bytes_new(sqlite3_column_blob(statement, 0),
+		                         sqlite3_column_bytes(statement, 0));
+		g_hash_table_insert(codec->dictionaries, GUINT_TO_POINTER(id),
+		                    dictionary);
 	}
-	return PURPLE_MESSAGE_CONTENT_TYPE_PLAIN;
+
+	sqlite3_finalize(statement);
+
+	return dictionary;
 }
 
-static sqlite3_stmt *
-purple_sqlite_history_adapter_build_query(PurpleSqliteHistoryAdapter *adapter,
-                                          const gchar * search_query,
-                                          gboolean remove,
-                                          GError **error)
+/* purple_history_content(content) returns the text of a content column,
+ * decompressing it if it is a blob.
+ */
+static void
+purple_sqlite_history_adapter_content_func(sqlite3_context *context,
+                                           G_GNUC_UNUSED int argc,
+                                           sqlite3_value **argv)
 {
-	gchar **split = NULL;
-	gint i = 0;
-	GList *ins = NULL;
-	GList *froms = NULL;
-	GList *keywords = NULL;
-	GString *query = NULL;
-	GList *iter = NULL;
-	gboolean first = FALSE;
-	sqlite3_stmt *prepared_statement = NULL;
-	gint index = 1;
-	gint query_items = 0;
+	PurpleSqliteHistoryAdapterCodec *codec = sqlite3_user_data(context);
+	GByteArray *output = NULL;
+	const guint8 *data = NULL;
+	gsize length = 0;
+	gint rc = Z_OK;
 
-	split = g_strsplit(search_query, " ", -1);
-	for(i = 0; split[i] != NULL; i++) {
-		if(g_str_has_prefix(split[i], "in:")) {
-			if(split[i][3] == '\0') {
-				continue;
-			}
-			ins = g_list_prepend(ins, g_strdup(split[i]+3));
-			query_items++;
-		} else if(g_str_has_prefix(split[i], "from:")) {
-			if(split[i][5] == '\0') {
-				continue;
-			}
-			froms = g_list_prepend(froms, g_strdup(split[i]+5));
-			query_items++;
-		} else {
-			if(split[i][0] == '\0') {
-				continue;
-			}
-			keywords = g_list_prepend(keywords,
-			                          g_strdup_printf("%%%s%%", split[i]));
-			query_items++;
-		}
-	}
+	if(sqlite3_value_type(argv[0]) != SQLITE_BLOB) {
+		sqlite3_result_value(context, argv[0]);
 
-	g_clear_pointer(&split, g_strfreev);
+		return;
+	}
 
-	if(remove) {
-		if(query_items != 0) {
-			query = g_string_new("DELETE FROM message_log WHERE TRUE\n");
-		} else {
-			g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
-			            "Attempting to remove messages without "
-			            "query parameters.");
+	data = sqlite3_value_blob(argv[0]);
+	length = sqlite3_value_bytes(argv[0]);
+	if(length < 1) {
+		sqlite3_result_error(context, "corrupt compressed message content",
+		                     -1);
 
-			return NULL;
-		}
-	} else {
-		query = g_string_new("SELECT "
-		                     "message_id, author, author_name_color, "
-		                     "author_alias, recipient, content_type, "
-		                     "content, client_timestamp "
-		                     "FROM message_log WHERE TRUE\n");
+		return;
 	}
 
-	if(ins != NULL) {
-		first = TRUE;
-		g_string_append(query, "AND (conversation_id IN (");
-		for(iter = ins; iter != NULL; iter = iter->next) {
-			if(!first) {
-				g_string_append(query, ", ");
-			}
-			first = FALSE;
-			g_string_append(query, "?");
+	inflateReset(&codec->inflater);
+
+	if(data[0] != 0) {
+		GBytes *dictionary = NULL;
+
+		dictionary = purple_sqlite_history_adapter_codec_get_dictionary(codec,
+		                                                                sqlite3_context_db_handle(context),
+		                                                                data[0]);
+		if(dictionary == NULL) {
+			sqlite3_result_error(context,
+			                     "unknown compression dictionary", -1);
+
+			return;
 		}
-		g_string_append(query, "))");
+
+		inflateSetDictionary(&codec->inflater,
+		                     g_bytes_get_data(dictionary, NULL),
+		                     g_bytes_get_size(dictionary));
 	}
 
-	if(froms != NULL) {
-		first = TRUE;
-		g_string_append(query, "AND (author IN (");
-		for(iter = froms; iter != NULL; iter = iter->next) {
-			if(!first) {
-				g_string_append(query, ", ");
-			}
-			first = FALSE;
-			g_string_append(query, "?");
+	output = g_byte_array_sized_new(length * 4);
+	codec->inflater.next_in = (Bytef *)data + 1;
+	codec->inflater.avail_in = length - 1;
+
+	do {
+		guint8 buffer[4096];
+
+		codec->inflater.next_out = buffer;
+		codec->inflater.avail_out = sizeof(buffer);
+
+		rc = inflate(&codec->inflater, Z_NO_FLUSH);
+		if(rc != Z_OK && rc != Z_STREAM_END) {
+			break;
 		}
-		g_string_append(query, "))");
+
+		g_byte_array_append(output, buffer,
+		                    sizeof(buffer) - codec->inflater.avail_out);
+	} while(rc != Z_STREAM_END);
+
+	if(rc != Z_STREAM_END) {
+		g_byte_array_free(output, TRUE);
+		sqlite3_result_error(context, "corrupt compressed message content",
+		                     -1);
+
+		return;
 	}
 
-	if(keywords != NULL) {
-		first = TRUE;
-		g_string_append(query, "AND (");
-		for(iter = keywords; iter != NULL; iter = iter->next) {
-			if(!first) {
-				g_string_append(query, " OR ");
-			}
-			first = FALSE;
-			g_string_append(query, " content LIKE ? ");
-		}
-		g_string_append(query, ")");
+	length = output->len;
+	sqlite3_result_text(context,
+	                    (const char *)g_byte_array_free(output, FALSE),
+	                    length, g_free);
+}
+
+/* purple_history_compress(content) returns content compressed as a blob if
+ * that makes it smaller and content unchanged otherwise.
+ */
+static void
+purple_sqlite_history_adapter_compress_func(sqlite3_context *context,
+                                            G_GNUC_UNUSED int argc,
+                                            sqlite3_value **argv)
+{
+	PurpleSqliteHistoryAdapterCodec *codec = sqlite3_user_data(context);
+	const guint8 *text = NULL;
+	guint8 *compressed = NULL;
+	guint8 id = 0;
+	gsize length = 0;
+
+	if(sqlite3_value_type(argv[0]) != SQLITE_TEXT) {
+		sqlite3_result_value(context, argv[0]);
+
+		return;
 	}
-	g_string_append(query, ";");
 
-	sqlite3_prepare_v2(adapter->db, query->str, -1, &prepared_statement, NULL);
+	text = sqlite3_value_text(argv[0]);
+	length = sqlite3_value_bytes(argv[0]);
+	if(length < PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_THRESHOLD) {
+		sqlite3_result_value(context, argv[0]);
 
-	g_string_free(query, TRUE);
+		return;
+	}
 
-	if(prepared_statement == NULL) {
-		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
-		            "Error creating the prepared statement: %s",
-		            sqlite3_errmsg(adapter->db));
+	deflateReset(&codec->deflater);
 
-		g_list_free_full(ins, g_free);
-		g_list_free_full(froms, g_free);
-		g_list_free_full(keywords, g_free);
+	/* Most messages are a single short line that only shrinks when it can
+	 * refer to earlier messages, which is what the dictionary is made of.
+	 */
+	if(codec->dictionary_id != 0) {
+		GBytes *dictionary = NULL;
 
-		return NULL;
+		dictionary = purple_sqlite_history_adapter_codec_get_dictionary(codec,
+		                                                                sqlite3_context_db_handle(context),
+		                                                                codec->dictionary_id);
+		if(dictionary != NULL) {
+			deflateSetDictionary(&codec->deflater,
+			                     g_bytes_get_data(dictionary, NULL),
+			                     g_bytes_get_size(dictionary));
+			id = codec->dictionary_id;
+		}
 	}
 
-	while(ins != NULL) {
-		sqlite3_bind_text(prepared_statement, index++,
-		                  (const char *)ins->data, -1, g_free);
-		ins = g_list_delete_link(ins, ins);
+	/* Anything that does not fit in less than the text is not worth it. */
+	compressed = g_malloc(length);
+	compressed[0] = id;
+	codec->deflater.next_in = (Bytef *)text;
+	codec->deflater.avail_in = length;
+	codec->deflater.next_out = compressed + 1;
+	codec->deflater.avail_out = length - 1;
+
+	if(deflate(&codec->deflater, Z_FINISH) != Z_STREAM_END) {
+		g_free(compressed);
+		sqlite3_result_value(context, argv[0]);
+
+		return;
 	}
 
-	while(froms != NULL) {
-		sqlite3_bind_text(prepared_statement, index++,
-		                  (const char *)froms->data, -1, g_free);
-		froms = g_list_delete_link(froms, froms);
-	}
+	sqlite3_result_blob(context, compressed,
+	                    length - codec->deflater.avail_out, g_free);
+}
+
+/* Registers the functions that the schema may depend on. This has to be done
+ * for every connection before anything touches message_log. Each connection
+ * gets its own codec, which db owns and which is returned in codec if it is
+ * not NULL.
+ */
+static gboolean
+purple_sqlite_history_adapter_register_functions(sqlite3 *db,
+                                                 PurpleSqliteHistoryAdapterCodec **codec,
+                                                 GError **error)
+{
+	PurpleSqliteHistoryAdapterCodec *new_codec = NULL;
+	gint rc = 0;
+
+	new_codec = purple_sqlite_history_adapter_codec_new();
+	if(new_codec == NULL) {
+		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                    "Error initializing zlib");
+
+		return FALSE;
+	}
+
+	/* Both functions share the codec, so only the second one frees it. That
+	 * also happens if registering it fails.
+	 */
+	rc = sqlite3_create_function_v2(db, "purple_history_content", 1,
+	                                SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+	                                new_codec,
+	                                purple_sqlite_history_adapter_content_func,
+	                                NULL, NULL, NULL);
+	if(rc != SQLITE_OK) {
+		purple_sqlite_history_adapter_codec_free(new_codec);
+	} else {
+		rc = sqlite3_create_function_v2(db, "purple_history_compress", 1,
+		                                SQLITE_UTF8, new_codec,
+		                                purple_sqlite_history_adapter_compress_func,
+		                                NULL, NULL,
+		                                (GDestroyNotify)purple_sqlite_history_adapter_codec_free);
+	}
+
+	if(rc != SQLITE_OK) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error registering functions: %s", sqlite3_errmsg(db));
+
+		return FALSE;
+	}
+
+	if(codec != NULL) {
+		*codec = new_codec;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+purple_sqlite_history_adapter_run_migrations(PurpleSqliteHistoryAdapter *adapter,
+                                             GError **error)
+{
+	const char *path = "/im/pidgin/libpurple/sqlitehistoryadapter";
+	const char *migrations[] = {
+		"01-schema.sql",
+		"02-indexes.sql",
+		"03-fts.sql",
+		"04-message-id.sql",
+		"05-compression.sql",
+		"06-fts-progress.sql",
+		"07-conversation-time.sql",
+		NULL
+	};
+
+	return purple_sqlite3_run_migrations_from_resources(adapter->db, path,
+	                                                    migrations, error);
+}
+
+/* Runs a pragma that returns a single integer and returns it, or -1 on
+ * error.
+ */
+static gint64
+purple_sqlite_history_adapter_get_pragma(sqlite3 *db, const gchar *pragma) {
+	sqlite3_stmt *statement = NULL;
+	gchar *sql = NULL;
+	gint64 value = -1;
+
+	sql = g_strdup_printf("PRAGMA %s;", pragma);
+	sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+	g_free(sql);
+
+	if(statement == NULL) {
+		return -1;
+	}
+
+	if(sqlite3_step(statement) == SQLITE_ROW) {
+		value = sqlite3_column_int64(statement, 0);
+	}
+
+	sqlite3_finalize(statement);
+
+	return value;
+}
+
+static gboolean
+purple_sqlite_history_adapter_apply_synchronous(PurpleSqliteHistoryAdapter *adapter,
+                                                GError **error)
+{
+	const gchar *levels[] = {"OFF", "NORMAL", "FULL", "EXTRA"};
+	gchar *errmsg = NULL;
+	gchar *sql = NULL;
+
+	sql = g_strdup_printf("PRAGMA synchronous=%s;",
+	                      levels[adapter->synchronous]);
+	sqlite3_exec(adapter->db, sql, NULL, NULL, &errmsg);
+	g_free(sql);
+
+	if(errmsg != NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error setting the synchronous level: %s", errmsg);
+		sqlite3_free(errmsg);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+purple_sqlite_history_adapter_configure(PurpleSqliteHistoryAdapter *adapter,
+                                        GError **error)
+{
+	gchar *errmsg = NULL;
+
+	/* Write ahead logging lets readers continue while the writer thread is
+	 * committing and makes each commit a single append to the log. In-memory
+	 * databases silently stay in memory journal mode.
+	 */
+	sqlite3_exec(adapter->db, "PRAGMA journal_mode=WAL;", NULL, NULL, &errmsg);
+	if(errmsg != NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error enabling write ahead logging: %s", errmsg);
+		sqlite3_free(errmsg);
+
+		return FALSE;
+	}
+
+	return purple_sqlite_history_adapter_apply_synchronous(adapter, error);
+}
+
+/* Opens the read only connection that queries use. This must be called after
+ * the migrations have been run and the main connection has switched the
+ * database to write ahead logging, which is what allows readers to run
+ * alongside the writer thread.
+ */
+static void
+purple_sqlite_history_adapter_open_reader(PurpleSqliteHistoryAdapter *adapter)
+{
+	GError *error = NULL;
+	gint rc = 0;
+
+	if(adapter->filename[0] == '\0' ||
+	   purple_strequal(adapter->filename, ":memory:"))
+	{
+		return;
+	}
+
+	rc = sqlite3_open_v2(adapter->filename, &adapter->read_db,
+	                     SQLITE_OPEN_READONLY, NULL);
+	if(rc != SQLITE_OK) {
+		g_warning("failed to open a read only connection to %s, queries "
+		          "will use the main connection: %s", adapter->filename,
+		          sqlite3_errmsg(adapter->read_db));
+		g_clear_pointer(&adapter->read_db, sqlite3_close);
+
+		return;
+	}
+
+	if(!purple_sqlite_history_adapter_register_functions(adapter->read_db,
+	                                                     NULL, &error))
+	{
+		g_warning("failed to set up the read only connection to %s, queries "
+		          "will use the main connection: %s", adapter->filename,
+		          error->message);
+		g_clear_error(&error);
+		g_clear_pointer(&adapter->read_db, sqlite3_close);
+
+		return;
+	}
+
+	adapter->read_statements = purple_sqlite_history_adapter_statement_cache_new();
+}
+
+static void
+purple_sqlite_history_adapter_close(PurpleSqliteHistoryAdapter *adapter) {
+	g_clear_handle_id(&adapter->compaction_source, g_source_remove);
+	adapter->compacting = FALSE;
+
+	/* Wait for any running query and keep new ones out until both connections
+	 * are closed.
+	 */
+	g_mutex_lock(&adapter->read_lock);
+
+	g_clear_pointer(&adapter->read_statements,
+	                purple_sqlite_history_adapter_statement_cache_free);
+	g_clear_pointer(&adapter->read_db, sqlite3_close);
+
+	purple_sqlite_history_adapter_stop_writer(adapter);
+	g_clear_pointer(&adapter->statements,
+	                purple_sqlite_history_adapter_statement_cache_free);
+	g_clear_pointer(&adapter->db, sqlite3_close);
+
+	/* Closing the database freed the codec. */
+	adapter->codec = NULL;
+	adapter->compressed_index = FALSE;
+
+	g_mutex_unlock(&adapter->read_lock);
+}
+
+static void
+purple_sqlite_history_adapter_row_free(PurpleSqliteHistoryAdapterRow *row) {
+	g_free(row->protocol);
+	g_free(row->account);
+	g_free(row->conversation_id);
+	g_free(row->message_id);
+	g_free(row->author);
+	g_free(row->author_name_color);
+	g_free(row->author_alias);
+	g_free(row->recipient);
+	g_free(row->content);
+	g_free(row->timestamp);
+
+	g_free(row);
+}
+
+static gboolean
+purple_sqlite_history_adapter_insert_row(PurpleSqliteHistoryAdapter *adapter,
+                                         sqlite3_stmt *statement,
+                                         PurpleSqliteHistoryAdapterRow *row,
+                                         gboolean compress, GError **error)
+{
+	gint result = 0;
+
+	sqlite3_bind_text(statement, 1, row->protocol, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 2, row->account, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 3, row->conversation_id, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 4, row->message_id, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 5, row->author, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 6, row->author_name_color, -1,
+	                  SQLITE_STATIC);
+	sqlite3_bind_text(statement, 7, row->author_alias, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 8, row->recipient, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 9, row->content_type, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 10, row->content, -1, SQLITE_STATIC);
+	sqlite3_bind_text(statement, 11, row->timestamp, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(statement, 12, row->timestamp_us);
+	sqlite3_bind_int(statement, 13, compress);
+
+	result = sqlite3_step(statement);
+
+	if(result != SQLITE_DONE) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error writing to the history database: %s",
+		            sqlite3_errmsg(adapter->db));
+	}
+
+	sqlite3_reset(statement);
+	sqlite3_clear_bindings(statement);
+
+	return result == SQLITE_DONE;
+}
+
+/* Writes every row in batch in a single transaction and returns the number of
+ * rows that were committed. If any of them could not be written, error is
+ * set to the first failure.
+ */
+static guint
+purple_sqlite_history_adapter_commit(PurpleSqliteHistoryAdapter *adapter,
+                                     GQueue *batch, GError **error)
+{
+	PurpleSqliteHistoryAdapterRow *row = NULL;
+	sqlite3_stmt *statement = NULL;
+	gchar *errmsg = NULL;
+	gboolean compress = FALSE;
+	guint written = 0;
+
+	g_mutex_lock(&adapter->db_lock);
+
+	/* Until the search index can read compressed content, it is not written
+	 * any.
+	 */
+	compress = (adapter->compression != PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE &&
+	            adapter->compressed_index);
+
+	if(adapter->write_mode == PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE_REPLACE) {
+		statement = adapter->upsert_statement;
+	} else {
+		statement = adapter->insert_statement;
+	}
+
+	sqlite3_exec(adapter->db, "BEGIN;", NULL, NULL, &errmsg);
+	if(errmsg != NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error starting a history transaction: %s", errmsg);
+		sqlite3_free(errmsg);
+
+		g_queue_clear_full(batch,
+		                   (GDestroyNotify)purple_sqlite_history_adapter_row_free);
+		g_mutex_unlock(&adapter->db_lock);
+
+		return 0;
+	}
+
+	while((row = g_queue_pop_head(batch)) != NULL) {
+		GError *row_error = NULL;
+
+		if(purple_sqlite_history_adapter_insert_row(adapter, statement, row,
+		                                            compress, &row_error))
+		{
+			written++;
+		} else if(error != NULL && *error == NULL) {
+			g_propagate_error(error, row_error);
+		} else {
+			g_error_free(row_error);
+		}
+
+		purple_sqlite_history_adapter_row_free(row);
+	}
+
+	sqlite3_exec(adapter->db, "COMMIT;", NULL, NULL, &errmsg);
+	if(errmsg != NULL) {
+		/* Nothing from this batch made it to the database. */
+		g_clear_error(error);
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error committing a history transaction: %s", errmsg);
+		sqlite3_free(errmsg);
+
+		sqlite3_exec(adapter->db, "ROLLBACK;", NULL, NULL, NULL);
+
+		written = 0;
+	}
+
+	g_mutex_unlock(&adapter->db_lock);
+
+	return written;
+}
+
+static gpointer
+purple_sqlite_history_adapter_writer_thread(gpointer data) {
+	PurpleSqliteHistoryAdapter *adapter = data;
+	PurpleSqliteHistoryAdapterJob *job = NULL;
+	GQueue jobs = G_QUEUE_INIT;
+
+	g_mutex_lock(&adapter->lock);
+
+	while(TRUE) {
+		GQueue batch = G_QUEUE_INIT;
+		GError *error = NULL;
+		gint64 deadline = 0;
+		guint n_rows = 0;
+		guint written = 0;
+
+		while(g_queue_is_empty(adapter->pending) &&
+		      g_queue_is_empty(adapter->jobs) && !adapter->stopping)
+		{
+			g_cond_wait(&adapter->cond, &adapter->lock);
+		}
+
+		if(g_queue_is_empty(adapter->pending)) {
+			if(adapter->stopping) {
+				/* Everything has been written, the remaining jobs are
+				 * cancelled below.
+				 */
+				break;
+			}
+
+			/* Messages always go first, so maintenance only runs while
+			 * nothing is waiting to be written.
+			 */
+			job = g_queue_pop_head(adapter->jobs);
+			g_mutex_unlock(&adapter->lock);
+
+			job->func(job->task, g_task_get_source_object(job->task),
+			          g_task_get_task_data(job->task),
+			          g_task_get_cancellable(job->task));
+			g_object_unref(job->task);
+			g_free(job);
+
+			g_mutex_lock(&adapter->lock);
+
+			continue;
+		}
+
+		/* Give other messages a chance to join this transaction unless
+		 * someone is waiting on us or the queue is already full.
+		 */
+		deadline = g_get_monotonic_time() +
+		           adapter->commit_interval * G_TIME_SPAN_MILLISECOND;
+		while(!adapter->stopping && adapter->flush_waiters == 0 &&
+		      adapter->pending->length < PURPLE_SQLITE_HISTORY_ADAPTER_MAX_PENDING)
+		{
+			if(!g_cond_wait_until(&adapter->cond, &adapter->lock, deadline)) {
+				break;
+			}
+		}
+
+		/* Steal everything that's pending and wake up any writers that were
+		 * waiting for space in the queue.
+		 */
+		batch = *adapter->pending;
+		g_queue_init(adapter->pending);
+		n_rows = batch.length;
+		g_cond_broadcast(&adapter->cond);
+
+		g_mutex_unlock(&adapter->lock);
+		written = purple_sqlite_history_adapter_commit(adapter, &batch,
+		                                               &error);
+		g_mutex_lock(&adapter->lock);
+
+		adapter->committed += written;
+		adapter->failed += n_rows - written;
+
+		/* Keep the first failure around until a flush reports it. */
+		if(error != NULL) {
+			if(adapter->write_error == NULL) {
+				adapter->write_error = error;
+			} else {
+				g_error_free(error);
+			}
+		}
+
+		g_cond_broadcast(&adapter->cond);
+	}
+
+	jobs = *adapter->jobs;
+	g_queue_init(adapter->jobs);
+
+	g_mutex_unlock(&adapter->lock);
+
+	while((job = g_queue_pop_head(&jobs)) != NULL) {
+		g_task_return_new_error(job->task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+		                        "The history adapter was deactivated");
+		g_object_unref(job->task);
+		g_free(job);
+	}
+
+	return NULL;
+}
+
+/* Queues task to run func on the writer thread, see
+ * PurpleSqliteHistoryAdapterJob.
+ */
+static void
+purple_sqlite_history_adapter_queue_job(PurpleSqliteHistoryAdapter *adapter,
+                                        GTask *task, GTaskThreadFunc func)
+{
+	PurpleSqliteHistoryAdapterJob *job = NULL;
+
+	job = g_new(PurpleSqliteHistoryAdapterJob, 1);
+	job->task = g_object_ref(task);
+	job->func = func;
+
+	g_mutex_lock(&adapter->lock);
+	g_queue_push_tail(adapter->jobs, job);
+	g_cond_broadcast(&adapter->cond);
+	g_mutex_unlock(&adapter->lock);
+}
+
+static gboolean
+purple_sqlite_history_adapter_start_writer(PurpleSqliteHistoryAdapter *adapter,
+                                           GError **error)
+{
+	const gchar *insert = NULL;
+	const gchar *upsert = NULL;
+
+	/* Both statements rely on the unique index on the account, conversation
+	 * and message id, so a redelivered message never adds another row. The
+	 * thirteenth parameter says whether to compress the content.
+	 */
+	insert = "INSERT OR IGNORE INTO message_log(protocol, account, "
+	         "conversation_id, message_id, author, author_name_color, "
+	         "author_alias, recipient, content_type, content, "
+	         "client_timestamp, client_timestamp_us) "
+	         "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, "
+	         "CASE WHEN ?13 THEN purple_history_compress(?10) ELSE ?10 END, "
+	         "?11, ?12)";
+	upsert = "INSERT INTO message_log(protocol, account, conversation_id, "
+	         "message_id, author, author_name_color, author_alias, "
+	         "recipient, content_type, content, client_timestamp, "
+	         "client_timestamp_us) "
+	         "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, "
+	         "CASE WHEN ?13 THEN purple_history_compress(?10) ELSE ?10 END, "
+	         "?11, ?12) "
+	         "ON CONFLICT(account, conversation_id, message_id) DO UPDATE SET "
+	         "author = excluded.author, "
+	         "author_name_color = excluded.author_name_color, "
+	         "author_alias = excluded.author_alias, "
+	         "recipient = excluded.recipient, "
+	         "content_type = excluded.content_type, "
+	         "content = excluded.content";
+
+	sqlite3_prepare_v2(adapter->db, insert, -1, &adapter->insert_statement,
+	                   NULL);
+	sqlite3_prepare_v2(adapter->db, upsert, -1, &adapter->upsert_statement,
+	                   NULL);
+	if(adapter->insert_statement == NULL || adapter->upsert_statement == NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error creating the prepared statement: %s",
+		            sqlite3_errmsg(adapter->db));
+
+		g_clear_pointer(&adapter->insert_statement, sqlite3_finalize);
+		g_clear_pointer(&adapter->upsert_statement, sqlite3_finalize);
+
+		return FALSE;
+	}
+
+	adapter->stopping = FALSE;
+	adapter->writer = g_thread_try_new("purple-history-writer",
+	                                   purple_sqlite_history_adapter_writer_thread,
+	                                   adapter, error);
+	if(adapter->writer == NULL) {
+		g_clear_pointer(&adapter->insert_statement, sqlite3_finalize);
+		g_clear_pointer(&adapter->upsert_statement, sqlite3_finalize);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+purple_sqlite_history_adapter_stop_writer(PurpleSqliteHistoryAdapter *adapter)
+{
+	if(adapter->writer == NULL) {
+		return;
+	}
+
+	/* The writer thread drains the queue before it exits. */
+	g_mutex_lock(&adapter->lock);
+	adapter->stopping = TRUE;
+	g_cond_broadcast(&adapter->cond);
+	g_mutex_unlock(&adapter->lock);
+
+	g_clear_pointer(&adapter->writer, g_thread_join);
+	g_clear_pointer(&adapter->insert_statement, sqlite3_finalize);
+	g_clear_pointer(&adapter->upsert_statement, sqlite3_finalize);
+}
+
+/* Blocks until every message that was queued before this was called has been
+ * handled by the writer thread, whether it could be written or not.
+ */
+static void
+purple_sqlite_history_adapter_wait_for_writer(PurpleSqliteHistoryAdapter *adapter)
+{
+	guint64 target = 0;
+
+	g_mutex_lock(&adapter->lock);
+
+	if(adapter->writer == NULL) {
+		g_mutex_unlock(&adapter->lock);
+
+		return;
+	}
+
+	/* Anything written after this point isn't our concern. */
+	target = adapter->queued;
+	adapter->flush_waiters++;
+	g_cond_broadcast(&adapter->cond);
+
+	while(adapter->committed + adapter->failed < target) {
+		g_cond_wait(&adapter->cond, &adapter->lock);
+	}
+
+	adapter->flush_waiters--;
+
+	g_mutex_unlock(&adapter->lock);
+}
+
+static void
+purple_sqlite_history_adapter_flush_thread(GTask *task, gpointer source_object,
+                                           G_GNUC_UNUSED gpointer task_data,
+                                           G_GNUC_UNUSED GCancellable *cancellable)
+{
+	GError *error = NULL;
+
+	if(purple_sqlite_history_adapter_flush(source_object, &error)) {
+		g_task_return_boolean(task, TRUE);
+	} else {
+		g_task_return_error(task, error);
+	}
+}
+
+static gchar *
+purple_sqlite_history_adapter_get_content_type(PurpleMessageContentType content_type) {
+	switch(content_type) {
+		case PURPLE_MESSAGE_CONTENT_TYPE_PLAIN:
+			return "plain";
+			break;
+		case PURPLE_MESSAGE_CONTENT_TYPE_HTML:
+			return "html";
+			break;
+		case PURPLE_MESSAGE_CONTENT_TYPE_XHTML:
+			return "xhtml";
+			break;
+		case PURPLE_MESSAGE_CONTENT_TYPE_MARKDOWN:
+			return "markdown";
+			break;
+		default:
+			return "";
+			break;
+	}
+}
+
+static PurpleMessageContentType
+purple_sqlite_history_adapter_get_content_type_enum(const gchar *content_type)
+{
+	if(purple_strequal(content_type, "plain")) {
+		return PURPLE_MESSAGE_CONTENT_TYPE_PLAIN;
+	}
+	if(purple_strequal(content_type, "html")) {
+		return PURPLE_MESSAGE_CONTENT_TYPE_HTML;
+	}
+	if(purple_strequal(content_type, "xhtml")) {
+		return PURPLE_MESSAGE_CONTENT_TYPE_XHTML;
+	}
+	if(purple_strequal(content_type, "markdown")) {
+		return PURPLE_MESSAGE_CONTENT_TYPE_MARKDOWN;
+	}
+	return PURPLE_MESSAGE_CONTENT_TYPE_PLAIN;
+}
+
+static gint64
+purple_sqlite_history_adapter_date_time_to_usec(GDateTime *date_time) {
+	gint64 usec = 0;
+
+	usec = g_date_time_to_unix(date_time) * G_USEC_PER_SEC;
+	usec += g_date_time_get_microsecond(date_time);
+
+	return usec;
+}
+
+/* Parses the value of a before: or after: term. Both full ISO 8601 date times
+ * and plain dates are accepted, values without a timezone are treated as
+ * local time.
+ */
+static gboolean
+purple_sqlite_history_adapter_parse_time(const gchar *value, gint64 *usec) {
+	GDateTime *date_time = NULL;
+	GTimeZone *tz = g_time_zone_new_local();
+
+	date_time = g_date_time_new_from_iso8601(value, tz);
+	if(date_time == NULL) {
+		gchar *full = g_strdup_printf("%sT00:00:00", value);
+
+		date_time = g_date_time_new_from_iso8601(full, tz);
+
+		g_free(full);
+	}
+
+	g_time_zone_unref(tz);
+
+	if(date_time == NULL) {
+		return FALSE;
+	}
+
+	*usec = purple_sqlite_history_adapter_date_time_to_usec(date_time);
+
+	g_date_time_unref(date_time);
+
+	return TRUE;
+}
+
+static GQuark
+purple_sqlite_history_adapter_snippet_quark(void) {
+	return g_quark_from_static_string("purple-sqlite-history-adapter-snippet");
+}
+
+/* Turns a keyword into an FTS5 prefix query, quoting it so that any FTS5
+ * syntax in the keyword is matched literally.
+ */
+static gchar *
+purple_sqlite_history_adapter_quote_keyword(const gchar *keyword) {
+	GString *quoted = g_string_new("\"");
+
+	for(const gchar *p = keyword; *p != '\0'; p++) {
+		if(*p == '"') {
+			g_string_append_c(quoted, '"');
+		}
+		g_string_append_c(quoted, *p);
+	}
+
+	g_string_append(quoted, "\"*");
+
+	return g_string_free(quoted, FALSE);
+}
+
+/* Splits a query into its terms. Spaces between double quotes do not end a
+ * term and a backslash between them escapes the next character, so values
+ * like in:"#pidgin room" can contain anything. The quotes themselves are not
+ * part of the term.
+ */
+static gchar **
+purple_sqlite_history_adapter_split_query(const gchar *query) {
+	GPtrArray *terms = g_ptr_array_new();
+	GString *term = g_string_new(NULL);
+	gboolean quoted = FALSE;
+
+	for(const gchar *p = query; TRUE; p++) {
+		if(*p == '\0' || (*p == ' ' && !quoted)) {
+			g_ptr_array_add(terms, g_strndup(term->str, term->len));
+			g_string_truncate(term, 0);
+
+			if(*p == '\0') {
+				break;
+			}
+		} else if(*p == '"') {
+			quoted = !quoted;
+		} else if(*p == '\\' && quoted && p[1] != '\0') {
+			p++;
+			g_string_append_c(term, *p);
+		} else {
+			g_string_append_c(term, *p);
+		}
+	}
+
+	g_string_free(term, TRUE);
+	g_ptr_array_add(terms, NULL);
+
+	return (gchar **)g_ptr_array_free(terms, FALSE);
+}
+
+static sqlite3_stmt *
+purple_sqlite_history_adapter_prepare_query(sqlite3 *db, gboolean remove,
+                                            GList *ins, GList *accounts,
+                                            GList *froms,
+                                            gboolean keywords,
+                                            gboolean has_after,
+                                            gboolean has_before,
+                                            gboolean has_before_id,
+                                            const PurpleSqliteHistoryAdapterCursor *after,
+                                            gboolean limited,
+                                            gboolean last)
+{
+	GString *query = NULL;
+	GList *iter = NULL;
+	gboolean first = FALSE;
+	sqlite3_stmt *prepared_statement = NULL;
+
+	if(remove) {
+		query = g_string_new("DELETE FROM message_log WHERE TRUE\n");
+	} else if(keywords) {
+		/* Keyword searches go through the full text index, ranking the
+		 * results by relevance and including a snippet of the match.
+		 */
+		query = g_string_new("SELECT "
+		                     "message_log.message_id, message_log.author, "
+		                     "message_log.author_name_color, "
+		                     "message_log.author_alias, "
+		                     "message_log.recipient, "
+		                     "message_log.content_type, "
+		                     "purple_history_content(message_log.content), "
+		                     "IFNULL(message_log.client_timestamp_us, "
+		                     "message_log.client_timestamp), "
+		                     "message_log.rowid, "
+		                     "snippet(message_log_fts, 0, '<b>', '</b>', "
+		                     "'...', 16) "
+		                     "FROM message_log JOIN message_log_fts "
+		                     "ON message_log_fts.rowid = message_log.rowid "
+		                     "WHERE TRUE\n");
+	} else {
+		query = g_string_new("SELECT "
+		                     "message_id, author, author_name_color, "
+		                     "author_alias, recipient, content_type, "
+		                     "purple_history_content(content), "
+		                     "IFNULL(client_timestamp_us, client_timestamp), "
+		                     "rowid "
+		                     "FROM message_log WHERE TRUE\n");
+	}
+
+	if(ins != NULL) {
+		first = TRUE;
+		g_string_append(query, "AND (message_log.conversation_id IN (");
+		for(iter = ins; iter != NULL; iter = iter->next) {
+			if(!first) {
+				g_string_append(query, ", ");
+			}
+			first = FALSE;
+			g_string_append(query, "?");
+		}
+		g_string_append(query, "))");
+	}
+
+	if(accounts != NULL) {
+		first = TRUE;
+		g_string_append(query, "AND (message_log.account IN (");
+		for(iter = accounts; iter != NULL; iter = iter->next) {
+			if(!first) {
+				g_string_append(query, ", ");
+			}
+			first = FALSE;
+			g_string_append(query, "?");
+		}
+		g_string_append(query, "))");
+	}
+
+	if(froms != NULL) {
+		first = TRUE;
+		g_string_append(query, "AND (message_log.author IN (");
+		for(iter = froms; iter != NULL; iter = iter->next) {
+			if(!first) {
+				g_string_append(query, ", ");
+			}
+			first = FALSE;
+			g_string_append(query, "?");
+		}
+		g_string_append(query, "))");
+	}
+
+	if(keywords) {
+		if(remove) {
+			g_string_append(query,
+			                "AND (message_log.rowid IN ("
+			                "SELECT rowid FROM message_log_fts "
+			                "WHERE message_log_fts MATCH ?))");
+		} else {
+			g_string_append(query, "AND (message_log_fts MATCH ?)");
+		}
+	}
+
+	if(has_after) {
+		g_string_append(query, "AND (message_log.client_timestamp_us >= ?)");
+	}
+
+	if(has_before && has_before_id) {
+		/* Messages written at the same time as the message with the given id
+		 * are ordered by their rowid, just like the results of last:.
+		 */
+		g_string_append(query,
+		                "AND (message_log.client_timestamp_us < ? OR "
+		                "(message_log.client_timestamp_us = ? AND "
+		                "message_log.rowid < ("
+		                "SELECT boundary.rowid FROM message_log AS boundary "
+		                "WHERE boundary.account = message_log.account "
+		                "AND boundary.conversation_id = "
+		                "message_log.conversation_id "
+		                "AND boundary.message_id = ?)))");
+	} else if(has_before) {
+		g_string_append(query, "AND (message_log.client_timestamp_us < ?)");
+	}
+
+	if(after != NULL && after->has_timestamp) {
+		g_string_append(query,
+		                "AND ((message_log.client_timestamp_us, "
+		                "message_log.rowid) > (?, ?))");
+	} else if(after != NULL) {
+		/* Everything that has a timestamp comes after the rows that don't. */
+		g_string_append(query,
+		                "AND (message_log.client_timestamp_us IS NOT NULL OR "
+		                "message_log.rowid > ?)");
+	}
+
+	/* Paged queries continue after the timestamp and rowid of the last
+	 * message of the previous page, so they have to be ordered by those, even
+	 * when they search for keywords. The timestamp indexes end with the rowid,
+	 * so this is the order they are already in.
+	 */
+	if(limited) {
+		g_string_append(query,
+		                "\nORDER BY message_log.client_timestamp_us, "
+		                "message_log.rowid LIMIT ?");
+	} else if(last) {
+		/* Pick the most recent messages and then put them back into
+		 * chronological order, the timestamp and rowid being the eighth and
+		 * ninth columns.
+		 */
+		g_string_prepend(query, "SELECT * FROM (");
+		g_string_append(query,
+		                "\nORDER BY message_log.client_timestamp_us DESC, "
+		                "message_log.rowid DESC LIMIT ?)"
+		                "\nORDER BY 8, 9");
+	} else if(keywords && !remove) {
+		g_string_append(query, "\nORDER BY bm25(message_log_fts)");
+	}
+	g_string_append(query, ";");
+
+	sqlite3_prepare_v2(db, query->str, -1, &prepared_statement, NULL);
+
+	g_string_free(query, TRUE);
+
+	return prepared_statement;
+}
+
+static sqlite3_stmt *
+purple_sqlite_history_adapter_build_query(sqlite3 *db,
+                                          PurpleSqliteHistoryAdapterStatementCache *cache,
+                                          const gchar * search_query,
+                                          gboolean remove,
+                                          const PurpleSqliteHistoryAdapterCursor *after,
+                                          guint limit,
+                                          GError **error)
+{
+	gchar **split = NULL;
+	gint i = 0;
+	GList *ins = NULL;
+	GList *accounts = NULL;
+	GList *froms = NULL;
+	GList *keywords = NULL;
+	GList *iter = NULL;
+	gchar *key = NULL;
+	sqlite3_stmt *prepared_statement = NULL;
+	gint index = 1;
+	gint query_items = 0;
+	gint64 before = 0;
+	gint64 after = 0;
+	gboolean has_before = FALSE;
+	gboolean has_after = FALSE;
+	gchar *before_id = NULL;
+	const gchar *invalid = NULL;
+	guint64 last = 0;
+
+	split = purple_sqlite_history_adapter_split_query(search_query);
+	for(i = 0; split[i] != NULL; i++) {
+		if(g_str_has_prefix(split[i], "last:")) {
+			if(split[i][5] == '\0') {
+				continue;
+			}
+
+			if(remove || limit > 0 ||
+			   !g_ascii_string_to_unsigned(split[i] + 5, 10, 1, G_MAXINT64,
+			                               &last, NULL))
+			{
+				g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+				            "Invalid term in query: %s", split[i]);
+
+				g_strfreev(split);
+				g_list_free_full(ins, g_free);
+				g_list_free_full(accounts, g_free);
+				g_list_free_full(froms, g_free);
+				g_list_free_full(keywords, g_free);
+				g_free(before_id);
+
+				return NULL;
+			}
+
+			continue;
+		}
+
+		if(g_str_has_prefix(split[i], "before-id:")) {
+			if(split[i][10] == '\0') {
+				continue;
+			}
+
+			g_free(before_id);
+			before_id = g_strdup(split[i] + 10);
+
+			continue;
+		}
+
+		if(g_str_has_prefix(split[i], "before:") ||
+		   g_str_has_prefix(split[i], "after:"))
+		{
+			gboolean is_before = (split[i][0] == 'b');
+			const gchar *value = split[i] + (is_before ? 7 : 6);
+			gint64 usec = 0;
+
+			if(*value == '\0') {
+				continue;
+			}
+
+			if(!purple_sqlite_history_adapter_parse_time(value, &usec)) {
+				g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+				            "Invalid date or time in query: %s", split[i]);
+
+				g_strfreev(split);
+				g_list_free_full(ins, g_free);
+				g_list_free_full(accounts, g_free);
+				g_list_free_full(froms, g_free);
+				g_list_free_full(keywords, g_free);
+				g_free(before_id);
+
+				return NULL;
+			}
+
+			/* Multiple terms narrow the range. */
+			if(is_before) {
+				before = has_before ? MIN(before, usec) : usec;
+				has_before = TRUE;
+			} else {
+				after = has_after ? MAX(after, usec) : usec;
+				has_after = TRUE;
+			}
+			query_items++;
+		} else if(g_str_has_prefix(split[i], "in:")) {
+			if(split[i][3] == '\0') {
+				continue;
+			}
+			ins = g_list_prepend(ins, g_strdup(split[i]+3));
+			query_items++;
+		} else if(g_str_has_prefix(split[i], "account:")) {
+			if(split[i][8] == '\0') {
+				continue;
+			}
+			accounts = g_list_prepend(accounts, g_strdup(split[i]+8));
+			query_items++;
+		} else if(g_str_has_prefix(split[i], "from:")) {
+			if(split[i][5] == '\0') {
+				continue;
+			}
+			froms = g_list_prepend(froms, g_strdup(split[i]+5));
+			query_items++;
+		} else {
+			if(split[i][0] == '\0') {
+				continue;
+			}
+			keywords = g_list_prepend(keywords,
+			                          purple_sqlite_history_adapter_quote_keyword(split[i]));
+			query_items++;
+		}
+	}
+
+	g_clear_pointer(&split, g_strfreev);
+
+	if(before_id != NULL && !has_before) {
+		invalid = "Invalid term in query: before-id: requires before:";
+	} else if(remove && query_items == 0) {
+		invalid = "Attempting to remove messages without query parameters.";
+	}
+
+	if(invalid != NULL) {
+		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0, invalid);
+
+		g_list_free_full(ins, g_free);
+		g_list_free_full(accounts, g_free);
+		g_list_free_full(froms, g_free);
+		g_list_free_full(keywords, g_free);
+		g_free(before_id);
+
+		return NULL;
+	}
+
+	/* The SQL only depends on the shape of the query, so that is what we
+	 * cache the prepared statements by. All keywords are bound to a single
+	 * MATCH expression, so only their presence matters.
+	 */
+	key = g_strdup_printf("%s:%u:%u:%u:%d:%d:%d:%d:%d:%d:%d:%d",
+	                      remove ? "delete" : "select",
+	                      g_list_length(ins), g_list_length(accounts),
+	                      g_list_length(froms), keywords != NULL, has_after,
+	                      has_before, before_id != NULL, after != NULL,
+	                      after != NULL && after->has_timestamp, limit > 0,
+	                      last > 0);
+
+	prepared_statement = purple_sqlite_history_adapter_statement_cache_lookup(cache,
+	                                                                          key);
+	if(prepared_statement == NULL) {
+		prepared_statement = purple_sqlite_history_adapter_prepare_query(db,
+		                                                                 remove,
+		                                                                 ins,
+		                                                                 accounts,
+		                                                                 froms,
+		                                                                 keywords != NULL,
+		                                                                 has_after,
+		                                                                 has_before,
+		                                                                 before_id != NULL,
+		                                                                 after,
+		                                                                 limit > 0,
+		                                                                 last > 0);
+
+		if(prepared_statement == NULL) {
+			g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+			            "Error creating the prepared statement: %s",
+			            sqlite3_errmsg(db));
+
+			g_free(key);
+			g_list_free_full(ins, g_free);
+			g_list_free_full(accounts, g_free);
+			g_list_free_full(froms, g_free);
+			g_list_free_full(keywords, g_free);
+			g_free(before_id);
+
+			return NULL;
+		}
+
+		purple_sqlite_history_adapter_statement_cache_insert(cache,
+		                                                     key,
+		                                                     prepared_statement);
+	} else {
+		g_free(key);
+	}
+
+	while(ins != NULL) {
+		sqlite3_bind_text(prepared_statement, index++,
+		                  (const char *)ins->data, -1, g_free);
+		ins = g_list_delete_link(ins, ins);
+	}
+
+	while(accounts != NULL) {
+		sqlite3_bind_text(prepared_statement, index++,
+		                  (const char *)accounts->data, -1, g_free);
+		accounts = g_list_delete_link(accounts, accounts);
+	}
+
+	while(froms != NULL) {
+		sqlite3_bind_text(prepared_statement, index++,
+		                  (const char *)froms->data, -1, g_free);
+		froms = g_list_delete_link(froms, froms);
+	}
+
+	if(keywords != NULL) {
+		GString *match = g_string_new(NULL);
+
+		/* Any of the keywords may match, just like the rest of the query
+		 * terms.
+		 */
+		for(iter = keywords; iter != NULL; iter = iter->next) {
+			if(match->len > 0) {
+				g_string_append(match, " OR ");
+			}
+			g_string_append(match, (const gchar *)iter->data);
+		}
+		g_list_free_full(keywords, g_free);
+
+		sqlite3_bind_text(prepared_statement, index++,
+		                  g_string_free(match, FALSE), -1, g_free);
+	}
+
+	if(has_after) {
+		sqlite3_bind_int64(prepared_statement, index++, after);
+	}
+
+	if(has_before) {
+		sqlite3_bind_int64(prepared_statement, index++, before);
+
+		if(before_id != NULL) {
+			sqlite3_bind_int64(prepared_statement, index++, before);
+			sqlite3_bind_text(prepared_statement, index++, before_id, -1,
+			                  g_free);
+		}
+	}
+
+	if(after != NULL) {
+		if(after->has_timestamp) {
+			sqlite3_bind_int64(prepared_statement, index++,
+			                   after->timestamp_us);
+		}
+
+		sqlite3_bind_int64(prepared_statement, index++, after->rowid);
+	}
+
+	if(limit > 0) {
+		sqlite3_bind_int64(prepared_statement, index++, limit);
+	}
+
+	if(last > 0) {
+		sqlite3_bind_int64(prepared_statement, index++, (sqlite3_int64)last);
+	}
+
+	return prepared_statement;
+}
+
+static PurpleMessage *
+purple_sqlite_history_adapter_message_from_row(sqlite3_stmt *statement) {
+	PurpleMessage *message = NULL;
+	PurpleMessageContentType ct;
+	gint64 timestamp_us = 0;
+	const gchar *message_id = NULL;
+	const gchar *author = NULL;
+	const gchar *author_name_color = NULL;
+	const gchar *author_alias = NULL;
+	const gchar *recipient = NULL;
+	const gchar *content = NULL;
+	const gchar *content_type = NULL;
+
+	message_id = (const gchar *)sqlite3_column_text(statement, 0);
+	author = (const gchar *)sqlite3_column_text(statement, 1);
+	author_name_color = (const gchar *)sqlite3_column_text(statement, 2);
+	author_alias = (const gchar *)sqlite3_column_text(statement, 3);
+	recipient = (const gchar *)sqlite3_column_text(statement, 4);
+	content_type = (const gchar *)sqlite3_column_text(statement, 5);
+	ct = purple_sqlite_history_adapter_get_content_type_enum(content_type);
+	content = (const gchar *)sqlite3_column_text(statement, 6);
+
+	/* Rows written before client_timestamp_us existed only have the ISO 8601
+	 * text, everything else gives us microseconds directly.
+	 */
+	if(sqlite3_column_type(statement, 7) == SQLITE_INTEGER) {
+		timestamp_us = sqlite3_column_int64(statement, 7);
+	} else {
+		const gchar *timestamp = NULL;
+		GDateTime *date_time = NULL;
+
+		timestamp = (const gchar *)sqlite3_column_text(statement, 7);
+		date_time = g_date_time_new_from_iso8601(timestamp, NULL);
+		if(date_time != NULL) {
+			timestamp_us = purple_sqlite_history_adapter_date_time_to_usec(date_time);
+			g_date_time_unref(date_time);
+		}
+	}
+
+	message = purple_message_new_full(message_id, author, author_alias,
+	                                  recipient, content, ct, timestamp_us, 0);
+	if(author_name_color != NULL) {
+		purple_message_set_author_name_color(message, author_name_color);
+	}
+
+	if(sqlite3_column_count(statement) > 9) {
+		const gchar *snippet = NULL;
+
+		snippet = (const gchar *)sqlite3_column_text(statement, 9);
+		g_object_set_qdata_full(G_OBJECT(message),
+		                        purple_sqlite_history_adapter_snippet_quark(),
+		                        g_strdup(snippet), g_free);
+	}
+
+	return message;
+}
+
+static void
+purple_sqlite_history_adapter_free_results(GList *results) {
+	g_list_free_full(results, g_object_unref);
+}
+
+static gint
+purple_sqlite_history_adapter_progress_cb(gpointer data) {
+	/* Returning non-zero interrupts the statement that is being stepped. */
+	return g_cancellable_is_cancelled(G_CANCELLABLE(data));
+}
+
+/* Runs a select query and returns the matching messages in order.
+ *
+ * Queries use the read only connection when there is one, so they only wait
+ * for the writer thread to flush what was written before the query was
+ * started, and never for the batch transactions themselves. In memory
+ * databases can not be shared between connections, so those fall back to the
+ * main connection.
+ */
+static GList *
+purple_sqlite_history_adapter_run_query(PurpleSqliteHistoryAdapter *adapter,
+                                        const gchar *query,
+                                        const PurpleSqliteHistoryAdapterCursor *after,
+                                        guint limit,
+                                        PurpleSqliteHistoryAdapterCursor *last,
+                                        GCancellable *cancellable,
+                                        GError **error)
+{
+	PurpleSqliteHistoryAdapterStatementCache *cache = NULL;
+	sqlite3_stmt *prepared_statement = NULL;
+	sqlite3 *db = NULL;
+	GList *results = NULL;
+	gint rc = 0;
+
+	purple_sqlite_history_adapter_wait_for_writer(adapter);
+
+	g_mutex_lock(&adapter->read_lock);
+
+	if(adapter->db == NULL) {
+		g_mutex_unlock(&adapter->read_lock);
+
+		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                    _("Adapter has not been activated"));
+
+		return NULL;
+	}
+
+	if(adapter->read_db != NULL) {
+		db = adapter->read_db;
+		cache = adapter->read_statements;
+	} else {
+		g_mutex_lock(&adapter->db_lock);
+		db = adapter->db;
+		cache = adapter->statements;
+	}
+
+	prepared_statement = purple_sqlite_history_adapter_build_query(db, cache,
+	                                                               query,
+	                                                               FALSE,
+	                                                               after,
+	                                                               limit,
+	                                                               error);
+
+	if(prepared_statement != NULL) {
+		if(cancellable != NULL) {
+			sqlite3_progress_handler(db, 1000,
+			                         purple_sqlite_history_adapter_progress_cb,
+			                         cancellable);
+		}
+
+		while((rc = sqlite3_step(prepared_statement)) == SQLITE_ROW) {
+			PurpleMessage *message = NULL;
+
+			message = purple_sqlite_history_adapter_message_from_row(prepared_statement);
+			/* The eighth column is client_timestamp_us unless that is
+			 * NULL, in which case it is the text timestamp or NULL.
+			 */
+			if(last != NULL) {
+				last->has_timestamp = (sqlite3_column_type(prepared_statement, 7) ==
+				                       SQLITE_INTEGER);
+				last->timestamp_us = sqlite3_column_int64(prepared_statement, 7);
+				last->rowid = sqlite3_column_int64(prepared_statement, 8);
+			}
+
+			results = g_list_prepend(results, message);
+		}
+
+		if(cancellable != NULL) {
+			sqlite3_progress_handler(db, 0, NULL, NULL);
+		}
+
+		if(rc != SQLITE_DONE) {
+			if(!g_cancellable_set_error_if_cancelled(cancellable, error)) {
+				g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+				            "Error querying the database: %s",
+				            sqlite3_errmsg(db));
+			}
+
+			g_clear_pointer(&results,
+			                purple_sqlite_history_adapter_free_results);
+		}
+
+		purple_sqlite_history_adapter_release_statement(prepared_statement);
+	}
+
+	if(db != adapter->read_db) {
+		g_mutex_unlock(&adapter->db_lock);
+	}
+
+	g_mutex_unlock(&adapter->read_lock);
+
+	return g_list_reverse(results);
+}
+
+static void
+purple_sqlite_history_adapter_query_thread(GTask *task,
+                                           gpointer source_object,
+                                           gpointer task_data,
+                                           GCancellable *cancellable)
+{
+	PurpleSqliteHistoryAdapter *adapter = source_object;
+	GError *error = NULL;
+	GList *results = NULL;
+
+	if(g_task_return_error_if_cancelled(task)) {
+		return;
+	}
+
+	results = purple_sqlite_history_adapter_run_query(adapter,
+	                                                  (const gchar *)task_data,
+	                                                  NULL, 0, NULL,
+	                                                  cancellable, &error);
+
+	if(error != NULL) {
+		g_task_return_error(task, error);
+
+		return;
+	}
+
+	g_task_return_pointer(task, results,
+	                      (GDestroyNotify)purple_sqlite_history_adapter_free_results);
+}
+
+/******************************************************************************
+ * Compaction
+ *****************************************************************************/
+static void purple_sqlite_history_adapter_schedule_compaction(PurpleSqliteHistoryAdapter *adapter, guint delay);
+
+typedef struct {
+	gint64 deadline;
+	guint64 removed;
+	guint64 reclaimed;
+	gboolean expired;
+} PurpleSqliteHistoryAdapterCompaction;
+
+static gboolean
+purple_sqlite_history_adapter_compaction_expired(PurpleSqliteHistoryAdapterCompaction *compaction)
+{
+	if(!compaction->expired && compaction->deadline > 0 &&
+	   g_get_monotonic_time() >= compaction->deadline)
+	{
+		compaction->expired = TRUE;
+	}
+
+	return compaction->expired;
+}
+
+/* Runs statement, which deletes at most one batch of messages, and returns the
+ * number of messages that were deleted or -1 on error. Each batch is its own
+ * transaction so the writer thread can get in between them.
+ */
+static gint
+purple_sqlite_history_adapter_compaction_delete(PurpleSqliteHistoryAdapter *adapter,
+                                                sqlite3_stmt *statement,
+                                                PurpleSqliteHistoryAdapterCompaction *compaction,
+                                                GError **error)
+{
+	gint changes = 0;
+
+	g_mutex_lock(&adapter->db_lock);
+
+	if(sqlite3_step(statement) != SQLITE_DONE) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error removing old messages: %s",
+		            sqlite3_errmsg(adapter->db));
+		sqlite3_reset(statement);
+		g_mutex_unlock(&adapter->db_lock);
+
+		return -1;
+	}
+
+	changes = sqlite3_changes(adapter->db);
+	sqlite3_reset(statement);
+
+	g_mutex_unlock(&adapter->db_lock);
+
+	compaction->removed += changes;
+
+	return changes;
+}
+
+static sqlite3_stmt *
+purple_sqlite_history_adapter_compaction_prepare(PurpleSqliteHistoryAdapter *adapter,
+                                                 const gchar *sql,
+                                                 GError **error)
+{
+	sqlite3_stmt *statement = NULL;
+
+	g_mutex_lock(&adapter->db_lock);
+	sqlite3_prepare_v2(adapter->db, sql, -1, &statement, NULL);
+	if(statement == NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error creating the prepared statement: %s",
+		            sqlite3_errmsg(adapter->db));
+	}
+	g_mutex_unlock(&adapter->db_lock);
+
+	return statement;
+}
+
+static gboolean
+purple_sqlite_history_adapter_compact_by_age(PurpleSqliteHistoryAdapter *adapter,
+                                             PurpleSqliteHistoryAdapterCompaction *compaction,
+                                             GError **error)
+{
+	sqlite3_stmt *statement = NULL;
+	gint64 cutoff = 0;
+	gint changes = 0;
+
+	statement = purple_sqlite_history_adapter_compaction_prepare(adapter,
+		"DELETE FROM message_log WHERE rowid IN ("
+		"SELECT rowid FROM message_log "
+		"WHERE client_timestamp_us < ?1 LIMIT ?2);",
+		error);
+	if(statement == NULL) {
+		return FALSE;
+	}
+
+	cutoff = g_get_real_time() - (gint64)adapter->max_age * G_TIME_SPAN_DAY;
+	sqlite3_bind_int64(statement, 1, cutoff);
+	sqlite3_bind_int(statement, 2,
+	                 PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BATCH);
+
+	do {
+		changes = purple_sqlite_history_adapter_compaction_delete(adapter,
+		                                                          statement,
+		                                                          compaction,
+		                                                          error);
+	} while(changes == PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BATCH &&
+	        !purple_sqlite_history_adapter_compaction_expired(compaction));
+
+	sqlite3_finalize(statement);
+
+	return changes >= 0;
+}
+
+typedef struct {
+	gchar *conversation_id;
+	gchar *account;
+	gint64 excess;
+} PurpleSqliteHistoryAdapterExcess;
+
+static void
+purple_sqlite_history_adapter_excess_free(PurpleSqliteHistoryAdapterExcess *excess)
+{
+	g_free(excess->conversation_id);
+	g_free(excess->account);
+	g_free(excess);
+}
+
+static void
+purple_sqlite_history_adapter_set_count_cursor(PurpleSqliteHistoryAdapter *adapter,
+                                               const gchar *conversation_id,
+                                               const gchar *account)
+{
+	g_free(adapter->count_cursor_conversation);
+	adapter->count_cursor_conversation = g_strdup(conversation_id);
+	g_free(adapter->count_cursor_account);
+	adapter->count_cursor_account = g_strdup(account);
+}
+
+static gboolean
+purple_sqlite_history_adapter_compact_by_count(PurpleSqliteHistoryAdapter *adapter,
+                                               PurpleSqliteHistoryAdapterCompaction *compaction,
+                                               GError **error)
+{
+	sqlite3_stmt *select = NULL;
+	sqlite3_stmt *deletion = NULL;
+	gboolean ret = TRUE;
+
+	/* Conversations are counted a batch at a time in the order of
+	 * message_log_conversation_idx, starting after the one that the last run
+	 * ended with, so a run never has to count the whole table.
+	 */
+	select = purple_sqlite_history_adapter_compaction_prepare(adapter,
+		"SELECT conversation_id, account, COUNT(*) FROM message_log "
+		"WHERE (conversation_id, account) > (?1, ?2) "
+		"GROUP BY conversation_id, account "
+		"ORDER BY conversation_id, account LIMIT ?3;",
+		error);
+	if(select == NULL) {
+		return FALSE;
+	}
+
+	deletion = purple_sqlite_history_adapter_compaction_prepare(adapter,
+		"DELETE FROM message_log WHERE rowid IN ("
+		"SELECT rowid FROM message_log "
+		"WHERE conversation_id = ?1 AND account = ?2 "
+		"ORDER BY client_timestamp_us, rowid LIMIT ?3);",
+		error);
+	if(deletion == NULL) {
+		sqlite3_finalize(select);
+
+		return FALSE;
+	}
+
+	while(ret && !purple_sqlite_history_adapter_compaction_expired(compaction)) {
+		GList *conversations = NULL;
+		guint visited = 0;
+
+		/* The select has to be finished before anything is deleted, so
+		 * collect the batch of conversations first.
+		 */
+		g_mutex_lock(&adapter->db_lock);
+		sqlite3_bind_text(select, 1,
+		                  adapter->count_cursor_conversation != NULL ?
+		                  adapter->count_cursor_conversation : "",
+		                  -1, SQLITE_TRANSIENT);
+		sqlite3_bind_text(select, 2,
+		                  adapter->count_cursor_account != NULL ?
+		                  adapter->count_cursor_account : "",
+		                  -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int(select, 3,
+		                 PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BATCH);
+		while(sqlite3_step(select) == SQLITE_ROW) {
+			PurpleSqliteHistoryAdapterExcess *excess = NULL;
+
+			excess = g_new(PurpleSqliteHistoryAdapterExcess, 1);
+			excess->conversation_id = g_strdup((const gchar *)sqlite3_column_text(select, 0));
+			excess->account = g_strdup((const gchar *)sqlite3_column_text(select, 1));
+			excess->excess = sqlite3_column_int64(select, 2) -
+			                 adapter->max_messages;
+
+			conversations = g_list_prepend(conversations, excess);
+			visited++;
+		}
+		sqlite3_reset(select);
+		g_mutex_unlock(&adapter->db_lock);
+
+		conversations = g_list_reverse(conversations);
+
+		for(GList *l = conversations; l != NULL; l = l->next) {
+			PurpleSqliteHistoryAdapterExcess *excess = l->data;
+
+			sqlite3_bind_text(deletion, 1, excess->conversation_id, -1,
+			                  SQLITE_STATIC);
+			sqlite3_bind_text(deletion, 2, excess->account, -1,
+			                  SQLITE_STATIC);
+
+			while(excess->excess > 0 &&
+			      !purple_sqlite_history_adapter_compaction_expired(compaction))
+			{
+				gint changes = 0;
+
+				sqlite3_bind_int64(deletion, 3,
+				                   MIN(excess->excess,
+				                       PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BATCH));
+				changes = purple_sqlite_history_adapter_compaction_delete(adapter,
+				                                                          deletion,
+				                                                          compaction,
+				                                                          error);
+				if(changes < 0) {
+					ret = FALSE;
+
+					break;
+				}
+
+				/* Someone else may have removed messages in the meantime. */
+				excess->excess = (changes == 0) ? 0 : excess->excess - changes;
+			}
+
+			if(excess->excess > 0) {
+				/* The next run starts with this conversation again. */
+				break;
+			}
+
+			purple_sqlite_history_adapter_set_count_cursor(adapter,
+			                                               excess->conversation_id,
+			                                               excess->account);
+		}
+
+		g_list_free_full(conversations,
+		                 (GDestroyNotify)purple_sqlite_history_adapter_excess_free);
+
+		if(ret && !compaction->expired &&
+		   visited < PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BATCH)
+		{
+			/* Every conversation was visited, the next run starts over. */
+			purple_sqlite_history_adapter_set_count_cursor(adapter, NULL,
+			                                               NULL);
+
+			break;
+		}
+	}
+
+	sqlite3_finalize(select);
+	sqlite3_finalize(deletion);
+
+	return ret;
+}
+
+static gint64
+purple_sqlite_history_adapter_get_used_size(PurpleSqliteHistoryAdapter *adapter)
+{
+	gint64 page_size = 0;
+	gint64 page_count = 0;
+	gint64 freelist_count = 0;
+
+	g_mutex_lock(&adapter->db_lock);
+	page_size = purple_sqlite_history_adapter_get_pragma(adapter->db,
+	                                                     "page_size");
+	page_count = purple_sqlite_history_adapter_get_pragma(adapter->db,
+	                                                      "page_count");
+	freelist_count = purple_sqlite_history_adapter_get_pragma(adapter->db,
+	                                                          "freelist_count");
+	g_mutex_unlock(&adapter->db_lock);
+
+	return (page_count - freelist_count) * page_size;
+}
+
+static gboolean
+purple_sqlite_history_adapter_compact_by_size(PurpleSqliteHistoryAdapter *adapter,
+                                              PurpleSqliteHistoryAdapterCompaction *compaction,
+                                              GError **error)
+{
+	sqlite3_stmt *statement = NULL;
+	gint changes = 0;
+
+	statement = purple_sqlite_history_adapter_compaction_prepare(adapter,
+		"DELETE FROM message_log WHERE rowid IN ("
+		"SELECT rowid FROM message_log "
+		"ORDER BY client_timestamp_us, rowid LIMIT ?1);",
+		error);
+	if(statement == NULL) {
+		return FALSE;
+	}
+
+	sqlite3_bind_int(statement, 1,
+	                 PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BATCH);
+
+	/* Pages are only freed once they are empty, so this may remove a few
+	 * more messages than strictly necessary.
+	 */
+	while(purple_sqlite_history_adapter_get_used_size(adapter) > (gint64)adapter->max_size &&
+	      !purple_sqlite_history_adapter_compaction_expired(compaction))
+	{
+		changes = purple_sqlite_history_adapter_compaction_delete(adapter,
+		                                                          statement,
+		                                                          compaction,
+		                                                          error);
+		if(changes <= 0) {
+			break;
+		}
+	}
+
+	sqlite3_finalize(statement);
+
+	return changes >= 0;
+}
+
+static gboolean
+purple_sqlite_history_adapter_compact_vacuum(PurpleSqliteHistoryAdapter *adapter,
+                                             PurpleSqliteHistoryAdapterCompaction *compaction,
+                                             GError **error)
+{
+	gchar *sql = NULL;
+	gboolean incremental = FALSE;
+	gboolean ret = TRUE;
+
+	/* incremental_vacuum does nothing until the database has been converted
+	 * by purple_sqlite_history_adapter_convert_vacuum_async(), so the free
+	 * pages would never go away.
+	 */
+	g_mutex_lock(&adapter->db_lock);
+	incremental = purple_sqlite_history_adapter_get_pragma(adapter->db,
+	                                                       "auto_vacuum") == 2;
+	g_mutex_unlock(&adapter->db_lock);
+
+	if(!incremental) {
+		return TRUE;
+	}
+
+	sql = g_strdup_printf("PRAGMA incremental_vacuum(%d);",
+	                      PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BATCH);
+
+	while(!purple_sqlite_history_adapter_compaction_expired(compaction)) {
+		gchar *errmsg = NULL;
+		gint64 free_pages = 0;
+
+		g_mutex_lock(&adapter->db_lock);
+
+		free_pages = purple_sqlite_history_adapter_get_pragma(adapter->db,
+		                                                      "freelist_count");
+		if(free_pages > 0) {
+			sqlite3_exec(adapter->db, sql, NULL, NULL, &errmsg);
+		}
+
+		g_mutex_unlock(&adapter->db_lock);
+
+		if(errmsg != NULL) {
+			g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+			            "Error vacuuming the database: %s", errmsg);
+			sqlite3_free(errmsg);
+			ret = FALSE;
+
+			break;
+		}
+
+		if(free_pages <= 0) {
+			break;
+		}
+	}
+
+	g_free(sql);
+
+	return ret;
+}
+
+/* Applies the retention policy and returns free pages to the file system,
+ * within the deadline of compaction if it has one.
+ */
+static gboolean
+purple_sqlite_history_adapter_run_compaction(PurpleSqliteHistoryAdapter *adapter,
+                                             PurpleSqliteHistoryAdapterCompaction *compaction,
+                                             GError **error)
+{
+	gint64 page_size = 0;
+	gint64 pages_before = 0;
+	gint64 pages_after = 0;
+	gboolean ret = TRUE;
+
+	g_mutex_lock(&adapter->compaction_lock);
+
+	g_mutex_lock(&adapter->db_lock);
+	page_size = purple_sqlite_history_adapter_get_pragma(adapter->db,
+	                                                     "page_size");
+	pages_before = purple_sqlite_history_adapter_get_pragma(adapter->db,
+	                                                        "page_count");
+	g_mutex_unlock(&adapter->db_lock);
+
+	if(adapter->max_age > 0) {
+		ret = purple_sqlite_history_adapter_compact_by_age(adapter,
+		                                                   compaction,
+		                                                   error);
+	}
+
+	if(ret && adapter->max_messages > 0 && !compaction->expired) {
+		ret = purple_sqlite_history_adapter_compact_by_count(adapter,
+		                                                     compaction,
+		                                                     error);
+	}
+
+	if(ret && adapter->max_size > 0 && !compaction->expired) {
+		ret = purple_sqlite_history_adapter_compact_by_size(adapter,
+		                                                    compaction,
+		                                                    error);
+	}
+
+	/* Return whatever is free now, whether it was freed by this run or by
+	 * purple_history_adapter_remove().
+	 */
+	if(ret && !compaction->expired) {
+		ret = purple_sqlite_history_adapter_compact_vacuum(adapter,
+		                                                   compaction,
+		                                                   error);
+	}
+
+	g_mutex_lock(&adapter->db_lock);
+	pages_after = purple_sqlite_history_adapter_get_pragma(adapter->db,
+	                                                       "page_count");
+	g_mutex_unlock(&adapter->db_lock);
+
+	g_mutex_unlock(&adapter->compaction_lock);
+
+	if(pages_after < pages_before) {
+		compaction->reclaimed = (pages_before - pages_after) * page_size;
+	}
+
+	return ret;
+}
+
+static void
+purple_sqlite_history_adapter_compaction_thread(GTask *task,
+                                                gpointer source_object,
+                                                G_GNUC_UNUSED gpointer task_data,
+                                                G_GNUC_UNUSED GCancellable *cancellable)
+{
+	PurpleSqliteHistoryAdapterCompaction *compaction = NULL;
+	GError *error = NULL;
+
+	compaction = g_new0(PurpleSqliteHistoryAdapterCompaction, 1);
+	compaction->deadline = g_get_monotonic_time() +
+	                       PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BUDGET;
+
+	if(!purple_sqlite_history_adapter_run_compaction(source_object,
+	                                                 compaction, &error))
+	{
+		g_free(compaction);
+		g_task_return_error(task, error);
+
+		return;
+	}
+
+	g_task_return_pointer(task, compaction, g_free);
+}
+
+static void
+purple_sqlite_history_adapter_compaction_done_cb(GObject *obj,
+                                                 GAsyncResult *result,
+                                                 G_GNUC_UNUSED gpointer data)
+{
+	PurpleSqliteHistoryAdapter *adapter = PURPLE_SQLITE_HISTORY_ADAPTER(obj);
+	PurpleSqliteHistoryAdapterCompaction *compaction = NULL;
+	GError *error = NULL;
+	guint delay = adapter->compaction_interval * 1000;
+
+	adapter->compacting = FALSE;
+
+	compaction = g_task_propagate_pointer(G_TASK(result), &error);
+	if(compaction == NULL) {
+		if(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			/* The adapter was deactivated. */
+			g_clear_error(&error);
+
+			return;
+		}
+
+		g_warning("failed to compact the history database: %s",
+		          error->message);
+		g_clear_error(&error);
+	} else {
+		if(compaction->removed > 0 || compaction->reclaimed > 0) {
+			g_signal_emit(adapter, signals[SIG_COMPACTED], 0,
+			              compaction->removed, compaction->reclaimed);
+		}
+
+		if(compaction->expired) {
+			delay = PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_RETRY;
+		}
+
+		g_free(compaction);
+	}
+
+	purple_sqlite_history_adapter_schedule_compaction(adapter, delay);
+}
+
+static gboolean
+purple_sqlite_history_adapter_compaction_cb(gpointer data) {
+	PurpleSqliteHistoryAdapter *adapter = data;
+	GTask *task = NULL;
+
+	adapter->compaction_source = 0;
+	adapter->compacting = TRUE;
+
+	/* The batches run on the writer thread in between the message batches,
+	 * and the result comes back here to emit the signal and schedule the
+	 * next run.
+	 */
+	task = g_task_new(adapter, NULL,
+	                  purple_sqlite_history_adapter_compaction_done_cb, NULL);
+	g_task_set_source_tag(task, purple_sqlite_history_adapter_compaction_cb);
+	purple_sqlite_history_adapter_queue_job(adapter, task,
+	                                        purple_sqlite_history_adapter_compaction_thread);
+	g_object_unref(task);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+purple_sqlite_history_adapter_schedule_compaction(PurpleSqliteHistoryAdapter *adapter,
+                                                  guint delay)
+{
+	g_clear_handle_id(&adapter->compaction_source, g_source_remove);
+
+	/* A running compaction schedules the next one when it is done. */
+	if(adapter->db == NULL || adapter->compaction_interval == 0 ||
+	   adapter->compacting)
+	{
+		return;
+	}
+
+	/* Compaction is maintenance, so it yields to everything else. */
+	adapter->compaction_source = g_timeout_add_full(G_PRIORITY_LOW, delay,
+	                                                purple_sqlite_history_adapter_compaction_cb,
+	                                                adapter, NULL);
+}
+
+/* Compaction returns free pages to the file system with incremental_vacuum,
+ * which only works when auto_vacuum was set before the tables were created.
+ * Older databases have to be converted with a full VACUUM, which may renumber
+ * the rowids, so the search index is rebuilt as well. That holds db_lock for
+ * as long as it takes, so it is only done when asked for and writes stop
+ * waiting for the writer thread in the meantime.
+ */
+static void
+purple_sqlite_history_adapter_convert_vacuum_thread(GTask *task,
+                                                    gpointer source_object,
+                                                    G_GNUC_UNUSED gpointer task_data,
+                                                    G_GNUC_UNUSED GCancellable *cancellable)
+{
+	PurpleSqliteHistoryAdapter *adapter = source_object;
+	gchar *errmsg = NULL;
+
+	g_mutex_lock(&adapter->db_lock);
+	if(purple_sqlite_history_adapter_get_pragma(adapter->db,
+	                                            "auto_vacuum") == 2)
+	{
+		g_mutex_unlock(&adapter->db_lock);
+		g_task_return_boolean(task, TRUE);
+
+		return;
+	}
+
+	g_mutex_lock(&adapter->lock);
+	adapter->converting = TRUE;
+	g_cond_broadcast(&adapter->cond);
+	g_mutex_unlock(&adapter->lock);
+
+	sqlite3_exec(adapter->db,
+	             "PRAGMA auto_vacuum=INCREMENTAL;"
+	             "VACUUM;"
+	             "DELETE FROM message_log_fts_pending;"
+	             "INSERT INTO message_log_fts(message_log_fts) "
+	             "VALUES('rebuild');",
+	             NULL, NULL, &errmsg);
+	g_mutex_unlock(&adapter->db_lock);
+
+	g_mutex_lock(&adapter->lock);
+	adapter->converting = FALSE;
+	g_mutex_unlock(&adapter->lock);
+
+	if(errmsg != NULL) {
+		g_task_return_new_error(task, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                        "Error enabling incremental vacuuming: %s",
+		                        errmsg);
+		sqlite3_free(errmsg);
+
+		return;
+	}
+
+	g_task_return_boolean(task, TRUE);
+}
+
+/* The search index reads the content column directly until compression is
+ * enabled, so that the database stays usable by other tools. Once it may hold
+ * compressed content, the index is switched over to read it through
+ * purple_history_content() instead, and it is switched back once all of the
+ * content has been converted back to text.
+ *
+ * Either variant starts out empty and the existing messages are added by
+ * purple_sqlite_history_adapter_fill_search_index(), so the triggers skip the
+ * rows that it hasn't gotten to yet.
+ */
+#define PURPLE_SQLITE_HISTORY_ADAPTER_INDEXED(row) \
+	"NOT EXISTS(SELECT 1 FROM message_log_fts_pending" \
+	"	WHERE " row ".rowid > indexed AND " row ".rowid <= target)"
+
+static const gchar *purple_sqlite_history_adapter_plain_index =
+	"DROP TRIGGER IF EXISTS message_log_fts_insert;"
+	"DROP TRIGGER IF EXISTS message_log_fts_delete;"
+	"DROP TRIGGER IF EXISTS message_log_fts_update;"
+	"DROP TABLE IF EXISTS message_log_fts;"
+	"DROP VIEW IF EXISTS message_log_text;"
+	"CREATE VIRTUAL TABLE message_log_fts USING fts5("
+	"	content,"
+	"	content='message_log',"
+	"	content_rowid='rowid',"
+	"	tokenize='unicode61 remove_diacritics 2'"
+	");"
+	"CREATE TRIGGER message_log_fts_insert AFTER INSERT ON message_log"
+	"	WHEN " PURPLE_SQLITE_HISTORY_ADAPTER_INDEXED("new") " BEGIN"
+	"	INSERT INTO message_log_fts(rowid, content)"
+	"	VALUES (new.rowid, new.content);"
+	"END;"
+	"CREATE TRIGGER message_log_fts_delete AFTER DELETE ON message_log"
+	"	WHEN " PURPLE_SQLITE_HISTORY_ADAPTER_INDEXED("old") " BEGIN"
+	"	INSERT INTO message_log_fts(message_log_fts, rowid, content)"
+	"	VALUES ('delete', old.rowid, old.content);"
+	"END;"
+	"CREATE TRIGGER message_log_fts_update AFTER UPDATE OF content"
+	"	ON message_log"
+	"	WHEN " PURPLE_SQLITE_HISTORY_ADAPTER_INDEXED("old") " BEGIN"
+	"	INSERT INTO message_log_fts(message_log_fts, rowid, content)"
+	"	VALUES ('delete', old.rowid, old.content);"
+	"	INSERT INTO message_log_fts(rowid, content)"
+	"	VALUES (new.rowid, new.content);"
+	"END;";
+
+static const gchar *purple_sqlite_history_adapter_compressed_index =
+	"DROP TRIGGER IF EXISTS message_log_fts_insert;"
+	"DROP TRIGGER IF EXISTS message_log_fts_delete;"
+	"DROP TRIGGER IF EXISTS message_log_fts_update;"
+	"DROP TABLE IF EXISTS message_log_fts;"
+	"DROP VIEW IF EXISTS message_log_text;"
+	"CREATE VIEW message_log_text AS"
+	"	SELECT rowid AS rowid, purple_history_content(content) AS content"
+	"	FROM message_log;"
+	"CREATE VIRTUAL TABLE message_log_fts USING fts5("
+	"	content,"
+	"	content='message_log_text',"
+	"	content_rowid='rowid',"
+	"	tokenize='unicode61 remove_diacritics 2'"
+	");"
+	"CREATE TRIGGER message_log_fts_insert AFTER INSERT ON message_log"
+	"	WHEN " PURPLE_SQLITE_HISTORY_ADAPTER_INDEXED("new") " BEGIN"
+	"	INSERT INTO message_log_fts(rowid, content)"
+	"	VALUES (new.rowid, purple_history_content(new.content));"
+	"END;"
+	"CREATE TRIGGER message_log_fts_delete AFTER DELETE ON message_log"
+	"	WHEN " PURPLE_SQLITE_HISTORY_ADAPTER_INDEXED("old") " BEGIN"
+	"	INSERT INTO message_log_fts(message_log_fts, rowid, content)"
+	"	VALUES ('delete', old.rowid, purple_history_content(old.content));"
+	"END;"
+	"CREATE TRIGGER message_log_fts_update AFTER UPDATE OF content"
+	"	ON message_log"
+	"	WHEN purple_history_content(old.content) IS NOT"
+	"	     purple_history_content(new.content) AND"
+	"	     " PURPLE_SQLITE_HISTORY_ADAPTER_INDEXED("old") " BEGIN"
+	"	INSERT INTO message_log_fts(message_log_fts, rowid, content)"
+	"	VALUES ('delete', old.rowid, purple_history_content(old.content));"
+	"	INSERT INTO message_log_fts(rowid, content)"
+	"	VALUES (new.rowid, purple_history_content(new.content));"
+	"END;";
+
+/* Reads which search index the database has and which dictionary new content
+ * is compressed against.
+ */
+static void
+purple_sqlite_history_adapter_load_compression_state(PurpleSqliteHistoryAdapter *adapter)
+{
+	sqlite3_stmt *statement = NULL;
+
+	sqlite3_prepare_v2(adapter->db,
+	                   "SELECT EXISTS(SELECT 1 FROM sqlite_master "
+	                   "WHERE type = 'view' AND name = 'message_log_text'), "
+	                   "(SELECT MAX(id) FROM message_log_dictionary);",
+	                   -1, &statement, NULL);
+	if(statement == NULL) {
+		return;
+	}
+
+	if(sqlite3_step(statement) == SQLITE_ROW) {
+		adapter->compressed_index = sqlite3_column_int(statement, 0);
+		adapter->codec->dictionary_id = sqlite3_column_int(statement, 1);
+	}
+
+	sqlite3_finalize(statement);
+}
+
+/* Adds the next batch of the messages that were there when the search index
+ * was switched to the index and sets finished if there are none left. This
+ * must be called with db_lock held.
+ */
+static gboolean
+purple_sqlite_history_adapter_fill_search_index(PurpleSqliteHistoryAdapter *adapter,
+                                                gboolean *finished,
+                                                GError **error)
+{
+	sqlite3_stmt *statement = NULL;
+	gchar *errmsg = NULL;
+	gchar *sql = NULL;
+	gint64 indexed = 0;
+	gint64 target = 0;
+	gint64 last = 0;
+	gboolean pending = FALSE;
+
+	*finished = TRUE;
+
+	sqlite3_prepare_v2(adapter->db,
+	                   "SELECT indexed, target, (SELECT MAX(rowid) FROM "
+	                   "(SELECT rowid FROM message_log WHERE rowid > indexed "
+	                   "AND rowid <= target ORDER BY rowid LIMIT ?1)) "
+	                   "FROM message_log_fts_pending;",
+	                   -1, &statement, NULL);
+	if(statement == NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error creating the prepared statement: %s",
+		            sqlite3_errmsg(adapter->db));
+
+		return FALSE;
+	}
+
+	sqlite3_bind_int(statement, 1,
+	                 PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BATCH);
+	if(sqlite3_step(statement) == SQLITE_ROW) {
+		pending = TRUE;
+		indexed = sqlite3_column_int64(statement, 0);
+		target = sqlite3_column_int64(statement, 1);
+		last = sqlite3_column_int64(statement, 2);
+	}
+	sqlite3_finalize(statement);
+
+	if(!pending) {
+		return TRUE;
+	}
+
+	if(last <= indexed) {
+		/* Everything up to target is in the index now. */
+		sql = g_strdup("DELETE FROM message_log_fts_pending;");
+	} else {
+		const gchar *content = "content";
+		gchar *progress = NULL;
+
+		if(adapter->compressed_index) {
+			content = "purple_history_content(content)";
+		}
+
+		*finished = (last >= target);
+		if(*finished) {
+			progress = g_strdup("DELETE FROM message_log_fts_pending;");
+		} else {
+			progress = g_strdup_printf("UPDATE message_log_fts_pending "
+			                           "SET indexed = %" G_GINT64_FORMAT ";",
+			                           last);
+		}
+
+		sql = g_strdup_printf("BEGIN;"
+		                      "INSERT INTO message_log_fts(rowid, content) "
+		                      "SELECT rowid, %s FROM message_log "
+		                      "WHERE rowid > %" G_GINT64_FORMAT " AND "
+		                      "rowid <= %" G_GINT64_FORMAT ";"
+		                      "%s"
+		                      "COMMIT;",
+		                      content, indexed, last, progress);
+		g_free(progress);
+	}
+
+	sqlite3_exec(adapter->db, sql, NULL, NULL, &errmsg);
+	g_free(sql);
+
+	if(errmsg != NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error filling the search index: %s", errmsg);
+		sqlite3_free(errmsg);
+
+		sqlite3_exec(adapter->db, "ROLLBACK;", NULL, NULL, NULL);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Fills the search index one batch at a time and queues itself again for the
+ * next one, so that new messages are written in between.
+ */
+static void
+purple_sqlite_history_adapter_fill_search_index_thread(GTask *task,
+                                                       gpointer source_object,
+                                                       G_GNUC_UNUSED gpointer task_data,
+                                                       GCancellable *cancellable)
+{
+	PurpleSqliteHistoryAdapter *adapter = source_object;
+	GError *error = NULL;
+	gboolean finished = TRUE;
+	gboolean ret = FALSE;
+
+	if(g_task_return_error_if_cancelled(task)) {
+		return;
+	}
+
+	g_mutex_lock(&adapter->db_lock);
+	ret = purple_sqlite_history_adapter_fill_search_index(adapter, &finished,
+	                                                      &error);
+	g_mutex_unlock(&adapter->db_lock);
+
+	if(!ret) {
+		g_task_return_error(task, error);
+	} else if(!finished && !g_cancellable_is_cancelled(cancellable)) {
+		purple_sqlite_history_adapter_queue_job(adapter, task,
+		                                        purple_sqlite_history_adapter_fill_search_index_thread);
+	} else if(!g_task_return_error_if_cancelled(task)) {
+		g_task_return_boolean(task, TRUE);
+	}
+}
+
+static void
+purple_sqlite_history_adapter_fill_search_index_cb(GObject *obj,
+                                                   GAsyncResult *result,
+                                                   G_GNUC_UNUSED gpointer data)
+{
+	PurpleSqliteHistoryAdapter *adapter = PURPLE_SQLITE_HISTORY_ADAPTER(obj);
+	GError *error = NULL;
+
+	if(!g_task_propagate_boolean(G_TASK(result), &error)) {
+		/* The index continues where it left off the next time the adapter is
+		 * activated.
+		 */
+		if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning("failed to fill the search index of %s: %s",
+			          adapter->filename, error->message);
+		}
+
+		g_clear_error(&error);
+	}
+}
+
+static void
+purple_sqlite_history_adapter_queue_fill_search_index(PurpleSqliteHistoryAdapter *adapter)
+{
+	GTask *task = NULL;
+
+	task = g_task_new(adapter, NULL,
+	                  purple_sqlite_history_adapter_fill_search_index_cb,
+	                  NULL);
+	purple_sqlite_history_adapter_queue_job(adapter, task,
+	                                        purple_sqlite_history_adapter_fill_search_index_thread);
+	g_object_unref(task);
+}
+
+/* Switches the search index over to the compressed or the plain variant.
+ * The new index is empty, the messages that are already there are added by
+ * the job that this queues. This must be called with db_lock held.
+ */
+static gboolean
+purple_sqlite_history_adapter_set_search_index(PurpleSqliteHistoryAdapter *adapter,
+                                               gboolean compressed,
+                                               GError **error)
+{
+	const gchar *sql = NULL;
+	gchar *errmsg = NULL;
+
+	if(adapter->compressed_index == compressed) {
+		return TRUE;
+	}
+
+	if(compressed) {
+		sql = purple_sqlite_history_adapter_compressed_index;
+	} else {
+		sql = purple_sqlite_history_adapter_plain_index;
+	}
+
+	sqlite3_exec(adapter->db, "BEGIN;", NULL, NULL, &errmsg);
+	if(errmsg == NULL) {
+		sqlite3_exec(adapter->db,
+		             "DELETE FROM message_log_fts_pending;"
+		             "INSERT INTO message_log_fts_pending(indexed, target) "
+		             "SELECT 0, IFNULL(MAX(rowid), 0) FROM message_log;",
+		             NULL, NULL, &errmsg);
+	}
+	if(errmsg == NULL) {
+		sqlite3_exec(adapter->db, sql, NULL, NULL, &errmsg);
+	}
+	if(errmsg == NULL) {
+		sqlite3_exec(adapter->db, "COMMIT;", NULL, NULL, &errmsg);
+	}
+
+	if(errmsg != NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error switching the search index: %s", errmsg);
+		sqlite3_free(errmsg);
+
+		sqlite3_exec(adapter->db, "ROLLBACK;", NULL, NULL, NULL);
+
+		return FALSE;
+	}
+
+	adapter->compressed_index = compressed;
+
+	purple_sqlite_history_adapter_queue_fill_search_index(adapter);
+
+	return TRUE;
+}
+
+/* Stores the most recent history as the dictionary that new content is
+ * compressed against. Only the newest messages are read, at most one per byte
+ * of the dictionary, so this doesn't depend on how much history there is.
+ * Nothing is stored if there is too little history to be useful, which means
+ * that the next call tries again. This must be called with db_lock held.
+ */
+static gboolean
+purple_sqlite_history_adapter_train_dictionary(PurpleSqliteHistoryAdapter *adapter,
+                                               GError **error)
+{
+	sqlite3_stmt *statement = NULL;
+	GByteArray *dictionary = NULL;
+	GPtrArray *samples = NULL;
+	gsize size = 0;
+	gint rc = 0;
+
+	sqlite3_prepare_v2(adapter->db,
+	                   "SELECT purple_history_content(content) "
+	                   "FROM message_log ORDER BY rowid DESC LIMIT ?1;",
+	                   -1, &statement, NULL);
+	if(statement == NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error creating the prepared statement: %s",
+		            sqlite3_errmsg(adapter->db));
+
+		return FALSE;
+	}
+
+	sqlite3_bind_int(statement, 1,
+	                 PURPLE_SQLITE_HISTORY_ADAPTER_DICTIONARY_SIZE);
+
+	/* zlib prefers matches closer to the end of the dictionary, so the most
+	 * recent messages go last.
+	 */
+	samples = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+
+	while(size < PURPLE_SQLITE_HISTORY_ADAPTER_DICTIONARY_SIZE &&
+	      (rc = sqlite3_step(statement)) == SQLITE_ROW)
+	{
+		const guchar *text = sqlite3_column_text(statement, 0);
+		gsize length = sqlite3_column_bytes(statement, 0);
+
+		length = MIN(length, PURPLE_SQLITE_HISTORY_ADAPTER_DICTIONARY_SIZE - size);
+		g_ptr_array_add(samples, g_bytes_new(text, length));
+		size += length;
+	}
+
+	sqlite3_finalize(statement);
+
+	if(rc != SQLITE_ROW && rc != SQLITE_DONE) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error reading messages for the dictionary: %s",
+		            sqlite3_errmsg(adapter->db));
+		g_ptr_array_free(samples, TRUE);
+
+		return FALSE;
+	}
+
+	if(size < PURPLE_SQLITE_HISTORY_ADAPTER_DICTIONARY_MINIMUM) {
+		g_ptr_array_free(samples, TRUE);
+
+		return TRUE;
+	}
+
+	dictionary = g_byte_array_sized_new(size);
+	for(guint i = samples->len; i > 0; i--) {
+		GBytes *sample = g_ptr_array_index(samples, i - 1);
+		gsize length = 0;
+		gconstpointer data = g_bytes_get_data(sample, &length);
+
+		g_byte_array_append(dictionary, data, length);
+	}
+	g_ptr_array_free(samples, TRUE);
+
+	sqlite3_prepare_v2(adapter->db,
+	                   "INSERT INTO message_log_dictionary(id, dictionary) "
+	                   "VALUES (?1, ?2);",
+	                   -1, &statement, NULL);
+	if(statement == NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error creating the prepared statement: %s",
+		            sqlite3_errmsg(adapter->db));
+		g_byte_array_free(dictionary, TRUE);
+
+		return FALSE;
+	}
+
+	sqlite3_bind_int(statement, 1, adapter->codec->dictionary_id + 1);
+	sqlite3_bind_blob(statement, 2, dictionary->data, dictionary->len,
+	                  SQLITE_TRANSIENT);
+	rc = sqlite3_step(statement);
+	sqlite3_finalize(statement);
+	g_byte_array_free(dictionary, TRUE);
+
+	if(rc != SQLITE_DONE) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error storing the dictionary: %s",
+		            sqlite3_errmsg(adapter->db));
+
+		return FALSE;
+	}
+
+	adapter->codec->dictionary_id++;
+
+	return TRUE;
+}
+
+/* Gets the database ready for compressed content by switching the search
+ * index over and storing a dictionary. Neither depends on the size of the
+ * history, the existing messages are added to the index in the background.
+ * This must be called with db_lock held.
+ */
+static gboolean
+purple_sqlite_history_adapter_prepare_compression(PurpleSqliteHistoryAdapter *adapter,
+                                                  GError **error)
+{
+	if(!purple_sqlite_history_adapter_set_search_index(adapter, TRUE, error)) {
+		return FALSE;
+	}
+
+	if(adapter->codec->dictionary_id != 0) {
+		return TRUE;
+	}
+
+	return purple_sqlite_history_adapter_train_dictionary(adapter, error);
+}
+
+/* This runs on the writer thread so that no message is written while the
+ * search index is switched over.
+ */
+static void
+purple_sqlite_history_adapter_prepare_compression_thread(GTask *task,
+                                                         gpointer source_object,
+                                                         G_GNUC_UNUSED gpointer task_data,
+                                                         G_GNUC_UNUSED GCancellable *cancellable)
+{
+	PurpleSqliteHistoryAdapter *adapter = source_object;
+	GError *error = NULL;
+	gboolean ret = TRUE;
+
+	g_mutex_lock(&adapter->db_lock);
+	if(adapter->compression != PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE) {
+		ret = purple_sqlite_history_adapter_prepare_compression(adapter,
+		                                                        &error);
+	}
+	g_mutex_unlock(&adapter->db_lock);
+
+	if(!ret) {
+		g_task_return_error(task, error);
+
+		return;
+	}
+
+	g_task_return_boolean(task, TRUE);
+}
+
+static void
+purple_sqlite_history_adapter_prepare_compression_cb(GObject *obj,
+                                                     GAsyncResult *result,
+                                                     G_GNUC_UNUSED gpointer data)
+{
+	PurpleSqliteHistoryAdapter *adapter = PURPLE_SQLITE_HISTORY_ADAPTER(obj);
+	GError *error = NULL;
+
+	if(!g_task_propagate_boolean(G_TASK(result), &error)) {
+		/* Messages are stored as text until this succeeds, which is tried
+		 * again the next time the adapter is activated.
+		 */
+		if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning("failed to prepare %s for compression: %s",
+			          adapter->filename, error->message);
+		}
+
+		g_clear_error(&error);
+	}
+}
+
+static void
+purple_sqlite_history_adapter_queue_prepare_compression(PurpleSqliteHistoryAdapter *adapter)
+{
+	GTask *task = NULL;
+
+	task = g_task_new(adapter, NULL,
+	                  purple_sqlite_history_adapter_prepare_compression_cb,
+	                  NULL);
+	purple_sqlite_history_adapter_queue_job(adapter, task,
+	                                        purple_sqlite_history_adapter_prepare_compression_thread);
+	g_object_unref(task);
+}
+
+/* Converts one batch of messages to the current compression and queues itself
+ * again for the next one, so that new messages are written in between. Once
+ * everything is converted, it does the same for the search index, so that
+ * the index is complete when this finishes. The task data holds the last
+ * rowid that has been converted.
+ */
+static void
+purple_sqlite_history_adapter_convert_content_thread(GTask *task,
+                                                     gpointer source_object,
+                                                     gpointer task_data,
+                                                     GCancellable *cancellable)
+{
+	PurpleSqliteHistoryAdapter *adapter = source_object;
+	sqlite3_stmt *statement = NULL;
+	GError *error = NULL;
+	gint64 *after = task_data;
+	gint64 last = 0;
+	const gchar *sql = NULL;
+	gboolean compress = FALSE;
+	gboolean indexed = TRUE;
+
+	if(g_task_return_error_if_cancelled(task)) {
+		return;
+	}
+
+	g_mutex_lock(&adapter->db_lock);
+
+	compress = (adapter->compression != PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE);
+	if(compress &&
+	   !purple_sqlite_history_adapter_prepare_compression(adapter, &error))
+	{
+		g_mutex_unlock(&adapter->db_lock);
+		g_task_return_error(task, error);
+
+		return;
+	}
+
+	sqlite3_prepare_v2(adapter->db,
+	                   "SELECT MAX(rowid) FROM (SELECT rowid FROM message_log "
+	                   "WHERE rowid > ?1 ORDER BY rowid LIMIT ?2);",
+	                   -1, &statement, NULL);
+	if(statement != NULL) {
+		sqlite3_bind_int64(statement, 1, *after);
+		sqlite3_bind_int(statement, 2,
+		                 PURPLE_SQLITE_HISTORY_ADAPTER_COMPACTION_BATCH);
+		if(sqlite3_step(statement) == SQLITE_ROW) {
+			last = sqlite3_column_int64(statement, 0);
+		}
+		g_clear_pointer(&statement, sqlite3_finalize);
+	}
+
+	if(last > 0) {
+		if(compress) {
+			sql = "UPDATE message_log "
+			      "SET content = purple_history_compress(content) "
+			      "WHERE rowid > ?1 AND rowid <= ?2 AND "
+			      "typeof(content) = 'text';";
+		} else {
+			sql = "UPDATE message_log "
+			      "SET content = purple_history_content(content) "
+			      "WHERE rowid > ?1 AND rowid <= ?2 AND "
+			      "typeof(content) = 'blob';";
+		}
+
+		sqlite3_prepare_v2(adapter->db, sql, -1, &statement, NULL);
+		if(statement != NULL) {
+			sqlite3_bind_int64(statement, 1, *after);
+			sqlite3_bind_int64(statement, 2, last);
+			if(sqlite3_step(statement) != SQLITE_DONE) {
+				g_clear_pointer(&statement, sqlite3_finalize);
+			}
+		}
+
+		if(statement == NULL) {
+			g_set_error(&error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+			            "Error converting messages: %s",
+			            sqlite3_errmsg(adapter->db));
+		}
+
+		g_clear_pointer(&statement, sqlite3_finalize);
+	} else if(!compress && adapter->compressed_index) {
+		/* Everything has been converted back to text, unless compression was
+		 * turned on and off again in the meantime, so the search index no
+		 * longer needs the functions of the adapter.
+		 */
+		gboolean blobs = TRUE;
+
+		sqlite3_prepare_v2(adapter->db,
+		                   "SELECT EXISTS(SELECT 1 FROM message_log "
+		                   "WHERE typeof(content) = 'blob');",
+		                   -1, &statement, NULL);
+		if(statement != NULL && sqlite3_step(statement) == SQLITE_ROW) {
+			blobs = sqlite3_column_int(statement, 0);
+		}
+		g_clear_pointer(&statement, sqlite3_finalize);
+
+		if(!blobs) {
+			purple_sqlite_history_adapter_set_search_index(adapter, FALSE,
+			                                               &error);
+		}
+	}
+
+	if(last == 0 && error == NULL) {
+		purple_sqlite_history_adapter_fill_search_index(adapter, &indexed,
+		                                                &error);
+	}
+
+	g_mutex_unlock(&adapter->db_lock);
+
+	if(error != NULL) {
+		g_task_return_error(task, error);
+	} else if((last > 0 || !indexed) &&
+	          !g_cancellable_is_cancelled(cancellable))
+	{
+		*after = last;
+		purple_sqlite_history_adapter_queue_job(adapter, task,
+		                                        purple_sqlite_history_adapter_convert_content_thread);
+	} else if(!g_task_return_error_if_cancelled(task)) {
+		g_task_return_boolean(task, TRUE);
+	}
+}
+
+/******************************************************************************
+ * PurpleHistoryAdapter Implementation
+ *****************************************************************************/
+static gboolean
+purple_sqlite_history_adapter_activate(PurpleHistoryAdapter *adapter,
+                                       GError **error)
+{
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	gint rc = 0;
+
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+
+	if(sqlite_adapter->db != NULL) {
+		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                    _("Adapter has already been activated"));
+
+		return FALSE;
+	}
+
+	if(sqlite_adapter->filename == NULL) {
+		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                    _("No filename specified"));
+
+		return FALSE;
+	}
+
+	rc = sqlite3_open(sqlite_adapter->filename, &sqlite_adapter->db);
+	if(rc != SQLITE_OK) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            _("Error opening database in purplesqlitehistoryadapter for file %s"),
+		            sqlite_adapter->filename);
+		g_clear_pointer(&sqlite_adapter->db, sqlite3_close);
+
+		return FALSE;
+	}
+
+	if(!purple_sqlite_history_adapter_register_functions(sqlite_adapter->db,
+	                                                     &sqlite_adapter->codec,
+	                                                     error))
+	{
+		g_clear_pointer(&sqlite_adapter->db, sqlite3_close);
+
+		return FALSE;
+	}
+
+	/* This only takes effect if the database is new, older databases are
+	 * converted by purple_sqlite_history_adapter_convert_vacuum_async().
+	 */
+	sqlite3_exec(sqlite_adapter->db, "PRAGMA auto_vacuum=INCREMENTAL;", NULL,
+	             NULL, NULL);
+
+	if(!purple_sqlite_history_adapter_run_migrations(sqlite_adapter, error)) {
+		g_clear_pointer(&sqlite_adapter->db, sqlite3_close);
+
+		return FALSE;
+	}
+
+	if(!purple_sqlite_history_adapter_configure(sqlite_adapter, error)) {
+		g_clear_pointer(&sqlite_adapter->db, sqlite3_close);
+
+		return FALSE;
+	}
+
+	if(!purple_sqlite_history_adapter_start_writer(sqlite_adapter, error)) {
+		g_clear_pointer(&sqlite_adapter->db, sqlite3_close);
+
+		return FALSE;
+	}
+
+	sqlite_adapter->statements = purple_sqlite_history_adapter_statement_cache_new();
+
+	g_mutex_lock(&sqlite_adapter->db_lock);
+	purple_sqlite_history_adapter_load_compression_state(sqlite_adapter);
+	g_mutex_unlock(&sqlite_adapter->db_lock);
+
+	/* Continue filling the search index if that was interrupted. */
+	purple_sqlite_history_adapter_queue_fill_search_index(sqlite_adapter);
+
+	g_mutex_lock(&sqlite_adapter->read_lock);
+	purple_sqlite_history_adapter_open_reader(sqlite_adapter);
+	g_mutex_unlock(&sqlite_adapter->read_lock);
+
+	if(sqlite_adapter->compression != PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE) {
+		purple_sqlite_history_adapter_queue_prepare_compression(sqlite_adapter);
+	}
+
+	purple_sqlite_history_adapter_schedule_compaction(sqlite_adapter,
+	                                                  sqlite_adapter->compaction_interval * 1000);
+
+	return TRUE;
+}
+
+static gboolean
+purple_sqlite_history_adapter_deactivate(PurpleHistoryAdapter *adapter,
+                                         GError **error)
+{
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+
+	purple_sqlite_history_adapter_close(sqlite_adapter);
+
+	return TRUE;
+}
+
+static GList*
+purple_sqlite_history_adapter_query(PurpleHistoryAdapter *adapter,
+                                    const gchar *query, GError **error)
+{
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+
+	return purple_sqlite_history_adapter_run_query(sqlite_adapter, query, NULL,
+	                                               0, NULL, NULL, error);
+}
+
+static void
+purple_sqlite_history_adapter_query_async(PurpleHistoryAdapter *adapter,
+                                          const gchar *query,
+                                          GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer data)
+{
+	GTask *task = NULL;
+
+	task = g_task_new(adapter, cancellable, callback, data);
+	g_task_set_source_tag(task, purple_sqlite_history_adapter_query_async);
+	g_task_set_task_data(task, g_strdup(query), g_free);
+
+	g_task_run_in_thread(task, purple_sqlite_history_adapter_query_thread);
+
+	g_object_unref(task);
+}
+
+static GList *
+purple_sqlite_history_adapter_query_finish(PurpleHistoryAdapter *adapter,
+                                           GAsyncResult *result,
+                                           GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(result, adapter), NULL);
+
+	return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+static GList *
+purple_sqlite_history_adapter_query_page(PurpleHistoryAdapter *adapter,
+                                         const gchar *query,
+                                         const gchar *cursor,
+                                         guint page_size,
+                                         gchar **next_cursor,
+                                         GError **error)
+{
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	PurpleSqliteHistoryAdapterCursor after = {FALSE, 0, 0};
+	PurpleSqliteHistoryAdapterCursor last = {FALSE, 0, 0};
+	GError *local_error = NULL;
+	GList *results = NULL;
+
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+
+	/* The cursor is the timestamp and the rowid of the last message of the
+	 * previous page separated by a colon, the timestamp being empty if that
+	 * message didn't have one.
+	 */
+	if(cursor != NULL) {
+		const gchar *rowid = strchr(cursor, ':');
+		gboolean valid = (rowid != NULL);
+
+		if(valid && rowid != cursor) {
+			gchar *timestamp = g_strndup(cursor, rowid - cursor);
+
+			after.has_timestamp = TRUE;
+			valid = g_ascii_string_to_signed(timestamp, 10, G_MININT64,
+			                                 G_MAXINT64, &after.timestamp_us,
+			                                 NULL);
+			g_free(timestamp);
+		}
+
+		if(valid) {
+			valid = g_ascii_string_to_signed(rowid + 1, 10, 0, G_MAXINT64,
+			                                 &after.rowid, NULL);
+		}
+
+		if(!valid) {
+			g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+			            "Invalid cursor: %s", cursor);
+
+			return NULL;
+		}
+	}
+
+	results = purple_sqlite_history_adapter_run_query(sqlite_adapter, query,
+	                                                  cursor != NULL ? &after : NULL,
+	                                                  page_size, &last, NULL,
+	                                                  &local_error);
+
+	if(local_error != NULL) {
+		g_propagate_error(error, local_error);
+
+		return NULL;
+	}
+
+	/* A short page means we've reached the end. */
+	if(next_cursor != NULL) {
+		if(g_list_length(results) != page_size) {
+			*next_cursor = NULL;
+		} else if(last.has_timestamp) {
+			*next_cursor = g_strdup_printf("%" G_GINT64_FORMAT ":%"
+			                               G_GINT64_FORMAT,
+			                               last.timestamp_us, last.rowid);
+		} else {
+			*next_cursor = g_strdup_printf(":%" G_GINT64_FORMAT, last.rowid);
+		}
+	}
+
+	return results;
+}
+
+static gboolean
+purple_sqlite_history_adapter_remove(PurpleHistoryAdapter *adapter,
+                                     const gchar *query, GError **error)
+{
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	sqlite3_stmt * prepared_statement = NULL;
+	gint result = 0;
+
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+
+	if(sqlite_adapter->db == NULL) {
+		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                    _("Adapter has not been activated"));
+
+		return FALSE;
+	}
+
+	purple_sqlite_history_adapter_wait_for_writer(sqlite_adapter);
+
+	g_mutex_lock(&sqlite_adapter->db_lock);
+
+	prepared_statement = purple_sqlite_history_adapter_build_query(sqlite_adapter->db,
+	                                                               sqlite_adapter->statements,
+	                                                               query,
+	                                                               TRUE,
+	                                                               NULL, 0,
+	                                                               error);
+
+	if(prepared_statement == NULL) {
+		g_mutex_unlock(&sqlite_adapter->db_lock);
+
+		return FALSE;
+	}
+
+	result = sqlite3_step(prepared_statement);
+
+	if(result != SQLITE_DONE) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error removing from the database: %s",
+		            sqlite3_errmsg(sqlite_adapter->db));
+
+		purple_sqlite_history_adapter_release_statement(prepared_statement);
+		g_mutex_unlock(&sqlite_adapter->db_lock);
+
+		return FALSE;
+	}
+
+	purple_sqlite_history_adapter_release_statement(prepared_statement);
+	g_mutex_unlock(&sqlite_adapter->db_lock);
+
+	return TRUE;
+}
+
+static gboolean
+purple_sqlite_history_adapter_write(PurpleHistoryAdapter *adapter,
+                                    PurpleConversation *conversation,
+                                    PurpleMessage *message, GError **error)
+{
+	PurpleAccount *account = NULL;
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	PurpleSqliteHistoryAdapterRow *row = NULL;
+	PurpleMessageContentType content_type;
+	GDateTime *timestamp = NULL;
+	const gchar *message_id = NULL;
+
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+
+	if(sqlite_adapter->db == NULL) {
+		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                    _("Adapter has not been activated"));
+
+		return FALSE;
+	}
+
+	account = purple_conversation_get_account(conversation);
+	content_type = purple_message_get_content_type(message);
+
+	row = g_new0(PurpleSqliteHistoryAdapterRow, 1);
+	row->protocol = g_strdup(purple_account_get_protocol_name(account));
+	row->account = g_strdup(purple_account_get_username(account));
+	row->conversation_id = g_strdup(purple_conversation_get_name(conversation));
+
+	message_id = purple_message_get_id(message);
+	if(message_id != NULL) {
+		row->message_id = g_strdup(message_id);
+	} else {
+		row->message_id = g_uuid_string_random();
+	}
+
+	row->author = g_strdup(purple_message_get_author(message));
+	row->author_name_color = g_strdup(purple_message_get_author_name_color(message));
+	row->author_alias = g_strdup(purple_message_get_author_alias(message));
+	row->recipient = g_strdup(purple_message_get_recipient(message));
+	row->content_type = purple_sqlite_history_adapter_get_content_type(content_type);
+	row->content = g_strdup(purple_message_get_contents(message));
+	timestamp = purple_message_get_timestamp(message);
+	row->timestamp = g_date_time_format_iso8601(timestamp);
+	row->timestamp_us = purple_sqlite_history_adapter_date_time_to_usec(timestamp);
+
+	g_mutex_lock(&sqlite_adapter->lock);
+
+	/* Apply back pressure if the writer thread can't keep up, unless it is
+	 * busy converting the database, which could take longer than we want to
+	 * block the caller for.
+	 */
+	while(sqlite_adapter->pending->length >= PURPLE_SQLITE_HISTORY_ADAPTER_MAX_PENDING &&
+	      !sqlite_adapter->converting && !sqlite_adapter->stopping)
+	{
+		g_cond_wait(&sqlite_adapter->cond, &sqlite_adapter->lock);
+	}
+
+	g_queue_push_tail(sqlite_adapter->pending, row);
+	sqlite_adapter->queued++;
+	g_cond_broadcast(&sqlite_adapter->cond);
+
+	g_mutex_unlock(&sqlite_adapter->lock);
+
+	return TRUE;
+}
+
+/******************************************************************************
+ * GObject Implementation
+ *****************************************************************************/
+static void
+purple_sqlite_history_adapter_get_property(GObject *obj, guint param_id,
+                                           GValue *value, GParamSpec *pspec)
+{
+	PurpleSqliteHistoryAdapter *adapter = PURPLE_SQLITE_HISTORY_ADAPTER(obj);
+
+	switch(param_id) {
+		case PROP_FILENAME:
+			g_value_set_string(value,
+			                   purple_sqlite_history_adapter_get_filename(adapter));
+			break;
+		case PROP_SYNCHRONOUS:
+			g_value_set_enum(value,
+			                 purple_sqlite_history_adapter_get_synchronous(adapter));
+			break;
+		case PROP_COMMIT_INTERVAL:
+			g_value_set_uint(value,
+			                 purple_sqlite_history_adapter_get_commit_interval(adapter));
+			break;
+		case PROP_WRITE_MODE:
+			g_value_set_enum(value,
+			                 purple_sqlite_history_adapter_get_write_mode(adapter));
+			break;
+		case PROP_MAX_AGE:
+			g_value_set_uint(value,
+			                 purple_sqlite_history_adapter_get_max_age(adapter));
+			break;
+		case PROP_MAX_MESSAGES:
+			g_value_set_uint(value,
+			                 purple_sqlite_history_adapter_get_max_messages(adapter));
+			break;
+		case PROP_MAX_SIZE:
+			g_value_set_uint64(value,
+			                   purple_sqlite_history_adapter_get_max_size(adapter));
+			break;
+		case PROP_COMPACTION_INTERVAL:
+			g_value_set_uint(value,
+			                 purple_sqlite_history_adapter_get_compaction_interval(adapter));
+			break;
+		case PROP_COMPRESSION:
+			g_value_set_enum(value,
+			                 purple_sqlite_history_adapter_get_compression(adapter));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
+			break;
+	}
+}
+
+static void
+purple_sqlite_history_adapter_set_property(GObject *obj, guint param_id,
+                                           const GValue *value,
+                                           GParamSpec *pspec)
+{
+	PurpleSqliteHistoryAdapter *adapter = PURPLE_SQLITE_HISTORY_ADAPTER(obj);
+
+	switch(param_id) {
+		case PROP_FILENAME:
+			purple_sqlite_history_adapter_set_filename(adapter,
+			                                           g_value_get_string(value));
+			break;
+		case PROP_SYNCHRONOUS:
+			purple_sqlite_history_adapter_set_synchronous(adapter,
+			                                              g_value_get_enum(value));
+			break;
+		case PROP_COMMIT_INTERVAL:
+			purple_sqlite_history_adapter_set_commit_interval(adapter,
+			                                                  g_value_get_uint(value));
+			break;
+		case PROP_WRITE_MODE:
+			purple_sqlite_history_adapter_set_write_mode(adapter,
+			                                             g_value_get_enum(value));
+			break;
+		case PROP_MAX_AGE:
+			purple_sqlite_history_adapter_set_max_age(adapter,
+			                                          g_value_get_uint(value));
+			break;
+		case PROP_MAX_MESSAGES:
+			purple_sqlite_history_adapter_set_max_messages(adapter,
+			                                               g_value_get_uint(value));
+			break;
+		case PROP_MAX_SIZE:
+			purple_sqlite_history_adapter_set_max_size(adapter,
+			                                           g_value_get_uint64(value));
+			break;
+		case PROP_COMPACTION_INTERVAL:
+			purple_sqlite_history_adapter_set_compaction_interval(adapter,
+			                                                      g_value_get_uint(value));
+			break;
+		case PROP_COMPRESSION:
+			purple_sqlite_history_adapter_set_compression(adapter,
+			                                              g_value_get_enum(value));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
+			break;
+	}
+}
+
+static void
+purple_sqlite_history_adapter_finalize(GObject *obj) {
+	PurpleSqliteHistoryAdapter *adapter = NULL;
+
+	adapter = PURPLE_SQLITE_HISTORY_ADAPTER(obj);
+
+	g_clear_pointer(&adapter->filename, g_free);
+
+	if(adapter->db != NULL) {
+		g_warning("PurpleSqliteHistoryAdapter was finalized before being "
+		          "deactivated");
+
+		purple_sqlite_history_adapter_close(adapter);
+	}
+
+	g_queue_free_full(adapter->pending,
+	                  (GDestroyNotify)purple_sqlite_history_adapter_row_free);
+	g_queue_free(adapter->jobs);
+	g_clear_error(&adapter->write_error);
+	g_clear_pointer(&adapter->count_cursor_conversation, g_free);
+	g_clear_pointer(&adapter->count_cursor_account, g_free);
+	g_mutex_clear(&adapter->compaction_lock);
+	g_mutex_clear(&adapter->db_lock);
+	g_mutex_clear(&adapter->read_lock);
+	g_mutex_clear(&adapter->lock);
+	g_cond_clear(&adapter->cond);
+
+	G_OBJECT_CLASS(purple_sqlite_history_adapter_parent_class)->finalize(obj);
+}
+
+static void
+purple_sqlite_history_adapter_init(PurpleSqliteHistoryAdapter *adapter) {
+	g_mutex_init(&adapter->compaction_lock);
+	g_mutex_init(&adapter->db_lock);
+	g_mutex_init(&adapter->read_lock);
+	g_mutex_init(&adapter->lock);
+	g_cond_init(&adapter->cond);
+
+	adapter->pending = g_queue_new();
+	adapter->jobs = g_queue_new();
+}
+
+static void
+purple_sqlite_history_adapter_class_init(PurpleSqliteHistoryAdapterClass *klass)
+{
+	GObjectClass *obj_class = G_OBJECT_CLASS(klass);
+	PurpleHistoryAdapterClass *adapter_class = PURPLE_HISTORY_ADAPTER_CLASS(klass);
+
+	obj_class->get_property = purple_sqlite_history_adapter_get_property;
+	obj_class->set_property = purple_sqlite_history_adapter_set_property;
+	obj_class->finalize = purple_sqlite_history_adapter_finalize;
+
+	adapter_class->activate = purple_sqlite_history_adapter_activate;
+	adapter_class->deactivate = purple_sqlite_history_adapter_deactivate;
+	adapter_class->query = purple_sqlite_history_adapter_query;
+	adapter_class->query_async = purple_sqlite_history_adapter_query_async;
+	adapter_class->query_finish = purple_sqlite_history_adapter_query_finish;
+	adapter_class->query_page = purple_sqlite_history_adapter_query_page;
+	adapter_class->remove = purple_sqlite_history_adapter_remove;
+	adapter_class->write = purple_sqlite_history_adapter_write;
+
+	/**
+	 * PurpleHistoryAdapter::filename:
+	 *
+	 * The filename that the sqlite database will store data to.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_FILENAME] = g_param_spec_string(
+		"filename", "filename", "The filename of the sqlite database",
+		NULL,
+		G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS
+	);
+
+	/**
+	 * PurpleSqliteHistoryAdapter:synchronous:
+	 *
+	 * The `PRAGMA synchronous` level to use for the database. The database is
+	 * always opened in write ahead logging mode, where
+	 * %PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_NORMAL is safe against
+	 * corruption and avoids an fsync on every commit.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_SYNCHRONOUS] = g_param_spec_enum(
+		"synchronous", "synchronous",
+		"The synchronous level of the sqlite database",
+		PURPLE_TYPE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS,
+		PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_NORMAL,
+		G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * PurpleSqliteHistoryAdapter:commit-interval:
+	 *
+	 * The number of milliseconds the writer thread waits for more messages
+	 * before committing everything that is pending in a single transaction.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_COMMIT_INTERVAL] = g_param_spec_uint(
+		"commit-interval", "commit-interval",
+		"The number of milliseconds to batch writes for",
+		0, G_MAXUINT, PURPLE_SQLITE_HISTORY_ADAPTER_DEFAULT_COMMIT_INTERVAL,
+		G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * PurpleSqliteHistoryAdapter:write-mode:
+	 *
+	 * What to do when a message is written that is already in the database.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_WRITE_MODE] = g_param_spec_enum(
+		"write-mode", "write-mode",
+		"What to do with messages that have already been written",
+		PURPLE_TYPE_SQLITE_HISTORY_ADAPTER_WRITE_MODE,
+		PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE_IGNORE,
+		G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * PurpleSqliteHistoryAdapter:max-age:
+	 *
+	 * The number of days to keep messages for, or 0 to keep them forever.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_MAX_AGE] = g_param_spec_uint(
+		"max-age", "max-age",
+		"The number of days to keep messages for",
+		0, G_MAXUINT, 0,
+		G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * PurpleSqliteHistoryAdapter:max-messages:
+	 *
+	 * The number of messages to keep for each conversation, or 0 to keep all
+	 * of them.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_MAX_MESSAGES] = g_param_spec_uint(
+		"max-messages", "max-messages",
+		"The number of messages to keep per conversation",
+		0, G_MAXUINT, 0,
+		G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * PurpleSqliteHistoryAdapter:max-size:
+	 *
+	 * The number of bytes the messages may use in the database before the
+	 * oldest ones are removed, or 0 for no limit.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_MAX_SIZE] = g_param_spec_uint64(
+		"max-size", "max-size",
+		"The maximum size of the database in bytes",
+		0, G_MAXUINT64, 0,
+		G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * PurpleSqliteHistoryAdapter:compaction-interval:
+	 *
+	 * The number of seconds between compaction runs while the adapter is
+	 * active, or 0 to only compact when
+	 * purple_sqlite_history_adapter_compact() is called.
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_COMPACTION_INTERVAL] = g_param_spec_uint(
+		"compaction-interval", "compaction-interval",
+		"The number of seconds between compaction runs",
+		0, G_MAXUINT / 1000,
+		PURPLE_SQLITE_HISTORY_ADAPTER_DEFAULT_COMPACTION_INTERVAL,
+		G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+
+	/**
+	 * PurpleSqliteHistoryAdapter:compression:
+	 *
+	 * How the content of new messages is compressed. Existing messages can
+	 * be converted with purple_sqlite_history_adapter_convert_content().
+	 *
+	 * Since: 3.0.0
+	 */
+	properties[PROP_COMPRESSION] = g_param_spec_enum(
+		"compression", "compression",
+		"How to compress the content of messages",
+		PURPLE_TYPE_SQLITE_HISTORY_ADAPTER_COMPRESSION,
+		PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE,
+		G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS);
+
+	g_object_class_install_properties(obj_class, N_PROPERTIES, properties);
+
+	/**
+	 * PurpleSqliteHistoryAdapter::compacted:
+	 * @adapter: The instance.
+	 * @removed: The number of messages that were removed.
+	 * @reclaimed: The number of bytes that were returned to the file system.
+	 *
+	 * Emitted after a compaction run removed messages or reclaimed space.
+	 *
+	 * Since: 3.0.0
+	 */
+	signals[SIG_COMPACTED] = g_signal_new_class_handler(
+		"compacted",
+		G_OBJECT_CLASS_TYPE(klass),
+		G_SIGNAL_RUN_LAST,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		G_TYPE_NONE,
+		2,
+		G_TYPE_UINT64,
+		G_TYPE_UINT64);
+}
+
+/******************************************************************************
+ * Public API
+ *****************************************************************************/
+PurpleHistoryAdapter *
+purple_sqlite_history_adapter_new(const gchar *filename) {
+	return g_object_new(
+		PURPLE_TYPE_SQLITE_HISTORY_ADAPTER,
+		"filename", filename,
+		"id", "sqlite-adapter",
+		"name", N_("SQLite Adapter"),
+		NULL);
+}
+
+const gchar *
+purple_sqlite_history_adapter_get_filename(PurpleSqliteHistoryAdapter *adapter)
+{
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), NULL);
+
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+
+	return sqlite_adapter->filename;
+}
+
+PurpleSqliteHistoryAdapterSynchronous
+purple_sqlite_history_adapter_get_synchronous(PurpleSqliteHistoryAdapter *adapter)
+{
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter),
+	                     PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_NORMAL);
+
+	return adapter->synchronous;
+}
+
+void
+purple_sqlite_history_adapter_set_synchronous(PurpleSqliteHistoryAdapter *adapter,
+                                              PurpleSqliteHistoryAdapterSynchronous synchronous)
+{
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
+	g_return_if_fail(synchronous <= PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_EXTRA);
+
+	if(adapter->synchronous == synchronous) {
+		return;
+	}
+
+	adapter->synchronous = synchronous;
+
+	if(adapter->db != NULL) {
+		GError *error = NULL;
+
+		g_mutex_lock(&adapter->db_lock);
+		if(!purple_sqlite_history_adapter_apply_synchronous(adapter, &error)) {
+			g_warning("%s", error->message);
+			g_clear_error(&error);
+		}
+		g_mutex_unlock(&adapter->db_lock);
+	}
+
+	g_object_notify_by_pspec(G_OBJECT(adapter), properties[PROP_SYNCHRONOUS]);
+}
+
+guint
+purple_sqlite_history_adapter_get_commit_interval(PurpleSqliteHistoryAdapter *adapter)
+{
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), 0);
+
+	return adapter->commit_interval;
+}
+
+void
+purple_sqlite_history_adapter_set_commit_interval(PurpleSqliteHistoryAdapter *adapter,
+                                                  guint interval)
+{
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
+
+	g_mutex_lock(&adapter->lock);
+	adapter->commit_interval = interval;
+	g_mutex_unlock(&adapter->lock);
+
+	g_object_notify_by_pspec(G_OBJECT(adapter),
+	                         properties[PROP_COMMIT_INTERVAL]);
+}
+
+PurpleSqliteHistoryAdapterWriteMode
+purple_sqlite_history_adapter_get_write_mode(PurpleSqliteHistoryAdapter *adapter)
+{
+	PurpleSqliteHistoryAdapterWriteMode mode;
+
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter),
+	                     PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE_IGNORE);
+
+	g_mutex_lock(&adapter->db_lock);
+	mode = adapter->write_mode;
+	g_mutex_unlock(&adapter->db_lock);
+
+	return mode;
+}
+
+void
+purple_sqlite_history_adapter_set_write_mode(PurpleSqliteHistoryAdapter *adapter,
+                                             PurpleSqliteHistoryAdapterWriteMode mode)
+{
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
+	g_return_if_fail(mode <= PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE_REPLACE);
+
+	g_mutex_lock(&adapter->db_lock);
+	adapter->write_mode = mode;
+	g_mutex_unlock(&adapter->db_lock);
+
+	g_object_notify_by_pspec(G_OBJECT(adapter), properties[PROP_WRITE_MODE]);
+}
+
+guint
+purple_sqlite_history_adapter_get_max_age(PurpleSqliteHistoryAdapter *adapter)
+{
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), 0);
+
+	return adapter->max_age;
+}
+
+void
+purple_sqlite_history_adapter_set_max_age(PurpleSqliteHistoryAdapter *adapter,
+                                          guint days)
+{
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
+
+	adapter->max_age = days;
+
+	g_object_notify_by_pspec(G_OBJECT(adapter), properties[PROP_MAX_AGE]);
+}
+
+guint
+purple_sqlite_history_adapter_get_max_messages(PurpleSqliteHistoryAdapter *adapter)
+{
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), 0);
+
+	return adapter->max_messages;
+}
+
+void
+purple_sqlite_history_adapter_set_max_messages(PurpleSqliteHistoryAdapter *adapter,
+                                               guint max_messages)
+{
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
+
+	adapter->max_messages = max_messages;
+
+	g_object_notify_by_pspec(G_OBJECT(adapter), properties[PROP_MAX_MESSAGES]);
+}
+
+guint64
+purple_sqlite_history_adapter_get_max_size(PurpleSqliteHistoryAdapter *adapter)
+{
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), 0);
+
+	return adapter->max_size;
+}
+
+void
+purple_sqlite_history_adapter_set_max_size(PurpleSqliteHistoryAdapter *adapter,
+                                           guint64 max_size)
+{
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
+
+	adapter->max_size = max_size;
+
+	g_object_notify_by_pspec(G_OBJECT(adapter), properties[PROP_MAX_SIZE]);
+}
+
+guint
+purple_sqlite_history_adapter_get_compaction_interval(PurpleSqliteHistoryAdapter *adapter)
+{
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), 0);
+
+	return adapter->compaction_interval;
+}
+
+void
+purple_sqlite_history_adapter_set_compaction_interval(PurpleSqliteHistoryAdapter *adapter,
+                                                      guint interval)
+{
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
+
+	adapter->compaction_interval = interval;
+
+	purple_sqlite_history_adapter_schedule_compaction(adapter,
+	                                                  interval * 1000);
+
+	g_object_notify_by_pspec(G_OBJECT(adapter),
+	                         properties[PROP_COMPACTION_INTERVAL]);
+}
+
+PurpleSqliteHistoryAdapterCompression
+purple_sqlite_history_adapter_get_compression(PurpleSqliteHistoryAdapter *adapter)
+{
+	PurpleSqliteHistoryAdapterCompression compression;
+
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter),
+	                     PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE);
+
+	g_mutex_lock(&adapter->db_lock);
+	compression = adapter->compression;
+	g_mutex_unlock(&adapter->db_lock);
+
+	return compression;
+}
+
+void
+purple_sqlite_history_adapter_set_compression(PurpleSqliteHistoryAdapter *adapter,
+                                              PurpleSqliteHistoryAdapterCompression compression)
+{
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
+	g_return_if_fail(compression <= PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_DEFLATE);
+
+	g_mutex_lock(&adapter->db_lock);
+	adapter->compression = compression;
+	g_mutex_unlock(&adapter->db_lock);
 
-	while(keywords != NULL) {
-		sqlite3_bind_text(prepared_statement, index++,
-		                  (const char *)keywords->data, -1, g_free);
-		keywords = g_list_delete_link(keywords, keywords);
+	if(adapter->db != NULL &&
+	   compression != PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE)
+	{
+		purple_sqlite_history_adapter_queue_prepare_compression(adapter);
 	}
 
-	return prepared_statement;
+	g_object_notify_by_pspec(G_OBJECT(adapter), properties[PROP_COMPRESSION]);
 }
 
-/******************************************************************************
- * PurpleHistoryAdapter Implementation
- *****************************************************************************/
-static gboolean
-purple_sqlite_history_adapter_activate(PurpleHistoryAdapter *adapter,
-                                       GError **error)
+void
+purple_sqlite_history_adapter_convert_content_async(PurpleSqliteHistoryAdapter *adapter,
+                                                    GCancellable *cancellable,
+                                                    GAsyncReadyCallback callback,
+                                                    gpointer data)
 {
-	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
-	gint rc = 0;
+	GTask *task = NULL;
 
-	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
 
-	if(sqlite_adapter->db != NULL) {
-		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
-		                    _("Adapter has already been activated"));
+	task = g_task_new(adapter, cancellable, callback, data);
+	g_task_set_source_tag(task,
+	                      purple_sqlite_history_adapter_convert_content_async);
 
-		return FALSE;
+	if(adapter->db == NULL) {
+		g_task_return_new_error(task, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                        _("Adapter has not been activated"));
+		g_object_unref(task);
+
+		return;
 	}
 
-	if(sqlite_adapter->filename == NULL) {
-		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
-		                    _("No filename specified"));
+	g_task_set_task_data(task, g_new0(gint64, 1), g_free);
+	purple_sqlite_history_adapter_queue_job(adapter, task,
+	                                        purple_sqlite_history_adapter_convert_content_thread);
+	g_object_unref(task);
+}
 
-		return FALSE;
-	}
+gboolean
+purple_sqlite_history_adapter_convert_content_finish(PurpleSqliteHistoryAdapter *adapter,
+                                                     GAsyncResult *result,
+                                                     GError **error)
+{
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), FALSE);
+	g_return_val_if_fail(g_task_is_valid(result, adapter), FALSE);
 
-	rc = sqlite3_open(sqlite_adapter->filename, &sqlite_adapter->db);
-	if(rc != SQLITE_OK) {
-		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
-		            _("Error opening database in purplesqlitehistoryadapter for file %s"),
-		            sqlite_adapter->filename);
-		g_clear_pointer(&sqlite_adapter->db, sqlite3_close);
+	return g_task_propagate_boolean(G_TASK(result), error);
+}
 
-		return FALSE;
-	}
+void
+purple_sqlite_history_adapter_convert_vacuum_async(PurpleSqliteHistoryAdapter *adapter,
+                                                   GCancellable *cancellable,
+                                                   GAsyncReadyCallback callback,
+                                                   gpointer data)
+{
+	GTask *task = NULL;
 
-	if(!purple_sqlite_history_adapter_run_migrations(sqlite_adapter, error)) {
-		g_clear_pointer(&sqlite_adapter->db, sqlite3_close);
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
 
-		return FALSE;
+	task = g_task_new(adapter, cancellable, callback, data);
+	g_task_set_source_tag(task,
+	                      purple_sqlite_history_adapter_convert_vacuum_async);
+
+	if(adapter->db == NULL) {
+		g_task_return_new_error(task, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                        _("Adapter has not been activated"));
+		g_object_unref(task);
+
+		return;
 	}
 
-	return TRUE;
+	purple_sqlite_history_adapter_queue_job(adapter, task,
+	                                        purple_sqlite_history_adapter_convert_vacuum_thread);
+	g_object_unref(task);
 }
 
-static gboolean
-purple_sqlite_history_adapter_deactivate(PurpleHistoryAdapter *adapter,
-                                         GError **error)
+gboolean
+purple_sqlite_history_adapter_convert_vacuum_finish(PurpleSqliteHistoryAdapter *adapter,
+                                                    GAsyncResult *result,
+                                                    GError **error)
 {
-	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
-
-	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
-	g_clear_pointer(&sqlite_adapter->db, sqlite3_close);
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), FALSE);
+	g_return_val_if_fail(g_task_is_valid(result, adapter), FALSE);
 
-	return TRUE;
+	return g_task_propagate_boolean(G_TASK(result), error);
 }
 
-static GList*
-purple_sqlite_history_adapter_query(PurpleHistoryAdapter *adapter,
-                                    const gchar *query, GError **error)
+gboolean
+purple_sqlite_history_adapter_compact(PurpleSqliteHistoryAdapter *adapter,
+                                      GTimeSpan budget, gboolean *finished,
+                                      GError **error)
 {
-	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
-	sqlite3_stmt *prepared_statement = NULL;
-	GList *results = NULL;
+	PurpleSqliteHistoryAdapterCompaction compaction = {0, 0, 0, FALSE};
+	gboolean ret = TRUE;
 
-	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), FALSE);
 
-	if(sqlite_adapter->db == NULL) {
+	if(finished != NULL) {
+		*finished = TRUE;
+	}
+
+	if(adapter->db == NULL) {
 		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
 		                    _("Adapter has not been activated"));
 
 		return FALSE;
 	}
 
-	prepared_statement = purple_sqlite_history_adapter_build_query(sqlite_adapter,
-	                                                               query,
-	                                                               FALSE,
-	                                                               error);
-
-	if(prepared_statement == NULL) {
-		return NULL;
+	if(budget > 0) {
+		compaction.deadline = g_get_monotonic_time() + budget;
 	}
 
-	while(sqlite3_step(prepared_statement) == SQLITE_ROW) {
-		PurpleMessage *message = NULL;
-		PurpleMessageContentType ct;
-		GDateTime *g_date_time = NULL;
-		const gchar *message_id = NULL;
-		const gchar *author = NULL;
-		const gchar *author_name_color = NULL;
-		const gchar *author_alias = NULL;
-		const gchar *recipient = NULL;
-		const gchar *content = NULL;
-		const gchar *content_type = NULL;
-		const gchar *timestamp = NULL;
-
-		message_id = (const gchar *)sqlite3_column_text(prepared_statement, 0);
-		author = (const gchar *)sqlite3_column_text(prepared_statement, 1);
-		author_name_color = (const gchar *)sqlite3_column_text(prepared_statement, 2);
-		author_alias = (const gchar *)sqlite3_column_text(prepared_statement, 3);
-		recipient = (const gchar *)sqlite3_column_text(prepared_statement, 4);
-		content_type = (const gchar *)sqlite3_column_text(prepared_statement, 5);
-		ct = purple_sqlite_history_adapter_get_content_type_enum(content_type);
-		content = (const gchar *)sqlite3_column_text(prepared_statement, 6);
-		timestamp = (const gchar *)sqlite3_column_text(prepared_statement, 7);
-		g_date_time = g_date_time_new_from_iso8601(timestamp, NULL);
+	ret = purple_sqlite_history_adapter_run_compaction(adapter, &compaction,
+	                                                   error);
 
-		message = g_object_new(PURPLE_TYPE_MESSAGE,
-		                       "id", message_id,
-		                       "author", author,
-		                       "author_name_color", author_name_color,
-		                       "author_alias", author_alias,
-		                       "recipient", recipient,
-		                       "contents", content,
-		                       "content_type", ct,
-		                       "timestamp", g_date_time,
-		                       NULL);
-
-		results = g_list_prepend(results, message);
+	if(finished != NULL && ret) {
+		*finished = !compaction.expired;
 	}
 
-	results = g_list_reverse(results);
-
-	sqlite3_finalize(prepared_statement);
+	if(compaction.removed > 0 || compaction.reclaimed > 0) {
+		g_signal_emit(adapter, signals[SIG_COMPACTED], 0, compaction.removed,
+		              compaction.reclaimed);
+	}
 
-	return results;
+	return ret;
 }
 
-static gboolean
-purple_sqlite_history_adapter_remove(PurpleHistoryAdapter *adapter,
-                                     const gchar *query, GError **error)
+gboolean
+purple_sqlite_history_adapter_flush(PurpleSqliteHistoryAdapter *adapter,
+                                    GError **error)
 {
-	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
-	sqlite3_stmt * prepared_statement = NULL;
-	gint result = 0;
+	GError *write_error = NULL;
 
-	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), FALSE);
 
-	if(sqlite_adapter->db == NULL) {
-		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
-		                    _("Adapter has not been activated"));
+	purple_sqlite_history_adapter_wait_for_writer(adapter);
 
-		return FALSE;
-	}
+	g_mutex_lock(&adapter->lock);
+	write_error = g_steal_pointer(&adapter->write_error);
+	g_mutex_unlock(&adapter->lock);
 
-	prepared_statement = purple_sqlite_history_adapter_build_query(sqlite_adapter,
-	                                                               query,
-	                                                               TRUE,
-	                                                               error);
+	if(write_error != NULL) {
+		g_propagate_error(error, write_error);
 
-	if(prepared_statement == NULL) {
 		return FALSE;
 	}
 
-	result = sqlite3_step(prepared_statement);
+	return TRUE;
+}
 
-	if(result != SQLITE_DONE) {
-		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
-		            "Error removing from the database: %s",
-		            sqlite3_errmsg(sqlite_adapter->db));
+void
+purple_sqlite_history_adapter_flush_async(PurpleSqliteHistoryAdapter *adapter,
+                                          GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer data)
+{
+	GTask *task = NULL;
 
-		sqlite3_finalize(prepared_statement);
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
 
-		return FALSE;
-	}
+	task = g_task_new(adapter, cancellable, callback, data);
+	g_task_set_source_tag(task, purple_sqlite_history_adapter_flush_async);
 
-	sqlite3_finalize(prepared_statement);
+	g_task_run_in_thread(task, purple_sqlite_history_adapter_flush_thread);
 
-	return TRUE;
+	g_object_unref(task);
 }
 
-static gboolean
-purple_sqlite_history_adapter_write(PurpleHistoryAdapter *adapter,
-                                    PurpleConversation *conversation,
-                                    PurpleMessage *message, GError **error)
+gboolean
+purple_sqlite_history_adapter_flush_finish(PurpleSqliteHistoryAdapter *adapter,
+                                           GAsyncResult *result,
+                                           GError **error)
 {
-	PurpleAccount *account = NULL;
-	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
-	sqlite3_stmt *prepared_statement = NULL;
-	gchar *timestamp = NULL;
-	gchar *content_type = NULL;
-	const gchar * message_id = NULL;
-	const gchar *script = NULL;
-	gint result = 0;
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), FALSE);
+	g_return_val_if_fail(g_task_is_valid(result, adapter), FALSE);
 
-	script = "INSERT INTO message_log(protocol, account, conversation_id, "
-			 "message_id, author, author_name_color, author_alias, "
-			 "recipient, content_type, content, client_timestamp) "
-	         "VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+	return g_task_propagate_boolean(G_TASK(result), error);
+}
 
-	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+const gchar *
+purple_sqlite_history_adapter_get_snippet(PurpleMessage *message) {
+	g_return_val_if_fail(PURPLE_IS_MESSAGE(message), NULL);
 
-	if(sqlite_adapter->db == NULL) {
-		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
-		                    _("Adapter has not been activated"));
+	return g_object_get_qdata(G_OBJECT(message),
+	                          purple_sqlite_history_adapter_snippet_quark());
+}
 
-		return FALSE;
-	}
+gboolean
+purple_sqlite_history_adapter_rebuild_search_index(PurpleSqliteHistoryAdapter *adapter,
+                                                   GError **error)
+{
+	gchar *errmsg = NULL;
 
-	sqlite3_prepare_v2(sqlite_adapter->db, script, -1, &prepared_statement, NULL);
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), FALSE);
+
+	if(adapter->db == NULL) {
+		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                    _("Adapter has not been activated"));
 
-	if(prepared_statement == NULL) {
-		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
-		            "Error creating the prepared statement: %s",
-		            sqlite3_errmsg(sqlite_adapter->db));
 		return FALSE;
 	}
 
-	account = purple_conversation_get_account(conversation);
+	purple_sqlite_history_adapter_wait_for_writer(adapter);
 
-	sqlite3_bind_text(prepared_statement,
-	                  1, purple_account_get_protocol_name(account), -1,
-	                  SQLITE_STATIC);
-	sqlite3_bind_text(prepared_statement,
-	                  2, purple_account_get_username(account), -1,
-	                  SQLITE_STATIC);
-	sqlite3_bind_text(prepared_statement,
-	                  3, purple_conversation_get_name(conversation), -1,
-	                  SQLITE_STATIC);
-	message_id = purple_message_get_id(message);
-	if(message_id != NULL) {
-		sqlite3_bind_text(prepared_statement, 4, message_id, -1,
-		                  SQLITE_STATIC);
-	} else {
-		sqlite3_bind_text(prepared_statement, 4, g_uuid_string_random(), -1,
-		                  g_free);
+	g_mutex_lock(&adapter->db_lock);
+	sqlite3_exec(adapter->db,
+	             "BEGIN;"
+	             "DELETE FROM message_log_fts_pending;"
+	             "INSERT INTO message_log_fts(message_log_fts) "
+	             "VALUES('rebuild');"
+	             "COMMIT;",
+	             NULL, NULL, &errmsg);
+	if(errmsg != NULL) {
+		sqlite3_exec(adapter->db, "ROLLBACK;", NULL, NULL, NULL);
 	}
-	sqlite3_bind_text(prepared_statement,
-	                  5, purple_message_get_author(message), -1,
-	                  SQLITE_STATIC);
-	sqlite3_bind_text(prepared_statement,
-	                  6, purple_message_get_author_name_color(message), -1,
-	                  SQLITE_STATIC);
-	sqlite3_bind_text(prepared_statement,
-	                  7, purple_message_get_author_alias(message), -1,
-	                  SQLITE_STATIC);
-	sqlite3_bind_text(prepared_statement,
-	                  8, purple_message_get_recipient(message), -1,
-	                  SQLITE_STATIC);
-	content_type = purple_sqlite_history_adapter_get_content_type(purple_message_get_content_type(message));
-	sqlite3_bind_text(prepared_statement,
-	                  9, content_type, -1, SQLITE_STATIC);
-	sqlite3_bind_text(prepared_statement,
-	                  10, purple_message_get_contents(message), -1,
-	                  SQLITE_STATIC);
-	timestamp = g_date_time_format_iso8601(purple_message_get_timestamp(message));
-	sqlite3_bind_text(prepared_statement, 11, timestamp, -1, g_free);
-
-	result = sqlite3_step(prepared_statement);
+	g_mutex_unlock(&adapter->db_lock);
 
-	if(result != SQLITE_DONE) {
+	if(errmsg != NULL) {
 		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
-		            "Error writing to the database: %s",
-		            sqlite3_errmsg(sqlite_adapter->db));
-
-		sqlite3_finalize(prepared_statement);
+		            "Error rebuilding the search index: %s", errmsg);
+		sqlite3_free(errmsg);
 
 		return FALSE;
 	}
 
-	sqlite3_finalize(prepared_statement);
-
 	return TRUE;
 }
 
-/******************************************************************************
- * GObject Implementation
- *****************************************************************************/
-static void
-purple_sqlite_history_adapter_get_property(GObject *obj, guint param_id,
-                                           GValue *value, GParamSpec *pspec)
+gchar *
+purple_sqlite_history_adapter_explain_page(PurpleSqliteHistoryAdapter *adapter,
+                                           const gchar *query,
+                                           GError **error)
 {
-	PurpleSqliteHistoryAdapter *adapter = PURPLE_SQLITE_HISTORY_ADAPTER(obj);
+	PurpleSqliteHistoryAdapterCursor after = {TRUE, 0, 0};
+	sqlite3_stmt *prepared_statement = NULL;
+	sqlite3_stmt *explain = NULL;
+	GString *plan = NULL;
+	gchar *sql = NULL;
 
-	switch(param_id) {
-		case PROP_FILENAME:
-			g_value_set_string(value,
-			                   purple_sqlite_history_adapter_get_filename(adapter));
-			break;
-		default:
-			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
-			break;
+	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), NULL);
+
+	if(adapter->db == NULL) {
+		g_set_error_literal(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		                    _("Adapter has not been activated"));
+
+		return NULL;
 	}
-}
 
-static void
-purple_sqlite_history_adapter_set_property(GObject *obj, guint param_id,
-                                           const GValue *value,
-                                           GParamSpec *pspec)
-{
-	PurpleSqliteHistoryAdapter *adapter = PURPLE_SQLITE_HISTORY_ADAPTER(obj);
+	g_mutex_lock(&adapter->db_lock);
 
-	switch(param_id) {
-		case PROP_FILENAME:
-			purple_sqlite_history_adapter_set_filename(adapter,
-			                                           g_value_get_string(value));
-			break;
-		default:
-			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
-			break;
+	prepared_statement = purple_sqlite_history_adapter_build_query(adapter->db,
+	                                                               adapter->statements,
+	                                                               query,
+	                                                               FALSE,
+	                                                               &after, 1,
+	                                                               error);
+	if(prepared_statement == NULL) {
+		g_mutex_unlock(&adapter->db_lock);
+
+		return NULL;
 	}
-}
 
-static void
-purple_sqlite_history_adapter_finalize(GObject *obj) {
-	PurpleSqliteHistoryAdapter *adapter = NULL;
+	sql = g_strconcat("EXPLAIN QUERY PLAN ", sqlite3_sql(prepared_statement),
+	                  NULL);
+	purple_sqlite_history_adapter_release_statement(prepared_statement);
 
-	adapter = PURPLE_SQLITE_HISTORY_ADAPTER(obj);
+	sqlite3_prepare_v2(adapter->db, sql, -1, &explain, NULL);
+	g_free(sql);
 
-	g_clear_pointer(&adapter->filename, g_free);
+	if(explain == NULL) {
+		g_set_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0,
+		            "Error creating the prepared statement: %s",
+		            sqlite3_errmsg(adapter->db));
+		g_mutex_unlock(&adapter->db_lock);
 
-	if(adapter->db != NULL) {
-		g_warning("PurpleSqliteHistoryAdapter was finalized before being "
-		          "deactivated");
+		return NULL;
+	}
 
-		g_clear_pointer(&adapter->db, sqlite3_close);
+	/* The fourth column describes each step of the plan. */
+	plan = g_string_new(NULL);
+	while(sqlite3_step(explain) == SQLITE_ROW) {
+		g_string_append_printf(plan, "%s\n",
+		                       (const gchar *)sqlite3_column_text(explain, 3));
 	}
+	sqlite3_finalize(explain);
 
-	G_OBJECT_CLASS(purple_sqlite_history_adapter_parent_class)->finalize(obj);
-}
+	g_mutex_unlock(&adapter->db_lock);
 
-static void
-purple_sqlite_history_adapter_init(PurpleSqliteHistoryAdapter *adapter) {
+	return g_string_free(plan, FALSE);
 }
 
-static void
-purple_sqlite_history_adapter_class_init(PurpleSqliteHistoryAdapterClass *klass)
+void
+purple_sqlite_history_adapter_get_statement_cache_stats(PurpleSqliteHistoryAdapter *adapter,
+                                                        guint64 *hits,
+                                                        guint64 *misses)
 {
-	GObjectClass *obj_class = G_OBJECT_CLASS(klass);
-	PurpleHistoryAdapterClass *adapter_class = PURPLE_HISTORY_ADAPTER_CLASS(klass);
-
-	obj_class->get_property = purple_sqlite_history_adapter_get_property;
-	obj_class->set_property = purple_sqlite_history_adapter_set_property;
-	obj_class->finalize = purple_sqlite_history_adapter_finalize;
-
-	adapter_class->activate = purple_sqlite_history_adapter_activate;
-	adapter_class->deactivate = purple_sqlite_history_adapter_deactivate;
-	adapter_class->query = purple_sqlite_history_adapter_query;
-	adapter_class->remove = purple_sqlite_history_adapter_remove;
-	adapter_class->write = purple_sqlite_history_adapter_write;
+	PurpleSqliteHistoryAdapterStatementCache *caches[2];
+	guint64 total_hits = 0;
+	guint64 total_misses = 0;
+	gsize i = 0;
 
-	/**
-	 * PurpleHistoryAdapter::filename:
-	 *
-	 * The filename that the sqlite database will store data to.
-	 *
-	 * Since: 3.0.0
-	 */
-	properties[PROP_FILENAME] = g_param_spec_string(
-		"filename", "filename", "The filename of the sqlite database",
-		NULL,
-		G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS
-	);
+	g_return_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter));
 
-	g_object_class_install_properties(obj_class, N_PROPERTIES, properties);
-}
+	g_mutex_lock(&adapter->read_lock);
+	g_mutex_lock(&adapter->db_lock);
 
-/******************************************************************************
- * Public API
- *****************************************************************************/
-PurpleHistoryAdapter *
-purple_sqlite_history_adapter_new(const gchar *filename) {
-	return g_object_new(
-		PURPLE_TYPE_SQLITE_HISTORY_ADAPTER,
-		"filename", filename,
-		"id", "sqlite-adapter",
-		"name", N_("SQLite Adapter"),
-		NULL);
-}
+	caches[0] = adapter->statements;
+	caches[1] = adapter->read_statements;
 
-const gchar *
-purple_sqlite_history_adapter_get_filename(PurpleSqliteHistoryAdapter *adapter)
-{
-	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	for(i = 0; i < G_N_ELEMENTS(caches); i++) {
+		if(caches[i] != NULL) {
+			total_hits += caches[i]->hits;
+			total_misses += caches[i]->misses;
+		}
+	}
 
-	g_return_val_if_fail(PURPLE_IS_SQLITE_HISTORY_ADAPTER(adapter), NULL);
+	g_mutex_unlock(&adapter->db_lock);
+	g_mutex_unlock(&adapter->read_lock);
 
-	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	if(hits != NULL) {
+		*hits = total_hits;
+	}
 
-	return sqlite_adapter->filename;
+	if(misses != NULL) {
+		*misses = total_misses;
+	}
 }
@@ -31,12 +31,122 @@
 
 G_BEGIN_DECLS
 
+/**
+ * PurpleSqliteHistoryAdapterSynchronous:
+ * @PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_OFF: Hand data off to the
+ *  operating system without syncing.
+ * @PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_NORMAL: Sync at checkpoints. This
+ *  is durable across application crashes but may lose the last transactions
+ *  on a power loss.
+ * @PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_FULL: Sync on every commit.
+ * @PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_EXTRA: Like
+ *  @PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_FULL but also syncs the
+ *  directory after a journal is removed.
+ *
+ * The value used for `PRAGMA synchronous` on the history database.
+ *
+ * Since: 3.0.0
+ */
+typedef enum /*< prefix=PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS,underscore_name=PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS >*/
+{
+	PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_OFF = 0,
+	PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_NORMAL,
+	PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_FULL,
+	PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_EXTRA,
+} PurpleSqliteHistoryAdapterSynchronous;
+
+/**
+ * PurpleSqliteHistoryAdapterWriteMode:
+ * @PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE_IGNORE: Keep the message that was
+ *  written first and ignore any later copies.
+ * @PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE_REPLACE: Update the stored message
+ *  with the author and contents of the new copy, for example when a protocol
+ *  delivers an edited message with the same id. The original timestamp is
+ *  kept.
+ *
+ * What to do when a message is written with the same account, conversation,
+ * and message id as one that is already in the database.
+ *
+ * Since: 3.0.0
+ */
+typedef enum /*< prefix=PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE,underscore_name=PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE >*/
+{
+	PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE_IGNORE = 0,
+	PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE_REPLACE,
+} PurpleSqliteHistoryAdapterWriteMode;
+
+/**
+ * PurpleSqliteHistoryAdapterCompression:
+ * @PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE: Store the content of
+ *  messages as text.
+ * @PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_DEFLATE: Compress the content of
+ *  messages with deflate when that makes it smaller. Short messages are
+ *  compressed against a dictionary of earlier history that is stored in the
+ *  database.
+ *
+ * How the content of messages is stored in the database. Databases may
+ * contain a mix of both, and are always read correctly.
+ *
+ * Since: 3.0.0
+ */
+typedef enum /*< prefix=PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION,underscore_name=PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION >*/
+{
+	PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE = 0,
+	PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_DEFLATE,
+} PurpleSqliteHistoryAdapterCompression;
+
 /**
  * PurpleSqliteHistoryAdapter:
  *
  * #PurpleSqliteHistoryAdapter is a class that allows interfacing with an
  * SQLite database to store history. It is a subclass of @PurpleHistoryAdapter.
  *
+ * Messages passed to purple_history_adapter_write() are not written
+ * immediately. Instead they are queued and a dedicated writer thread commits
+ * everything that is pending in a single transaction every
+ * #PurpleSqliteHistoryAdapter:commit-interval milliseconds. Queries and
+ * removals wait for the queue to be flushed before they run, so they always
+ * see every message that has been written.
+ *
+ * Queries run on a separate read only connection, so they are not blocked by
+ * the commits of the writer thread, and purple_history_adapter_query_async()
+ * runs them on a worker thread. Cancelling the #GCancellable of an
+ * asynchronous query interrupts it even while SQLite is still searching.
+ *
+ * Old messages can be removed automatically by setting a retention policy
+ * with #PurpleSqliteHistoryAdapter:max-age,
+ * #PurpleSqliteHistoryAdapter:max-messages, and
+ * #PurpleSqliteHistoryAdapter:max-size. The policy is applied in short
+ * batches every #PurpleSqliteHistoryAdapter:compaction-interval seconds,
+ * which also returns unused pages to the file system. The batches run on the
+ * thread that writes messages, in between the messages.
+ *
+ * The content of messages can be compressed by setting
+ * #PurpleSqliteHistoryAdapter:compression. Until then the database only uses
+ * plain SQLite and can be read and modified by other tools. Once compression
+ * is enabled, the search index depends on functions that the adapter
+ * registers, so other tools can only read it. Converting the content back with
+ * compression disabled lifts that again.
+ *
+ * Queries are a space separated list of terms. Values can be wrapped in
+ * double quotes to include spaces, in which case a backslash escapes the next
+ * character, for example `in:"#pidgin room"`. `in:NAME` matches messages in
+ * the conversation named `NAME`, `account:NAME` matches messages of the
+ * account with the username `NAME`, `from:NAME` matches messages authored by
+ * `NAME`, `after:TIME` and `before:TIME` limit the results to messages written
+ * at or after and strictly before `TIME` which is either an ISO 8601 date or
+ * date and time. `before-id:ID` extends `before:` to also match the messages
+ * written at exactly `TIME` that were stored before the message with the id
+ * `ID`, which makes a stable cursor for paging backwards through messages
+ * that share a timestamp. Any other term is a keyword that is searched for in the
+ * contents of the message using a full text index. When keywords are given,
+ * the results are ordered by relevance and a snippet of the matching text is
+ * available via purple_sqlite_history_adapter_get_snippet(). Finally,
+ * `last:COUNT` limits the results to the `COUNT` most recent matching messages
+ * in chronological order. It can not be used in removals or paged queries.
+ * Paged queries always return messages in chronological order, including
+ * those with keywords.
+ *
  * Since: 3.0.0
  */
 
@@ -68,6 +178,405 @@ PurpleHistoryAdapter *purple_sqlite_history_adapter_new(const gchar *filename);
  */
 const gchar *purple_sqlite_history_adapter_get_filename(PurpleSqliteHistoryAdapter *adapter);
 
+/**
+ * purple_sqlite_history_adapter_get_synchronous:
+ * @adapter: The instance.
+ *
+ * Gets the `PRAGMA synchronous` level that @adapter uses.
+ *
+ * Returns: The synchronous level.
+ *
+ * Since: 3.0.0
+ */
+PurpleSqliteHistoryAdapterSynchronous purple_sqlite_history_adapter_get_synchronous(PurpleSqliteHistoryAdapter *adapter);
+
+/**
+ * purple_sqlite_history_adapter_set_synchronous:
+ * @adapter: The instance.
+ * @synchronous: The new synchronous level.
+ *
+ * Sets the `PRAGMA synchronous` level of @adapter. If @adapter is active the
+ * new level is applied immediately, otherwise it will be applied when it is
+ * activated.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_set_synchronous(PurpleSqliteHistoryAdapter *adapter, PurpleSqliteHistoryAdapterSynchronous synchronous);
+
+/**
+ * purple_sqlite_history_adapter_get_commit_interval:
+ * @adapter: The instance.
+ *
+ * Gets the number of milliseconds that the writer thread waits for more
+ * messages before committing a batch.
+ *
+ * Returns: The commit interval in milliseconds.
+ *
+ * Since: 3.0.0
+ */
+guint purple_sqlite_history_adapter_get_commit_interval(PurpleSqliteHistoryAdapter *adapter);
+
+/**
+ * purple_sqlite_history_adapter_set_commit_interval:
+ * @adapter: The instance.
+ * @interval: The new commit interval in milliseconds.
+ *
+ * Sets the number of milliseconds that the writer thread waits for more
+ * messages before committing them in one transaction. A value of 0 commits
+ * whatever is pending as soon as the writer thread wakes up.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_set_commit_interval(PurpleSqliteHistoryAdapter *adapter, guint interval);
+
+/**
+ * purple_sqlite_history_adapter_get_write_mode:
+ * @adapter: The instance.
+ *
+ * Gets what @adapter does when a message is written again.
+ *
+ * Returns: The write mode.
+ *
+ * Since: 3.0.0
+ */
+PurpleSqliteHistoryAdapterWriteMode purple_sqlite_history_adapter_get_write_mode(PurpleSqliteHistoryAdapter *adapter);
+
+/**
+ * purple_sqlite_history_adapter_set_write_mode:
+ * @adapter: The instance.
+ * @mode: The new write mode.
+ *
+ * Sets what @adapter does when a message is written with the same account,
+ * conversation, and message id as one that it already has. Messages without
+ * an id are given a random one, so they are never considered duplicates.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_set_write_mode(PurpleSqliteHistoryAdapter *adapter, PurpleSqliteHistoryAdapterWriteMode mode);
+
+/**
+ * purple_sqlite_history_adapter_get_max_age:
+ * @adapter: The instance.
+ *
+ * Gets the number of days that @adapter keeps messages for.
+ *
+ * Returns: The maximum age of messages in days, or 0 if there is no limit.
+ *
+ * Since: 3.0.0
+ */
+guint purple_sqlite_history_adapter_get_max_age(PurpleSqliteHistoryAdapter *adapter);
+
+/**
+ * purple_sqlite_history_adapter_set_max_age:
+ * @adapter: The instance.
+ * @days: The maximum age of messages in days, or 0 for no limit.
+ *
+ * Sets the number of days that @adapter keeps messages for. Older messages are
+ * removed the next time @adapter is compacted.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_set_max_age(PurpleSqliteHistoryAdapter *adapter, guint days);
+
+/**
+ * purple_sqlite_history_adapter_get_max_messages:
+ * @adapter: The instance.
+ *
+ * Gets the number of messages that @adapter keeps for each conversation.
+ *
+ * Returns: The maximum number of messages, or 0 if there is no limit.
+ *
+ * Since: 3.0.0
+ */
+guint purple_sqlite_history_adapter_get_max_messages(PurpleSqliteHistoryAdapter *adapter);
+
+/**
+ * purple_sqlite_history_adapter_set_max_messages:
+ * @adapter: The instance.
+ * @max_messages: The maximum number of messages, or 0 for no limit.
+ *
+ * Sets the number of messages that @adapter keeps for each conversation. The
+ * oldest messages of conversations that have more are removed the next time
+ * @adapter is compacted.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_set_max_messages(PurpleSqliteHistoryAdapter *adapter, guint max_messages);
+
+/**
+ * purple_sqlite_history_adapter_get_max_size:
+ * @adapter: The instance.
+ *
+ * Gets the number of bytes that the messages of @adapter may use.
+ *
+ * Returns: The maximum size in bytes, or 0 if there is no limit.
+ *
+ * Since: 3.0.0
+ */
+guint64 purple_sqlite_history_adapter_get_max_size(PurpleSqliteHistoryAdapter *adapter);
+
+/**
+ * purple_sqlite_history_adapter_set_max_size:
+ * @adapter: The instance.
+ * @max_size: The maximum size in bytes, or 0 for no limit.
+ *
+ * Sets the number of bytes that the messages of @adapter may use. When the
+ * database is larger, the oldest messages are removed the next time @adapter
+ * is compacted.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_set_max_size(PurpleSqliteHistoryAdapter *adapter, guint64 max_size);
+
+/**
+ * purple_sqlite_history_adapter_get_compaction_interval:
+ * @adapter: The instance.
+ *
+ * Gets the number of seconds between automatic compaction runs.
+ *
+ * Returns: The compaction interval in seconds, or 0 if automatic compaction is
+ *          disabled.
+ *
+ * Since: 3.0.0
+ */
+guint purple_sqlite_history_adapter_get_compaction_interval(PurpleSqliteHistoryAdapter *adapter);
+
+/**
+ * purple_sqlite_history_adapter_set_compaction_interval:
+ * @adapter: The instance.
+ * @interval: The compaction interval in seconds, or 0 to disable automatic
+ *            compaction.
+ *
+ * Sets how often @adapter compacts itself while it is active. Each run is
+ * limited to a few milliseconds on the thread that writes messages and
+ * continues shortly after if there was more to do.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_set_compaction_interval(PurpleSqliteHistoryAdapter *adapter, guint interval);
+
+/**
+ * purple_sqlite_history_adapter_get_compression:
+ * @adapter: The instance.
+ *
+ * Gets how @adapter stores the content of new messages.
+ *
+ * Returns: The compression mode.
+ *
+ * Since: 3.0.0
+ */
+PurpleSqliteHistoryAdapterCompression purple_sqlite_history_adapter_get_compression(PurpleSqliteHistoryAdapter *adapter);
+
+/**
+ * purple_sqlite_history_adapter_set_compression:
+ * @adapter: The instance.
+ * @compression: The new compression mode.
+ *
+ * Sets how @adapter stores the content of new messages. This does not change
+ * messages that have already been written, see
+ * purple_sqlite_history_adapter_convert_content_async() for that.
+ *
+ * Enabling compression switches the search index over and stores a
+ * dictionary in the background. New messages are stored as text until that
+ * has finished. The messages that were already there are then added to the
+ * new search index in small batches, so keyword queries may miss some of them
+ * until that is done.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_set_compression(PurpleSqliteHistoryAdapter *adapter, PurpleSqliteHistoryAdapterCompression compression);
+
+/**
+ * purple_sqlite_history_adapter_convert_content_async:
+ * @adapter: The instance.
+ * @cancellable: (nullable): A #GCancellable or %NULL.
+ * @callback: (scope async): The callback to call when the conversion is done.
+ * @data: User data to pass to @callback.
+ *
+ * Converts the content of every message that is already in the database to
+ * the current #PurpleSqliteHistoryAdapter:compression of @adapter. The
+ * messages are converted in small batches on the thread that writes messages,
+ * so writes and queries continue in the meantime. The search index is
+ * complete by the time this finishes.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_convert_content_async(PurpleSqliteHistoryAdapter *adapter, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer data);
+
+/**
+ * purple_sqlite_history_adapter_convert_content_finish:
+ * @adapter: The instance.
+ * @result: The #GAsyncResult passed to the callback.
+ * @error: (nullable): A return address for a #GError.
+ *
+ * Gets the result of purple_sqlite_history_adapter_convert_content_async().
+ *
+ * Returns: %TRUE on success, otherwise %FALSE with @error set.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_sqlite_history_adapter_convert_content_finish(PurpleSqliteHistoryAdapter *adapter, GAsyncResult *result, GError **error);
+
+/**
+ * purple_sqlite_history_adapter_convert_vacuum_async:
+ * @adapter: The instance.
+ * @cancellable: (nullable): A #GCancellable or %NULL.
+ * @callback: (scope async): The callback to call when the conversion is done.
+ * @data: User data to pass to @callback.
+ *
+ * Converts a database that was created before incremental vacuuming was
+ * enabled, so that purple_sqlite_history_adapter_compact() can return its
+ * free pages to the file system. New databases don't need this, and it does
+ * nothing if @adapter has already been converted.
+ *
+ * This rewrites the whole database on the thread that writes messages, so it
+ * is meant for explicit maintenance. Queries continue in the meantime and
+ * writes are queued without blocking, but removals wait until it is done.
+ * The conversion may renumber the messages, so the cursor of a query that
+ * was started before it may repeat or skip messages.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_convert_vacuum_async(PurpleSqliteHistoryAdapter *adapter, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer data);
+
+/**
+ * purple_sqlite_history_adapter_convert_vacuum_finish:
+ * @adapter: The instance.
+ * @result: The #GAsyncResult passed to the callback.
+ * @error: (nullable): A return address for a #GError.
+ *
+ * Gets the result of purple_sqlite_history_adapter_convert_vacuum_async().
+ *
+ * Returns: %TRUE on success, otherwise %FALSE with @error set.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_sqlite_history_adapter_convert_vacuum_finish(PurpleSqliteHistoryAdapter *adapter, GAsyncResult *result, GError **error);
+
+/**
+ * purple_sqlite_history_adapter_compact:
+ * @adapter: The instance.
+ * @budget: The number of microseconds this may take, or 0 for no limit.
+ * @finished: (out) (optional): A return address for whether everything was
+ *            done within @budget.
+ * @error: (nullable): A return address for a #GError.
+ *
+ * Applies the retention policy of @adapter, that is
+ * #PurpleSqliteHistoryAdapter:max-age,
+ * #PurpleSqliteHistoryAdapter:max-messages, and
+ * #PurpleSqliteHistoryAdapter:max-size, and then returns the free pages of the
+ * database to the file system. Messages are removed in small batches so the
+ * writer thread is never blocked for long.
+ *
+ * This runs on the calling thread, so it is meant for explicit maintenance.
+ * The automatic compaction of #PurpleSqliteHistoryAdapter:compaction-interval
+ * does not block the main thread.
+ *
+ * #PurpleSqliteHistoryAdapter::compacted is emitted if anything was removed or
+ * reclaimed.
+ *
+ * Returns: %TRUE on success, otherwise %FALSE with @error set.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_sqlite_history_adapter_compact(PurpleSqliteHistoryAdapter *adapter, GTimeSpan budget, gboolean *finished, GError **error);
+
+/**
+ * purple_sqlite_history_adapter_flush:
+ * @adapter: The instance.
+ * @error: (nullable): A return address for a #GError.
+ *
+ * Blocks until every message that has been written to @adapter so far has
+ * been committed to the database. This does nothing if @adapter is not
+ * active.
+ *
+ * purple_history_adapter_write() only queues messages, so this is where
+ * failures to write them are reported. If any message could not be written
+ * since the last flush that returned an error, the first of those errors is
+ * returned.
+ *
+ * Returns: %TRUE if every message was written, otherwise %FALSE with @error
+ *          set.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_sqlite_history_adapter_flush(PurpleSqliteHistoryAdapter *adapter, GError **error);
+
+/**
+ * purple_sqlite_history_adapter_flush_async:
+ * @adapter: The instance.
+ * @cancellable: (nullable): A #GCancellable or %NULL.
+ * @callback: (scope async): The callback to call when the flush is done.
+ * @data: User data to pass to @callback.
+ *
+ * Waits for the writer thread of @adapter on a worker thread, see
+ * purple_sqlite_history_adapter_flush().
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_flush_async(PurpleSqliteHistoryAdapter *adapter, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer data);
+
+/**
+ * purple_sqlite_history_adapter_flush_finish:
+ * @adapter: The instance.
+ * @result: The #GAsyncResult passed to the callback.
+ * @error: (nullable): A return address for a #GError.
+ *
+ * Gets the result of purple_sqlite_history_adapter_flush_async().
+ *
+ * Returns: %TRUE if every message was written, otherwise %FALSE with @error
+ *          set.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_sqlite_history_adapter_flush_finish(PurpleSqliteHistoryAdapter *adapter, GAsyncResult *result, GError **error);
+
+/**
+ * purple_sqlite_history_adapter_get_snippet:
+ * @message: A #PurpleMessage returned from a keyword query.
+ *
+ * Gets the snippet of @message that matched the keywords of the query that
+ * returned it. The matching words are wrapped in `<b>` and `</b>`.
+ *
+ * Returns: (nullable): The snippet, or %NULL if @message was not returned by
+ *          a keyword query of a #PurpleSqliteHistoryAdapter.
+ *
+ * Since: 3.0.0
+ */
+const gchar *purple_sqlite_history_adapter_get_snippet(PurpleMessage *message);
+
+/**
+ * purple_sqlite_history_adapter_rebuild_search_index:
+ * @adapter: The instance.
+ * @error: (nullable): A return address for a #GError.
+ *
+ * Rebuilds the full text index of @adapter from the stored messages. The index
+ * is kept up to date automatically, so this is only needed if the database
+ * was modified outside of libpurple.
+ *
+ * Returns: %TRUE on success, otherwise %FALSE with @error set.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_sqlite_history_adapter_rebuild_search_index(PurpleSqliteHistoryAdapter *adapter, GError **error);
+
+/**
+ * purple_sqlite_history_adapter_get_statement_cache_stats:
+ * @adapter: The instance.
+ * @hits: (out) (optional): A return address for the number of queries that
+ *        reused a cached prepared statement.
+ * @misses: (out) (optional): A return address for the number of queries that
+ *          had to prepare a new statement.
+ *
+ * Gets the statistics of the prepared statement cache of @adapter. Queries are
+ * cached by their shape, that is the number of each kind of term, so the same
+ * search with different values reuses the same statement. The statistics are
+ * reset when @adapter is activated.
+ *
+ * Since: 3.0.0
+ */
+void purple_sqlite_history_adapter_get_statement_cache_stats(PurpleSqliteHistoryAdapter *adapter, guint64 *hits, guint64 *misses);
+
 G_END_DECLS
 
 #endif /* PURPLE_SQLITE_HISTORY_ADAPTER */
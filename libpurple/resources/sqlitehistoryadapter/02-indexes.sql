@@ -0,0 +1,20 @@
+-- Store the client timestamp as an integer number of microseconds since the
+-- unix epoch so that time ranges can be compared without parsing text.
+ALTER TABLE message_log ADD COLUMN client_timestamp_us INTEGER NULL;
+
+-- SQLite's date functions only keep millisecond precision, which is plenty
+-- for existing rows. New rows are written with full precision.
+UPDATE message_log
+	SET client_timestamp_us = CAST(ROUND((julianday(client_timestamp) - 2440587.5) * 86400000.0) AS INTEGER) * 1000
+	WHERE client_timestamp IS NOT NULL;
+
+-- in: queries only know the conversation, so it leads the index while the
+-- account is still available for lookups of a specific conversation.
+CREATE INDEX message_log_conversation_idx
+	ON message_log(conversation_id, account, client_timestamp_us);
+
+CREATE INDEX message_log_author_idx
+	ON message_log(author, client_timestamp_us);
+
+CREATE INDEX message_log_timestamp_idx
+	ON message_log(client_timestamp_us);
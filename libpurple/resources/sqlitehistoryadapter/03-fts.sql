@@ -0,0 +1,28 @@
+-- A full text index over the message content. It is an external content
+-- table, so it only stores the index and reads the text from message_log.
+-- NOTE: message_log has no INTEGER PRIMARY KEY, so a full VACUUM may renumber
+-- its rowids. Rebuild the index with the 'rebuild' command after one.
+CREATE VIRTUAL TABLE message_log_fts USING fts5(
+	content,
+	content='message_log',
+	content_rowid='rowid',
+	tokenize='unicode61 remove_diacritics 2'
+);
+
+-- Index everything that was written before this migration.
+INSERT INTO message_log_fts(message_log_fts) VALUES('rebuild');
+
+CREATE TRIGGER message_log_fts_insert AFTER INSERT ON message_log BEGIN
+	INSERT INTO message_log_fts(rowid, content) VALUES(new.rowid, new.content);
+END;
+
+CREATE TRIGGER message_log_fts_delete AFTER DELETE ON message_log BEGIN
+	INSERT INTO message_log_fts(message_log_fts, rowid, content)
+		VALUES('delete', old.rowid, old.content);
+END;
+
+CREATE TRIGGER message_log_fts_update AFTER UPDATE OF content ON message_log BEGIN
+	INSERT INTO message_log_fts(message_log_fts, rowid, content)
+		VALUES('delete', old.rowid, old.content);
+	INSERT INTO message_log_fts(rowid, content) VALUES(new.rowid, new.content);
+END;
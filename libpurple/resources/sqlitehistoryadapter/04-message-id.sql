@@ -0,0 +1,12 @@
+-- Protocols redeliver messages all of the time, for example when rejoining a
+-- chat or replaying server side history. Only keep the first copy of any
+-- duplicates that were written before this index existed.
+DELETE FROM message_log
+WHERE rowid NOT IN (
+	SELECT MIN(rowid)
+	FROM message_log
+	GROUP BY account, conversation_id, message_id
+);
+
+CREATE UNIQUE INDEX message_log_message_id_idx
+ON message_log(account, conversation_id, message_id);
@@ -0,0 +1,10 @@
+-- Once compression has been enabled, the content column may hold a BLOB of
+-- compressed UTF-8 instead of TEXT. Only then does the adapter switch the
+-- search index over to functions that it registers itself, so until then
+-- other tools can keep using the database. Compressed content may refer to one
+-- of these dictionaries, which are never changed once they are written.
+CREATE TABLE message_log_dictionary
+(
+        id INTEGER PRIMARY KEY,
+        dictionary BLOB NOT NULL
+);
@@ -0,0 +1,11 @@
+-- When the search index is switched between reading the content directly and
+-- reading it through purple_history_content(), it starts out empty and the
+-- messages that were already there are indexed a batch at a time. The rows
+-- after indexed up to and including target are still waiting for that, so the
+-- triggers leave them alone. There is at most one row, and none once the
+-- index is complete.
+CREATE TABLE message_log_fts_pending
+(
+        indexed INTEGER NOT NULL,
+        target INTEGER NOT NULL
+);
@@ -0,0 +1,5 @@
+-- Most queries only know the conversation, and message_log_conversation_idx
+-- can't return those in chronological order because the account comes first.
+-- This one can, so paging through a conversation never has to sort it.
+CREATE INDEX message_log_conversation_time_idx
+	ON message_log(conversation_id, client_timestamp_us);
@@ -27,6 +27,7 @@
 #include "notify.h"
 #include "purpleaccountmanager.h"
 #include "purplemarkup.h"
+#include "purpleprivate.h"
 #include "savedstatuses.h"
 #include "request.h"
 #include "status.h"
@@ -83,7 +84,6 @@ struct _PurpleSavedStatusSub
 };
 
 static GList      *saved_statuses = NULL;
-static guint       save_timer = 0;
 static gboolean    statuses_loaded = FALSE;
 
 /*
@@ -322,39 +322,23 @@ statuses_to_xmlnode(void)
 	return node;
 }
 
-static void
+static PurpleXmlNode *
 sync_statuses(void)
 {
-	PurpleXmlNode *node;
-	char *data;
-
 	if (!statuses_loaded)
 	{
 		purple_debug_error("status", "Attempted to save statuses before they "
 						 "were read!\n");
-		return;
+		return NULL;
 	}
 
-	node = statuses_to_xmlnode();
-	data = purple_xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_config_file("status.xml", data, -1);
-	g_free(data);
-	purple_xmlnode_free(node);
-}
-
-static gboolean
-save_cb(gpointer data)
-{
-	sync_statuses();
-	save_timer = 0;
-	return FALSE;
+	return statuses_to_xmlnode();
 }
 
 static void
 schedule_save(void)
 {
-	if (save_timer == 0)
-		save_timer = g_timeout_add_seconds(5, save_cb, NULL);
+	purple_persistence_schedule_save("status.xml", sync_statuses);
 }
 
 
@@ -1255,12 +1239,7 @@ purple_savedstatuses_uninit(void)
 
 	remove_old_transient_statuses();
 
-	if (save_timer != 0)
-	{
-		g_source_remove(save_timer);
-		save_timer = 0;
-		sync_statuses();
-	}
+	purple_persistence_flush("status.xml");
 
 	g_list_free_full(saved_statuses, (GDestroyNotify)free_saved_status);
 	saved_statuses = NULL;
@@ -0,0 +1,271 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+#include "../purpleprivate.h"
+
+/* GLib never makes a hash table with fewer than this many buckets. */
+#define TEST_HASH_TABLE_MIN_SIZE (8)
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static void
+test_purple_blist_node_collect_setting(const gchar *key, const GValue *value,
+                                       gpointer data)
+{
+	GHashTable *collected = data;
+
+	g_assert_false(g_hash_table_contains(collected, key));
+	g_hash_table_insert(collected, g_strdup(key),
+	                    g_strdup_value_contents(value));
+}
+
+typedef struct {
+	gsize size;
+	guint allocations;
+} TestPurpleBlistNodeSize;
+
+static void
+test_purple_blist_node_hash_table_size_cb(const gchar *key,
+                                          const GValue *value,
+                                          gpointer data)
+{
+	TestPurpleBlistNodeSize *size = data;
+
+	/* The key and the GValue were each allocated on their own, and strings
+	 * were copied into the GValue.
+	 */
+	size->size += strlen(key) + 1 + sizeof(GValue);
+	size->allocations += 2;
+
+	if(G_VALUE_HOLDS_STRING(value) && g_value_get_string(value) != NULL) {
+		size->size += strlen(g_value_get_string(value)) + 1;
+		size->allocations++;
+	}
+}
+
+/* Works out what the settings of node used to cost when they were kept in a
+ * GHashTable. The table itself is opaque, so only its bucket arrays are
+ * counted, which makes this a lower bound.
+ */
+static void
+test_purple_blist_node_hash_table_size(PurpleBlistNode *node,
+                                       TestPurpleBlistNodeSize *size)
+{
+	size->size = TEST_HASH_TABLE_MIN_SIZE * (2 * sizeof(gpointer) +
+	                                         sizeof(guint));
+	size->allocations = 4;
+
+	purple_blist_node_foreach_setting(node,
+	                                  test_purple_blist_node_hash_table_size_cb,
+	                                  size);
+}
+
+static void
+test_purple_blist_node_set_icon_settings(PurpleBlistNode *node) {
+	purple_blist_node_set_string(node, "buddy_icon", "icon.png");
+	purple_blist_node_set_string(node, "icon_checksum", "abcdef");
+	purple_blist_node_set_bool(node, "custom_buddy_icon", TRUE);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_purple_blist_node_settings(void) {
+	PurpleBlistNode *node = NULL;
+	GHashTable *collected = NULL;
+
+	node = g_object_new(PURPLE_TYPE_GROUP, "name", "test", NULL);
+
+	g_assert_false(purple_blist_node_has_setting(node, "never-set-anywhere"));
+	g_assert_null(purple_blist_node_get_string(node, "never-set-anywhere"));
+
+	purple_blist_node_set_bool(node, "custom_buddy_icon", TRUE);
+	purple_blist_node_set_int(node, "last_seen", 42);
+	purple_blist_node_set_string(node, "buddy_icon", "icon.png");
+	purple_blist_node_set_string(node, "icon_checksum", "abc");
+
+	g_assert_true(purple_blist_node_get_bool(node, "custom_buddy_icon"));
+	g_assert_cmpint(purple_blist_node_get_int(node, "last_seen"), ==, 42);
+	g_assert_cmpstr(purple_blist_node_get_string(node, "buddy_icon"), ==,
+	                "icon.png");
+	g_assert_cmpstr(purple_blist_node_get_string(node, "icon_checksum"), ==,
+	                "abc");
+
+	/* Replacing a value, including with itself, and changing its type. */
+	purple_blist_node_set_string(node, "buddy_icon",
+	                             purple_blist_node_get_string(node,
+	                                                          "buddy_icon"));
+	g_assert_cmpstr(purple_blist_node_get_string(node, "buddy_icon"), ==,
+	                "icon.png");
+	purple_blist_node_set_int(node, "icon_checksum", 7);
+	g_assert_cmpint(purple_blist_node_get_int(node, "icon_checksum"), ==, 7);
+
+	collected = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	purple_blist_node_foreach_setting(node,
+	                                  test_purple_blist_node_collect_setting,
+	                                  collected);
+	g_assert_cmpuint(g_hash_table_size(collected), ==, 4);
+	g_assert_cmpstr(g_hash_table_lookup(collected, "buddy_icon"), ==,
+	                "\"icon.png\"");
+	g_assert_cmpstr(g_hash_table_lookup(collected, "last_seen"), ==, "42");
+	g_hash_table_destroy(collected);
+
+	purple_blist_node_remove_setting(node, "last_seen");
+	purple_blist_node_remove_setting(node, "never-set-anywhere");
+	g_assert_false(purple_blist_node_has_setting(node, "last_seen"));
+	g_assert_true(purple_blist_node_has_setting(node, "buddy_icon"));
+	g_assert_true(purple_blist_node_has_setting(node, "custom_buddy_icon"));
+	g_assert_true(purple_blist_node_has_setting(node, "icon_checksum"));
+
+	g_clear_object(&node);
+}
+
+static void
+test_purple_blist_node_settings_size(void) {
+	PurpleBlistNode *node = NULL;
+	TestPurpleBlistNodeSize old_size;
+	gsize size = 0;
+	guint allocations = 0;
+
+	node = g_object_new(PURPLE_TYPE_GROUP, "name", "size", NULL);
+
+	size = purple_blist_node_get_settings_size(node, &allocations);
+	g_assert_cmpuint(size, ==, 0);
+	g_assert_cmpuint(allocations, ==, 0);
+
+	/* One array for the settings plus a copy of each string. */
+	test_purple_blist_node_set_icon_settings(node);
+	size = purple_blist_node_get_settings_size(node, &allocations);
+	g_assert_cmpuint(allocations, ==, 3);
+	g_assert_cmpuint(size, >=, sizeof("icon.png") + sizeof("abcdef"));
+
+	test_purple_blist_node_hash_table_size(node, &old_size);
+	g_assert_cmpuint(size, <, old_size.size);
+	g_assert_cmpuint(allocations, <, old_size.allocations);
+
+	/* Removing everything frees the array. */
+	purple_blist_node_remove_setting(node, "buddy_icon");
+	purple_blist_node_remove_setting(node, "icon_checksum");
+	purple_blist_node_remove_setting(node, "custom_buddy_icon");
+	size = purple_blist_node_get_settings_size(node, &allocations);
+	g_assert_cmpuint(size, ==, 0);
+	g_assert_cmpuint(allocations, ==, 0);
+
+	g_clear_object(&node);
+}
+
+/* Run with -m perf to see how long it takes to give a large number of nodes
+ * the settings that buddy icons use and to read them back, and how much memory
+ * those settings take.
+ */
+static void
+test_purple_blist_node_settings_perf(void) {
+	PurpleBlistNode **nodes = NULL;
+	TestPurpleBlistNodeSize old_size = {0, 0};
+	const guint n_nodes = 50000;
+	gdouble elapsed = 0.0;
+	gsize size = 0;
+	guint allocations = 0;
+
+	if(!g_test_perf()) {
+		g_test_skip("only run in perf mode");
+
+		return;
+	}
+
+	nodes = g_new0(PurpleBlistNode *, n_nodes);
+	for(guint i = 0; i < n_nodes; i++) {
+		nodes[i] = g_object_new(PURPLE_TYPE_GROUP, "name", "perf", NULL);
+	}
+
+	g_test_timer_start();
+	for(guint i = 0; i < n_nodes; i++) {
+		test_purple_blist_node_set_icon_settings(nodes[i]);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed, "set 3 settings on %u nodes: %fs",
+	                        n_nodes, elapsed);
+
+	g_test_timer_start();
+	for(guint i = 0; i < n_nodes; i++) {
+		g_assert_nonnull(purple_blist_node_get_string(nodes[i], "buddy_icon"));
+		g_assert_true(purple_blist_node_get_bool(nodes[i],
+		                                         "custom_buddy_icon"));
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed, "read 2 settings on %u nodes: %fs",
+	                        n_nodes, elapsed);
+
+	for(guint i = 0; i < n_nodes; i++) {
+		TestPurpleBlistNodeSize node_size;
+		guint node_allocations = 0;
+
+		size += purple_blist_node_get_settings_size(nodes[i],
+		                                            &node_allocations);
+		allocations += node_allocations;
+
+		test_purple_blist_node_hash_table_size(nodes[i], &node_size);
+		old_size.size += node_size.size;
+		old_size.allocations += node_size.allocations;
+	}
+	g_test_minimized_result((gdouble)size / n_nodes,
+	                        "settings per node: %.1f bytes in %.1f allocations",
+	                        (gdouble)size / n_nodes,
+	                        (gdouble)allocations / n_nodes);
+	g_test_message("settings per node in a GHashTable: at least %.1f bytes "
+	               "in %.1f allocations",
+	               (gdouble)old_size.size / n_nodes,
+	               (gdouble)old_size.allocations / n_nodes);
+	g_assert_cmpuint(size, <, old_size.size);
+	g_assert_cmpuint(allocations, <, old_size.allocations);
+
+	for(guint i = 0; i < n_nodes; i++) {
+		g_clear_object(&nodes[i]);
+	}
+	g_free(nodes);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_test_add_func("/blist-node/settings",
+	                test_purple_blist_node_settings);
+	g_test_add_func("/blist-node/settings/size",
+	                test_purple_blist_node_settings_size);
+	g_test_add_func("/blist-node/settings/perf",
+	                test_purple_blist_node_settings_perf);
+
+	return g_test_run();
+}
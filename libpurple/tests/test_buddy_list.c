@@ -0,0 +1,475 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+#include "../purpleprivate.h"
+
+/******************************************************************************
+ * TestPurpleBuddyListProtocol
+ *****************************************************************************/
+static GType test_purple_buddy_list_protocol_get_type(void);
+
+typedef struct {
+	PurpleProtocol parent;
+} TestPurpleBuddyListProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestPurpleBuddyListProtocolClass;
+
+static GList *
+test_purple_buddy_list_protocol_info(G_GNUC_UNUSED PurpleProtocolChat *protocol_chat,
+                                     G_GNUC_UNUSED PurpleConnection *connection)
+{
+	PurpleProtocolChatEntry *pce = g_new0(PurpleProtocolChatEntry, 1);
+
+	pce->label = "Room";
+	pce->identifier = "room";
+	pce->required = TRUE;
+
+	return g_list_append(NULL, pce);
+}
+
+static void
+test_purple_buddy_list_protocol_chat_init(PurpleProtocolChatInterface *iface) {
+	iface->info = test_purple_buddy_list_protocol_info;
+}
+
+G_DEFINE_TYPE_WITH_CODE(TestPurpleBuddyListProtocol,
+                        test_purple_buddy_list_protocol,
+                        PURPLE_TYPE_PROTOCOL,
+                        G_IMPLEMENT_INTERFACE(PURPLE_TYPE_PROTOCOL_CHAT,
+                                              test_purple_buddy_list_protocol_chat_init))
+
+static void
+test_purple_buddy_list_protocol_init(G_GNUC_UNUSED TestPurpleBuddyListProtocol *protocol)
+{
+}
+
+static void
+test_purple_buddy_list_protocol_class_init(G_GNUC_UNUSED TestPurpleBuddyListProtocolClass *klass)
+{
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+typedef struct {
+	PurpleProtocol *protocol;
+	PurpleAccount *account;
+	PurpleGroup *group;
+} TestPurpleBuddyListFixture;
+
+static void
+test_purple_buddy_list_setup(TestPurpleBuddyListFixture *fixture,
+                             G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleProtocolManager *manager = purple_protocol_manager_get_default();
+	PurpleConnection *connection = NULL;
+	GError *error = NULL;
+
+	fixture->protocol = g_object_new(test_purple_buddy_list_protocol_get_type(),
+	                                 "id", "test-buddy-list",
+	                                 NULL);
+	purple_protocol_manager_register(manager, fixture->protocol, &error);
+	g_assert_no_error(error);
+
+	fixture->account = purple_account_new("test", "test-buddy-list");
+
+	/* Chats can only be found while their account is connected. The account
+	 * takes the reference to the connection.
+	 */
+	connection = g_object_new(PURPLE_TYPE_CONNECTION,
+	                          "protocol", fixture->protocol,
+	                          "account", fixture->account,
+	                          NULL);
+	purple_connection_set_state(connection, PURPLE_CONNECTION_STATE_CONNECTED);
+	g_assert_true(purple_account_is_connected(fixture->account));
+
+	fixture->group = purple_group_new("test chats");
+	purple_blist_add_group(fixture->group, NULL);
+}
+
+static void
+test_purple_buddy_list_teardown(TestPurpleBuddyListFixture *fixture,
+                                G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleProtocolManager *manager = purple_protocol_manager_get_default();
+	PurpleBlistNode *node = PURPLE_BLIST_NODE(fixture->group);
+	GError *error = NULL;
+
+	while(node->child != NULL) {
+		purple_blist_remove_chat(PURPLE_CHAT(node->child));
+	}
+	purple_blist_remove_group(fixture->group);
+
+	purple_account_set_connection(fixture->account, NULL);
+	g_clear_object(&fixture->account);
+
+	purple_protocol_manager_unregister(manager, fixture->protocol, &error);
+	g_assert_no_error(error);
+	g_clear_object(&fixture->protocol);
+}
+
+/* The buddy list that is loaded at start up, with changes in the journal that
+ * haven't been folded into it yet.
+ */
+static const gchar *test_purple_buddy_list_xml =
+	"<purple version='1.0'><blist>"
+	"<group name='Friends'/>"
+	"<group name='Work'><setting name='note' type='string'>old</setting>"
+	"</group>"
+	"</blist><privacy/></purple>";
+
+static const gchar *test_purple_buddy_list_journal =
+	"<group name='Friends'><setting name='collapsed' type='bool'>1</setting>"
+	"</group>\n"
+	"<group name='Work'><unset name='note'/></group>\n"
+	"<group name='Missing'><setting name='size' type='int'>3</setting>"
+	"</group>\n";
+
+/* An entry that was cut short, which is only added to the journal in the
+ * subprocess of test_purple_buddy_list_journal_partial() as the parser logs
+ * errors for it.
+ */
+static const gchar *test_purple_buddy_list_journal_partial =
+	"<group name='Friends'><setting name='size' type='i";
+
+static gchar *
+test_purple_buddy_list_read_file(const gchar *filename) {
+	gchar *path = g_build_filename(purple_config_dir(), filename, NULL);
+	gchar *contents = NULL;
+
+	if(!g_file_get_contents(path, &contents, NULL, NULL)) {
+		contents = NULL;
+	}
+
+	g_free(path);
+
+	return contents;
+}
+
+static void
+test_purple_buddy_list_write_file(const gchar *dir, const gchar *filename,
+                                  const gchar *contents)
+{
+	gchar *path = g_build_filename(dir, filename, NULL);
+	GError *error = NULL;
+
+	g_file_set_contents(path, contents, -1, &error);
+	g_assert_no_error(error);
+
+	g_free(path);
+}
+
+static void
+test_purple_buddy_list_remove_dir(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name = NULL;
+
+	if(dir == NULL) {
+		return;
+	}
+
+	while((name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if(g_file_test(child, G_FILE_TEST_IS_DIR)) {
+			test_purple_buddy_list_remove_dir(child);
+		} else {
+			g_unlink(child);
+		}
+
+		g_free(child);
+	}
+
+	g_dir_close(dir);
+	g_rmdir(path);
+}
+
+static PurpleChat *
+test_purple_buddy_list_add_chat(TestPurpleBuddyListFixture *fixture,
+                                const gchar *room)
+{
+	PurpleChat *chat = NULL;
+	GHashTable *components = NULL;
+
+	components = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                   g_free);
+	g_hash_table_insert(components, g_strdup("room"), g_strdup(room));
+
+	/* Chats are added at the end so the list is in the order they were
+	 * added in.
+	 */
+	chat = purple_chat_new(fixture->account, NULL, components);
+	purple_blist_add_chat(chat, fixture->group,
+	                      _purple_blist_get_last_child(PURPLE_BLIST_NODE(fixture->group)));
+
+	return chat;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_purple_buddy_list_find_chat_add(TestPurpleBuddyListFixture *fixture,
+                                     G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleChat *one = NULL;
+	PurpleChat *two = NULL;
+	PurpleChat *other = NULL;
+	PurpleAccount *offline = NULL;
+
+	one = test_purple_buddy_list_add_chat(fixture, "#one");
+	g_assert_true(purple_blist_find_chat(fixture->account, "#one") == one);
+
+	/* A chat added after the index was built is found without a rebuild. */
+	g_assert_null(purple_blist_find_chat(fixture->account, "#two"));
+	two = test_purple_buddy_list_add_chat(fixture, "#two");
+	g_assert_true(purple_blist_find_chat(fixture->account, "#two") == two);
+
+	/* The first chat in the list wins when names are the same. */
+	other = test_purple_buddy_list_add_chat(fixture, "#one");
+	g_assert_true(purple_blist_find_chat(fixture->account, "#one") == one);
+	g_assert_true(other != one);
+
+	/* Chats are only found for their own account, and only while it is
+	 * connected.
+	 */
+	offline = purple_account_new("offline", "test-buddy-list");
+	g_assert_null(purple_blist_find_chat(offline, "#one"));
+	g_clear_object(&offline);
+}
+
+static void
+test_purple_buddy_list_find_chat_remove(TestPurpleBuddyListFixture *fixture,
+                                        G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleChat *one = NULL;
+	PurpleChat *other = NULL;
+	PurpleChat *two = NULL;
+
+	one = test_purple_buddy_list_add_chat(fixture, "#one");
+	other = test_purple_buddy_list_add_chat(fixture, "#one");
+	two = test_purple_buddy_list_add_chat(fixture, "#two");
+	g_assert_true(purple_blist_find_chat(fixture->account, "#one") == one);
+
+	/* Removing the first chat makes the next one with its name show up. */
+	purple_blist_remove_chat(one);
+	g_assert_true(purple_blist_find_chat(fixture->account, "#one") == other);
+
+	purple_blist_remove_chat(other);
+	g_assert_null(purple_blist_find_chat(fixture->account, "#one"));
+
+	purple_blist_remove_chat(two);
+	g_assert_null(purple_blist_find_chat(fixture->account, "#two"));
+}
+
+static void
+test_purple_buddy_list_find_chat_rename(TestPurpleBuddyListFixture *fixture,
+                                        G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleChat *one = NULL;
+	PurpleChat *two = NULL;
+
+	one = test_purple_buddy_list_add_chat(fixture, "#one");
+	two = test_purple_buddy_list_add_chat(fixture, "#two");
+	g_assert_true(purple_blist_find_chat(fixture->account, "#two") == two);
+
+	/* A name that was looked up and missed is found once a chat gets it. */
+	g_assert_null(purple_blist_find_chat(fixture->account, "#three"));
+	purple_chat_set_component(two, "room", "#three");
+	g_assert_null(purple_blist_find_chat(fixture->account, "#two"));
+	g_assert_true(purple_blist_find_chat(fixture->account, "#three") == two);
+
+	/* Removing the component means the chat can't be found anymore. */
+	purple_chat_set_component(one, "room", NULL);
+	g_assert_null(purple_blist_find_chat(fixture->account, "#one"));
+
+	/* Editing the components directly is caught when the stale name is
+	 * looked up.
+	 */
+	g_hash_table_replace(purple_chat_get_components(two), g_strdup("room"),
+	                     g_strdup("#four"));
+	g_assert_null(purple_blist_find_chat(fixture->account, "#three"));
+	g_assert_true(purple_blist_find_chat(fixture->account, "#four") == two);
+}
+
+/* These run in order against the buddy list that main() had loaded. */
+static void
+test_purple_buddy_list_journal_load(void) {
+	PurpleBlistNode *friends = NULL;
+	PurpleBlistNode *work = NULL;
+
+	friends = PURPLE_BLIST_NODE(purple_blist_find_group("Friends"));
+	work = PURPLE_BLIST_NODE(purple_blist_find_group("Work"));
+	g_assert_nonnull(friends);
+	g_assert_nonnull(work);
+
+	/* Entries were replayed on top of blist.xml, in order. */
+	g_assert_true(purple_blist_node_get_bool(friends, "collapsed"));
+	g_assert_false(purple_blist_node_has_setting(work, "note"));
+
+	/* Entries for nodes that don't exist are skipped. */
+	g_assert_null(purple_blist_find_group("Missing"));
+}
+
+static void
+test_purple_buddy_list_journal_partial(void) {
+	if(g_test_subprocess()) {
+		PurpleBlistNode *friends = NULL;
+
+		friends = PURPLE_BLIST_NODE(purple_blist_find_group("Friends"));
+		g_assert_nonnull(friends);
+
+		/* The entries before the partial one were still replayed, and the
+		 * partial one was skipped.
+		 */
+		g_assert_true(purple_blist_node_get_bool(friends, "collapsed"));
+		g_assert_false(purple_blist_node_has_setting(friends, "size"));
+
+		return;
+	}
+
+	g_test_trap_subprocess(NULL, 0, 0);
+	g_test_trap_assert_passed();
+	g_test_trap_assert_stderr("*XML parser error*");
+}
+
+static void
+test_purple_buddy_list_journal_compact(void) {
+	gchar *contents = NULL;
+
+	/* Replaying the journal scheduled a rewrite, which folds the journal into
+	 * blist.xml and removes it.
+	 */
+	purple_persistence_flush("blist.xml");
+
+	contents = test_purple_buddy_list_read_file("blist.journal");
+	g_assert_null(contents);
+
+	contents = test_purple_buddy_list_read_file("blist.xml");
+	g_assert_nonnull(contents);
+	g_assert_nonnull(g_strstr_len(contents, -1, "collapsed"));
+	g_assert_null(g_strstr_len(contents, -1, ">old<"));
+	g_free(contents);
+}
+
+static void
+test_purple_buddy_list_journal_pending(void) {
+	PurpleBlistNode *friends = NULL;
+	gchar *contents = NULL;
+
+	friends = PURPLE_BLIST_NODE(purple_blist_find_group("Friends"));
+
+	/* A change while a rewrite is pending still goes into the journal, in
+	 * case that rewrite fails.
+	 */
+	purple_blist_schedule_save();
+	purple_blist_node_set_string(friends, "note", "pending");
+
+	/* This only waits for the writes that were already queued. */
+	purple_persistence_flush("not-a-file.xml");
+
+	contents = test_purple_buddy_list_read_file("blist.journal");
+	g_assert_nonnull(contents);
+	g_assert_nonnull(g_strstr_len(contents, -1, "pending"));
+	g_free(contents);
+
+	purple_persistence_flush("blist.xml");
+
+	contents = test_purple_buddy_list_read_file("blist.journal");
+	g_assert_null(contents);
+
+	contents = test_purple_buddy_list_read_file("blist.xml");
+	g_assert_nonnull(g_strstr_len(contents, -1, "pending"));
+	g_free(contents);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar *argv[]) {
+	gchar *dir = NULL, *journal = NULL;
+	gint ret = 0;
+
+	g_test_init(&argc, &argv, NULL);
+
+	/* The buddy list is loaded from here when libpurple starts. */
+	dir = g_dir_make_tmp("test_buddy_list-XXXXXX", NULL);
+	g_assert_nonnull(dir);
+	purple_util_set_user_dir(dir);
+
+	g_assert_cmpint(g_mkdir_with_parents(purple_config_dir(), 0700), ==, 0);
+	test_purple_buddy_list_write_file(purple_config_dir(), "blist.xml",
+	                                  test_purple_buddy_list_xml);
+
+	if(g_test_subprocess()) {
+		/* The errors that the parser logs for the partial entry are
+		 * expected, so they can't be fatal while it is replayed.
+		 */
+		journal = g_strconcat(test_purple_buddy_list_journal,
+		                      test_purple_buddy_list_journal_partial, NULL);
+		g_log_set_always_fatal(G_LOG_FATAL_MASK);
+	} else {
+		journal = g_strdup(test_purple_buddy_list_journal);
+	}
+	test_purple_buddy_list_write_file(purple_config_dir(), "blist.journal",
+	                                  journal);
+	g_free(journal);
+
+	test_ui_purple_init();
+
+	g_test_add("/buddy-list/find-chat/add", TestPurpleBuddyListFixture, NULL,
+	           test_purple_buddy_list_setup,
+	           test_purple_buddy_list_find_chat_add,
+	           test_purple_buddy_list_teardown);
+	g_test_add("/buddy-list/find-chat/remove", TestPurpleBuddyListFixture,
+	           NULL,
+	           test_purple_buddy_list_setup,
+	           test_purple_buddy_list_find_chat_remove,
+	           test_purple_buddy_list_teardown);
+	g_test_add("/buddy-list/find-chat/rename", TestPurpleBuddyListFixture,
+	           NULL,
+	           test_purple_buddy_list_setup,
+	           test_purple_buddy_list_find_chat_rename,
+	           test_purple_buddy_list_teardown);
+
+	g_test_add_func("/buddy-list/journal/load",
+	                test_purple_buddy_list_journal_load);
+	g_test_add_func("/buddy-list/journal/partial",
+	                test_purple_buddy_list_journal_partial);
+	g_test_add_func("/buddy-list/journal/compact",
+	                test_purple_buddy_list_journal_compact);
+	g_test_add_func("/buddy-list/journal/pending",
+	                test_purple_buddy_list_journal_pending);
+
+	ret = g_test_run();
+
+	test_purple_buddy_list_remove_dir(dir);
+	g_free(dir);
+
+	return ret;
+}
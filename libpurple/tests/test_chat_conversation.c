@@ -0,0 +1,498 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+#include "../purpleprivate.h"
+
+/******************************************************************************
+ * TestPurpleChatProtocol
+ *****************************************************************************/
+static GType test_purple_chat_protocol_get_type(void);
+
+typedef struct {
+	PurpleProtocol parent;
+} TestPurpleChatProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestPurpleChatProtocolClass;
+
+G_DEFINE_TYPE(TestPurpleChatProtocol, test_purple_chat_protocol,
+              PURPLE_TYPE_PROTOCOL)
+
+static void
+test_purple_chat_protocol_init(G_GNUC_UNUSED TestPurpleChatProtocol *protocol)
+{
+}
+
+static void
+test_purple_chat_protocol_class_init(G_GNUC_UNUSED TestPurpleChatProtocolClass *klass)
+{
+}
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+typedef struct {
+	PurpleProtocol *protocol;
+	PurpleAccount *account;
+	PurpleChatConversation *chat;
+} TestPurpleChatConversationFixture;
+
+static void
+test_purple_chat_conversation_setup(TestPurpleChatConversationFixture *fixture,
+                                    G_GNUC_UNUSED gconstpointer data)
+{
+	/* Chats need a connection, and user names that are unique to the chat
+	 * keep the buddy list out of the way.
+	 */
+	fixture->protocol = g_object_new(test_purple_chat_protocol_get_type(),
+	                                 "id", "test-chat",
+	                                 "options", OPT_PROTO_UNIQUE_CHATNAME,
+	                                 NULL);
+	fixture->account = purple_account_new("test", "test-chat");
+
+	/* The account takes the reference to the connection. */
+	g_object_new(PURPLE_TYPE_CONNECTION,
+	             "protocol", fixture->protocol,
+	             "account", fixture->account,
+	             NULL);
+
+	fixture->chat = PURPLE_CHAT_CONVERSATION(purple_chat_conversation_new(fixture->account,
+	                                                                      "#pidgin"));
+	g_assert_true(PURPLE_IS_CHAT_CONVERSATION(fixture->chat));
+}
+
+static void
+test_purple_chat_conversation_teardown(TestPurpleChatConversationFixture *fixture,
+                                       G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleConversationManager *manager = NULL;
+
+	/* Leave first so that nothing is sent to the protocol. */
+	purple_chat_conversation_leave(fixture->chat);
+
+	manager = purple_conversation_manager_get_default();
+	purple_conversation_manager_unregister(manager,
+	                                       PURPLE_CONVERSATION(fixture->chat));
+	g_clear_object(&fixture->chat);
+
+	purple_account_set_connection(fixture->account, NULL);
+	g_clear_object(&fixture->account);
+	g_clear_object(&fixture->protocol);
+}
+
+static void
+test_purple_chat_conversation_count_cb(G_GNUC_UNUSED PurpleChatConversation *chat,
+                                       G_GNUC_UNUSED const gchar *user,
+                                       G_GNUC_UNUSED PurpleChatUserFlags flags,
+                                       G_GNUC_UNUSED gboolean new_arrival,
+                                       gpointer data)
+{
+	gint *count = data;
+
+	*count = *count + 1;
+}
+
+static gboolean
+test_purple_chat_conversation_joining_cb(G_GNUC_UNUSED PurpleChatConversation *chat,
+                                         G_GNUC_UNUSED const gchar *user,
+                                         G_GNUC_UNUSED PurpleChatUserFlags flags,
+                                         gpointer data)
+{
+	gint *count = data;
+
+	*count = *count + 1;
+
+	return FALSE;
+}
+
+static void
+test_purple_chat_conversation_users_joined_cb(G_GNUC_UNUSED PurpleChatConversation *chat,
+                                              GList *users, gpointer data)
+{
+	GString *names = data;
+
+	for(GList *l = users; l != NULL; l = l->next) {
+		g_assert_true(PURPLE_IS_CHAT_USER(l->data));
+
+		g_string_append_printf(names, "%s ",
+		                       purple_chat_user_get_name(l->data));
+	}
+
+	g_string_append(names, "| ");
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_purple_chat_conversation_find_user(TestPurpleChatConversationFixture *fixture,
+                                        G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleChatUser *chat_user = NULL;
+
+	purple_chat_conversation_add_user(fixture->chat, "alice", NULL,
+	                                  PURPLE_CHAT_USER_NONE, FALSE);
+
+	/* An e followed by a combining acute accent. */
+	purple_chat_conversation_add_user(fixture->chat, "jose\xcc\x81", NULL,
+	                                  PURPLE_CHAT_USER_NONE, FALSE);
+
+	chat_user = purple_chat_conversation_find_user(fixture->chat, "alice");
+	g_assert_true(PURPLE_IS_CHAT_USER(chat_user));
+	g_assert_cmpstr(purple_chat_user_get_name(chat_user), ==, "alice");
+
+	/* The precomposed form finds the same user. */
+	chat_user = purple_chat_conversation_find_user(fixture->chat,
+	                                               "jos\xc3\xa9");
+	g_assert_true(PURPLE_IS_CHAT_USER(chat_user));
+	g_assert_cmpstr(purple_chat_user_get_name(chat_user), ==, "jose\xcc\x81");
+	g_assert_true(purple_chat_conversation_has_user(fixture->chat,
+	                                                "jos\xc3\xa9"));
+
+	/* Adding the other form replaces the user instead of adding another. */
+	purple_chat_conversation_add_user(fixture->chat, "jos\xc3\xa9", NULL,
+	                                  PURPLE_CHAT_USER_NONE, FALSE);
+	g_assert_cmpuint(purple_chat_conversation_get_users_count(fixture->chat),
+	                 ==, 2);
+
+	g_assert_null(purple_chat_conversation_find_user(fixture->chat, "bob"));
+
+	purple_chat_conversation_remove_user(fixture->chat, "jose\xcc\x81", NULL);
+	g_assert_null(purple_chat_conversation_find_user(fixture->chat,
+	                                                 "jos\xc3\xa9"));
+	g_assert_cmpuint(purple_chat_conversation_get_users_count(fixture->chat),
+	                 ==, 1);
+}
+
+static void
+test_purple_chat_conversation_compare(TestPurpleChatConversationFixture *fixture,
+                                      G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleChatUser *users[5];
+	GList *list = NULL;
+	GString *names = NULL;
+
+	/* Operators come first, then names regardless of their case, preferring
+	 * the alias over the name.
+	 */
+	users[0] = purple_chat_user_new(fixture->chat, "carol", NULL,
+	                                PURPLE_CHAT_USER_NONE);
+	users[1] = purple_chat_user_new(fixture->chat, "Bob", NULL,
+	                                PURPLE_CHAT_USER_NONE);
+	users[2] = purple_chat_user_new(fixture->chat, "zed", NULL,
+	                                PURPLE_CHAT_USER_OP);
+	users[3] = purple_chat_user_new(fixture->chat, "alice", NULL,
+	                                PURPLE_CHAT_USER_NONE);
+	users[4] = purple_chat_user_new(fixture->chat, "yves", "Aaron",
+	                                PURPLE_CHAT_USER_NONE);
+
+	for(gint i = 0; i < 5; i++) {
+		list = g_list_prepend(list, users[i]);
+	}
+	list = g_list_sort(list, (GCompareFunc)purple_chat_user_compare);
+
+	names = g_string_new(NULL);
+	for(GList *l = list; l != NULL; l = l->next) {
+		g_string_append_printf(names, "%s ",
+		                       purple_chat_user_get_name(l->data));
+	}
+	g_assert_cmpstr(names->str, ==, "zed yves alice Bob carol ");
+
+	/* The cached sort key follows changes to the alias. */
+	g_object_set(users[4], "alias", "zz", NULL);
+	g_assert_cmpint(purple_chat_user_compare(users[4], users[0]), >, 0);
+	g_assert_cmpint(purple_chat_user_compare(users[0], users[4]), <, 0);
+
+	g_assert_cmpint(purple_chat_user_compare(users[3], users[3]), ==, 0);
+	g_assert_cmpint(purple_chat_user_compare(users[3], NULL), <, 0);
+	g_assert_cmpint(purple_chat_user_compare(NULL, NULL), ==, 0);
+
+	g_string_free(names, TRUE);
+	g_list_free(list);
+	for(gint i = 0; i < 5; i++) {
+		g_clear_object(&users[i]);
+	}
+}
+
+static void
+test_purple_chat_conversation_shared_key(TestPurpleChatConversationFixture *fixture,
+                                         G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleChatUser *a = NULL;
+	PurpleChatUser *b = NULL;
+	PurpleChatUser *c = NULL;
+
+	/* Keys are interned, so users with the same name share one string, even
+	 * when the names only match after folding.
+	 */
+	a = purple_chat_user_new(fixture->chat, "jose\xcc\x81", NULL,
+	                         PURPLE_CHAT_USER_NONE);
+	b = purple_chat_user_new(fixture->chat, "jose\xcc\x81", NULL,
+	                         PURPLE_CHAT_USER_NONE);
+	c = purple_chat_user_new(fixture->chat, "jos\xc3\xa9", NULL,
+	                         PURPLE_CHAT_USER_NONE);
+
+	g_assert_true(purple_chat_user_get_key(a) == purple_chat_user_get_key(b));
+	g_assert_true(purple_chat_user_get_key(a) == purple_chat_user_get_key(c));
+	g_assert_cmpint(purple_chat_user_compare(a, b), ==, 0);
+
+	g_clear_object(&a);
+	g_clear_object(&b);
+	g_clear_object(&c);
+}
+
+static void
+test_purple_chat_conversation_rename_user(TestPurpleChatConversationFixture *fixture,
+                                          G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleChatUser *chat_user = NULL;
+
+	purple_chat_conversation_add_user(fixture->chat, "alice", NULL,
+	                                  PURPLE_CHAT_USER_VOICE, FALSE);
+
+	purple_chat_conversation_rename_user(fixture->chat, "alice", "bob");
+	g_assert_null(purple_chat_conversation_find_user(fixture->chat, "alice"));
+	chat_user = purple_chat_conversation_find_user(fixture->chat, "bob");
+	g_assert_true(PURPLE_IS_CHAT_USER(chat_user));
+	g_assert_cmpint(purple_chat_user_get_flags(chat_user), ==,
+	                PURPLE_CHAT_USER_VOICE);
+
+	/* A new name with the same key replaces the user rather than removing
+	 * it.
+	 */
+	purple_chat_conversation_add_user(fixture->chat, "jose\xcc\x81", NULL,
+	                                  PURPLE_CHAT_USER_NONE, FALSE);
+	purple_chat_conversation_rename_user(fixture->chat, "jose\xcc\x81",
+	                                     "jos\xc3\xa9");
+	chat_user = purple_chat_conversation_find_user(fixture->chat,
+	                                               "jose\xcc\x81");
+	g_assert_true(PURPLE_IS_CHAT_USER(chat_user));
+	g_assert_cmpstr(purple_chat_user_get_name(chat_user), ==, "jos\xc3\xa9");
+	g_assert_cmpuint(purple_chat_conversation_get_users_count(fixture->chat),
+	                 ==, 2);
+}
+
+static void
+test_purple_chat_conversation_add_users_bulk(TestPurpleChatConversationFixture *fixture,
+                                             G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleChatUser *chat_user = NULL;
+	GList *users = NULL;
+	GList *flags = NULL;
+	GString *names = NULL;
+	gint joined = 0;
+	gint plugin_joining = 0;
+	gint plugin_joined = 0;
+
+	names = g_string_new(NULL);
+	g_signal_connect(fixture->chat, "users-joined",
+	                 G_CALLBACK(test_purple_chat_conversation_users_joined_cb),
+	                 names);
+	g_signal_connect(fixture->chat, "user-joined",
+	                 G_CALLBACK(test_purple_chat_conversation_count_cb),
+	                 &joined);
+	purple_signal_connect(purple_conversations_get_handle(),
+	                      "chat-user-joining", fixture,
+	                      PURPLE_CALLBACK(test_purple_chat_conversation_joining_cb),
+	                      &plugin_joining);
+	purple_signal_connect(purple_conversations_get_handle(),
+	                      "chat-user-joined", fixture,
+	                      PURPLE_CALLBACK(test_purple_chat_conversation_count_cb),
+	                      &plugin_joined);
+
+	/* The same name twice only keeps the last one. */
+	users = g_list_append(users, "carol");
+	flags = g_list_append(flags, GINT_TO_POINTER(PURPLE_CHAT_USER_NONE));
+	users = g_list_append(users, "bob");
+	flags = g_list_append(flags, GINT_TO_POINTER(PURPLE_CHAT_USER_NONE));
+	users = g_list_append(users, "alice");
+	flags = g_list_append(flags, GINT_TO_POINTER(PURPLE_CHAT_USER_NONE));
+	users = g_list_append(users, "bob");
+	flags = g_list_append(flags, GINT_TO_POINTER(PURPLE_CHAT_USER_OP));
+
+	purple_chat_conversation_add_users_bulk(fixture->chat, users, flags);
+
+	g_list_free(users);
+	g_list_free(flags);
+
+	/* The signal is emitted once with the batch sorted, and the per user
+	 * signal is not emitted at all. Plugins still see every entry.
+	 */
+	g_assert_cmpstr(names->str, ==, "bob alice carol | ");
+	g_assert_cmpint(joined, ==, 0);
+	g_assert_cmpint(plugin_joining, ==, 4);
+	g_assert_cmpint(plugin_joined, ==, 4);
+
+	g_assert_cmpuint(purple_chat_conversation_get_users_count(fixture->chat),
+	                 ==, 3);
+	chat_user = purple_chat_conversation_find_user(fixture->chat, "bob");
+	g_assert_cmpint(purple_chat_user_get_flags(chat_user), ==,
+	                PURPLE_CHAT_USER_OP);
+
+	/* An empty batch does nothing. */
+	purple_chat_conversation_add_users_bulk(fixture->chat, NULL, NULL);
+	g_assert_cmpstr(names->str, ==, "bob alice carol | ");
+
+	/* The regular path still emits the per user signal. */
+	purple_chat_conversation_add_user(fixture->chat, "dave", NULL,
+	                                  PURPLE_CHAT_USER_NONE, FALSE);
+	g_assert_cmpint(joined, ==, 1);
+	g_assert_cmpint(plugin_joined, ==, 5);
+	g_assert_cmpstr(names->str, ==, "bob alice carol | ");
+
+	purple_signals_disconnect_by_handle(fixture);
+	g_string_free(names, TRUE);
+}
+
+static void
+test_purple_chat_conversation_ignore_prefix(TestPurpleChatConversationFixture *fixture,
+                                            G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleChatConversation *chat = fixture->chat;
+
+	/* A status prefix also ignores the name without it. */
+	purple_chat_conversation_ignore(chat, "@bob");
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat, "@bob"));
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat, "BOB"));
+	g_assert_cmpstr(purple_chat_conversation_get_ignored_user(chat, "bob"),
+	                ==, "@bob");
+
+	purple_chat_conversation_ignore(chat, "@+carol");
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat, "carol"));
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat, "+carol"));
+
+	purple_chat_conversation_ignore(chat, "%dave");
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat, "dave"));
+
+	/* A % is only a prefix when it comes first. */
+	purple_chat_conversation_ignore(chat, "+%erin");
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat, "%erin"));
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat, "erin"));
+
+	purple_chat_conversation_ignore(chat, "@%frank");
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat, "%frank"));
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat, "frank"));
+
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat, "alice"));
+	g_assert_cmpuint(g_list_length(purple_chat_conversation_get_ignored(chat)),
+	                 ==, 5);
+}
+
+static void
+test_purple_chat_conversation_ignore_unignore(TestPurpleChatConversationFixture *fixture,
+                                              G_GNUC_UNUSED gconstpointer data)
+{
+	PurpleChatConversation *chat = fixture->chat;
+	GList *ignored = NULL;
+
+	purple_chat_conversation_ignore(chat, "Bob");
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat, "bob"));
+
+	/* Ignoring a name twice does nothing. */
+	purple_chat_conversation_ignore(chat, "bob");
+	g_assert_cmpuint(g_list_length(purple_chat_conversation_get_ignored(chat)),
+	                 ==, 1);
+
+	/* The newest entry takes over the names it shares with others. */
+	purple_chat_conversation_ignore(chat, "@bob");
+	g_assert_cmpstr(purple_chat_conversation_get_ignored_user(chat, "bob"),
+	                ==, "@bob");
+
+	/* Removing it hands the name back to the older entry. */
+	purple_chat_conversation_unignore(chat, "@bob");
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat, "@bob"));
+	g_assert_cmpstr(purple_chat_conversation_get_ignored_user(chat, "bob"),
+	                ==, "Bob");
+
+	purple_chat_conversation_unignore(chat, "BOB");
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat, "bob"));
+	g_assert_null(purple_chat_conversation_get_ignored(chat));
+
+	/* Unignoring a name that isn't ignored does nothing. */
+	purple_chat_conversation_unignore(chat, "bob");
+
+	/* Setting the list rebuilds the names. */
+	ignored = g_list_append(NULL, g_strdup("@dave"));
+	ignored = g_list_append(ignored, g_strdup("carol"));
+	ignored = purple_chat_conversation_set_ignored(chat, ignored);
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat, "dave"));
+	g_assert_true(purple_chat_conversation_is_ignored_user(chat, "carol"));
+
+	purple_chat_conversation_unignore(chat, "carol");
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat, "carol"));
+
+	purple_chat_conversation_unignore(chat, "dave");
+	g_assert_false(purple_chat_conversation_is_ignored_user(chat, "@dave"));
+	g_assert_null(purple_chat_conversation_get_ignored(chat));
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_test_add("/chat-conversation/find-user",
+	           TestPurpleChatConversationFixture, NULL,
+	           test_purple_chat_conversation_setup,
+	           test_purple_chat_conversation_find_user,
+	           test_purple_chat_conversation_teardown);
+	g_test_add("/chat-conversation/compare",
+	           TestPurpleChatConversationFixture, NULL,
+	           test_purple_chat_conversation_setup,
+	           test_purple_chat_conversation_compare,
+	           test_purple_chat_conversation_teardown);
+	g_test_add("/chat-conversation/shared-key",
+	           TestPurpleChatConversationFixture, NULL,
+	           test_purple_chat_conversation_setup,
+	           test_purple_chat_conversation_shared_key,
+	           test_purple_chat_conversation_teardown);
+	g_test_add("/chat-conversation/rename-user",
+	           TestPurpleChatConversationFixture, NULL,
+	           test_purple_chat_conversation_setup,
+	           test_purple_chat_conversation_rename_user,
+	           test_purple_chat_conversation_teardown);
+	g_test_add("/chat-conversation/add-users-bulk",
+	           TestPurpleChatConversationFixture, NULL,
+	           test_purple_chat_conversation_setup,
+	           test_purple_chat_conversation_add_users_bulk,
+	           test_purple_chat_conversation_teardown);
+
+	g_test_add("/chat-conversation/ignore/prefix",
+	           TestPurpleChatConversationFixture, NULL,
+	           test_purple_chat_conversation_setup,
+	           test_purple_chat_conversation_ignore_prefix,
+	           test_purple_chat_conversation_teardown);
+	g_test_add("/chat-conversation/ignore/unignore",
+	           TestPurpleChatConversationFixture, NULL,
+	           test_purple_chat_conversation_setup,
+	           test_purple_chat_conversation_ignore_unignore,
+	           test_purple_chat_conversation_teardown);
+
+	return g_test_run();
+}
@@ -116,6 +116,43 @@ test_purple_contact_properties(void) {
 	g_clear_object(&account);
 }
 
+static void
+test_purple_contact_shared_strings(void) {
+	PurpleAccount *account = NULL;
+	PurpleContact *contact1 = NULL;
+	PurpleContact *contact2 = NULL;
+	gchar *username = NULL;
+
+	account = purple_account_new("test", "test");
+	contact1 = purple_contact_new(account, "id1");
+	contact2 = purple_contact_new(account, "id2");
+
+	/* Use a separate allocation to make sure the contacts don't just end up
+	 * with the same pointer we passed in.
+	 */
+	username = g_strdup("username");
+	purple_contact_set_username(contact1, username);
+	purple_contact_set_username(contact2, "username");
+	purple_contact_set_alias(contact1, "alias");
+	purple_contact_set_alias(contact2, "alias");
+
+	g_assert_true(purple_contact_get_username(contact1) ==
+	              purple_contact_get_username(contact2));
+	g_assert_true(purple_contact_get_alias(contact1) ==
+	              purple_contact_get_alias(contact2));
+
+	/* The string must outlive the contact it came from. */
+	g_clear_object(&contact1);
+	g_assert_cmpstr(purple_contact_get_username(contact2), ==, "username");
+
+	purple_contact_set_alias(contact2, NULL);
+	g_assert_null(purple_contact_get_alias(contact2));
+
+	g_free(username);
+	g_clear_object(&contact2);
+	g_clear_object(&account);
+}
+
 /******************************************************************************
  * Main
  *****************************************************************************/
@@ -129,6 +166,8 @@ main(gint argc, gchar *argv[]) {
 	                test_purple_contact_new);
 	g_test_add_func("/contact/properties",
 	                test_purple_contact_properties);
+	g_test_add_func("/contact/shared-strings",
+	                test_purple_contact_shared_strings);
 
 	return g_test_run();
 }
\ No newline at end of file
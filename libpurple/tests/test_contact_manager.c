@@ -260,6 +260,69 @@ test_purple_contact_manager_find_with_id(void) {
 	g_clear_object(&manager);
 }
 
+static void
+test_purple_contact_manager_find_with_username_rename(void) {
+	PurpleAccount *account = NULL;
+	PurpleContact *contact1 = NULL;
+	PurpleContact *contact2 = NULL;
+	PurpleContact *found = NULL;
+	PurpleContactManager *manager = NULL;
+
+	manager = g_object_new(PURPLE_TYPE_CONTACT_MANAGER, NULL);
+
+	account = purple_account_new("test", "test");
+
+	contact1 = purple_contact_new(account, NULL);
+	purple_contact_set_username(contact1, "user1");
+	purple_contact_manager_add(manager, contact1);
+
+	/* A second contact with the same username is found after the first one
+	 * is gone.
+	 */
+	contact2 = purple_contact_new(account, NULL);
+	purple_contact_set_username(contact2, "user1");
+	purple_contact_manager_add(manager, contact2);
+
+	found = purple_contact_manager_find_with_username(manager, account,
+	                                                  "user1");
+	g_assert_true(found == contact1);
+	g_clear_object(&found);
+
+	/* Renaming a contact moves it in the index. */
+	purple_contact_set_username(contact1, "renamed");
+
+	found = purple_contact_manager_find_with_username(manager, account,
+	                                                  "renamed");
+	g_assert_true(found == contact1);
+	g_clear_object(&found);
+
+	found = purple_contact_manager_find_with_username(manager, account,
+	                                                  "user1");
+	g_assert_true(found == contact2);
+	g_clear_object(&found);
+
+	g_assert_true(purple_contact_manager_remove(manager, contact2));
+
+	found = purple_contact_manager_find_with_username(manager, account,
+	                                                  "user1");
+	g_assert_null(found);
+
+	g_assert_true(purple_contact_manager_remove(manager, contact1));
+
+	/* Changes after a contact has been removed are ignored. */
+	purple_contact_set_username(contact1, "user1");
+
+	found = purple_contact_manager_find_with_username(manager, account,
+	                                                  "user1");
+	g_assert_null(found);
+
+	/* Cleanup. */
+	g_clear_object(&account);
+	g_clear_object(&contact1);
+	g_clear_object(&contact2);
+	g_clear_object(&manager);
+}
+
 static void
 test_purple_contact_manager_add_buddy(void) {
 	PurpleAccount *account = NULL;
@@ -344,6 +407,151 @@ test_purple_contact_manager_add_buddy(void) {
 	g_clear_object(&buddy);
 	g_clear_object(&contact);
 }
+
+/* Tallies the strings of a roster, counting each interned string once for
+ * unique and once per reference for copies.
+ */
+typedef struct {
+	GHashTable *unique;
+	gsize unique_bytes;
+	gsize copied_bytes;
+	guint references;
+} TestPurpleContactManagerStrings;
+
+static void
+test_purple_contact_manager_strings_add(TestPurpleContactManagerStrings *strings,
+                                        const gchar *str)
+{
+	gsize size = 0;
+
+	if(str == NULL) {
+		return;
+	}
+
+	size = strlen(str) + 1;
+	strings->references++;
+	strings->copied_bytes += size;
+
+	if(g_hash_table_add(strings->unique, (gpointer)str)) {
+		strings->unique_bytes += size;
+	}
+}
+
+/* Builds a roster of buddies, which the contact manager mirrors as contacts,
+ * with some history for each of them and reports how much memory the
+ * interned names and aliases take compared to every object having its own
+ * copy.
+ */
+static void
+test_purple_contact_manager_shared_strings(void) {
+	TestPurpleContactManagerStrings strings = {NULL, 0, 0, 0};
+	PurpleAccount *account = NULL;
+	PurpleContactManager *manager = NULL;
+	PurpleStatusType *type = NULL;
+	GPtrArray *buddies = NULL;
+	GPtrArray *messages = NULL;
+	GList *statuses = NULL;
+	const guint n_buddies = 1000;
+	const guint n_messages = 20;
+
+	manager = purple_contact_manager_get_default();
+
+	account = purple_account_new("test", "test");
+	type = purple_status_type_new(PURPLE_STATUS_OFFLINE, "offline",
+	                              "offline", TRUE);
+	statuses = g_list_append(statuses, type);
+	purple_account_set_status_types(account, statuses);
+
+	buddies = g_ptr_array_new_with_free_func(g_object_unref);
+	messages = g_ptr_array_new_with_free_func(g_object_unref);
+	strings.unique = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	for(guint i = 0; i < n_buddies; i++) {
+		PurpleBuddy *buddy = NULL;
+		PurpleContact *contact = NULL;
+		gchar *name = g_strdup_printf("buddy%u@example.com", i);
+		gchar *alias = NULL;
+		gchar *server_alias = g_strdup_printf("Friend %u", i % 50);
+
+		/* Only some buddies have a local alias. */
+		if(i % 2 == 0) {
+			alias = g_strdup_printf("Buddy %u", i);
+		}
+
+		buddy = purple_buddy_new(account, name, alias);
+		purple_buddy_set_server_alias(buddy, server_alias);
+		g_ptr_array_add(buddies, buddy);
+
+		contact = purple_contact_manager_find_with_username(manager, account,
+		                                                    name);
+		g_assert_true(PURPLE_IS_CONTACT(contact));
+		g_assert_true(purple_contact_get_username(contact) ==
+		              purple_buddy_get_name(buddy));
+
+		test_purple_contact_manager_strings_add(&strings,
+		                                        purple_buddy_get_name(buddy));
+		test_purple_contact_manager_strings_add(&strings,
+		                                        purple_buddy_get_local_alias(buddy));
+		test_purple_contact_manager_strings_add(&strings,
+		                                        purple_buddy_get_server_alias(buddy));
+		test_purple_contact_manager_strings_add(&strings,
+		                                        purple_contact_get_username(contact));
+		test_purple_contact_manager_strings_add(&strings,
+		                                        purple_contact_get_alias(contact));
+		test_purple_contact_manager_strings_add(&strings,
+		                                        purple_contact_get_display_name(contact));
+
+		for(guint j = 0; j < n_messages; j++) {
+			PurpleMessage *message = NULL;
+			gchar *author = g_strdup(name);
+
+			message = g_object_new(PURPLE_TYPE_MESSAGE,
+			                       "author", author,
+			                       "author-alias", alias,
+			                       "recipient", "me@example.com",
+			                       "contents", "hello",
+			                       NULL);
+			g_free(author);
+
+			g_assert_true(purple_message_get_author(message) ==
+			              purple_buddy_get_name(buddy));
+
+			test_purple_contact_manager_strings_add(&strings,
+			                                        purple_message_get_author(message));
+			test_purple_contact_manager_strings_add(&strings,
+			                                        purple_message_get_author_alias(message));
+			test_purple_contact_manager_strings_add(&strings,
+			                                        purple_message_get_recipient(message));
+
+			g_ptr_array_add(messages, message);
+		}
+
+		g_free(name);
+		g_free(alias);
+		g_free(server_alias);
+	}
+
+	/* The headers of the interned strings are not counted. */
+	g_test_minimized_result((gdouble)strings.unique_bytes,
+	                        "interned roster strings: %" G_GSIZE_FORMAT
+	                        " bytes in %u strings for %u references",
+	                        strings.unique_bytes,
+	                        g_hash_table_size(strings.unique),
+	                        strings.references);
+	g_test_message("roster strings as separate copies: %" G_GSIZE_FORMAT
+	               " bytes in %u allocations",
+	               strings.copied_bytes, strings.references);
+	g_assert_cmpuint(g_hash_table_size(strings.unique), <, strings.references);
+	g_assert_cmpuint(strings.unique_bytes * 10, <, strings.copied_bytes);
+
+	g_hash_table_destroy(strings.unique);
+	g_ptr_array_free(messages, TRUE);
+
+	purple_contact_manager_remove_all(manager, account);
+	g_ptr_array_free(buddies, TRUE);
+	g_clear_object(&account);
+}
+
 /******************************************************************************
  * Main
  *****************************************************************************/
@@ -367,11 +575,15 @@ main(gint argc, gchar *argv[]) {
 
 	g_test_add_func("/contact-manager/find/with-username",
 	                test_purple_contact_manager_find_with_username);
+	g_test_add_func("/contact-manager/find/with-username-rename",
+	                test_purple_contact_manager_find_with_username_rename);
 	g_test_add_func("/contact-manager/find/with-id",
 	                test_purple_contact_manager_find_with_id);
 
 	g_test_add_func("/contact-manager/add-buddy",
 	                test_purple_contact_manager_add_buddy);
+	g_test_add_func("/contact-manager/shared-strings",
+	                test_purple_contact_manager_shared_strings);
 
 	return g_test_run();
 }
@@ -0,0 +1,234 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+#define HISTORY_SIZE_PREF "/purple/conversations/message_history_size"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleConversation *
+test_purple_conversation_im_new(PurpleAccount *account, const gchar *name) {
+	/* Conversations register themselves with the default manager. */
+	return g_object_new(PURPLE_TYPE_IM_CONVERSATION,
+	                    "account", account,
+	                    "name", name,
+	                    NULL);
+}
+
+static void
+test_purple_conversation_im_destroy(PurpleConversation *conversation) {
+	PurpleConversationManager *manager = NULL;
+
+	manager = purple_conversation_manager_get_default();
+	purple_conversation_manager_unregister(manager, conversation);
+
+	g_object_unref(conversation);
+}
+
+static void
+test_purple_conversation_write(PurpleConversation *conversation,
+                               const gchar *contents, const gchar *iso8601)
+{
+	PurpleMessage *message = NULL;
+	GDateTime *timestamp = NULL;
+
+	timestamp = g_date_time_new_from_iso8601(iso8601, NULL);
+	message = g_object_new(PURPLE_TYPE_MESSAGE,
+	                       "author", "alice",
+	                       "contents", contents,
+	                       "timestamp", timestamp,
+	                       NULL);
+	g_date_time_unref(timestamp);
+
+	purple_conversation_write_message(conversation, message);
+
+	g_object_unref(message);
+}
+
+static void
+test_purple_conversation_load_older_cb(GObject *obj, GAsyncResult *result,
+                                       gpointer data)
+{
+	GList **messages = data;
+	GError *error = NULL;
+
+	*messages = purple_conversation_load_older_messages_finish(PURPLE_CONVERSATION(obj),
+	                                                           result, &error);
+	g_assert_no_error(error);
+
+	g_main_loop_quit(g_object_get_data(obj, "loop"));
+}
+
+static GList *
+test_purple_conversation_load_older(PurpleConversation *conversation,
+                                    PurpleMessage *before, guint count)
+{
+	GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+	GList *messages = NULL;
+
+	g_object_set_data(G_OBJECT(conversation), "loop", loop);
+	purple_conversation_load_older_messages_async(conversation, before, count,
+	                                              NULL,
+	                                              test_purple_conversation_load_older_cb,
+	                                              &messages);
+	g_main_loop_run(loop);
+	g_object_set_data(G_OBJECT(conversation), "loop", NULL);
+
+	g_main_loop_unref(loop);
+
+	return messages;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_purple_conversation_message_history_size(void) {
+	PurpleAccount *account = NULL;
+	PurpleConversation *conversation = NULL;
+	GList *history = NULL;
+	gint size = 0;
+
+	size = purple_prefs_get_int(HISTORY_SIZE_PREF);
+	purple_prefs_set_int(HISTORY_SIZE_PREF, 3);
+
+	account = purple_account_new("test", "test");
+	conversation = test_purple_conversation_im_new(account, "trimmed");
+
+	test_purple_conversation_write(conversation, "1", "2022-01-01T12:00:01Z");
+	test_purple_conversation_write(conversation, "2", "2022-01-01T12:00:02Z");
+	test_purple_conversation_write(conversation, "3", "2022-01-01T12:00:03Z");
+	test_purple_conversation_write(conversation, "4", "2022-01-01T12:00:04Z");
+	test_purple_conversation_write(conversation, "5", "2022-01-01T12:00:05Z");
+
+	/* Only the newest messages are kept, newest first. */
+	history = purple_conversation_get_message_history(conversation);
+	g_assert_cmpuint(g_list_length(history), ==, 3);
+	g_assert_cmpstr(purple_message_get_contents(history->data), ==, "5");
+	g_assert_cmpstr(purple_message_get_contents(g_list_last(history)->data),
+	                ==, "3");
+
+	/* A size of zero keeps everything. */
+	purple_prefs_set_int(HISTORY_SIZE_PREF, 0);
+	test_purple_conversation_write(conversation, "6", "2022-01-01T12:00:06Z");
+	test_purple_conversation_write(conversation, "7", "2022-01-01T12:00:07Z");
+
+	history = purple_conversation_get_message_history(conversation);
+	g_assert_cmpuint(g_list_length(history), ==, 5);
+
+	purple_conversation_clear_message_history(conversation);
+	g_assert_null(purple_conversation_get_message_history(conversation));
+
+	purple_prefs_set_int(HISTORY_SIZE_PREF, size);
+
+	test_purple_conversation_im_destroy(conversation);
+	g_clear_object(&account);
+}
+
+static void
+test_purple_conversation_load_older_messages(void) {
+	PurpleAccount *account = NULL;
+	PurpleAccount *other_account = NULL;
+	PurpleConversation *conversation = NULL;
+	PurpleConversation *other = NULL;
+	GList *history = NULL;
+	GList *messages = NULL;
+	gint size = 0;
+
+	size = purple_prefs_get_int(HISTORY_SIZE_PREF);
+	purple_prefs_set_int(HISTORY_SIZE_PREF, 3);
+
+	/* The name needs quoting in a history query. */
+	account = purple_account_new("test", "test");
+	conversation = test_purple_conversation_im_new(account, "bob: \"the\" bot");
+
+	/* The same name on another account must not show up. */
+	other_account = purple_account_new("other", "test");
+	other = test_purple_conversation_im_new(other_account,
+	                                        "bob: \"the\" bot");
+	test_purple_conversation_write(other, "other", "2022-01-01T11:30:00Z");
+
+	/* Messages 2 to 4 share a timestamp and the oldest of them is the oldest
+	 * one in the message history after the trimming.
+	 */
+	test_purple_conversation_write(conversation, "1", "2022-01-01T11:00:00Z");
+	test_purple_conversation_write(conversation, "2", "2022-01-01T12:00:00Z");
+	test_purple_conversation_write(conversation, "3", "2022-01-01T12:00:00Z");
+	test_purple_conversation_write(conversation, "4", "2022-01-01T12:00:00Z");
+	test_purple_conversation_write(conversation, "5", "2022-01-01T13:00:00Z");
+
+	history = purple_conversation_get_message_history(conversation);
+	g_assert_cmpuint(g_list_length(history), ==, 3);
+	g_assert_cmpstr(purple_message_get_contents(g_list_last(history)->data),
+	                ==, "3");
+
+	/* Nothing that shares the timestamp of the oldest message is lost. */
+	messages = test_purple_conversation_load_older(conversation, NULL, 10);
+	g_assert_cmpuint(g_list_length(messages), ==, 2);
+	g_assert_cmpstr(purple_message_get_contents(messages->data), ==, "1");
+	g_assert_cmpstr(purple_message_get_contents(messages->next->data), ==,
+	                "2");
+
+	/* Loading continues from the oldest message that was loaded. */
+	history = test_purple_conversation_load_older(conversation,
+	                                              messages->next->data, 10);
+	g_assert_cmpuint(g_list_length(history), ==, 1);
+	g_assert_cmpstr(purple_message_get_contents(history->data), ==, "1");
+	g_list_free_full(history, g_object_unref);
+
+	history = test_purple_conversation_load_older(conversation,
+	                                              messages->data, 10);
+	g_assert_null(history);
+	g_list_free_full(messages, g_object_unref);
+
+	/* The count limits the result to the most recent messages. */
+	messages = test_purple_conversation_load_older(conversation, NULL, 1);
+	g_assert_cmpuint(g_list_length(messages), ==, 1);
+	g_assert_cmpstr(purple_message_get_contents(messages->data), ==, "2");
+	g_list_free_full(messages, g_object_unref);
+
+	purple_prefs_set_int(HISTORY_SIZE_PREF, size);
+
+	test_purple_conversation_im_destroy(conversation);
+	test_purple_conversation_im_destroy(other);
+	g_clear_object(&account);
+	g_clear_object(&other_account);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_test_add_func("/conversation/message-history-size",
+	                test_purple_conversation_message_history_size);
+	g_test_add_func("/conversation/load-older-messages",
+	                test_purple_conversation_load_older_messages);
+
+	return g_test_run();
+}
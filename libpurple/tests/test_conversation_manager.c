@@ -0,0 +1,133 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleConversation *
+test_purple_conversation_manager_im_new(PurpleAccount *account,
+                                        const gchar *name)
+{
+	/* Conversations register themselves with the default manager. */
+	return g_object_new(PURPLE_TYPE_IM_CONVERSATION,
+	                    "account", account,
+	                    "name", name,
+	                    NULL);
+}
+
+static void
+test_purple_conversation_manager_im_destroy(PurpleConversation *conversation)
+{
+	PurpleConversationManager *manager = NULL;
+
+	manager = purple_conversation_manager_get_default();
+	purple_conversation_manager_unregister(manager, conversation);
+
+	g_object_unref(conversation);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_purple_conversation_manager_find(void) {
+	PurpleAccount *account1 = NULL;
+	PurpleAccount *account2 = NULL;
+	PurpleConversation *conversation1 = NULL;
+	PurpleConversation *conversation2 = NULL;
+	PurpleConversationManager *manager = NULL;
+
+	manager = purple_conversation_manager_get_default();
+
+	account1 = purple_account_new("test1", "test");
+	account2 = purple_account_new("test2", "test");
+
+	conversation1 = test_purple_conversation_manager_im_new(account1, "bob");
+	conversation2 = test_purple_conversation_manager_im_new(account2, "bob");
+
+	g_assert_true(purple_conversation_manager_is_registered(manager,
+	                                                        conversation1));
+
+	/* Lookups are per account. */
+	g_assert_true(purple_conversation_manager_find(manager, account1, "bob") ==
+	              conversation1);
+	g_assert_true(purple_conversation_manager_find_im(manager, account2,
+	                                                  "bob") == conversation2);
+	g_assert_null(purple_conversation_manager_find_chat(manager, account1,
+	                                                    "bob"));
+	g_assert_null(purple_conversation_manager_find_im(manager, account1,
+	                                                  "alice"));
+
+	/* Unregistered conversations are no longer found. */
+	test_purple_conversation_manager_im_destroy(conversation2);
+	g_assert_null(purple_conversation_manager_find_im(manager, account2,
+	                                                  "bob"));
+
+	test_purple_conversation_manager_im_destroy(conversation1);
+	g_assert_null(purple_conversation_manager_find_im(manager, account1,
+	                                                  "bob"));
+
+	g_clear_object(&account1);
+	g_clear_object(&account2);
+}
+
+static void
+test_purple_conversation_manager_find_renamed(void) {
+	PurpleAccount *account = NULL;
+	PurpleConversation *conversation = NULL;
+	PurpleConversationManager *manager = NULL;
+
+	manager = purple_conversation_manager_get_default();
+
+	account = purple_account_new("test", "test");
+
+	conversation = test_purple_conversation_manager_im_new(account, "bob");
+
+	purple_conversation_set_name(conversation, "alice");
+
+	g_assert_null(purple_conversation_manager_find_im(manager, account,
+	                                                  "bob"));
+	g_assert_true(purple_conversation_manager_find_im(manager, account,
+	                                                  "alice") == conversation);
+
+	test_purple_conversation_manager_im_destroy(conversation);
+	g_clear_object(&account);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_test_add_func("/conversation-manager/find",
+	                test_purple_conversation_manager_find);
+	g_test_add_func("/conversation-manager/find-renamed",
+	                test_purple_conversation_manager_find_renamed);
+
+	return g_test_run();
+}
@@ -259,11 +259,8 @@ test_purple_history_adapter_test_write(void) {
 
 	g_clear_object(&adapter);
 	g_clear_object(&message);
-
-	/* TODO: something is freeing our ref. */
-	/* g_clear_object(&account); */
-
 	g_clear_object(&conversation);
+	g_clear_object(&account);
 }
 
 
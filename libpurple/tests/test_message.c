@@ -0,0 +1,133 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <glib.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_purple_message_new_full(void) {
+	PurpleMessage *message = NULL;
+	GDateTime *dt = NULL;
+	gint64 timestamp = G_GINT64_CONSTANT(1234567890) * G_USEC_PER_SEC + 123456;
+
+	message = purple_message_new_full("id", "author", "alias", "recipient",
+	                                  "contents",
+	                                  PURPLE_MESSAGE_CONTENT_TYPE_HTML,
+	                                  timestamp, PURPLE_MESSAGE_RECV);
+
+	g_assert_cmpstr(purple_message_get_id(message), ==, "id");
+	g_assert_cmpstr(purple_message_get_author(message), ==, "author");
+	g_assert_cmpstr(purple_message_get_author_alias(message), ==, "alias");
+	g_assert_cmpstr(purple_message_get_recipient(message), ==, "recipient");
+	g_assert_cmpstr(purple_message_get_contents(message), ==, "contents");
+	g_assert_cmpint(purple_message_get_content_type(message), ==,
+	                PURPLE_MESSAGE_CONTENT_TYPE_HTML);
+	g_assert_cmpint(purple_message_get_flags(message), ==,
+	                PURPLE_MESSAGE_RECV);
+	g_assert_cmpint(purple_message_get_timestamp_usec(message), ==,
+	                timestamp);
+
+	dt = purple_message_get_timestamp(message);
+	g_assert_cmpint(g_date_time_to_unix(dt), ==, 1234567890);
+	g_assert_cmpint(g_date_time_get_microsecond(dt), ==, 123456);
+
+	/* The GDateTime is created once and then reused. */
+	g_assert_true(purple_message_get_timestamp(message) == dt);
+
+	g_clear_object(&message);
+}
+
+static void
+test_purple_message_timestamp(void) {
+	PurpleMessage *message = NULL;
+	GDateTime *dt = NULL;
+	gint64 before = g_get_real_time();
+
+	message = g_object_new(PURPLE_TYPE_MESSAGE, NULL);
+
+	/* A message without a timestamp gets the current time. */
+	g_assert_cmpint(purple_message_get_timestamp_usec(message), >=, before);
+
+	dt = g_date_time_new_from_unix_utc(1000);
+	purple_message_set_timestamp(message, dt);
+	g_assert_true(purple_message_get_timestamp(message) == dt);
+	g_assert_cmpint(purple_message_get_timestamp_usec(message), ==,
+	                1000 * G_USEC_PER_SEC);
+	g_date_time_unref(dt);
+
+	/* Times before the epoch must not be off by a second. */
+	purple_message_set_timestamp_usec(message, -1);
+	dt = purple_message_get_timestamp(message);
+	g_assert_cmpint(g_date_time_to_unix(dt), ==, -1);
+	g_assert_cmpint(g_date_time_get_microsecond(dt), ==, 999999);
+
+	g_clear_object(&message);
+}
+
+static void
+test_purple_message_attachments(void) {
+	PurpleMessage *message = NULL;
+	PurpleAttachment *attachment = NULL;
+	PurpleAttachment *found = NULL;
+
+	message = purple_message_new_system("contents", 0);
+
+	/* Nothing has been attached yet, so these must all cope with that. */
+	g_assert_null(purple_message_get_attachment(message, 1));
+	g_assert_false(purple_message_remove_attachment(message, 1));
+	purple_message_clear_attachments(message);
+
+	attachment = purple_attachment_new(1, "text/plain");
+	g_assert_true(purple_message_add_attachment(message, attachment));
+
+	found = purple_message_get_attachment(message, 1);
+	g_assert_true(found == attachment);
+	g_clear_object(&found);
+
+	g_assert_true(purple_message_remove_attachment(message, 1));
+	g_assert_null(purple_message_get_attachment(message, 1));
+
+	g_clear_object(&attachment);
+	g_clear_object(&message);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_test_add_func("/message/new-full",
+	                test_purple_message_new_full);
+	g_test_add_func("/message/timestamp",
+	                test_purple_message_timestamp);
+	g_test_add_func("/message/attachments",
+	                test_purple_message_attachments);
+
+	return g_test_run();
+}
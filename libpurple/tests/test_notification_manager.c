@@ -45,6 +45,33 @@ test_purple_notification_manager_unread_count_cb(G_GNUC_UNUSED GObject *obj,
 	*called = *called + 1;
 }
 
+static void
+test_purple_notification_manager_items_changed_cb(G_GNUC_UNUSED GListModel *model,
+                                                  G_GNUC_UNUSED guint position,
+                                                  G_GNUC_UNUSED guint removed,
+                                                  G_GNUC_UNUSED guint added,
+                                                  gpointer data)
+{
+	gint *called = data;
+
+	*called = *called + 1;
+}
+
+/* Records each change to the model as "position:removed:added" so that tests
+ * can check that only the affected ranges were touched.
+ */
+static void
+test_purple_notification_manager_items_changed_record_cb(G_GNUC_UNUSED GListModel *model,
+                                                         guint position,
+                                                         guint removed,
+                                                         guint added,
+                                                         gpointer data)
+{
+	GString *changes = data;
+
+	g_string_append_printf(changes, "%u:%u:%u ", position, removed, added);
+}
+
 /******************************************************************************
  * Tests
  *****************************************************************************/
@@ -161,6 +188,110 @@ test_purple_notification_manager_double_remove(void) {
 	g_clear_object(&manager);
 }
 
+static void
+test_purple_notification_manager_add_remove_many(void) {
+	PurpleNotificationManager *manager = NULL;
+	PurpleNotification *notifications[4];
+	GListModel *model = NULL;
+	GList *list = NULL;
+	GString *changes = NULL;
+	gint added_called = 0, removed_called = 0, changed_called = 0;
+
+	manager = g_object_new(PURPLE_TYPE_NOTIFICATION_MANAGER, NULL);
+	model = purple_notification_manager_get_model(manager);
+
+	g_signal_connect(manager, "added",
+	                 G_CALLBACK(test_purple_notification_manager_increment_cb),
+	                 &added_called);
+	g_signal_connect(manager, "removed",
+	                 G_CALLBACK(test_purple_notification_manager_increment_cb),
+	                 &removed_called);
+	g_signal_connect(model, "items-changed",
+	                 G_CALLBACK(test_purple_notification_manager_items_changed_cb),
+	                 &changed_called);
+
+	changes = g_string_new(NULL);
+	g_signal_connect(model, "items-changed",
+	                 G_CALLBACK(test_purple_notification_manager_items_changed_record_cb),
+	                 changes);
+
+	for(gint i = 0; i < 4; i++) {
+		GDateTime *timestamp = NULL;
+
+		/* Give each notification a distinct creation time so we can check
+		 * the ordering.
+		 */
+		timestamp = g_date_time_new_from_unix_utc(1000 + i);
+		notifications[i] = purple_notification_new(PURPLE_NOTIFICATION_TYPE_GENERIC,
+		                                           NULL, NULL, NULL);
+		purple_notification_set_created_timestamp(notifications[i], timestamp);
+		g_date_time_unref(timestamp);
+	}
+
+	/* Add one notification the normal way and the rest in bulk. */
+	purple_notification_manager_add(manager, notifications[2]);
+	g_assert_cmpint(changed_called, ==, 1);
+	g_string_truncate(changes, 0);
+
+	/* The new notifications go in before and after the existing one, which
+	 * is left alone. Each place gets one change, starting from the end.
+	 */
+	list = g_list_append(list, notifications[3]);
+	list = g_list_append(list, notifications[0]);
+	list = g_list_append(list, notifications[1]);
+	purple_notification_manager_add_many(manager, list);
+	g_list_free(list);
+
+	g_assert_cmpint(changed_called, ==, 3);
+	g_assert_cmpstr(changes->str, ==, "1:0:1 0:0:2 ");
+	g_assert_cmpint(added_called, ==, 4);
+	g_assert_cmpuint(g_list_model_get_n_items(model), ==, 4);
+	g_assert_cmpuint(purple_notification_manager_get_unread_count(manager), ==,
+	                 4);
+
+	for(guint i = 0; i < 4; i++) {
+		PurpleNotification *notification = g_list_model_get_item(model, i);
+
+		g_assert_true(notification == notifications[i]);
+		g_clear_object(&notification);
+	}
+
+	/* Remove three of them in bulk, including one that is read. The two
+	 * adjacent ones are removed together.
+	 */
+	purple_notification_set_read(notifications[1], TRUE);
+	g_string_truncate(changes, 0);
+
+	list = g_list_append(NULL, notifications[3]);
+	list = g_list_append(list, notifications[0]);
+	list = g_list_append(list, notifications[1]);
+	list = g_list_append(list, notifications[0]);
+	purple_notification_manager_remove_many(manager, list);
+	g_list_free(list);
+
+	g_assert_cmpstr(changes->str, ==, "3:1:0 0:2:0 ");
+	g_assert_cmpint(changed_called, ==, 5);
+	g_assert_cmpint(removed_called, ==, 3);
+	g_assert_cmpuint(g_list_model_get_n_items(model), ==, 1);
+	g_assert_cmpuint(purple_notification_manager_get_unread_count(manager), ==,
+	                 1);
+
+	/* Removing notifications that aren't in the manager does nothing. */
+	list = g_list_append(NULL, notifications[1]);
+	purple_notification_manager_remove_many(manager, list);
+	g_list_free(list);
+
+	g_assert_cmpint(changed_called, ==, 5);
+	g_assert_cmpint(removed_called, ==, 3);
+
+	g_string_free(changes, TRUE);
+	g_clear_object(&model);
+	g_clear_object(&manager);
+	for(gint i = 0; i < 4; i++) {
+		g_clear_object(&notifications[i]);
+	}
+}
+
 static void
 test_purple_notification_manager_remove_with_account_simple(void) {
 	PurpleNotificationManager *manager = NULL;
@@ -204,6 +335,7 @@ test_purple_notification_manager_remove_with_account_mixed(void) {
 	PurpleNotification *notification = NULL;
 	PurpleAccount *accounts[3];
 	GListModel *model = NULL;
+	GString *changes = NULL;
 	gint pattern[] = {0, 0, 1, 0, 2, 1, 0, 0, 1, 2, 0, 1, 0, 0, -1};
 	gint i = 0;
 
@@ -225,9 +357,17 @@ test_purple_notification_manager_remove_with_account_mixed(void) {
 
 	g_assert_cmpuint(14, ==, g_list_model_get_n_items(model));
 
-	/* Remove notifications for accounts[0]. */
+	/* Remove notifications for accounts[0]. Only the runs of them are
+	 * touched.
+	 */
+	changes = g_string_new(NULL);
+	g_signal_connect(model, "items-changed",
+	                 G_CALLBACK(test_purple_notification_manager_items_changed_record_cb),
+	                 changes);
+
 	purple_notification_manager_remove_with_account(manager, accounts[0], TRUE);
 	g_assert_cmpuint(6, ==, g_list_model_get_n_items(model));
+	g_assert_cmpstr(changes->str, ==, "12:2:0 10:1:0 6:2:0 3:1:0 0:2:0 ");
 
 	/* Remove notifications for accounts[1]. */
 	purple_notification_manager_remove_with_account(manager, accounts[1], TRUE);
@@ -237,6 +377,7 @@ test_purple_notification_manager_remove_with_account_mixed(void) {
 	purple_notification_manager_remove_with_account(manager, accounts[2], TRUE);
 	g_assert_cmpuint(0, ==, g_list_model_get_n_items(model));
 
+	g_string_free(changes, TRUE);
 	g_clear_object(&manager);
 	g_clear_object(&accounts[0]);
 	g_clear_object(&accounts[1]);
@@ -407,6 +548,9 @@ main(gint argc, gchar *argv[]) {
 	g_test_add_func("/notification-manager/double-remove",
 	                test_purple_notification_manager_double_remove);
 
+	g_test_add_func("/notification-manager/add-remove-many",
+	                test_purple_notification_manager_add_remove_many);
+
 	g_test_add_func("/notification-manager/remove-with-account/simple",
 	                test_purple_notification_manager_remove_with_account_simple);
 	g_test_add_func("/notification-manager/remove-with-account/mixed",
@@ -0,0 +1,425 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+#include "../purpleprivate.h"
+
+/* A modification time that no cache is written with, to tell whether a cache
+ * was written again.
+ */
+#define TEST_PURPLE_PERSISTENCE_OLD_MTIME (1)
+
+static const gchar *test_purple_persistence_xml =
+	"<?xml version='1.0' encoding='UTF-8' ?>\n"
+	"<roster version='1.0' xmlns='urn:test' xmlns:x='urn:test:x'>\n"
+	"\t<item name='alice &amp; bob' x:flag='yes'>\n"
+	"\t\t<x:note>line one&#10;line two &lt;3</x:note>\n"
+	"\t\t<empty/>\n"
+	"\t</item>\n"
+	"\t<item name='carol'>caf\xc3\xa9</item>\n"
+	"</roster>\n";
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static void
+test_purple_persistence_write_file(const gchar *dir, const gchar *filename,
+                                   const gchar *contents, gssize length)
+{
+	gchar *path = g_build_filename(dir, filename, NULL);
+	GError *error = NULL;
+
+	g_file_set_contents(path, contents, length, &error);
+	g_assert_no_error(error);
+
+	g_free(path);
+}
+
+static gchar *
+test_purple_persistence_read_cache(const gchar *filename, gsize *length) {
+	gchar *cache = g_strdup_printf("%s.cache", filename);
+	gchar *path = g_build_filename(purple_cache_dir(), cache, NULL);
+	gchar *contents = NULL;
+	GError *error = NULL;
+
+	g_file_get_contents(path, &contents, length, &error);
+	g_assert_no_error(error);
+
+	g_free(path);
+	g_free(cache);
+
+	return contents;
+}
+
+static GFile *
+test_purple_persistence_cache_file(const gchar *filename) {
+	gchar *cache = g_strdup_printf("%s.cache", filename);
+	gchar *path = g_build_filename(purple_cache_dir(), cache, NULL);
+	GFile *file = g_file_new_for_path(path);
+
+	g_free(path);
+	g_free(cache);
+
+	return file;
+}
+
+static void
+test_purple_persistence_age_cache(const gchar *filename) {
+	GFile *file = test_purple_persistence_cache_file(filename);
+	GError *error = NULL;
+
+	g_file_set_attribute_uint64(file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+	                            TEST_PURPLE_PERSISTENCE_OLD_MTIME,
+	                            G_FILE_QUERY_INFO_NONE, NULL, &error);
+	g_assert_no_error(error);
+
+	g_object_unref(file);
+}
+
+/* Returns whether the cache of filename was written since it was aged. */
+static gboolean
+test_purple_persistence_cache_written(const gchar *filename) {
+	GFile *file = test_purple_persistence_cache_file(filename);
+	GFileInfo *info = NULL;
+	GError *error = NULL;
+	guint64 mtime = 0;
+
+	info = g_file_query_info(file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+	                         G_FILE_QUERY_INFO_NONE, NULL, &error);
+	g_assert_no_error(error);
+
+	mtime = g_file_info_get_attribute_uint64(info,
+	                                         G_FILE_ATTRIBUTE_TIME_MODIFIED);
+
+	g_object_unref(info);
+	g_object_unref(file);
+
+	return mtime != TEST_PURPLE_PERSISTENCE_OLD_MTIME;
+}
+
+/* Reads filename, waits for its cache to be written and returns the value of
+ * the attribute of its root.
+ */
+static gchar *
+test_purple_persistence_read_value(const gchar *filename) {
+	PurpleXmlNode *node = NULL;
+	gchar *value = NULL;
+
+	node = purple_persistence_read(filename, "test");
+	g_assert_nonnull(node);
+	purple_persistence_flush(filename);
+
+	value = g_strdup(purple_xmlnode_get_attrib(node, "value"));
+	purple_xmlnode_free(node);
+
+	return value;
+}
+
+static const gchar *test_purple_persistence_snapshot_xml = NULL;
+
+static PurpleXmlNode *
+test_purple_persistence_snapshot(void) {
+	return purple_xmlnode_from_str(test_purple_persistence_snapshot_xml, -1);
+}
+
+/* Saves xml to filename through the persistence service, which writes its
+ * cache as well once it has been read.
+ */
+static void
+test_purple_persistence_save(const gchar *filename, const gchar *xml) {
+	test_purple_persistence_snapshot_xml = xml;
+	purple_persistence_schedule_save(filename,
+	                                 test_purple_persistence_snapshot);
+	purple_persistence_flush(filename);
+	test_purple_persistence_snapshot_xml = NULL;
+}
+
+/* Creates filename with a cache for xml.  A file that wasn't saved by the
+ * service doesn't get a cache, so it is saved again after it was read.
+ */
+static void
+test_purple_persistence_create(const gchar *filename, const gchar *xml) {
+	PurpleXmlNode *node = NULL;
+
+	test_purple_persistence_write_file(purple_config_dir(), filename, xml,
+	                                   -1);
+
+	node = purple_persistence_read(filename, "test");
+	g_assert_nonnull(node);
+	purple_xmlnode_free(node);
+
+	test_purple_persistence_save(filename, xml);
+}
+
+static void
+test_purple_persistence_remove_dir(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name = NULL;
+
+	if(dir == NULL) {
+		return;
+	}
+
+	while((name = g_dir_read_name(dir)) != NULL) {
+		gchar *child = g_build_filename(path, name, NULL);
+
+		if(g_file_test(child, G_FILE_TEST_IS_DIR)) {
+			test_purple_persistence_remove_dir(child);
+		} else {
+			g_unlink(child);
+		}
+
+		g_free(child);
+	}
+
+	g_dir_close(dir);
+	g_rmdir(path);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_purple_persistence_cache_round_trip(void) {
+	PurpleXmlNode *node = NULL;
+	gchar *expected = NULL, *actual = NULL;
+
+	test_purple_persistence_create("round-trip.xml",
+	                               test_purple_persistence_xml);
+
+	node = purple_util_read_xml_from_config_file("round-trip.xml", "test");
+	g_assert_nonnull(node);
+	g_assert_nonnull(purple_xmlnode_get_attrib(node, "cache-generation"));
+	expected = purple_xmlnode_to_str(node, NULL);
+	purple_xmlnode_free(node);
+
+	/* The cache is still good, so it is decoded and isn't written again. */
+	test_purple_persistence_age_cache("round-trip.xml");
+
+	node = purple_persistence_read("round-trip.xml", "test");
+	g_assert_nonnull(node);
+	purple_persistence_flush("round-trip.xml");
+
+	g_assert_false(test_purple_persistence_cache_written("round-trip.xml"));
+
+	actual = purple_xmlnode_to_str(node, NULL);
+	g_assert_cmpstr(actual, ==, expected);
+
+	purple_xmlnode_free(node);
+	g_free(expected);
+	g_free(actual);
+}
+
+static void
+test_purple_persistence_cache_stale(void) {
+	gchar *contents = NULL, *value = NULL;
+	gsize length = 0;
+
+	test_purple_persistence_create("stale.xml", "<test value='old'/>");
+	contents = test_purple_persistence_read_cache("stale.xml", &length);
+
+	/* The file is saved again with the same size, most likely within the
+	 * same second, but the old cache is put back as if writing the new one
+	 * had failed.
+	 */
+	test_purple_persistence_save("stale.xml", "<test value='new'/>");
+	test_purple_persistence_write_file(purple_cache_dir(), "stale.xml.cache",
+	                                   contents, length);
+	test_purple_persistence_age_cache("stale.xml");
+	g_free(contents);
+
+	value = test_purple_persistence_read_value("stale.xml");
+	g_assert_cmpstr(value, ==, "new");
+	g_free(value);
+
+	/* The stale cache was replaced by one for the new contents. */
+	g_assert_true(test_purple_persistence_cache_written("stale.xml"));
+
+	test_purple_persistence_age_cache("stale.xml");
+
+	value = test_purple_persistence_read_value("stale.xml");
+	g_assert_cmpstr(value, ==, "new");
+	g_free(value);
+
+	g_assert_false(test_purple_persistence_cache_written("stale.xml"));
+
+	/* Editing the file by hand drops its generation, so the cache is ignored
+	 * and isn't written again until the file is saved.
+	 */
+	test_purple_persistence_write_file(purple_config_dir(), "stale.xml",
+	                                   "<test value='edited'/>", -1);
+
+	value = test_purple_persistence_read_value("stale.xml");
+	g_assert_cmpstr(value, ==, "edited");
+	g_free(value);
+
+	g_assert_false(test_purple_persistence_cache_written("stale.xml"));
+}
+
+static void
+test_purple_persistence_cache_corrupt(void) {
+	gchar *contents = NULL, *needle = NULL, *value = NULL;
+	gsize length = 0;
+
+	test_purple_persistence_create("corrupt.xml", "<test value='needle'/>");
+
+	/* A changed byte in a string still decodes, so only the checksum of the
+	 * cache can catch it.
+	 */
+	contents = test_purple_persistence_read_cache("corrupt.xml", &length);
+	needle = g_strstr_len(contents, length, "needle");
+	g_assert_nonnull(needle);
+	needle[2] = 'x';
+	test_purple_persistence_write_file(purple_cache_dir(), "corrupt.xml.cache",
+	                                   contents, length);
+	test_purple_persistence_age_cache("corrupt.xml");
+
+	g_test_expect_message("persistence", G_LOG_LEVEL_WARNING,
+	                      "ignoring corrupt *");
+	value = test_purple_persistence_read_value("corrupt.xml");
+	g_test_assert_expected_messages();
+
+	g_assert_cmpstr(value, ==, "needle");
+	g_free(value);
+
+	g_assert_true(test_purple_persistence_cache_written("corrupt.xml"));
+
+	/* A truncated cache is ignored as well. */
+	test_purple_persistence_write_file(purple_cache_dir(), "corrupt.xml.cache",
+	                                   contents, length / 2);
+	test_purple_persistence_age_cache("corrupt.xml");
+
+	value = test_purple_persistence_read_value("corrupt.xml");
+	g_assert_cmpstr(value, ==, "needle");
+	g_free(value);
+
+	g_assert_true(test_purple_persistence_cache_written("corrupt.xml"));
+
+	g_free(contents);
+}
+
+/* Run with -m perf to compare reading a buddy list sized file from its cache
+ * with parsing it.
+ */
+static void
+test_purple_persistence_cache_perf(void) {
+	PurpleXmlNode *node = NULL;
+	GString *doc = NULL;
+	const guint n_buddies = 5000, n_rounds = 20;
+	gdouble parse = 0.0, cache = 0.0;
+
+	if(!g_test_perf()) {
+		g_test_skip("only run in perf mode");
+
+		return;
+	}
+
+	doc = g_string_new("<purple version='1.0'><blist>");
+	for(guint i = 0; i < n_buddies; i++) {
+		if(i % 100 == 0) {
+			if(i > 0) {
+				g_string_append(doc, "</group>");
+			}
+			g_string_append_printf(doc, "<group name='Group %u'>", i / 100);
+		}
+
+		g_string_append_printf(doc,
+		                       "<contact><buddy account='test@example.com' "
+		                       "proto='prpl-test'><name>user%u@example.com"
+		                       "</name><alias>User %u</alias>"
+		                       "<setting name='last_seen' type='int'>%u"
+		                       "</setting></buddy></contact>",
+		                       i, i, 1600000000 + i);
+	}
+	g_string_append(doc, "</group></blist><privacy/></purple>");
+
+	test_purple_persistence_create("perf.xml", doc->str);
+
+	g_test_timer_start();
+	for(guint i = 0; i < n_rounds; i++) {
+		node = purple_util_read_xml_from_config_file("perf.xml", "test");
+		g_assert_nonnull(node);
+		purple_xmlnode_free(node);
+	}
+	parse = g_test_timer_elapsed();
+	g_test_minimized_result(parse, "parse %u buddies %u times: %fs",
+	                        n_buddies, n_rounds, parse);
+
+	test_purple_persistence_age_cache("perf.xml");
+
+	g_test_timer_start();
+	for(guint i = 0; i < n_rounds; i++) {
+		node = purple_persistence_read("perf.xml", "test");
+		g_assert_nonnull(node);
+		purple_xmlnode_free(node);
+	}
+	cache = g_test_timer_elapsed();
+	g_test_minimized_result(cache, "read %u buddies from the cache %u times: "
+	                        "%fs",
+	                        n_buddies, n_rounds, cache);
+
+	/* Every read came from the cache. */
+	purple_persistence_flush("perf.xml");
+	g_assert_false(test_purple_persistence_cache_written("perf.xml"));
+
+	g_test_message("the cache takes %.0f%% of the time of parsing",
+	               100.0 * cache / parse);
+
+	g_string_free(doc, TRUE);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar *argv[]) {
+	gchar *dir = NULL;
+	gint ret = 0;
+
+	g_test_init(&argc, &argv, NULL);
+
+	dir = g_dir_make_tmp("test_persistence-XXXXXX", NULL);
+	g_assert_nonnull(dir);
+	purple_util_set_user_dir(dir);
+
+	g_assert_cmpint(g_mkdir_with_parents(purple_config_dir(), 0700), ==, 0);
+
+	test_ui_purple_init();
+
+	g_test_add_func("/persistence/cache/round-trip",
+	                test_purple_persistence_cache_round_trip);
+	g_test_add_func("/persistence/cache/stale",
+	                test_purple_persistence_cache_stale);
+	g_test_add_func("/persistence/cache/corrupt",
+	                test_purple_persistence_cache_corrupt);
+	g_test_add_func("/persistence/cache/perf",
+	                test_purple_persistence_cache_perf);
+
+	ret = g_test_run();
+
+	test_purple_persistence_remove_dir(dir);
+	g_free(dir);
+
+	return ret;
+}
@@ -0,0 +1,1643 @@
+/*
+ * Purple - Internet Messaging Library
+ * Copyright (C) Pidgin Developers <devel@pidgin.im>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <purple.h>
+
+#include <sqlite3.h>
+
+#include "test_ui.h"
+
+#define PURPLE_GLOBAL_HEADER_INSIDE
+#include "../purpleprivate.h"
+#undef PURPLE_GLOBAL_HEADER_INSIDE
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static PurpleHistoryAdapter *
+test_purple_sqlite_history_adapter_new_active(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	GError *error = NULL;
+	gboolean result = FALSE;
+
+	adapter = purple_sqlite_history_adapter_new(":memory:");
+
+	result = purple_history_adapter_activate(adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	return adapter;
+}
+
+/* Returns the name of a database file in a new temporary directory. Queries
+ * only use the read only connection when the database is a file.
+ */
+static gchar *
+test_purple_sqlite_history_adapter_filename_new(void) {
+	GError *error = NULL;
+	gchar *path = NULL;
+	gchar *filename = NULL;
+
+	path = g_dir_make_tmp("purple-history-XXXXXX", &error);
+	g_assert_no_error(error);
+
+	filename = g_build_filename(path, "history.db", NULL);
+	g_free(path);
+
+	return filename;
+}
+
+/* Removes the database and its temporary directory. This must only be called
+ * once every connection to the database has been closed.
+ */
+static void
+test_purple_sqlite_history_adapter_filename_free(gchar *filename) {
+	const gchar *suffixes[] = {"", "-wal", "-shm", "-journal"};
+	gchar *path = NULL;
+
+	for(gsize i = 0; i < G_N_ELEMENTS(suffixes); i++) {
+		gchar *name = g_strconcat(filename, suffixes[i], NULL);
+
+		g_remove(name);
+		g_free(name);
+	}
+
+	path = g_path_get_dirname(filename);
+	g_assert_cmpint(g_rmdir(path), ==, 0);
+	g_free(path);
+
+	g_free(filename);
+}
+
+static void
+test_purple_sqlite_history_adapter_destroy(PurpleHistoryAdapter *adapter) {
+	GError *error = NULL;
+	gboolean result = FALSE;
+
+	result = purple_history_adapter_deactivate(adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	g_clear_object(&adapter);
+}
+
+static PurpleConversation *
+test_purple_sqlite_history_adapter_conversation_new(const gchar *name) {
+	PurpleAccount *account = NULL;
+	PurpleConversation *conversation = NULL;
+
+	account = purple_account_new("test", "test");
+	conversation = g_object_new(PURPLE_TYPE_IM_CONVERSATION,
+	                            "account", account,
+	                            "name", name,
+	                            NULL);
+	g_object_unref(account);
+
+	return conversation;
+}
+
+static void
+test_purple_sqlite_history_adapter_write_n(PurpleHistoryAdapter *adapter,
+                                           PurpleConversation *conversation,
+                                           const gchar *author, gint count)
+{
+	for(gint i = 0; i < count; i++) {
+		PurpleMessage *message = NULL;
+		GError *error = NULL;
+		gchar *contents = NULL;
+		gboolean result = FALSE;
+
+		contents = g_strdup_printf("message %d", i);
+		message = purple_message_new_outgoing(author, NULL, contents, 0);
+		g_free(contents);
+
+		result = purple_history_adapter_write(adapter, conversation, message,
+		                                      &error);
+		g_assert_no_error(error);
+		g_assert_true(result);
+
+		g_clear_object(&message);
+	}
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_purple_sqlite_history_adapter_properties(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleSqliteHistoryAdapterSynchronous synchronous;
+	gchar *filename = NULL;
+	guint interval = 0;
+
+	adapter = g_object_new(
+		PURPLE_TYPE_SQLITE_HISTORY_ADAPTER,
+		"id", "test-sqlite",
+		"name", "Test SQLite",
+		"filename", ":memory:",
+		"synchronous", PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_FULL,
+		"commit-interval", 100,
+		NULL);
+
+	g_object_get(G_OBJECT(adapter),
+	             "filename", &filename,
+	             "synchronous", &synchronous,
+	             "commit-interval", &interval,
+	             NULL);
+
+	g_assert_cmpstr(filename, ==, ":memory:");
+	g_assert_cmpint(synchronous, ==,
+	                PURPLE_SQLITE_HISTORY_ADAPTER_SYNCHRONOUS_FULL);
+	g_assert_cmpuint(interval, ==, 100);
+
+	g_free(filename);
+	g_clear_object(&adapter);
+}
+
+static void
+test_purple_sqlite_history_adapter_write_query(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "alice",
+	                                           250);
+
+	/* Queries must see every message that was written before them even
+	 * though the writer thread commits them asynchronously.
+	 */
+	results = purple_history_adapter_query(adapter, "from:alice", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 250);
+	g_assert_cmpstr(purple_message_get_contents(results->data), ==,
+	                "message 0");
+	g_list_free_full(results, g_object_unref);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_flush(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+	gboolean result = FALSE;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	purple_sqlite_history_adapter_set_commit_interval(PURPLE_SQLITE_HISTORY_ADAPTER(adapter),
+	                                                  1000);
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "bob",
+	                                           10);
+	result = purple_sqlite_history_adapter_flush(PURPLE_SQLITE_HISTORY_ADAPTER(adapter),
+	                                             &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	result = purple_history_adapter_remove(adapter, "from:bob", &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	results = purple_history_adapter_query(adapter, "from:bob", &error);
+	g_assert_no_error(error);
+	g_assert_null(results);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_flush_async_cb(GObject *obj,
+                                                  GAsyncResult *result,
+                                                  gpointer data)
+{
+	GError **error = data;
+	gboolean ret = FALSE;
+
+	ret = purple_sqlite_history_adapter_flush_finish(PURPLE_SQLITE_HISTORY_ADAPTER(obj),
+	                                                 result, error);
+	g_assert_true(ret == (*error == NULL));
+
+	g_main_loop_quit(g_object_get_data(obj, "loop"));
+}
+
+static void
+test_purple_sqlite_history_adapter_write_error(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GMainLoop *loop = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+	sqlite3 *db = NULL;
+	gchar *filename = NULL;
+	gboolean result = FALSE;
+
+	filename = test_purple_sqlite_history_adapter_filename_new();
+	adapter = purple_sqlite_history_adapter_new(filename);
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	result = purple_history_adapter_activate(adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	/* Make every insert fail from a second connection. */
+	g_assert_cmpint(sqlite3_open(filename, &db), ==, SQLITE_OK);
+	sqlite3_busy_timeout(db, 1000);
+	g_assert_cmpint(sqlite3_exec(db,
+	                             "CREATE TRIGGER test_refuse BEFORE INSERT ON "
+	                             "message_log BEGIN "
+	                             "SELECT RAISE(ABORT, 'refused'); END;",
+	                             NULL, NULL, NULL), ==, SQLITE_OK);
+
+	/* Writes are only queued, so the failure shows up in the flush. */
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "mike",
+	                                           3);
+	result = purple_sqlite_history_adapter_flush(sqlite_adapter, &error);
+	g_assert_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0);
+	g_assert_false(result);
+	g_clear_error(&error);
+
+	/* It is only reported once. */
+	result = purple_sqlite_history_adapter_flush(sqlite_adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	/* The asynchronous version reports it as well. */
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "mike",
+	                                           1);
+
+	loop = g_main_loop_new(NULL, FALSE);
+	g_object_set_data(G_OBJECT(adapter), "loop", loop);
+	purple_sqlite_history_adapter_flush_async(sqlite_adapter, NULL,
+	                                          test_purple_sqlite_history_adapter_flush_async_cb,
+	                                          &error);
+	g_main_loop_run(loop);
+	g_assert_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0);
+	g_clear_error(&error);
+
+	g_assert_cmpint(sqlite3_exec(db, "DROP TRIGGER test_refuse;", NULL, NULL,
+	                             NULL), ==, SQLITE_OK);
+	g_assert_cmpint(sqlite3_close(db), ==, SQLITE_OK);
+
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "mike",
+	                                           2);
+	result = purple_sqlite_history_adapter_flush(sqlite_adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	results = purple_history_adapter_query(adapter, "from:mike", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 2);
+	g_list_free_full(results, g_object_unref);
+
+	g_main_loop_unref(loop);
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+
+	test_purple_sqlite_history_adapter_filename_free(filename);
+}
+
+static void
+test_purple_sqlite_history_adapter_time_range(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+	const gchar *timestamps[] = {
+		"2020-01-01T12:00:00Z",
+		"2021-01-01T12:00:00Z",
+		"2022-01-01T12:00:00Z",
+		NULL
+	};
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	for(gint i = 0; timestamps[i] != NULL; i++) {
+		PurpleMessage *message = NULL;
+		GDateTime *timestamp = NULL;
+		gboolean result = FALSE;
+
+		timestamp = g_date_time_new_from_iso8601(timestamps[i], NULL);
+		message = g_object_new(PURPLE_TYPE_MESSAGE,
+		                       "author", "carol",
+		                       "contents", timestamps[i],
+		                       "timestamp", timestamp,
+		                       NULL);
+		g_date_time_unref(timestamp);
+
+		result = purple_history_adapter_write(adapter, conversation, message,
+		                                      &error);
+		g_assert_no_error(error);
+		g_assert_true(result);
+
+		g_clear_object(&message);
+	}
+
+	results = purple_history_adapter_query(adapter,
+	                                       "from:carol after:2020-06-01T00:00:00Z",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 2);
+	g_list_free_full(results, g_object_unref);
+
+	results = purple_history_adapter_query(adapter,
+	                                       "after:2020-06-01T00:00:00Z "
+	                                       "before:2022-01-01T12:00:00Z",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 1);
+	g_assert_cmpstr(purple_message_get_contents(results->data), ==,
+	                "2021-01-01T12:00:00Z");
+	g_list_free_full(results, g_object_unref);
+
+	results = purple_history_adapter_query(adapter, "before:yesterday",
+	                                       &error);
+	g_assert_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0);
+	g_assert_null(results);
+	g_clear_error(&error);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_keywords(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+	gboolean result = FALSE;
+	const gchar *contents[] = {
+		"the quick brown fox",
+		"jumps over the lazy dog",
+		"a \"quoted\" word",
+		NULL
+	};
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	for(gint i = 0; contents[i] != NULL; i++) {
+		PurpleMessage *message = NULL;
+
+		message = purple_message_new_outgoing("dave", NULL, contents[i], 0);
+		result = purple_history_adapter_write(adapter, conversation, message,
+		                                      &error);
+		g_assert_no_error(error);
+		g_assert_true(result);
+
+		g_clear_object(&message);
+	}
+
+	/* Keywords match word prefixes case insensitively. */
+	results = purple_history_adapter_query(adapter, "QUI", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 1);
+	g_assert_cmpstr(purple_message_get_contents(results->data), ==,
+	                contents[0]);
+	g_assert_cmpstr(purple_sqlite_history_adapter_get_snippet(results->data),
+	                ==, "the <b>quick</b> brown fox");
+	g_list_free_full(results, g_object_unref);
+
+	/* Multiple keywords match any of them. */
+	results = purple_history_adapter_query(adapter, "fox dog", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 2);
+	g_list_free_full(results, g_object_unref);
+
+	/* FTS syntax in a keyword, here an escaped quote, is matched
+	 * literally.
+	 */
+	results = purple_history_adapter_query(adapter, "\"\\\"quoted\\\"\"",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 1);
+	g_list_free_full(results, g_object_unref);
+
+	/* Removing by keyword keeps the index in sync. */
+	result = purple_history_adapter_remove(adapter, "lazy", &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	results = purple_history_adapter_query(adapter, "dog", &error);
+	g_assert_no_error(error);
+	g_assert_null(results);
+
+	result = purple_sqlite_history_adapter_rebuild_search_index(PURPLE_SQLITE_HISTORY_ADAPTER(adapter),
+	                                                            &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	results = purple_history_adapter_query(adapter, "from:dave", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 2);
+	g_assert_null(purple_sqlite_history_adapter_get_snippet(results->data));
+	g_list_free_full(results, g_object_unref);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_query_page(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	gchar *cursor = NULL;
+	guint n_pages = 0;
+	guint n_messages = 0;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "erin",
+	                                           25);
+
+	do {
+		GError *error = NULL;
+		GList *results = NULL;
+		gchar *next_cursor = NULL;
+
+		results = purple_history_adapter_query_page(adapter, "from:erin",
+		                                            cursor, 10, &next_cursor,
+		                                            &error);
+		g_assert_no_error(error);
+		g_assert_cmpuint(g_list_length(results), <=, 10);
+
+		for(GList *l = results; l != NULL; l = l->next) {
+			gchar *expected = g_strdup_printf("message %u", n_messages++);
+
+			g_assert_cmpstr(purple_message_get_contents(l->data), ==,
+			                expected);
+
+			g_free(expected);
+		}
+
+		g_list_free_full(results, g_object_unref);
+		g_free(cursor);
+		cursor = next_cursor;
+		n_pages++;
+	} while(cursor != NULL);
+
+	g_assert_cmpuint(n_pages, ==, 3);
+	g_assert_cmpuint(n_messages, ==, 25);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_query_model(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleHistoryQuery *query = NULL;
+	PurpleConversation *conversation = NULL;
+	PurpleMessage *message = NULL;
+	GError *error = NULL;
+	gboolean result = FALSE;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "frank",
+	                                           15);
+
+	query = purple_history_query_new(adapter, "from:frank", 10);
+	g_assert_true(G_IS_LIST_MODEL(query));
+	g_assert_cmpuint(g_list_model_get_n_items(G_LIST_MODEL(query)), ==, 0);
+	g_assert_true(purple_history_query_get_has_more(query));
+
+	result = purple_history_query_load_more(query, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+	g_assert_cmpuint(g_list_model_get_n_items(G_LIST_MODEL(query)), ==, 10);
+	g_assert_true(purple_history_query_get_has_more(query));
+
+	result = purple_history_query_load_more(query, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+	g_assert_cmpuint(g_list_model_get_n_items(G_LIST_MODEL(query)), ==, 15);
+	g_assert_false(purple_history_query_get_has_more(query));
+
+	message = g_list_model_get_item(G_LIST_MODEL(query), 14);
+	g_assert_cmpstr(purple_message_get_contents(message), ==, "message 14");
+	g_clear_object(&message);
+
+	g_clear_object(&query);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_statement_cache(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+	guint64 hits = 0;
+	guint64 misses = 0;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "gina",
+	                                           3);
+
+	results = purple_history_adapter_query(adapter, "from:gina", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 3);
+	g_list_free_full(results, g_object_unref);
+
+	purple_sqlite_history_adapter_get_statement_cache_stats(sqlite_adapter,
+	                                                        &hits, &misses);
+	g_assert_cmpuint(hits, ==, 0);
+	g_assert_cmpuint(misses, ==, 1);
+
+	/* Same shape, different value, so the statement is reused and the old
+	 * bindings must not leak into the new query.
+	 */
+	results = purple_history_adapter_query(adapter, "from:nobody", &error);
+	g_assert_no_error(error);
+	g_assert_null(results);
+
+	results = purple_history_adapter_query(adapter, "from:gina", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 3);
+	g_list_free_full(results, g_object_unref);
+
+	purple_sqlite_history_adapter_get_statement_cache_stats(sqlite_adapter,
+	                                                        &hits, &misses);
+	g_assert_cmpuint(hits, ==, 2);
+	g_assert_cmpuint(misses, ==, 1);
+
+	/* A different shape needs a new statement. */
+	results = purple_history_adapter_query(adapter, "from:gina in:pidgy",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 3);
+	g_list_free_full(results, g_object_unref);
+
+	purple_sqlite_history_adapter_get_statement_cache_stats(sqlite_adapter,
+	                                                        &hits, &misses);
+	g_assert_cmpuint(hits, ==, 2);
+	g_assert_cmpuint(misses, ==, 2);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_last(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "jane",
+	                                           10);
+
+	/* The most recent messages come back oldest first. */
+	results = purple_history_adapter_query(adapter, "in:pidgy last:3", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 3);
+	g_assert_cmpstr(purple_message_get_contents(results->data), ==,
+	                "message 7");
+	g_assert_cmpstr(purple_message_get_contents(g_list_last(results)->data),
+	                ==, "message 9");
+	g_list_free_full(results, g_object_unref);
+
+	results = purple_history_adapter_query(adapter, "in:pidgy last:100",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 10);
+	g_list_free_full(results, g_object_unref);
+
+	/* Removals have no notion of recent messages. */
+	g_assert_false(purple_history_adapter_remove(adapter, "in:pidgy last:3",
+	                                             &error));
+	g_assert_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0);
+	g_clear_error(&error);
+
+	results = purple_history_adapter_query(adapter, "last:zero", &error);
+	g_assert_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0);
+	g_assert_null(results);
+	g_clear_error(&error);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_write_id(PurpleHistoryAdapter *adapter,
+                                            PurpleConversation *conversation,
+                                            const gchar *id,
+                                            const gchar *contents)
+{
+	PurpleMessage *message = NULL;
+	GError *error = NULL;
+	gboolean result = FALSE;
+
+	message = g_object_new(PURPLE_TYPE_MESSAGE,
+	                       "id", id,
+	                       "author", "kate",
+	                       "contents", contents,
+	                       NULL);
+
+	result = purple_history_adapter_write(adapter, conversation, message,
+	                                      &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	g_clear_object(&message);
+}
+
+static void
+test_purple_sqlite_history_adapter_duplicates(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	g_assert_cmpint(purple_sqlite_history_adapter_get_write_mode(sqlite_adapter),
+	                ==, PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE_IGNORE);
+
+	/* A redelivered message is ignored by default. */
+	test_purple_sqlite_history_adapter_write_id(adapter, conversation, "1",
+	                                            "first");
+	test_purple_sqlite_history_adapter_write_id(adapter, conversation, "1",
+	                                            "again");
+	test_purple_sqlite_history_adapter_write_id(adapter, conversation, "2",
+	                                            "second");
+
+	results = purple_history_adapter_query(adapter, "from:kate", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 2);
+	g_assert_cmpstr(purple_message_get_contents(results->data), ==, "first");
+	g_list_free_full(results, g_object_unref);
+
+	/* In replace mode the stored message is updated in place. */
+	purple_sqlite_history_adapter_set_write_mode(sqlite_adapter,
+	                                             PURPLE_SQLITE_HISTORY_ADAPTER_WRITE_MODE_REPLACE);
+	test_purple_sqlite_history_adapter_write_id(adapter, conversation, "1",
+	                                            "edited");
+
+	results = purple_history_adapter_query(adapter, "from:kate", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 2);
+	g_assert_cmpstr(purple_message_get_contents(results->data), ==, "edited");
+	g_list_free_full(results, g_object_unref);
+
+	/* The search index has to follow the update. */
+	results = purple_history_adapter_query(adapter, "first", &error);
+	g_assert_no_error(error);
+	g_assert_null(results);
+
+	results = purple_history_adapter_query(adapter, "edited", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 1);
+	g_list_free_full(results, g_object_unref);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_quoting(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleAccount *account = NULL;
+	PurpleConversation *conversation = NULL;
+	PurpleConversation *other = NULL;
+	PurpleConversation *quoted = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	conversation = test_purple_sqlite_history_adapter_conversation_new("#pidgin room");
+	quoted = test_purple_sqlite_history_adapter_conversation_new("say:\"hi\" \\o/");
+
+	/* A conversation with the same name on a different account. */
+	account = purple_account_new("other", "test");
+	other = g_object_new(PURPLE_TYPE_IM_CONVERSATION,
+	                     "account", account,
+	                     "name", "#pidgin room",
+	                     NULL);
+
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "jane",
+	                                           2);
+	test_purple_sqlite_history_adapter_write_n(adapter, other, "jane", 3);
+	test_purple_sqlite_history_adapter_write_n(adapter, quoted, "jane", 1);
+
+	results = purple_history_adapter_query(adapter, "in:\"#pidgin room\"",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 5);
+	g_list_free_full(results, g_object_unref);
+
+	results = purple_history_adapter_query(adapter,
+	                                       "account:other in:\"#pidgin room\"",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 3);
+	g_list_free_full(results, g_object_unref);
+
+	results = purple_history_adapter_query(adapter,
+	                                       "account:\"test\" "
+	                                       "in:\"#pidgin room\" last:10",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 2);
+	g_list_free_full(results, g_object_unref);
+
+	results = purple_history_adapter_query(adapter,
+	                                       "in:\"say:\\\"hi\\\" \\\\o/\"",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 1);
+	g_list_free_full(results, g_object_unref);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+	g_clear_object(&other);
+	g_clear_object(&quoted);
+	g_clear_object(&account);
+}
+
+static void
+test_purple_sqlite_history_adapter_write_at(PurpleHistoryAdapter *adapter,
+                                            PurpleConversation *conversation,
+                                            const gchar *id,
+                                            const gchar *iso8601)
+{
+	PurpleMessage *message = NULL;
+	GDateTime *timestamp = NULL;
+	GError *error = NULL;
+	gboolean result = FALSE;
+
+	timestamp = g_date_time_new_from_iso8601(iso8601, NULL);
+	message = g_object_new(PURPLE_TYPE_MESSAGE,
+	                       "id", id,
+	                       "author", "kate",
+	                       "contents", id,
+	                       "timestamp", timestamp,
+	                       NULL);
+	g_date_time_unref(timestamp);
+
+	result = purple_history_adapter_write(adapter, conversation, message,
+	                                      &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	g_clear_object(&message);
+}
+
+static void
+test_purple_sqlite_history_adapter_before_id(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	test_purple_sqlite_history_adapter_write_at(adapter, conversation, "z",
+	                                            "2022-01-01T11:00:00Z");
+	test_purple_sqlite_history_adapter_write_at(adapter, conversation, "a",
+	                                            "2022-01-01T12:00:00Z");
+	test_purple_sqlite_history_adapter_write_at(adapter, conversation, "b",
+	                                            "2022-01-01T12:00:00Z");
+	test_purple_sqlite_history_adapter_write_at(adapter, conversation, "c",
+	                                            "2022-01-01T12:00:00Z");
+
+	/* A strict cutoff drops everything that shares the timestamp. */
+	results = purple_history_adapter_query(adapter,
+	                                       "in:pidgy before:2022-01-01T12:00:00Z",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 1);
+	g_list_free_full(results, g_object_unref);
+
+	/* The id keeps the messages that were stored before it. */
+	results = purple_history_adapter_query(adapter,
+	                                       "in:pidgy before:2022-01-01T12:00:00Z "
+	                                       "before-id:c last:10",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 3);
+	g_assert_cmpstr(purple_message_get_id(results->data), ==, "z");
+	g_assert_cmpstr(purple_message_get_id(results->next->data), ==, "a");
+	g_assert_cmpstr(purple_message_get_id(results->next->next->data), ==, "b");
+	g_list_free_full(results, g_object_unref);
+
+	results = purple_history_adapter_query(adapter,
+	                                       "in:pidgy before:2022-01-01T12:00:00Z "
+	                                       "before-id:b last:1",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 1);
+	g_assert_cmpstr(purple_message_get_id(results->data), ==, "a");
+	g_list_free_full(results, g_object_unref);
+
+	/* An unknown id falls back to the strict cutoff. */
+	results = purple_history_adapter_query(adapter,
+	                                       "in:pidgy before:2022-01-01T12:00:00Z "
+	                                       "before-id:unknown",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 1);
+	g_list_free_full(results, g_object_unref);
+
+	results = purple_history_adapter_query(adapter, "in:pidgy before-id:c",
+	                                       &error);
+	g_assert_error(error, PURPLE_HISTORY_ADAPTER_DOMAIN, 0);
+	g_assert_null(results);
+	g_clear_error(&error);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_query_page_order(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GString *order = NULL;
+	gchar *cursor = NULL;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	conversation = test_purple_sqlite_history_adapter_conversation_new("paged");
+
+	/* Pages follow the timestamps, not the order the messages were stored
+	 * in, and messages with the same timestamp are not skipped.
+	 */
+	test_purple_sqlite_history_adapter_write_at(adapter, conversation, "c",
+	                                            "2020-01-03T00:00:00Z");
+	test_purple_sqlite_history_adapter_write_at(adapter, conversation, "a",
+	                                            "2020-01-01T00:00:00Z");
+	test_purple_sqlite_history_adapter_write_at(adapter, conversation, "b",
+	                                            "2020-01-02T00:00:00Z");
+	test_purple_sqlite_history_adapter_write_at(adapter, conversation, "b2",
+	                                            "2020-01-02T00:00:00Z");
+
+	order = g_string_new(NULL);
+	do {
+		GError *error = NULL;
+		GList *results = NULL;
+		gchar *next_cursor = NULL;
+
+		results = purple_history_adapter_query_page(adapter, "in:paged",
+		                                            cursor, 1, &next_cursor,
+		                                            &error);
+		g_assert_no_error(error);
+
+		for(GList *l = results; l != NULL; l = l->next) {
+			g_string_append_printf(order, "%s ",
+			                       purple_message_get_contents(l->data));
+		}
+
+		g_list_free_full(results, g_object_unref);
+		g_free(cursor);
+		cursor = next_cursor;
+	} while(cursor != NULL);
+
+	g_assert_cmpstr(order->str, ==, "a b b2 c ");
+	g_string_free(order, TRUE);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_query_page_plan(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	const gchar *queries[] = {
+		"",
+		"in:pidgy",
+		"in:pidgy account:test",
+		"in:pidgy after:2020-01-01",
+		"in:pidgy before:2020-01-01",
+		"from:erin",
+	};
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+
+	/* Every page is read straight from an index instead of sorting all of the
+	 * matching messages first.
+	 */
+	for(gsize i = 0; i < G_N_ELEMENTS(queries); i++) {
+		GError *error = NULL;
+		gchar *plan = NULL;
+
+		plan = purple_sqlite_history_adapter_explain_page(PURPLE_SQLITE_HISTORY_ADAPTER(adapter),
+		                                                  queries[i], &error);
+		g_assert_no_error(error);
+		g_assert_nonnull(plan);
+
+		g_test_message("%s:\n%s", queries[i], plan);
+
+		g_assert_nonnull(g_strstr_len(plan, -1, "USING INDEX"));
+		g_assert_null(g_strstr_len(plan, -1, "USE TEMP B-TREE"));
+
+		g_free(plan);
+	}
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+}
+
+static void
+test_purple_sqlite_history_adapter_compacted_cb(G_GNUC_UNUSED PurpleSqliteHistoryAdapter *adapter,
+                                                guint64 removed,
+                                                G_GNUC_UNUSED guint64 reclaimed,
+                                                gpointer data)
+{
+	guint64 *total = data;
+
+	*total += removed;
+}
+
+static void
+test_purple_sqlite_history_adapter_compact(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	PurpleConversation *other = NULL;
+	GDateTime *now = NULL;
+	GDateTime *old = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+	guint64 removed = 0;
+	gboolean finished = FALSE;
+	gboolean result = FALSE;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+	other = test_purple_sqlite_history_adapter_conversation_new("other");
+
+	g_signal_connect(adapter, "compacted",
+	                 G_CALLBACK(test_purple_sqlite_history_adapter_compacted_cb),
+	                 &removed);
+
+	/* Three messages from ten days ago. */
+	now = g_date_time_new_now_local();
+	old = g_date_time_add_days(now, -10);
+	g_date_time_unref(now);
+	for(gint i = 0; i < 3; i++) {
+		PurpleMessage *message = NULL;
+
+		message = g_object_new(PURPLE_TYPE_MESSAGE,
+		                       "author", "lisa",
+		                       "contents", "old",
+		                       "timestamp", old,
+		                       NULL);
+		result = purple_history_adapter_write(adapter, conversation, message,
+		                                      &error);
+		g_assert_no_error(error);
+		g_assert_true(result);
+		g_clear_object(&message);
+	}
+	g_date_time_unref(old);
+
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "lisa",
+	                                           10);
+	test_purple_sqlite_history_adapter_write_n(adapter, other, "lisa", 2);
+	result = purple_sqlite_history_adapter_flush(sqlite_adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	/* Without a policy nothing is removed. */
+	result = purple_sqlite_history_adapter_compact(sqlite_adapter, 0,
+	                                               &finished, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+	g_assert_true(finished);
+	g_assert_cmpuint(removed, ==, 0);
+
+	purple_sqlite_history_adapter_set_max_age(sqlite_adapter, 5);
+	result = purple_sqlite_history_adapter_compact(sqlite_adapter, 0,
+	                                               &finished, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+	g_assert_cmpuint(removed, ==, 3);
+
+	results = purple_history_adapter_query(adapter, "old", &error);
+	g_assert_no_error(error);
+	g_assert_null(results);
+
+	/* Only the conversation over the limit loses its oldest messages. */
+	purple_sqlite_history_adapter_set_max_messages(sqlite_adapter, 4);
+	result = purple_sqlite_history_adapter_compact(sqlite_adapter, 0,
+	                                               &finished, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+	g_assert_cmpuint(removed, ==, 9);
+
+	results = purple_history_adapter_query(adapter, "in:pidgy", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 4);
+	g_assert_cmpstr(purple_message_get_contents(results->data), ==,
+	                "message 6");
+	g_list_free_full(results, g_object_unref);
+
+	results = purple_history_adapter_query(adapter, "in:other", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 2);
+	g_list_free_full(results, g_object_unref);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+	g_clear_object(&other);
+}
+
+static void
+test_purple_sqlite_history_adapter_compact_size(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+	gchar *padding = NULL;
+	guint64 removed = 0;
+	guint remaining = 0;
+	gboolean finished = FALSE;
+	gboolean result = FALSE;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	conversation = test_purple_sqlite_history_adapter_conversation_new("sized");
+
+	g_signal_connect(adapter, "compacted",
+	                 G_CALLBACK(test_purple_sqlite_history_adapter_compacted_cb),
+	                 &removed);
+
+	/* About 400KiB of messages, not counting the indexes. */
+	padding = g_strnfill(2000, 'x');
+	for(gint i = 0; i < 200; i++) {
+		PurpleMessage *message = NULL;
+		gchar *contents = g_strdup_printf("message %d %s", i, padding);
+
+		message = purple_message_new_outgoing("mary", NULL, contents, 0);
+		result = purple_history_adapter_write(adapter, conversation, message,
+		                                      &error);
+		g_assert_no_error(error);
+		g_assert_true(result);
+
+		g_clear_object(&message);
+		g_free(contents);
+	}
+	g_free(padding);
+
+	result = purple_sqlite_history_adapter_flush(sqlite_adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	purple_sqlite_history_adapter_set_max_size(sqlite_adapter, 256 * 1024);
+	result = purple_sqlite_history_adapter_compact(sqlite_adapter, 0,
+	                                               &finished, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+	g_assert_true(finished);
+	g_assert_cmpuint(removed, >, 0);
+
+	/* The oldest messages go first. */
+	results = purple_history_adapter_query(adapter, "in:sized", &error);
+	g_assert_no_error(error);
+	remaining = g_list_length(results);
+	g_assert_cmpuint(remaining, >, 0);
+	g_assert_cmpuint(remaining + removed, ==, 200);
+	g_assert_true(g_str_has_prefix(purple_message_get_contents(g_list_last(results)->data),
+	                               "message 199 "));
+	g_list_free_full(results, g_object_unref);
+
+	/* Once the database fits nothing else is removed. */
+	removed = 0;
+	result = purple_sqlite_history_adapter_compact(sqlite_adapter, 0,
+	                                               &finished, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+	g_assert_cmpuint(removed, ==, 0);
+
+	results = purple_history_adapter_query(adapter, "in:sized", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, remaining);
+	g_list_free_full(results, g_object_unref);
+
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+static void
+test_purple_sqlite_history_adapter_convert_cb(GObject *obj,
+                                              GAsyncResult *result,
+                                              gpointer data)
+{
+	GError **error = data;
+	gboolean ret = FALSE;
+
+	ret = purple_sqlite_history_adapter_convert_content_finish(PURPLE_SQLITE_HISTORY_ADAPTER(obj),
+	                                                           result, error);
+	g_assert_true(ret == (*error == NULL));
+
+	g_main_loop_quit(g_object_get_data(obj, "loop"));
+}
+
+static void
+test_purple_sqlite_history_adapter_convert(PurpleSqliteHistoryAdapter *adapter)
+{
+	GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+	GError *error = NULL;
+
+	g_object_set_data(G_OBJECT(adapter), "loop", loop);
+	purple_sqlite_history_adapter_convert_content_async(adapter, NULL,
+	                                                    test_purple_sqlite_history_adapter_convert_cb,
+	                                                    &error);
+	g_main_loop_run(loop);
+	g_object_set_data(G_OBJECT(adapter), "loop", NULL);
+
+	g_assert_no_error(error);
+
+	g_main_loop_unref(loop);
+}
+
+/* Inserts a message the way another tool would and returns whether that
+ * worked.
+ */
+static gboolean
+test_purple_sqlite_history_adapter_insert_raw(sqlite3 *db, const gchar *id) {
+	gchar *errmsg = NULL;
+	gchar *sql = NULL;
+
+	sql = sqlite3_mprintf("INSERT INTO message_log(protocol, account, "
+	                      "conversation_id, message_id, author, content) "
+	                      "VALUES('test', 'test', 'raw', %Q, 'kate', "
+	                      "'raw penguins');", id);
+	sqlite3_exec(db, sql, NULL, NULL, &errmsg);
+	sqlite3_free(sql);
+
+	if(errmsg != NULL) {
+		g_assert_nonnull(g_strstr_len(errmsg, -1, "purple_history_content"));
+		sqlite3_free(errmsg);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gchar *
+test_purple_sqlite_history_adapter_query_raw(sqlite3 *db, const gchar *sql) {
+	sqlite3_stmt *statement = NULL;
+	gchar *value = NULL;
+
+	g_assert_cmpint(sqlite3_prepare_v2(db, sql, -1, &statement, NULL), ==,
+	                SQLITE_OK);
+	g_assert_cmpint(sqlite3_step(statement), ==, SQLITE_ROW);
+	value = g_strdup((const gchar *)sqlite3_column_text(statement, 0));
+	sqlite3_finalize(statement);
+
+	return value;
+}
+
+static void
+test_purple_sqlite_history_adapter_convert_vacuum_cb(GObject *obj,
+                                                     GAsyncResult *result,
+                                                     gpointer data)
+{
+	GError **error = data;
+	gboolean ret = FALSE;
+
+	ret = purple_sqlite_history_adapter_convert_vacuum_finish(PURPLE_SQLITE_HISTORY_ADAPTER(obj),
+	                                                          result, error);
+	g_assert_true(ret == (*error == NULL));
+
+	g_main_loop_quit(g_object_get_data(obj, "loop"));
+}
+
+static void
+test_purple_sqlite_history_adapter_convert_vacuum(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GMainLoop *loop = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+	sqlite3 *db = NULL;
+	gchar *filename = NULL;
+	gchar *value = NULL;
+	gboolean finished = FALSE;
+	gboolean result = FALSE;
+
+	/* A table created before the adapter sets auto_vacuum makes this look
+	 * like an older database.
+	 */
+	filename = test_purple_sqlite_history_adapter_filename_new();
+	g_assert_cmpint(sqlite3_open(filename, &db), ==, SQLITE_OK);
+	sqlite3_busy_timeout(db, 5000);
+	g_assert_cmpint(sqlite3_exec(db, "CREATE TABLE old(id INTEGER);", NULL,
+	                             NULL, NULL), ==, SQLITE_OK);
+
+	adapter = purple_sqlite_history_adapter_new(filename);
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	result = purple_history_adapter_activate(adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	conversation = test_purple_sqlite_history_adapter_conversation_new("old");
+	for(gint i = 0; i < 10; i++) {
+		PurpleMessage *message = NULL;
+		gchar *contents = g_strdup_printf("message %d", i);
+
+		message = purple_message_new_outgoing("mary", NULL, contents, 0);
+		result = purple_history_adapter_write(adapter, conversation, message,
+		                                      &error);
+		g_assert_no_error(error);
+		g_assert_true(result);
+
+		g_clear_object(&message);
+		g_free(contents);
+	}
+
+	result = purple_sqlite_history_adapter_flush(sqlite_adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	/* Activating doesn't convert the database by itself, and compacting it
+	 * still finishes.
+	 */
+	value = test_purple_sqlite_history_adapter_query_raw(db,
+	                                                     "PRAGMA auto_vacuum;");
+	g_assert_cmpstr(value, ==, "0");
+	g_free(value);
+
+	result = purple_sqlite_history_adapter_compact(sqlite_adapter, 0,
+	                                               &finished, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+	g_assert_true(finished);
+
+	loop = g_main_loop_new(NULL, FALSE);
+	g_object_set_data(G_OBJECT(adapter), "loop", loop);
+	purple_sqlite_history_adapter_convert_vacuum_async(sqlite_adapter, NULL,
+	                                                   test_purple_sqlite_history_adapter_convert_vacuum_cb,
+	                                                   &error);
+	g_main_loop_run(loop);
+	g_assert_no_error(error);
+
+	value = test_purple_sqlite_history_adapter_query_raw(db,
+	                                                     "PRAGMA auto_vacuum;");
+	g_assert_cmpstr(value, ==, "2");
+	g_free(value);
+
+	/* Converting it again does nothing. */
+	purple_sqlite_history_adapter_convert_vacuum_async(sqlite_adapter, NULL,
+	                                                   test_purple_sqlite_history_adapter_convert_vacuum_cb,
+	                                                   &error);
+	g_main_loop_run(loop);
+	g_assert_no_error(error);
+	g_object_set_data(G_OBJECT(adapter), "loop", NULL);
+
+	results = purple_history_adapter_query(adapter, "in:old message", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 10);
+	g_list_free_full(results, g_object_unref);
+
+	g_main_loop_unref(loop);
+	sqlite3_close(db);
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+	test_purple_sqlite_history_adapter_filename_free(filename);
+}
+
+static void
+test_purple_sqlite_history_adapter_compression(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleSqliteHistoryAdapter *sqlite_adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+	GString *str = NULL;
+	sqlite3 *db = NULL;
+	gchar *filename = NULL;
+	gchar *value = NULL;
+	const gchar *similar = NULL;
+	gboolean result = FALSE;
+
+	filename = test_purple_sqlite_history_adapter_filename_new();
+	adapter = purple_sqlite_history_adapter_new(filename);
+	sqlite_adapter = PURPLE_SQLITE_HISTORY_ADAPTER(adapter);
+	result = purple_history_adapter_activate(adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	g_assert_cmpint(purple_sqlite_history_adapter_get_compression(sqlite_adapter),
+	                ==, PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE);
+
+	g_assert_cmpint(sqlite3_open(filename, &db), ==, SQLITE_OK);
+	sqlite3_busy_timeout(db, 5000);
+
+	str = g_string_new("penguins ");
+	for(gint i = 0; i < 32; i++) {
+		g_string_append(str, "all work and no play makes kate a dull girl ");
+	}
+
+	test_purple_sqlite_history_adapter_write_id(adapter, conversation, "1",
+	                                            str->str);
+	test_purple_sqlite_history_adapter_write_id(adapter, conversation, "2",
+	                                            "short penguins");
+	result = purple_sqlite_history_adapter_flush(sqlite_adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	/* Without compression, other tools can write to the database and the
+	 * search index picks that up.
+	 */
+	g_assert_true(test_purple_sqlite_history_adapter_insert_raw(db, "raw-1"));
+	value = test_purple_sqlite_history_adapter_query_raw(db,
+	                                                     "SELECT COUNT(*) "
+	                                                     "FROM message_log_fts "
+	                                                     "WHERE message_log_fts "
+	                                                     "MATCH 'raw';");
+	g_assert_cmpstr(value, ==, "1");
+	g_free(value);
+
+	/* Compress everything that is there. */
+	purple_sqlite_history_adapter_set_compression(sqlite_adapter,
+	                                              PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_DEFLATE);
+	test_purple_sqlite_history_adapter_convert(sqlite_adapter);
+
+	g_assert_false(test_purple_sqlite_history_adapter_insert_raw(db, "raw-2"));
+	value = test_purple_sqlite_history_adapter_query_raw(db,
+	                                                     "SELECT typeof(content) "
+	                                                     "FROM message_log "
+	                                                     "WHERE message_id = '1';");
+	g_assert_cmpstr(value, ==, "blob");
+	g_free(value);
+	value = test_purple_sqlite_history_adapter_query_raw(db,
+	                                                     "SELECT COUNT(*) "
+	                                                     "FROM message_log_dictionary;");
+	g_assert_cmpstr(value, ==, "1");
+	g_free(value);
+
+	/* The new search index has been filled by the time that finishes. */
+	value = test_purple_sqlite_history_adapter_query_raw(db,
+	                                                     "SELECT COUNT(*) "
+	                                                     "FROM message_log_fts_pending;");
+	g_assert_cmpstr(value, ==, "0");
+	g_free(value);
+
+	/* A single line is compressed against the dictionary, which is what makes
+	 * it worth compressing at all.
+	 */
+	similar = "all work and no play makes kate a dull girl, said the penguins again";
+	test_purple_sqlite_history_adapter_write_id(adapter, conversation, "3",
+	                                            similar);
+	result = purple_sqlite_history_adapter_flush(sqlite_adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	value = test_purple_sqlite_history_adapter_query_raw(db,
+	                                                     "SELECT typeof(content) || hex(substr(content, 1, 1)) "
+	                                                     "FROM message_log "
+	                                                     "WHERE message_id = '3';");
+	g_assert_cmpstr(value, ==, "blob01");
+	g_free(value);
+
+	results = purple_history_adapter_query(adapter, "in:pidgy", &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 3);
+	g_assert_cmpstr(purple_message_get_contents(results->data), ==, str->str);
+	g_assert_cmpstr(purple_message_get_contents(results->next->data), ==,
+	                "short penguins");
+	g_assert_cmpstr(purple_message_get_contents(results->next->next->data), ==,
+	                similar);
+	g_list_free_full(results, g_object_unref);
+
+	/* The search index sees the uncompressed content. */
+	results = purple_history_adapter_query(adapter, "in:pidgy dull penguins",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 2);
+	g_list_free_full(results, g_object_unref);
+
+	/* Going back to text makes the database usable by other tools again. */
+	purple_sqlite_history_adapter_set_compression(sqlite_adapter,
+	                                              PURPLE_SQLITE_HISTORY_ADAPTER_COMPRESSION_NONE);
+	test_purple_sqlite_history_adapter_convert(sqlite_adapter);
+
+	value = test_purple_sqlite_history_adapter_query_raw(db,
+	                                                     "SELECT COUNT(*) "
+	                                                     "FROM message_log "
+	                                                     "WHERE typeof(content) = 'blob';");
+	g_assert_cmpstr(value, ==, "0");
+	g_free(value);
+	g_assert_true(test_purple_sqlite_history_adapter_insert_raw(db, "raw-3"));
+
+	results = purple_history_adapter_query(adapter, "in:pidgy dull penguins",
+	                                       &error);
+	g_assert_no_error(error);
+	g_assert_cmpuint(g_list_length(results), ==, 2);
+	g_assert_cmpstr(purple_message_get_contents(results->data), ==, str->str);
+	g_list_free_full(results, g_object_unref);
+
+	sqlite3_close(db);
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	test_purple_sqlite_history_adapter_filename_free(filename);
+	g_clear_object(&conversation);
+	g_string_free(str, TRUE);
+}
+
+static void
+test_purple_sqlite_history_adapter_query_async_cb(GObject *obj,
+                                                  GAsyncResult *result,
+                                                  gpointer data)
+{
+	GError *error = NULL;
+	GList **results = data;
+
+	*results = purple_history_adapter_query_finish(PURPLE_HISTORY_ADAPTER(obj),
+	                                               result, &error);
+	g_assert_no_error(error);
+
+	g_main_loop_quit(g_object_get_data(obj, "loop"));
+}
+
+static void
+test_purple_sqlite_history_adapter_query_async(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GMainLoop *loop = NULL;
+	GError *error = NULL;
+	GList *results = NULL;
+	gchar *filename = NULL;
+	gboolean result = FALSE;
+
+	/* Use a file so that the query runs on the read only connection. */
+	filename = test_purple_sqlite_history_adapter_filename_new();
+
+	adapter = purple_sqlite_history_adapter_new(filename);
+	result = purple_history_adapter_activate(adapter, &error);
+	g_assert_no_error(error);
+	g_assert_true(result);
+
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "hank",
+	                                           20);
+
+	loop = g_main_loop_new(NULL, FALSE);
+	g_object_set_data(G_OBJECT(adapter), "loop", loop);
+
+	purple_history_adapter_query_async(adapter, "from:hank", NULL,
+	                                   test_purple_sqlite_history_adapter_query_async_cb,
+	                                   &results);
+	g_main_loop_run(loop);
+
+	g_assert_cmpuint(g_list_length(results), ==, 20);
+	g_assert_cmpstr(purple_message_get_contents(results->data), ==,
+	                "message 0");
+	g_list_free_full(results, g_object_unref);
+
+	g_main_loop_unref(loop);
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+
+	test_purple_sqlite_history_adapter_filename_free(filename);
+}
+
+static void
+test_purple_sqlite_history_adapter_query_cancelled_cb(GObject *obj,
+                                                      GAsyncResult *result,
+                                                      gpointer data)
+{
+	GError *error = NULL;
+	GList *results = NULL;
+
+	results = purple_history_adapter_query_finish(PURPLE_HISTORY_ADAPTER(obj),
+	                                              result, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+	g_assert_null(results);
+	g_clear_error(&error);
+
+	g_main_loop_quit(data);
+}
+
+static void
+test_purple_sqlite_history_adapter_query_cancelled(void) {
+	PurpleHistoryAdapter *adapter = NULL;
+	PurpleConversation *conversation = NULL;
+	GCancellable *cancellable = NULL;
+	GMainLoop *loop = NULL;
+
+	adapter = test_purple_sqlite_history_adapter_new_active();
+	conversation = test_purple_sqlite_history_adapter_conversation_new("pidgy");
+
+	test_purple_sqlite_history_adapter_write_n(adapter, conversation, "ivan",
+	                                           5);
+
+	loop = g_main_loop_new(NULL, FALSE);
+	cancellable = g_cancellable_new();
+	g_cancellable_cancel(cancellable);
+
+	purple_history_adapter_query_async(adapter, "from:ivan", cancellable,
+	                                   test_purple_sqlite_history_adapter_query_cancelled_cb,
+	                                   loop);
+	g_main_loop_run(loop);
+
+	g_clear_object(&cancellable);
+	g_main_loop_unref(loop);
+	test_purple_sqlite_history_adapter_destroy(adapter);
+	g_clear_object(&conversation);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar *argv[]) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_test_add_func("/sqlite-history-adapter/properties",
+	                test_purple_sqlite_history_adapter_properties);
+	g_test_add_func("/sqlite-history-adapter/write-query",
+	                test_purple_sqlite_history_adapter_write_query);
+	g_test_add_func("/sqlite-history-adapter/flush",
+	                test_purple_sqlite_history_adapter_flush);
+	g_test_add_func("/sqlite-history-adapter/write-error",
+	                test_purple_sqlite_history_adapter_write_error);
+	g_test_add_func("/sqlite-history-adapter/time-range",
+	                test_purple_sqlite_history_adapter_time_range);
+	g_test_add_func("/sqlite-history-adapter/keywords",
+	                test_purple_sqlite_history_adapter_keywords);
+	g_test_add_func("/sqlite-history-adapter/query-page",
+	                test_purple_sqlite_history_adapter_query_page);
+	g_test_add_func("/sqlite-history-adapter/query-model",
+	                test_purple_sqlite_history_adapter_query_model);
+	g_test_add_func("/sqlite-history-adapter/statement-cache",
+	                test_purple_sqlite_history_adapter_statement_cache);
+	g_test_add_func("/sqlite-history-adapter/last",
+	                test_purple_sqlite_history_adapter_last);
+	g_test_add_func("/sqlite-history-adapter/quoting",
+	                test_purple_sqlite_history_adapter_quoting);
+	g_test_add_func("/sqlite-history-adapter/before-id",
+	                test_purple_sqlite_history_adapter_before_id);
+	g_test_add_func("/sqlite-history-adapter/query-page-order",
+	                test_purple_sqlite_history_adapter_query_page_order);
+	g_test_add_func("/sqlite-history-adapter/query-page-plan",
+	                test_purple_sqlite_history_adapter_query_page_plan);
+	g_test_add_func("/sqlite-history-adapter/duplicates",
+	                test_purple_sqlite_history_adapter_duplicates);
+	g_test_add_func("/sqlite-history-adapter/compact",
+	                test_purple_sqlite_history_adapter_compact);
+	g_test_add_func("/sqlite-history-adapter/compact-size",
+	                test_purple_sqlite_history_adapter_compact_size);
+	g_test_add_func("/sqlite-history-adapter/convert-vacuum",
+	                test_purple_sqlite_history_adapter_convert_vacuum);
+	g_test_add_func("/sqlite-history-adapter/compression",
+	                test_purple_sqlite_history_adapter_compression);
+	g_test_add_func("/sqlite-history-adapter/query-async",
+	                test_purple_sqlite_history_adapter_query_async);
+	g_test_add_func("/sqlite-history-adapter/query-cancelled",
+	                test_purple_sqlite_history_adapter_query_cancelled);
+
+	return g_test_run();
+}
@@ -21,6 +21,12 @@
  *
  */
 #include <glib.h>
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+#include <signal.h>
+#include <sys/resource.h>
+#endif
 
 #include <purple.h>
 
@@ -197,6 +203,233 @@ test_util_strdup_withhtml(void) {
 	g_free(result);
 }
 
+/******************************************************************************
+ * normalize tests
+ *****************************************************************************/
+static void
+test_util_normalize(void) {
+	GRefString *normalized = NULL;
+
+	/* Both results must stay valid in the same expression. */
+	g_assert_cmpstr(purple_normalize(NULL, "e\xcc\x81"), ==,
+	                purple_normalize(NULL, "\xc3\xa9"));
+	g_assert_cmpstr(purple_normalize(NULL, "foo"), !=,
+	                purple_normalize(NULL, "bar"));
+
+	normalized = purple_normalize_ref(NULL, "e\xcc\x81");
+	g_assert_cmpstr(normalized, ==, "\xc3\xa9");
+
+	/* Push enough other strings through to evict the cached entry. */
+	for(gint i = 0; i < 2048; i++) {
+		gchar *str = g_strdup_printf("user%d", i);
+
+		g_assert_cmpstr(purple_normalize(NULL, str), ==, str);
+		g_free(str);
+	}
+
+	g_assert_cmpstr(normalized, ==, "\xc3\xa9");
+	g_ref_string_release(normalized);
+}
+
+static gpointer
+test_util_normalize_threaded_worker(gpointer data) {
+	gint offset = GPOINTER_TO_INT(data);
+
+	for(gint i = 0; i < 1000; i++) {
+		gchar *str = g_strdup_printf("user%d", (i + offset) % 700);
+		const gchar *normalized = purple_normalize(NULL, str);
+
+		if(!purple_strequal(normalized, str)) {
+			g_free(str);
+
+			return GINT_TO_POINTER(FALSE);
+		}
+
+		g_free(str);
+	}
+
+	return GINT_TO_POINTER(TRUE);
+}
+
+static void
+test_util_normalize_threaded(void) {
+	GThread *threads[4];
+
+	for(guint i = 0; i < G_N_ELEMENTS(threads); i++) {
+		threads[i] = g_thread_new("normalize",
+		                          test_util_normalize_threaded_worker,
+		                          GUINT_TO_POINTER(i * 100));
+	}
+
+	for(guint i = 0; i < G_N_ELEMENTS(threads); i++) {
+		g_assert_true(GPOINTER_TO_INT(g_thread_join(threads[i])));
+	}
+}
+
+/******************************************************************************
+ * write_xml_to_config_file tests
+ *****************************************************************************/
+static gchar *
+test_util_write_xml_setup(void) {
+	gchar *dir = NULL;
+	GError *error = NULL;
+
+	dir = g_dir_make_tmp("test_util-XXXXXX", &error);
+	g_assert_no_error(error);
+
+	purple_util_set_user_dir(dir);
+
+	return dir;
+}
+
+static void
+test_util_write_xml_teardown(gchar *dir) {
+	GDir *config = NULL;
+	const gchar *name = NULL;
+
+	config = g_dir_open(purple_config_dir(), 0, NULL);
+	if(config != NULL) {
+		while((name = g_dir_read_name(config)) != NULL) {
+			gchar *path = g_build_filename(purple_config_dir(), name, NULL);
+
+			g_unlink(path);
+			g_free(path);
+		}
+
+		g_dir_close(config);
+		g_rmdir(purple_config_dir());
+	}
+
+	purple_util_set_user_dir(NULL);
+
+	g_rmdir(dir);
+	g_free(dir);
+}
+
+static gchar *
+test_util_write_xml_read(void) {
+	gchar *path = g_build_filename(purple_config_dir(), "test.xml", NULL);
+	gchar *contents = NULL;
+	GError *error = NULL;
+
+	g_file_get_contents(path, &contents, NULL, &error);
+	g_assert_no_error(error);
+
+	g_free(path);
+
+	return contents;
+}
+
+static void
+test_util_write_xml_to_config_file(void) {
+	PurpleXmlNode *node = NULL, *child = NULL;
+	gchar *dir = NULL, *contents = NULL, *expected = NULL;
+
+	dir = test_util_write_xml_setup();
+
+	node = purple_xmlnode_new("test");
+	purple_xmlnode_set_attrib(node, "value", "a & 'b'");
+	child = purple_xmlnode_new_child(node, "child");
+	purple_xmlnode_insert_data(child, "<data>", -1);
+
+	/* The config directory doesn't exist yet and is created. */
+	g_assert_true(purple_util_write_xml_to_config_file("test.xml", node));
+
+	contents = test_util_write_xml_read();
+	expected = purple_xmlnode_to_formatted_str(node, NULL);
+	g_assert_cmpstr(contents, ==, expected);
+	g_free(contents);
+	g_free(expected);
+
+	/* Writing it again replaces the old contents. */
+	purple_xmlnode_set_attrib(node, "value", "c");
+	g_assert_true(purple_util_write_xml_to_config_file("test.xml", node));
+
+	contents = test_util_write_xml_read();
+	expected = purple_xmlnode_to_formatted_str(node, NULL);
+	g_assert_cmpstr(contents, ==, expected);
+	g_free(contents);
+	g_free(expected);
+
+	purple_xmlnode_free(node);
+
+	test_util_write_xml_teardown(dir);
+}
+
+#ifdef G_OS_UNIX
+static void
+test_util_write_xml_to_config_file_failed(void) {
+	PurpleXmlNode *node = NULL, *big = NULL;
+	struct rlimit old_limit, limit;
+	void (*handler)(int) = NULL;
+	gchar *dir = NULL, *contents = NULL, *expected = NULL;
+	GDir *config = NULL;
+	const gchar *name = NULL;
+	gboolean written = FALSE;
+
+	dir = test_util_write_xml_setup();
+
+	node = purple_xmlnode_new("test");
+	purple_xmlnode_set_attrib(node, "value", "old");
+	g_assert_true(purple_util_write_xml_to_config_file("test.xml", node));
+	expected = purple_xmlnode_to_formatted_str(node, NULL);
+	purple_xmlnode_free(node);
+
+	/* A document that is many times larger than the file size limit below,
+	 * so the write fails after some of it was written.
+	 */
+	big = purple_xmlnode_new("test");
+	for(gint i = 0; i < 1000; i++) {
+		PurpleXmlNode *child = purple_xmlnode_new_child(big, "child");
+
+		purple_xmlnode_set_attrib(child, "value",
+		                          "0123456789012345678901234567890123456789");
+	}
+
+	g_assert_cmpint(getrlimit(RLIMIT_FSIZE, &old_limit), ==, 0);
+	limit = old_limit;
+	limit.rlim_cur = 4096;
+	if(old_limit.rlim_max != RLIM_INFINITY && old_limit.rlim_max < 4096) {
+		limit.rlim_cur = old_limit.rlim_max;
+	}
+
+	/* Going past the limit raises SIGXFSZ instead of only failing the write
+	 * unless the signal is ignored.
+	 */
+	handler = signal(SIGXFSZ, SIG_IGN);
+	g_assert_cmpint(setrlimit(RLIMIT_FSIZE, &limit), ==, 0);
+
+	g_test_expect_message("util", G_LOG_LEVEL_CRITICAL,
+	                      "Error writing file test.xml to directory *");
+	written = purple_util_write_xml_to_config_file("test.xml", big);
+
+	g_assert_cmpint(setrlimit(RLIMIT_FSIZE, &old_limit), ==, 0);
+	signal(SIGXFSZ, handler);
+
+	g_test_assert_expected_messages();
+
+	g_assert_false(written);
+	purple_xmlnode_free(big);
+
+	/* The old file is still there, untouched, and the partial temporary file
+	 * was removed.
+	 */
+	contents = test_util_write_xml_read();
+	g_assert_cmpstr(contents, ==, expected);
+	g_free(contents);
+	g_free(expected);
+
+	config = g_dir_open(purple_config_dir(), 0, NULL);
+	g_assert_nonnull(config);
+	while((name = g_dir_read_name(config)) != NULL) {
+		g_assert_cmpstr(name, ==, "test.xml");
+	}
+	g_dir_close(config);
+
+	test_util_write_xml_teardown(dir);
+}
+#endif
+
 /******************************************************************************
  * MANE
  *****************************************************************************/
@@ -221,5 +454,17 @@ main(gint argc, gchar **argv) {
 	g_test_add_func("/util/test_strdup_withhtml",
 	                test_util_strdup_withhtml);
 
+	g_test_add_func("/util/normalize/basic",
+	                test_util_normalize);
+	g_test_add_func("/util/normalize/threaded",
+	                test_util_normalize_threaded);
+
+	g_test_add_func("/util/write-xml-to-config-file/basic",
+	                test_util_write_xml_to_config_file);
+#ifdef G_OS_UNIX
+	g_test_add_func("/util/write-xml-to-config-file/failed",
+	                test_util_write_xml_to_config_file_failed);
+#endif
+
 	return g_test_run();
 }
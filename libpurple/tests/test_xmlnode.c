@@ -134,6 +134,165 @@ test_strip_prefixes(void) {
 	purple_xmlnode_free(xml);
 }
 
+static void
+test_xmlnode_arena(void) {
+	const char *xml_doc =
+		"<query xmlns='jabber:iq:roster' ver='1'>"
+			"<item jid='a@example.com' name='A'><group>Friends</group></item>"
+			"<item jid='b@example.com'><group>Work</group></item>"
+		"</query>";
+	PurpleXmlNode *heap = NULL, *arena = NULL, *item = NULL, *group = NULL;
+	gchar *heap_str = NULL, *arena_str = NULL, *data = NULL;
+
+	heap = purple_xmlnode_from_str(xml_doc, -1);
+	arena = purple_xmlnode_from_str_arena(xml_doc, -1);
+	g_assert_nonnull(heap);
+	g_assert_nonnull(arena);
+
+	heap_str = purple_xmlnode_to_str(heap, NULL);
+	arena_str = purple_xmlnode_to_str(arena, NULL);
+	g_assert_cmpstr(heap_str, ==, arena_str);
+	g_free(heap_str);
+	g_free(arena_str);
+
+	/* Element names are shared between the trees. */
+	g_assert_true(heap->name == arena->name);
+
+	item = purple_xmlnode_get_child(arena, "item");
+	g_assert_cmpstr(purple_xmlnode_get_attrib(item, "name"), ==, "A");
+
+	/* Heap nodes can be mixed into an arena tree. */
+	purple_xmlnode_set_attrib(item, "subscription", "both");
+	purple_xmlnode_insert_data(purple_xmlnode_new_child(item, "group"),
+	                           "Family", -1);
+	g_assert_cmpstr(purple_xmlnode_get_attrib(item, "subscription"), ==,
+	                "both");
+
+	/* Freeing part of the tree leaves the rest of it usable. */
+	purple_xmlnode_free(item);
+	item = purple_xmlnode_get_child(arena, "item");
+	g_assert_cmpstr(purple_xmlnode_get_attrib(item, "jid"), ==,
+	                "b@example.com");
+
+	group = purple_xmlnode_get_child(item, "group");
+	data = purple_xmlnode_get_data(group);
+	g_assert_cmpstr(data, ==, "Work");
+	g_free(data);
+
+	purple_xmlnode_free(arena);
+	purple_xmlnode_free(heap);
+
+	/* Errors free everything that was parsed so far. */
+	g_assert_null(purple_xmlnode_from_str_arena("<a><b>", -1));
+}
+
+/* Run with -m perf to compare parsing and freeing a roster sized document
+ * with and without an arena.
+ */
+static void
+test_xmlnode_arena_perf(void) {
+	GString *doc = NULL;
+	const guint n_items = 2000, n_rounds = 50;
+	gdouble elapsed = 0.0;
+
+	if(!g_test_perf()) {
+		g_test_skip("only run in perf mode");
+
+		return;
+	}
+
+	doc = g_string_new("<query xmlns='jabber:iq:roster'>");
+	for(guint i = 0; i < n_items; i++) {
+		g_string_append_printf(doc,
+		                       "<item jid='user%u@example.com' name='User %u' "
+		                       "subscription='both'><group>Group %u</group>"
+		                       "</item>",
+		                       i, i, i % 10);
+	}
+	g_string_append(doc, "</query>");
+
+	g_test_timer_start();
+	for(guint i = 0; i < n_rounds; i++) {
+		PurpleXmlNode *node = purple_xmlnode_from_str(doc->str, doc->len);
+
+		g_assert_nonnull(node);
+		purple_xmlnode_free(node);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed, "parse and free %u items %u times: %fs",
+	                        n_items, n_rounds, elapsed);
+
+	g_test_timer_start();
+	for(guint i = 0; i < n_rounds; i++) {
+		PurpleXmlNode *node = purple_xmlnode_from_str_arena(doc->str,
+		                                                    doc->len);
+
+		g_assert_nonnull(node);
+		purple_xmlnode_free(node);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_minimized_result(elapsed,
+	                        "parse and free %u items %u times in an arena: "
+	                        "%fs",
+	                        n_items, n_rounds, elapsed);
+
+	g_string_free(doc, TRUE);
+}
+
+static void
+test_xmlnode_write(void) {
+	const char *xml_doc =
+		"<query xmlns='jabber:iq:roster'>"
+			"<item jid='a@example.com' name='A'><group>Friends</group></item>"
+			"<item jid='b@example.com'/>"
+		"</query>";
+	PurpleXmlNode *xml = NULL, *node = NULL;
+	GOutputStream *stream = NULL;
+	GString *str = NULL;
+	GError *error = NULL;
+	gchar *expected = NULL;
+	gboolean ret = FALSE;
+
+	xml = purple_xmlnode_from_str(xml_doc, -1);
+	g_assert_nonnull(xml);
+
+	/* Appending keeps whatever is already in the buffer. */
+	str = g_string_new("prefix");
+	purple_xmlnode_append_to_str(xml, str);
+	expected = g_strconcat("prefix", xml_doc, NULL);
+	g_assert_cmpstr(str->str, ==, expected);
+	g_free(expected);
+	g_string_free(str, TRUE);
+
+	/* Streaming matches the formatted string. */
+	stream = g_memory_output_stream_new_resizable();
+	ret = purple_xmlnode_write_to_stream(xml, stream, TRUE, NULL, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_output_stream_write_all(stream, "", 1, NULL, NULL, &error);
+	g_assert_no_error(error);
+	g_output_stream_close(stream, NULL, &error);
+	g_assert_no_error(error);
+
+	expected = purple_xmlnode_to_formatted_str(xml, NULL);
+	g_assert_cmpstr(g_memory_output_stream_get_data(G_MEMORY_OUTPUT_STREAM(stream)),
+	                ==, expected);
+	g_free(expected);
+	g_object_unref(stream);
+
+	purple_xmlnode_free(xml);
+
+	/* Text is escaped the same way as g_markup_escape_text. */
+	node = purple_xmlnode_new("a");
+	purple_xmlnode_set_attrib(node, "b", "x&y");
+	purple_xmlnode_insert_data(node, "1<2\x01", -1);
+	str = g_string_new(NULL);
+	purple_xmlnode_append_to_str(node, str);
+	g_assert_cmpstr(str->str, ==, "<a b='x&amp;y'>1&lt;2&#x1;</a>");
+	g_string_free(str, TRUE);
+	purple_xmlnode_free(node);
+}
+
 gint
 main(gint argc, gchar **argv) {
 	g_test_init(&argc, &argv, NULL);
@@ -144,6 +303,12 @@ main(gint argc, gchar **argv) {
 	                test_xmlnode_prefixes);
 	g_test_add_func("/xmlnode/strip_prefixes",
 	                test_strip_prefixes);
+	g_test_add_func("/xmlnode/arena",
+	                test_xmlnode_arena);
+	g_test_add_func("/xmlnode/arena/perf",
+	                test_xmlnode_arena_perf);
+	g_test_add_func("/xmlnode/write",
+	                test_xmlnode_write);
 
 	return g_test_run();
 }
@@ -38,6 +38,8 @@
 
 #include <json-glib/json-glib.h>
 
+static void purple_normalize_uninit(void);
+
 void
 purple_util_init(void) {
 }
@@ -45,6 +47,8 @@ purple_util_init(void) {
 void
 purple_util_uninit(void) {
 	purple_util_set_user_dir(NULL);
+
+	purple_normalize_uninit();
 }
 
 /**************************************************************************
@@ -106,6 +110,90 @@ purple_util_write_data_to_data_file(const char *filename, const char *data, gssi
 	return ret;
 }
 
+static gboolean
+purple_util_write_xml_to_file_common(const char *dir, const char *filename,
+                                     const PurpleXmlNode *node)
+{
+	GFile *file = NULL;
+	GFileOutputStream *stream = NULL;
+	GError *error = NULL;
+	gchar *filename_full = NULL;
+	gboolean ret = FALSE;
+
+	g_return_val_if_fail(dir != NULL, FALSE);
+	g_return_val_if_fail(node != NULL, FALSE);
+
+	purple_debug_misc("util", "Writing file %s to directory %s",
+			  filename, dir);
+
+	/* Ensure the directory exists */
+	if (!g_file_test(dir, G_FILE_TEST_IS_DIR))
+	{
+		if (g_mkdir(dir, S_IRUSR | S_IWUSR | S_IXUSR) == -1)
+		{
+			purple_debug_error("util", "Error creating directory %s: %s\n",
+					   dir, g_strerror(errno));
+			return FALSE;
+		}
+	}
+
+	filename_full = g_build_filename(dir, filename, NULL);
+	file = g_file_new_for_path(filename_full);
+	g_free(filename_full);
+
+	/* The replace stream writes to a temporary file and only renames it over
+	 * the original when it is closed successfully, so a failed write leaves
+	 * the old file in place.
+	 */
+	stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL,
+	                        &error);
+	if(stream != NULL) {
+		if(purple_xmlnode_write_to_stream(node, G_OUTPUT_STREAM(stream), TRUE,
+		                                  NULL, &error))
+		{
+			ret = g_output_stream_close(G_OUTPUT_STREAM(stream), NULL,
+			                            &error);
+		} else {
+			/* Closing with a cancelled cancellable discards the temporary
+			 * file.
+			 */
+			GCancellable *cancellable = g_cancellable_new();
+
+			g_cancellable_cancel(cancellable);
+			g_output_stream_close(G_OUTPUT_STREAM(stream), cancellable, NULL);
+			g_object_unref(cancellable);
+		}
+
+		g_object_unref(stream);
+	}
+
+	if(error != NULL) {
+		purple_debug_error("util", "Error writing file %s to directory %s: %s",
+		                   filename, dir, error->message);
+		g_error_free(error);
+	}
+
+	g_object_unref(file);
+
+	return ret;
+}
+
+gboolean
+purple_util_write_xml_to_cache_file(const char *filename,
+                                    const PurpleXmlNode *node)
+{
+	return purple_util_write_xml_to_file_common(purple_cache_dir(), filename,
+	                                            node);
+}
+
+gboolean
+purple_util_write_xml_to_config_file(const char *filename,
+                                     const PurpleXmlNode *node)
+{
+	return purple_util_write_xml_to_file_common(purple_config_dir(), filename,
+	                                            node);
+}
+
 PurpleXmlNode *
 purple_util_read_xml_from_cache_file(const char *filename, const char *description)
 {
@@ -176,38 +264,297 @@ purple_running_kde(void)
 /**************************************************************************
  * String Functions
  **************************************************************************/
+/* The number of normalized strings remembered per account. */
+#define PURPLE_NORMALIZE_CACHE_SIZE (512)
+
+/* The number of results from purple_normalize() that are kept alive for each
+ * thread.  This is what allows more than one call in the same expression.
+ */
+#define PURPLE_NORMALIZE_RESULTS (4)
+
+#define PURPLE_NORMALIZE_CACHE_KEY "purple-normalize-cache"
+
+typedef struct {
+	PurpleProtocol *protocol;
+	GHashTable *entries;
+	GQueue lru;
+} PurpleNormalizeCache;
+
+typedef struct {
+	gchar *raw;
+	GRefString *normalized;
+	gint referenced;
+	GList link;
+} PurpleNormalizeEntry;
+
+typedef struct {
+	GRefString *results[PURPLE_NORMALIZE_RESULTS];
+	guint next;
+} PurpleNormalizeResults;
+
+/* Cache hits only take the reader lock, so threads that find their strings in
+ * the cache never wait for each other.
+ */
+static GRWLock normalize_lock;
+static PurpleNormalizeCache *normalize_default_cache = NULL;
+
+/* Serializes calls into the protocols, many of which return a static buffer,
+ * without holding up cache hits.
+ */
+static GMutex normalize_protocol_lock;
+
+static void
+purple_normalize_results_free(gpointer data) {
+	PurpleNormalizeResults *results = data;
+
+	for(guint i = 0; i < PURPLE_NORMALIZE_RESULTS; i++) {
+		g_clear_pointer(&results->results[i], g_ref_string_release);
+	}
+
+	g_free(results);
+}
+
+static GPrivate normalize_results =
+	G_PRIVATE_INIT(purple_normalize_results_free);
+
+static void
+purple_normalize_entry_free(gpointer data) {
+	PurpleNormalizeEntry *entry = data;
+
+	g_free(entry->raw);
+	g_ref_string_release(entry->normalized);
+	g_free(entry);
+}
+
+static PurpleNormalizeCache *
+purple_normalize_cache_new(void) {
+	PurpleNormalizeCache *cache = g_new0(PurpleNormalizeCache, 1);
+
+	/* The entries own themselves, the key is the raw string inside them. */
+	cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	                                       purple_normalize_entry_free);
+	g_queue_init(&cache->lru);
+
+	return cache;
+}
+
+static void
+purple_normalize_cache_clear(PurpleNormalizeCache *cache) {
+	g_queue_init(&cache->lru);
+	g_hash_table_remove_all(cache->entries);
+}
+
+static void
+purple_normalize_cache_free(gpointer data) {
+	PurpleNormalizeCache *cache = data;
+
+	/* The account may be finalized from another thread than the one that is
+	 * currently normalizing.
+	 */
+	g_rw_lock_writer_lock(&normalize_lock);
+	g_hash_table_destroy(cache->entries);
+	g_rw_lock_writer_unlock(&normalize_lock);
+
+	g_free(cache);
+}
+
+static void
+purple_normalize_uninit(void) {
+	g_clear_pointer(&normalize_default_cache, purple_normalize_cache_free);
+}
+
+/* Must be called with normalize_lock held for reading. Returns NULL if the
+ * cache has to be created or reset first.
+ */
+static PurpleNormalizeCache *
+purple_normalize_cache_lookup(PurpleAccount *account, PurpleProtocol *protocol)
+{
+	PurpleNormalizeCache *cache = NULL;
+
+	if(account == NULL) {
+		return normalize_default_cache;
+	}
+
+	cache = g_object_get_data(G_OBJECT(account), PURPLE_NORMALIZE_CACHE_KEY);
+	if(cache != NULL && cache->protocol != protocol) {
+		return NULL;
+	}
+
+	return cache;
+}
+
+/* Must be called with normalize_lock held for writing. */
+static PurpleNormalizeCache *
+purple_normalize_cache_get(PurpleAccount *account, PurpleProtocol *protocol) {
+	PurpleNormalizeCache *cache = NULL;
+
+	if(account == NULL) {
+		if(normalize_default_cache == NULL) {
+			normalize_default_cache = purple_normalize_cache_new();
+		}
+
+		return normalize_default_cache;
+	}
+
+	cache = g_object_get_data(G_OBJECT(account), PURPLE_NORMALIZE_CACHE_KEY);
+	if(cache == NULL) {
+		cache = purple_normalize_cache_new();
+		cache->protocol = protocol;
+		g_object_set_data_full(G_OBJECT(account), PURPLE_NORMALIZE_CACHE_KEY,
+		                       cache, purple_normalize_cache_free);
+	} else if(cache->protocol != protocol) {
+		/* The account was moved to a different protocol, so everything we
+		 * have seen so far was normalized with the wrong rules.
+		 */
+		purple_normalize_cache_clear(cache);
+		cache->protocol = protocol;
+	}
+
+	return cache;
+}
+
+/* Must be called with normalize_lock held for writing. Hits can't reorder the
+ * queue under the reader lock, so they only mark their entry and the queue is
+ * used as a clock: marked entries get another trip around instead of being
+ * evicted.
+ */
+static void
+purple_normalize_cache_evict(PurpleNormalizeCache *cache) {
+	while(g_queue_get_length(&cache->lru) >= PURPLE_NORMALIZE_CACHE_SIZE) {
+		GList *oldest = g_queue_pop_tail_link(&cache->lru);
+		PurpleNormalizeEntry *evicted = oldest->data;
+
+		if(g_atomic_int_compare_and_exchange(&evicted->referenced, TRUE,
+		                                     FALSE))
+		{
+			g_queue_push_head_link(&cache->lru, oldest);
+
+			continue;
+		}
+
+		g_hash_table_remove(cache->entries, evicted->raw);
+	}
+}
+
+/* Must be called without normalize_lock held. */
+static GRefString *
+purple_normalize_uncached(PurpleAccount *account, PurpleProtocol *protocol,
+                          const char *str)
+{
+	GRefString *normalized = NULL;
+	char *tmp = NULL;
+
+	if(PURPLE_IS_PROTOCOL_CLIENT(protocol)) {
+		const char *ret = NULL;
+
+		g_mutex_lock(&normalize_protocol_lock);
+		ret = purple_protocol_client_normalize(PURPLE_PROTOCOL_CLIENT(protocol),
+		                                       account, str);
+		if(ret != NULL) {
+			normalized = g_ref_string_new(ret);
+		}
+		g_mutex_unlock(&normalize_protocol_lock);
+
+		if(normalized != NULL) {
+			return normalized;
+		}
+	}
+
+	tmp = g_utf8_normalize(str, -1, G_NORMALIZE_DEFAULT);
+	normalized = g_ref_string_new(tmp != NULL ? tmp : "");
+	g_free(tmp);
+
+	return normalized;
+}
+
+GRefString *
+purple_normalize_ref(PurpleAccount *account, const char *str) {
+	PurpleNormalizeCache *cache = NULL;
+	PurpleNormalizeEntry *entry = NULL;
+	PurpleProtocol *protocol = NULL;
+	GRefString *normalized = NULL;
+
+	g_return_val_if_fail(str != NULL, NULL);
+
+	if(account != NULL) {
+		protocol = purple_account_get_protocol(account);
+	}
+
+	g_rw_lock_reader_lock(&normalize_lock);
+	cache = purple_normalize_cache_lookup(account, protocol);
+	if(cache != NULL) {
+		entry = g_hash_table_lookup(cache->entries, str);
+	}
+	if(entry != NULL) {
+		g_atomic_int_set(&entry->referenced, TRUE);
+		normalized = g_ref_string_acquire(entry->normalized);
+	}
+	g_rw_lock_reader_unlock(&normalize_lock);
+
+	if(normalized != NULL) {
+		return normalized;
+	}
+
+	normalized = purple_normalize_uncached(account, protocol, str);
+
+	g_rw_lock_writer_lock(&normalize_lock);
+
+	/* Another thread may have added the same string while we weren't holding
+	 * the lock, in which case its entry is kept.
+	 */
+	cache = purple_normalize_cache_get(account, protocol);
+	if(!g_hash_table_contains(cache->entries, str)) {
+		purple_normalize_cache_evict(cache);
+
+		entry = g_new0(PurpleNormalizeEntry, 1);
+		entry->raw = g_strdup(str);
+		entry->normalized = g_ref_string_acquire(normalized);
+		entry->link.data = entry;
+
+		g_hash_table_insert(cache->entries, entry->raw, entry);
+		g_queue_push_head_link(&cache->lru, &entry->link);
+	}
+
+	g_rw_lock_writer_unlock(&normalize_lock);
+
+	return normalized;
+}
+
 const char *
 purple_normalize(PurpleAccount *account, const char *str)
 {
-	const char *ret = NULL;
-	static char buf[BUF_LEN];
+	PurpleNormalizeResults *results = NULL;
+	GRefString *normalized = NULL;
 
 	/* This should prevent a crash if purple_normalize gets called with NULL str, see #10115 */
 	g_return_val_if_fail(str != NULL, "");
 
-	if (account != NULL)
-	{
-		PurpleProtocol *protocol = purple_account_get_protocol(account);
+	normalized = purple_normalize_ref(account, str);
 
-		if(PURPLE_IS_PROTOCOL_CLIENT(protocol)) {
-			ret = purple_protocol_client_normalize(PURPLE_PROTOCOL_CLIENT(protocol), account, str);
-		}
+	/* Keep the result alive in this thread until it is pushed out by later
+	 * calls, even if the cache evicts it in the meantime.
+	 */
+	results = g_private_get(&normalize_results);
+	if(results == NULL) {
+		results = g_new0(PurpleNormalizeResults, 1);
+		g_private_set(&normalize_results, results);
 	}
 
-	if (ret == NULL)
-	{
-		char *tmp;
-
-		tmp = g_utf8_normalize(str, -1, G_NORMALIZE_DEFAULT);
-		g_snprintf(buf, sizeof(buf), "%s", tmp);
-		g_free(tmp);
+	g_clear_pointer(&results->results[results->next], g_ref_string_release);
+	results->results[results->next] = normalized;
+	results->next = (results->next + 1) % PURPLE_NORMALIZE_RESULTS;
 
-		ret = buf;
-	}
+	return normalized;
+}
 
-	return ret;
+static void
+purple_normalize_nocase_buffer_free(gpointer data) {
+	g_free(data);
 }
 
+static GPrivate normalize_nocase_buffer =
+	G_PRIVATE_INIT(purple_normalize_nocase_buffer_free);
+
 /*
  * You probably don't want to call this directly, it is
  * mainly for use as a protocol callback function.  See the
@@ -216,20 +563,49 @@ purple_normalize(PurpleAccount *account, const char *str)
 const char *
 purple_normalize_nocase(const char *str)
 {
-	static char buf[BUF_LEN];
+	char *buf = NULL;
 	char *tmp1, *tmp2;
 
 	g_return_val_if_fail(str != NULL, NULL);
 
+	buf = g_private_get(&normalize_nocase_buffer);
+	if(buf == NULL) {
+		buf = g_malloc(BUF_LEN);
+		g_private_set(&normalize_nocase_buffer, buf);
+	}
+
 	tmp1 = g_utf8_strdown(str, -1);
 	tmp2 = g_utf8_normalize(tmp1, -1, G_NORMALIZE_DEFAULT);
-	g_snprintf(buf, sizeof(buf), "%s", tmp2 ? tmp2 : "");
+	g_snprintf(buf, BUF_LEN, "%s", tmp2 ? tmp2 : "");
 	g_free(tmp2);
 	g_free(tmp1);
 
 	return buf;
 }
 
+gboolean
+purple_str_intern_set(GRefString **dest, const gchar *str) {
+	GRefString *interned = NULL;
+
+	g_return_val_if_fail(dest != NULL, FALSE);
+
+	if(str != NULL) {
+		interned = g_ref_string_new_intern(str);
+	}
+
+	/* Interned strings are unique, so this is the same as comparing them. */
+	if(interned == *dest) {
+		g_clear_pointer(&interned, g_ref_string_release);
+
+		return FALSE;
+	}
+
+	g_clear_pointer(dest, g_ref_string_release);
+	*dest = interned;
+
+	return TRUE;
+}
+
 gboolean
 purple_validate(PurpleProtocol *protocol, const char *str)
 {
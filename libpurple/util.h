@@ -137,6 +137,40 @@ purple_util_write_data_to_config_file(const char *filename, const char *data, gs
 gboolean
 purple_util_write_data_to_data_file(const char *filename, const char *data, gssize size);
 
+/**
+ * purple_util_write_xml_to_cache_file:
+ * @filename: The basename of the file to write in the purple_cache_dir.
+ * @node:     The xml to write.
+ *
+ * Writes @node as formatted xml to a file of the given name in the Purple
+ * cache directory, streaming it to disk instead of building the whole
+ * document in memory first.  The existing file is only replaced once the
+ * new one has been written completely.
+ *
+ * Returns: TRUE if the file was written successfully.  FALSE otherwise.
+ *
+ * Since: 3.0.0
+ */
+gboolean
+purple_util_write_xml_to_cache_file(const char *filename, const PurpleXmlNode *node);
+
+/**
+ * purple_util_write_xml_to_config_file:
+ * @filename: The basename of the file to write in the purple_config_dir.
+ * @node:     The xml to write.
+ *
+ * Writes @node as formatted xml to a file of the given name in the Purple
+ * config directory.
+ *
+ *  See purple_util_write_xml_to_cache_file()
+ *
+ * Returns: TRUE if the file was written successfully.  FALSE otherwise.
+ *
+ * Since: 3.0.0
+ */
+gboolean
+purple_util_write_xml_to_config_file(const char *filename, const PurpleXmlNode *node);
+
 /**
  * purple_util_read_xml_from_cache_file:
  * @filename:    The basename of the file to open in the purple_cache_dir.
@@ -246,15 +280,35 @@ purple_strequal(const gchar *left, const gchar *right)
  *
  * Normalizes a string, so that it is suitable for comparison.
  *
- * The returned string will point to a static buffer, so if the
- * string is intended to be kept long-term, you <emphasis>must</emphasis>
- * g_strdup() it. Also, calling normalize() twice in the same line
- * will lead to problems.
+ * Results are cached per account, so normalizing the same string repeatedly
+ * is cheap.  This function is thread safe.
  *
- * Returns: A pointer to the normalized version stored in a static buffer.
+ * The returned string is owned by the calling thread and stays valid for at
+ * least the next three calls to this function in that thread, so it is safe
+ * to compare the results of two calls directly.  If the string is intended to
+ * be kept long-term, use purple_normalize_ref() instead.
+ *
+ * Returns: The normalized version of @str.
  */
 const char *purple_normalize(PurpleAccount *account, const char *str);
 
+/**
+ * purple_normalize_ref:
+ * @account: (nullable): The account the string belongs to.
+ * @str: The string to normalize.
+ *
+ * Normalizes a string like purple_normalize() but returns a reference to the
+ * cached result so that it can be kept for as long as needed.
+ *
+ * The returned value can be used anywhere a `const char *` is expected and
+ * must be released with g_ref_string_release().
+ *
+ * Returns: (transfer full): The normalized version of @str.
+ *
+ * Since: 3.0.0
+ */
+GRefString *purple_normalize_ref(PurpleAccount *account, const char *str);
+
 /**
  * purple_normalize_nocase:
  * @str:      The string to normalize.
@@ -43,17 +43,134 @@
 # define NEWLINE_S "\n"
 #endif
 
+/* Trees that are parsed in one go and freed in one go can have all of their
+ * nodes and data allocated from an arena.  The arena is freed when the last
+ * of its nodes is.
+ */
+#define PURPLE_XMLNODE_ARENA_BLOCK_SIZE (16 * 1024)
+#define PURPLE_XMLNODE_ARENA_ALIGN (2 * sizeof(gpointer))
+
+struct _PurpleXmlNodeArena {
+	gint ref_count;   /* one for each node, and one while it's being built */
+	GSList *blocks;
+	guint8 *pos;
+	gsize remaining;
+};
+
+static PurpleXmlNodeArena *
+purple_xmlnode_arena_new(void)
+{
+	PurpleXmlNodeArena *arena = g_new0(PurpleXmlNodeArena, 1);
+
+	arena->ref_count = 1;
+
+	return arena;
+}
+
+static void
+purple_xmlnode_arena_unref(PurpleXmlNodeArena *arena)
+{
+	if(g_atomic_int_dec_and_test(&arena->ref_count)) {
+		g_slist_free_full(arena->blocks, g_free);
+		g_free(arena);
+	}
+}
+
+static gpointer
+purple_xmlnode_arena_alloc(PurpleXmlNodeArena *arena, gsize size)
+{
+	gpointer ret = NULL;
+
+	size = (size + PURPLE_XMLNODE_ARENA_ALIGN - 1) &
+	       ~(PURPLE_XMLNODE_ARENA_ALIGN - 1);
+
+	if(size > arena->remaining) {
+		/* Large allocations get their own block so they don't waste the rest
+		 * of the current one.
+		 */
+		if(size > PURPLE_XMLNODE_ARENA_BLOCK_SIZE / 4) {
+			ret = g_malloc(size);
+			arena->blocks = g_slist_prepend(arena->blocks, ret);
+
+			return ret;
+		}
+
+		arena->pos = g_malloc(PURPLE_XMLNODE_ARENA_BLOCK_SIZE);
+		arena->remaining = PURPLE_XMLNODE_ARENA_BLOCK_SIZE;
+		arena->blocks = g_slist_prepend(arena->blocks, arena->pos);
+	}
+
+	ret = arena->pos;
+	arena->pos += size;
+	arena->remaining -= size;
+
+	return ret;
+}
+
+/* Copies data into the arena, or the heap when arena is NULL, and nul
+ * terminates it.
+ */
+static char *
+purple_xmlnode_arena_strndup(PurpleXmlNodeArena *arena, const char *data,
+                             gsize size)
+{
+	char *ret = NULL;
+
+	if(arena == NULL) {
+		return g_strndup(data, size);
+	}
+
+	ret = purple_xmlnode_arena_alloc(arena, size + 1);
+	memcpy(ret, data, size);
+	ret[size] = '\0';
+
+	return ret;
+}
+
+/* Names, namespaces and prefixes come from a small set of strings, so they are
+ * interned and shared between every node that uses them.
+ */
+static char *
+purple_xmlnode_intern(const char *str)
+{
+	return (str != NULL) ? g_ref_string_new_intern(str) : NULL;
+}
+
+static void
+purple_xmlnode_release(char *str)
+{
+	if(str != NULL) {
+		g_ref_string_release(str);
+	}
+}
+
 static PurpleXmlNode*
-new_node(const char *name, PurpleXmlNodeType type)
+new_node_in_arena(PurpleXmlNodeArena *arena, const char *name,
+                  PurpleXmlNodeType type)
 {
-	PurpleXmlNode *node = g_new0(PurpleXmlNode, 1);
+	PurpleXmlNode *node = NULL;
 
-	node->name = g_strdup(name);
+	if(arena != NULL) {
+		node = purple_xmlnode_arena_alloc(arena, sizeof(PurpleXmlNode));
+		memset(node, 0, sizeof(PurpleXmlNode));
+		node->arena = arena;
+		g_atomic_int_inc(&arena->ref_count);
+	} else {
+		node = g_new0(PurpleXmlNode, 1);
+	}
+
+	node->name = purple_xmlnode_intern(name);
 	node->type = type;
 
 	return node;
 }
 
+static PurpleXmlNode*
+new_node(const char *name, PurpleXmlNodeType type)
+{
+	return new_node_in_arena(NULL, name, type);
+}
+
 PurpleXmlNode*
 purple_xmlnode_new(const char *name)
 {
@@ -94,24 +211,32 @@ purple_xmlnode_insert_child(PurpleXmlNode *parent, PurpleXmlNode *child)
 	parent->lastchild = child;
 }
 
-void
-purple_xmlnode_insert_data(PurpleXmlNode *node, const char *data, gssize size)
+static void
+insert_data(PurpleXmlNodeArena *arena, PurpleXmlNode *node, const char *data,
+            gsize size)
 {
 	PurpleXmlNode *child;
-	gsize real_size;
 
-	g_return_if_fail(node != NULL);
-	g_return_if_fail(data != NULL);
-	g_return_if_fail(size != 0);
+	child = new_node_in_arena(arena, NULL, PURPLE_XMLNODE_TYPE_DATA);
 
-	real_size = size == -1 ? strlen(data) : (gsize)size;
+	if(arena != NULL) {
+		child->data = purple_xmlnode_arena_strndup(arena, data, size);
+	} else {
+		child->data = g_memdup2(data, size);
+	}
+	child->data_sz = size;
 
-	child = new_node(NULL, PURPLE_XMLNODE_TYPE_DATA);
+	purple_xmlnode_insert_child(node, child);
+}
 
-	child->data = g_memdup2(data, real_size);
-	child->data_sz = real_size;
+void
+purple_xmlnode_insert_data(PurpleXmlNode *node, const char *data, gssize size)
+{
+	g_return_if_fail(node != NULL);
+	g_return_if_fail(data != NULL);
+	g_return_if_fail(size != 0);
 
-	purple_xmlnode_insert_child(node, child);
+	insert_data(NULL, node, data, size == -1 ? strlen(data) : (gsize)size);
 }
 
 void
@@ -182,25 +307,33 @@ purple_xmlnode_set_attrib(PurpleXmlNode *node, const char *attr, const char *val
 	purple_xmlnode_set_attrib_full(node, attr, NULL, NULL, value);
 }
 
-void
-purple_xmlnode_set_attrib_full(PurpleXmlNode *node, const char *attr, const char *xmlns, const char *prefix, const char *value)
+static void
+set_attrib(PurpleXmlNodeArena *arena, PurpleXmlNode *node, const char *attr,
+           const char *xmlns, const char *prefix, const char *value)
 {
 	PurpleXmlNode *attrib_node;
 
-	g_return_if_fail(node != NULL);
-	g_return_if_fail(attr != NULL);
-	g_return_if_fail(value != NULL);
-
 	purple_xmlnode_remove_attrib_with_namespace(node, attr, xmlns);
-	attrib_node = new_node(attr, PURPLE_XMLNODE_TYPE_ATTRIB);
+	attrib_node = new_node_in_arena(arena, attr, PURPLE_XMLNODE_TYPE_ATTRIB);
 
-	attrib_node->data = g_strdup(value);
-	attrib_node->xmlns = g_strdup(xmlns);
-	attrib_node->prefix = g_strdup(prefix);
+	attrib_node->data = purple_xmlnode_arena_strndup(arena, value,
+	                                                 strlen(value));
+	attrib_node->xmlns = purple_xmlnode_intern(xmlns);
+	attrib_node->prefix = purple_xmlnode_intern(prefix);
 
 	purple_xmlnode_insert_child(node, attrib_node);
 }
 
+void
+purple_xmlnode_set_attrib_full(PurpleXmlNode *node, const char *attr, const char *xmlns, const char *prefix, const char *value)
+{
+	g_return_if_fail(node != NULL);
+	g_return_if_fail(attr != NULL);
+	g_return_if_fail(value != NULL);
+
+	set_attrib(NULL, node, attr, xmlns, prefix, value);
+}
+
 
 const char *
 purple_xmlnode_get_attrib(const PurpleXmlNode *node, const char *attr)
@@ -245,14 +378,14 @@ void purple_xmlnode_set_namespace(PurpleXmlNode *node, const char *xmlns)
 	g_return_if_fail(node != NULL);
 
 	tmp = node->xmlns;
-	node->xmlns = g_strdup(xmlns);
+	node->xmlns = purple_xmlnode_intern(xmlns);
 
 	if (node->namespace_map) {
 		g_hash_table_insert(node->namespace_map,
 			g_strdup(""), g_strdup(xmlns));
 	}
 
-	g_free(tmp);
+	purple_xmlnode_release(tmp);
 }
 
 const char *purple_xmlnode_get_namespace(const PurpleXmlNode *node)
@@ -291,10 +424,13 @@ const char *purple_xmlnode_get_default_namespace(const PurpleXmlNode *node)
 
 void purple_xmlnode_set_prefix(PurpleXmlNode *node, const char *prefix)
 {
+	char *tmp;
+
 	g_return_if_fail(node != NULL);
 
-	g_free(node->prefix);
-	node->prefix = g_strdup(prefix);
+	tmp = node->prefix;
+	node->prefix = purple_xmlnode_intern(prefix);
+	purple_xmlnode_release(tmp);
 }
 
 const char *purple_xmlnode_get_prefix(const PurpleXmlNode *node)
@@ -394,14 +530,19 @@ purple_xmlnode_free(PurpleXmlNode *node)
 	}
 
 	/* now dispose of ourselves */
-	g_free(node->name);
-	g_free(node->data);
-	g_free(node->xmlns);
-	g_free(node->prefix);
+	purple_xmlnode_release(node->name);
+	purple_xmlnode_release(node->xmlns);
+	purple_xmlnode_release(node->prefix);
 
 	g_clear_pointer(&node->namespace_map, g_hash_table_destroy);
 
-	g_free(node);
+	if(node->arena != NULL) {
+		/* The node and its data are freed along with the arena. */
+		purple_xmlnode_arena_unref(node->arena);
+	} else {
+		g_free(node->data);
+		g_free(node);
+	}
 }
 
 PurpleXmlNode*
@@ -483,9 +624,102 @@ purple_xmlnode_get_data_unescaped(const PurpleXmlNode *node)
 	return unescaped;
 }
 
+/* When writing to a stream, the text is written out in chunks of about this
+ * size rather than building the whole document first.
+ */
+#define PURPLE_XMLNODE_WRITER_CHUNK_SIZE (8 * 1024)
+
+#define PURPLE_XMLNODE_DECLARATION \
+	"<?xml version='1.0' encoding='UTF-8' ?>" NEWLINE_S NEWLINE_S
+
+typedef struct {
+	GString *text;
+	GOutputStream *stream;
+	GCancellable *cancellable;
+	GError *error;
+} PurpleXmlNodeWriter;
+
 static void
-purple_xmlnode_to_str_foreach_append_ns(const char *key, const char *value,
-	GString *buf)
+purple_xmlnode_writer_flush(PurpleXmlNodeWriter *writer, gboolean force)
+{
+	if(writer->stream == NULL || writer->error != NULL) {
+		return;
+	}
+
+	if(!force && writer->text->len < PURPLE_XMLNODE_WRITER_CHUNK_SIZE) {
+		return;
+	}
+
+	g_output_stream_write_all(writer->stream, writer->text->str,
+	                          writer->text->len, NULL, writer->cancellable,
+	                          &writer->error);
+	g_string_truncate(writer->text, 0);
+}
+
+/* Appends str escaped the same way as g_markup_escape_text(), without
+ * creating a temporary copy of it.
+ */
+static void
+purple_xmlnode_append_escaped(GString *text, const char *str, gsize len)
+{
+	const char *p = str, *start = str, *end = str + len;
+
+	while(p < end) {
+		const char *replacement = NULL;
+		char buf[8];
+		guchar c = *p;
+		gsize skip = 1;
+
+		switch(c) {
+			case '&':
+				replacement = "&amp;";
+				break;
+			case '<':
+				replacement = "&lt;";
+				break;
+			case '>':
+				replacement = "&gt;";
+				break;
+			case '\'':
+				replacement = "&apos;";
+				break;
+			case '"':
+				replacement = "&quot;";
+				break;
+			default:
+				if((c >= 0x1 && c <= 0x8) || (c >= 0xb && c <= 0xc) ||
+				   (c >= 0xe && c <= 0x1f) || c == 0x7f)
+				{
+					g_snprintf(buf, sizeof(buf), "&#x%x;", c);
+					replacement = buf;
+				} else if(c == 0xc2 && p + 1 < end) {
+					/* The C1 control characters, except for NEL. */
+					guchar c1 = p[1];
+
+					if(c1 >= 0x80 && c1 <= 0x9f && c1 != 0x85) {
+						g_snprintf(buf, sizeof(buf), "&#x%x;", c1);
+						replacement = buf;
+						skip = 2;
+					}
+				}
+				break;
+		}
+
+		if(replacement != NULL) {
+			g_string_append_len(text, start, p - start);
+			g_string_append(text, replacement);
+			p += skip;
+			start = p;
+		} else {
+			p++;
+		}
+	}
+
+	g_string_append_len(text, start, end - start);
+}
+
+static void
+purple_xmlnode_append_ns(const char *key, const char *value, GString *buf)
 {
 	if (*key) {
 		g_string_append_printf(buf, " xmlns:%s='%s'", key, value);
@@ -494,36 +728,36 @@ purple_xmlnode_to_str_foreach_append_ns(const char *key, const char *value,
 	}
 }
 
-static char *
-purple_xmlnode_to_str_helper(const PurpleXmlNode *node, int *len, gboolean formatting, int depth)
+static void
+purple_xmlnode_write(PurpleXmlNodeWriter *writer, const PurpleXmlNode *node,
+                     gboolean formatting, int depth)
 {
-	GString *text;
+	GString *text = writer->text;
 	const char *prefix;
 	const PurpleXmlNode *c;
-	char *node_name, *esc, *esc2, *tab = NULL;
 	gboolean need_end = FALSE, pretty = formatting;
 
-	g_return_val_if_fail(node != NULL, NULL);
-
-	text = g_string_new("");
+	if(writer->error != NULL) {
+		return;
+	}
 
 	if(pretty && depth) {
-		tab = g_strnfill(depth, '\t');
-		text = g_string_append(text, tab);
+		for(int i = 0; i < depth; i++) {
+			g_string_append_c(text, '\t');
+		}
 	}
 
-	node_name = g_markup_escape_text(node->name, -1);
 	prefix = purple_xmlnode_get_prefix(node);
 
+	g_string_append_c(text, '<');
 	if (prefix) {
-		g_string_append_printf(text, "<%s:%s", prefix, node_name);
-	} else {
-		g_string_append_printf(text, "<%s", node_name);
+		g_string_append_printf(text, "%s:", prefix);
 	}
+	purple_xmlnode_append_escaped(text, node->name, strlen(node->name));
 
 	if (node->namespace_map) {
 		g_hash_table_foreach(node->namespace_map,
-			(GHFunc)purple_xmlnode_to_str_foreach_append_ns, text);
+			(GHFunc)purple_xmlnode_append_ns, text);
 	} else {
 		/* Figure out if this node has a different default namespace from parent */
 		const char *xmlns = NULL;
@@ -539,23 +773,25 @@ purple_xmlnode_to_str_helper(const PurpleXmlNode *node, int *len, gboolean forma
 			parent_xmlns = purple_xmlnode_get_default_namespace(node->parent);
 		}
 		if (!purple_strequal(xmlns, parent_xmlns)) {
-			char *escaped_xmlns = g_markup_escape_text(xmlns, -1);
-			g_string_append_printf(text, " xmlns='%s'", escaped_xmlns);
-			g_free(escaped_xmlns);
+			g_string_append(text, " xmlns='");
+			if (xmlns) {
+				purple_xmlnode_append_escaped(text, xmlns, strlen(xmlns));
+			}
+			g_string_append_c(text, '\'');
 		}
 	}
 	for(c = node->child; c; c = c->next) {
 		if(c->type == PURPLE_XMLNODE_TYPE_ATTRIB) {
 			const char *aprefix = purple_xmlnode_get_prefix(c);
-			esc = g_markup_escape_text(c->name, -1);
-			esc2 = g_markup_escape_text(c->data, -1);
+
+			g_string_append_c(text, ' ');
 			if (aprefix) {
-				g_string_append_printf(text, " %s:%s='%s'", aprefix, esc, esc2);
-			} else {
-				g_string_append_printf(text, " %s='%s'", esc, esc2);
+				g_string_append_printf(text, "%s:", aprefix);
 			}
-			g_free(esc);
-			g_free(esc2);
+			purple_xmlnode_append_escaped(text, c->name, strlen(c->name));
+			g_string_append(text, "='");
+			purple_xmlnode_append_escaped(text, c->data, strlen(c->data));
+			g_string_append_c(text, '\'');
 		} else if(c->type == PURPLE_XMLNODE_TYPE_TAG || c->type == PURPLE_XMLNODE_TYPE_DATA) {
 			if(c->type == PURPLE_XMLNODE_TYPE_DATA) {
 				pretty = FALSE;
@@ -569,67 +805,111 @@ purple_xmlnode_to_str_helper(const PurpleXmlNode *node, int *len, gboolean forma
 
 		for(c = node->child; c; c = c->next) {
 			if(c->type == PURPLE_XMLNODE_TYPE_TAG) {
-				int esc_len;
-				esc = purple_xmlnode_to_str_helper(c, &esc_len, pretty, depth+1);
-				text = g_string_append_len(text, esc, esc_len);
-				g_free(esc);
+				purple_xmlnode_write(writer, c, pretty, depth + 1);
 			} else if(c->type == PURPLE_XMLNODE_TYPE_DATA && c->data_sz > 0) {
-				esc = g_markup_escape_text(c->data, c->data_sz);
-				text = g_string_append(text, esc);
-				g_free(esc);
+				purple_xmlnode_append_escaped(text, c->data, c->data_sz);
 			}
 		}
 
-		if(tab && pretty) {
-			text = g_string_append(text, tab);
+		if(pretty && depth) {
+			for(int i = 0; i < depth; i++) {
+				g_string_append_c(text, '\t');
+			}
 		}
+		g_string_append(text, "</");
 		if (prefix) {
-			g_string_append_printf(text, "</%s:%s>%s", prefix, node_name, formatting ? NEWLINE_S : "");
-		} else {
-			g_string_append_printf(text, "</%s>%s", node_name, formatting ? NEWLINE_S : "");
+			g_string_append_printf(text, "%s:", prefix);
 		}
+		purple_xmlnode_append_escaped(text, node->name, strlen(node->name));
+		g_string_append_printf(text, ">%s", formatting ? NEWLINE_S : "");
 	} else {
 		g_string_append_printf(text, "/>%s", formatting ? NEWLINE_S : "");
 	}
 
-	g_free(node_name);
-
-	g_free(tab);
-
-	if(len) {
-		*len = text->len;
-	}
-
-	return g_string_free(text, FALSE);
+	purple_xmlnode_writer_flush(writer, FALSE);
 }
 
 char *
 purple_xmlnode_to_str(const PurpleXmlNode *node, int *len)
 {
-	return purple_xmlnode_to_str_helper(node, len, FALSE, 0);
+	PurpleXmlNodeWriter writer = { NULL, };
+
+	g_return_val_if_fail(node != NULL, NULL);
+
+	writer.text = g_string_new(NULL);
+	purple_xmlnode_write(&writer, node, FALSE, 0);
+
+	if(len) {
+		*len = writer.text->len;
+	}
+
+	return g_string_free(writer.text, FALSE);
 }
 
 char *
 purple_xmlnode_to_formatted_str(const PurpleXmlNode *node, int *len)
 {
-	char *xml, *xml_with_declaration;
+	PurpleXmlNodeWriter writer = { NULL, };
 
 	g_return_val_if_fail(node != NULL, NULL);
 
-	xml = purple_xmlnode_to_str_helper(node, len, TRUE, 0);
-	xml_with_declaration =
-		g_strdup_printf("<?xml version='1.0' encoding='UTF-8' ?>" NEWLINE_S NEWLINE_S "%s", xml);
-	g_free(xml);
+	writer.text = g_string_new(PURPLE_XMLNODE_DECLARATION);
+	purple_xmlnode_write(&writer, node, TRUE, 0);
 
 	if (len) {
-		*len += sizeof("<?xml version='1.0' encoding='UTF-8' ?>" NEWLINE_S NEWLINE_S) - 1;
+		*len = writer.text->len;
+	}
+
+	return g_string_free(writer.text, FALSE);
+}
+
+void
+purple_xmlnode_append_to_str(const PurpleXmlNode *node, GString *str)
+{
+	PurpleXmlNodeWriter writer = { NULL, };
+
+	g_return_if_fail(node != NULL);
+	g_return_if_fail(str != NULL);
+
+	writer.text = str;
+	purple_xmlnode_write(&writer, node, FALSE, 0);
+}
+
+gboolean
+purple_xmlnode_write_to_stream(const PurpleXmlNode *node,
+                               GOutputStream *stream, gboolean formatted,
+                               GCancellable *cancellable, GError **error)
+{
+	PurpleXmlNodeWriter writer = { NULL, };
+
+	g_return_val_if_fail(node != NULL, FALSE);
+	g_return_val_if_fail(G_IS_OUTPUT_STREAM(stream), FALSE);
+
+	writer.text = g_string_sized_new(PURPLE_XMLNODE_WRITER_CHUNK_SIZE * 2);
+	writer.stream = stream;
+	writer.cancellable = cancellable;
+
+	if(formatted) {
+		g_string_append(writer.text, PURPLE_XMLNODE_DECLARATION);
+	}
+
+	purple_xmlnode_write(&writer, node, formatted, 0);
+	purple_xmlnode_writer_flush(&writer, TRUE);
+
+	g_string_free(writer.text, TRUE);
+
+	if(writer.error != NULL) {
+		g_propagate_error(error, writer.error);
+
+		return FALSE;
 	}
 
-	return xml_with_declaration;
+	return TRUE;
 }
 
 struct _xmlnode_parser_data {
 	PurpleXmlNode *current;
+	PurpleXmlNodeArena *arena;
 	gboolean error;
 };
 
@@ -646,14 +926,14 @@ purple_xmlnode_parser_element_start_libxml(void *user_data,
 	if(!element_name || xpd->error) {
 		return;
 	} else {
+		node = new_node_in_arena(xpd->arena, (const char *)element_name,
+		                         PURPLE_XMLNODE_TYPE_TAG);
 		if(xpd->current) {
-			node = purple_xmlnode_new_child(xpd->current, (const char*) element_name);
-		} else {
-			node = purple_xmlnode_new((const char *) element_name);
+			purple_xmlnode_insert_child(xpd->current, node);
 		}
 
-		purple_xmlnode_set_namespace(node, (const char *) xmlns);
-		purple_xmlnode_set_prefix(node, (const char *)prefix);
+		node->xmlns = purple_xmlnode_intern((const char *)xmlns);
+		node->prefix = purple_xmlnode_intern((const char *)prefix);
 
 		if (nb_namespaces != 0) {
 			node->namespace_map = g_hash_table_new_full(
@@ -676,7 +956,7 @@ purple_xmlnode_parser_element_start_libxml(void *user_data,
 			txt = attrib;
 			attrib = purple_unescape_text(txt);
 			g_free(txt);
-			purple_xmlnode_set_attrib_full(node, name, NULL, prefix, attrib);
+			set_attrib(xpd->arena, node, name, NULL, prefix, attrib);
 			g_free(attrib);
 		}
 
@@ -714,7 +994,7 @@ purple_xmlnode_parser_element_text_libxml(void *user_data, const xmlChar *text,
 		return;
 	}
 
-	purple_xmlnode_insert_data(xpd->current, (const char*) text, text_len);
+	insert_data(xpd->arena, xpd->current, (const char *)text, text_len);
 }
 
 static void
@@ -791,26 +1071,28 @@ static xmlSAXHandler purple_xmlnode_parser_libxml = {
 	purple_xmlnode_parser_structural_error_libxml, /* serror */
 };
 
-PurpleXmlNode *
-purple_xmlnode_from_str(const char *str, gssize size)
+static PurpleXmlNode *
+purple_xmlnode_parse(const char *str, gssize size, PurpleXmlNodeArena *arena)
 {
 	struct _xmlnode_parser_data *xpd;
 	PurpleXmlNode *ret;
 	gsize real_size;
-
-	g_return_val_if_fail(str != NULL, NULL);
+	gboolean failed;
 
 	real_size = size < 0 ? strlen(str) : (gsize)size;
 	xpd = g_new0(struct _xmlnode_parser_data, 1);
+	xpd->arena = arena;
 
-	if (xmlSAXUserParseMemory(&purple_xmlnode_parser_libxml, xpd, str, real_size) < 0) {
-		while(xpd->current && xpd->current->parent) {
-			xpd->current = xpd->current->parent;
-		}
-		g_clear_pointer(&xpd->current, purple_xmlnode_free);
+	failed = xmlSAXUserParseMemory(&purple_xmlnode_parser_libxml, xpd, str,
+	                               real_size) < 0;
+
+	/* Free the whole tree when we stopped part way through it. */
+	while(xpd->current && xpd->current->parent) {
+		xpd->current = xpd->current->parent;
 	}
+
 	ret = xpd->current;
-	if (xpd->error) {
+	if (failed || xpd->error) {
 		ret = NULL;
 		g_clear_pointer(&xpd->current, purple_xmlnode_free);
 	}
@@ -819,6 +1101,33 @@ purple_xmlnode_from_str(const char *str, gssize size)
 	return ret;
 }
 
+PurpleXmlNode *
+purple_xmlnode_from_str(const char *str, gssize size)
+{
+	g_return_val_if_fail(str != NULL, NULL);
+
+	return purple_xmlnode_parse(str, size, NULL);
+}
+
+PurpleXmlNode *
+purple_xmlnode_from_str_arena(const char *str, gssize size)
+{
+	PurpleXmlNodeArena *arena = NULL;
+	PurpleXmlNode *ret = NULL;
+
+	g_return_val_if_fail(str != NULL, NULL);
+
+	arena = purple_xmlnode_arena_new();
+	ret = purple_xmlnode_parse(str, size, arena);
+
+	/* Drop the reference that kept the arena alive while it was being
+	 * filled, from now on it lives as long as its nodes.
+	 */
+	purple_xmlnode_arena_unref(arena);
+
+	return ret;
+}
+
 PurpleXmlNode *
 purple_xmlnode_from_file(const char *dir, const char *filename, const char *description, const char *process)
 {
@@ -849,7 +1158,8 @@ purple_xmlnode_from_file(const char *dir, const char *filename, const char *desc
 	}
 
 	if ((contents != NULL) && (length > 0)) {
-		node = purple_xmlnode_from_str(contents, length);
+		/* Files are parsed, read and freed as a whole. */
+		node = purple_xmlnode_from_str_arena(contents, length);
 
 		/* If we were unable to parse the file then save its contents to a backup file */
 		if (node == NULL) {
@@ -902,8 +1212,13 @@ purple_xmlnode_copy(const PurpleXmlNode *src)
 
 	g_return_val_if_fail(src != NULL, NULL);
 
-	ret = new_node(src->name, src->type);
-	ret->xmlns = g_strdup(src->xmlns);
+	ret = new_node(NULL, src->type);
+	if (src->name) {
+		ret->name = g_ref_string_acquire(src->name);
+	}
+	if (src->xmlns) {
+		ret->xmlns = g_ref_string_acquire(src->xmlns);
+	}
 	if (src->data) {
 		if (src->data_sz) {
 			ret->data = g_memdup2(src->data, src->data_sz);
@@ -912,7 +1227,9 @@ purple_xmlnode_copy(const PurpleXmlNode *src)
 			ret->data = g_strdup(src->data);
 		}
 	}
-	ret->prefix = g_strdup(src->prefix);
+	if (src->prefix) {
+		ret->prefix = g_ref_string_acquire(src->prefix);
+	}
 	if (src->namespace_map) {
 		ret->namespace_map = g_hash_table_new_full(g_str_hash, g_str_equal,
 		                                           g_free, g_free);
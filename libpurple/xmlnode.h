@@ -28,6 +28,7 @@
 #define PURPLE_XMLNODE_H
 
 #include <glib.h>
+#include <gio/gio.h>
 #include <glib-object.h>
 
 #define PURPLE_TYPE_XMLNODE  (purple_xmlnode_get_type())
@@ -48,6 +49,8 @@ typedef enum
 
 } PurpleXmlNodeType;
 
+typedef struct _PurpleXmlNodeArena PurpleXmlNodeArena;
+
 /**
  * PurpleXmlNode:
  * @name:          The name of the node.
@@ -61,9 +64,14 @@ typedef enum
  * @next:          The next node or %NULL.
  * @prefix:        The namespace prefix if any.
  * @namespace_map: The namespace map.
+ * @arena:         The arena the node was allocated from, or %NULL.  This is
+ *                 private.
  *
  * XmlNode is a simplified API for handling XML. An XmlNode represents an XML
  * element and has API for children as well as attributes.
+ *
+ * @name, @xmlns and @prefix are interned #GRefString's that are shared with
+ * other nodes, so they must only be changed through the API.
  */
 typedef struct _PurpleXmlNode PurpleXmlNode;
 struct _PurpleXmlNode
@@ -79,6 +87,7 @@ struct _PurpleXmlNode
 	PurpleXmlNode *next;
 	char *prefix;
 	GHashTable *namespace_map;
+	PurpleXmlNodeArena *arena;
 };
 
 G_BEGIN_DECLS
@@ -374,6 +383,36 @@ char *purple_xmlnode_to_str(const PurpleXmlNode *node, int *len);
  */
 char *purple_xmlnode_to_formatted_str(const PurpleXmlNode *node, int *len);
 
+/**
+ * purple_xmlnode_append_to_str:
+ * @node: The starting node to output.
+ * @str: The string to append to.
+ *
+ * Appends the same xml that purple_xmlnode_to_str() would return to @str.
+ * This lets callers that serialize many nodes reuse a single buffer.
+ *
+ * Since: 3.0.0
+ */
+void purple_xmlnode_append_to_str(const PurpleXmlNode *node, GString *str);
+
+/**
+ * purple_xmlnode_write_to_stream:
+ * @node: The starting node to output.
+ * @stream: The stream to write to.
+ * @formatted: Whether to write human readable xml, including the xml
+ *             declaration, as purple_xmlnode_to_formatted_str() does.
+ * @cancellable: (nullable): A #GCancellable or %NULL.
+ * @error: Return location for a #GError or %NULL.
+ *
+ * Serializes @node directly to @stream in small chunks, without building
+ * the whole document in memory first.
+ *
+ * Returns: %TRUE on success, %FALSE if writing to @stream failed.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_xmlnode_write_to_stream(const PurpleXmlNode *node, GOutputStream *stream, gboolean formatted, GCancellable *cancellable, GError **error);
+
 /**
  * purple_xmlnode_from_str:
  * @str:  The string of xml.
@@ -388,6 +427,26 @@ char *purple_xmlnode_to_formatted_str(const PurpleXmlNode *node, int *len);
  */
 PurpleXmlNode *purple_xmlnode_from_str(const char *str, gssize size);
 
+/**
+ * purple_xmlnode_from_str_arena:
+ * @str:  The string of xml.
+ * @size: The size of the string, or -1 if @str is NUL-terminated.
+ *
+ * Creates a node from a string of XML like purple_xmlnode_from_str(), but
+ * allocates every node of the tree and its data from one arena.  This makes
+ * parsing and freeing a large document much cheaper.
+ *
+ * The nodes can be used, changed and freed like any other node.  However, the
+ * memory of the arena is only released once every node that was parsed has
+ * been freed, so this is meant for documents that are read and then freed as
+ * a whole.  Use purple_xmlnode_copy() for parts that are kept around.
+ *
+ * Returns: The new node.
+ *
+ * Since: 3.0.0
+ */
+PurpleXmlNode *purple_xmlnode_from_str_arena(const char *str, gssize size);
+
 /**
  * purple_xmlnode_copy:
  * @src: The node to copy.
@@ -1702,6 +1702,8 @@ pidgin_conversation_detach(PurpleConversation *conv) {
 			g_source_remove(gtkconv->attach_timer);
 			gtkconv->attach_timer = 0;
 		}
+		g_list_free_full(g_steal_pointer(&gtkconv->attach_current),
+		                 g_object_unref);
 
 		close_conv_cb(NULL, gtkconv);
 
@@ -1769,6 +1771,8 @@ pidgin_conv_destroy(PurpleConversation *conv)
 		g_source_remove(gtkconv->attach_timer);
 		gtkconv->attach_timer = 0;
 	}
+	g_list_free_full(g_steal_pointer(&gtkconv->attach_current),
+	                 g_object_unref);
 
 	g_free(gtkconv);
 }
@@ -2457,7 +2461,11 @@ message_compare(PurpleMessage *m1, PurpleMessage *m2)
 	return g_date_time_compare(dt1, dt2);
 }
 
-/* Adds some message history to the gtkconv. This happens in a idle-callback. */
+/* Adds some message history to the gtkconv. This happens in a idle-callback.
+ * attach_current holds its own references to the messages that are left, in
+ * ascending order, as the history of the conversation can be trimmed while
+ * they are being added.
+ */
 static gboolean
 add_message_history_to_gtkconv(gpointer data)
 {
@@ -2476,11 +2484,8 @@ add_message_history_to_gtkconv(gpointer data)
 		}
 		/* XXX: should it be gtkconv->active_conv? */
 		pidgin_conv_write_conv(gtkconv->active_conv, msg);
-		if (im) {
-			gtkconv->attach_current = g_list_delete_link(gtkconv->attach_current, gtkconv->attach_current);
-		} else {
-			gtkconv->attach_current = gtkconv->attach_current->prev;
-		}
+		gtkconv->attach_current = g_list_delete_link(gtkconv->attach_current, gtkconv->attach_current);
+		g_object_unref(msg);
 		count++;
 	}
 	gtkconv->attach_timer = timer;
@@ -2549,7 +2554,7 @@ gboolean pidgin_conv_attach_to_conversation(PurpleConversation *conv)
 			PurpleConversationManager *manager;
 			GList *convs;
 
-			list = g_list_copy(list);
+			list = g_list_copy_deep(list, (GCopyFunc)g_object_ref, NULL);
 			manager = purple_conversation_manager_get_default();
 			convs = purple_conversation_manager_get_all(manager);
 
@@ -2562,19 +2567,27 @@ gboolean pidgin_conv_attach_to_conversation(PurpleConversation *conv)
 				if (convs->data != conv &&
 						pidgin_conv_find_gtkconv(convs->data) == gtkconv) {
 					pidgin_conv_attach(convs->data);
-					list = g_list_concat(list, g_list_copy(purple_conversation_get_message_history(convs->data)));
+					list = g_list_concat(list, g_list_copy_deep(purple_conversation_get_message_history(convs->data),
+					                                            (GCopyFunc)g_object_ref, NULL));
 				}
 
 				convs = g_list_delete_link(convs, convs);
 			}
 			list = g_list_sort(list, (GCompareFunc)message_compare);
-			gtkconv->attach_current = list;
-			list = g_list_last(list);
-		} else if (PURPLE_IS_CHAT_CONVERSATION(conv)) {
-			gtkconv->attach_current = g_list_last(list);
+		} else {
+			/* The history is newest first. */
+			list = g_list_copy_deep(list, (GCopyFunc)g_object_ref, NULL);
+			list = g_list_reverse(list);
+		}
+
+		if (gtkconv->attach_timer) {
+			g_source_remove(gtkconv->attach_timer);
+			gtkconv->attach_timer = 0;
 		}
+		g_list_free_full(gtkconv->attach_current, g_object_unref);
+		gtkconv->attach_current = list;
 
-		dt = purple_message_get_timestamp(PURPLE_MESSAGE(list->data));
+		dt = purple_message_get_timestamp(PURPLE_MESSAGE(g_list_last(list)->data));
 		g_object_set_data_full(G_OBJECT(gtkconv->editor), "attach-start-time",
 		                       g_date_time_ref(dt), (GDestroyNotify)g_date_time_unref);
 		gtkconv->attach_timer = g_idle_add(add_message_history_to_gtkconv, gtkconv);
@@ -31,26 +31,46 @@
 /******************************************************************************
  * Helpers
  *****************************************************************************/
+#define PURPLE_HISTORY_PAGE_SIZE (256)
+
 static gboolean
 purple_history_query(const gchar *query, GError **error) {
 	PurpleHistoryManager *manager = purple_history_manager_get_default();
-	GList *results = NULL;
-
-	results = purple_history_manager_query(manager, query, error);
-
-	if(error != NULL) {
-		return FALSE;
-	}
+	gchar *cursor = NULL;
+
+	/* Walk the results a page at a time so we never hold more than one page
+	 * of messages in memory.
+	 */
+	do {
+		GError *local_error = NULL;
+		GList *results = NULL;
+		gchar *next_cursor = NULL;
+
+		results = purple_history_manager_query_page(manager, query, cursor,
+		                                            PURPLE_HISTORY_PAGE_SIZE,
+		                                            &next_cursor,
+		                                            &local_error);
+		g_free(cursor);
+		cursor = next_cursor;
+
+		if(local_error != NULL) {
+			g_propagate_error(error, local_error);
+			g_list_free_full(results, g_object_unref);
+			g_free(cursor);
+
+			return FALSE;
+		}
 
-	while(results != NULL) {
-		PurpleMessage *message = PURPLE_MESSAGE(results->data);
+		while(results != NULL) {
+			PurpleMessage *message = PURPLE_MESSAGE(results->data);
 
-		g_printf("%s: %s\n", purple_message_get_author(message),
-		         purple_message_get_contents(message));
+			g_printf("%s: %s\n", purple_message_get_author(message),
+			         purple_message_get_contents(message));
 
-		g_clear_object(&message);
-		results = g_list_delete_link(results, results);
-	}
+			g_clear_object(&message);
+			results = g_list_delete_link(results, results);
+		}
+	} while(cursor != NULL);
 
 	return TRUE;
 }